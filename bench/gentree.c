@@ -0,0 +1,239 @@
+/*
+# +-------------------------------------------------------------------+
+# | Program Name  :  gentree.c                                        |
+# | Author        :  Bhaskar Bhaumik (web.bhaskar.bhaumik@gmail.com)  |
+# | Version       :  0.1                                              |
+# | Date Created  :  October 13, 2018                                 |
+# | Description   :  Deterministic synthetic tree for the benchmarks, |
+# |                  and page cache eviction for the cold runs.       |
+# +-------------------------------------------------------------------+
+*/
+/*
+    gentree [-s scale] dir      create the tree (unless it is there already)
+    gentree -e dir              drop the files under dir from the page cache
+
+    The tree has one subdirectory per shape:
+
+        small   scale * 20000 files of 0 to 8K in 100 directories
+        huge    4 files of scale * 64M
+        deep    a chain of 256 directories with 2 files each
+        wide    one directory of scale * 20000 empty files
+        sparse  2 files of scale * 1G with 64K of data at each end
+
+    The contents come from a fixed seed, so every run and every machine
+    gets the same tree. A summary of the tree is written to dir/.gentree
+    and printed as JSON.
+*/
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#define SEED            0x2545F4914F6CDD1DULL
+#define CHUNK           (1 << 20)
+
+static char *progname = "gentree";
+static uint64_t rng = SEED;
+static unsigned long nfiles, ndirs;
+static unsigned long long nbytes;
+
+static uint64_t next_rand(void)
+{
+    /* xorshift64* */
+    rng ^= rng >> 12;
+    rng ^= rng << 25;
+    rng ^= rng >> 27;
+    return rng * 2685821657736338717ULL;
+}
+
+static void fill(unsigned char *buf, size_t len)
+{
+    size_t i;
+    uint64_t v;
+
+    for(i = 0; i + 8 <= len; i += 8) {
+        v = next_rand();
+        memcpy(buf + i, &v, 8);
+    }
+    for(v = next_rand(); i < len; i++, v >>= 8) buf[i] = (unsigned char)v;
+    return;
+}
+
+static void make_dir(const char *path)
+{
+    if(mkdir(path, 0755) != 0 && errno != EEXIST) {
+        perror(path);
+        exit(1);
+    }
+    ndirs++;
+    return;
+}
+
+/* A file of len bytes; with hole, only the first and last 64K are written */
+static void make_file(const char *path, unsigned long long len, int hole)
+{
+    int fd;
+    size_t n;
+    unsigned long long off = 0;
+    static unsigned char *buf;
+
+    if(buf == (unsigned char *)NULL && (buf = (unsigned char *)malloc(CHUNK)) == (unsigned char *)NULL) {
+        perror(progname);
+        exit(1);
+    }
+    if((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+        perror(path);
+        exit(1);
+    }
+    while(off < len) {
+        n = (len - off < CHUNK) ? (size_t)(len - off) : CHUNK;
+        if(hole && n > 65536) n = 65536;
+        fill(buf, n);
+        if(pwrite(fd, buf, n, (off_t)off) != (ssize_t)n) {
+            perror(path);
+            exit(1);
+        }
+        off += n;
+        if(hole && off < len - 65536) off = (len > 65536) ? len - 65536 : len;
+    }
+    if(ftruncate(fd, (off_t)len) != 0 || close(fd) != 0) {
+        perror(path);
+        exit(1);
+    }
+    nfiles++;
+    nbytes += len;
+    return;
+}
+
+static void generate(const char *dir, int scale)
+{
+    int i, j;
+    char path[4096];
+    size_t len;
+
+    make_dir(dir);
+
+    snprintf(path, sizeof(path), "%s/small", dir);
+    make_dir(path);
+    for(i = 0; i < 100; i++) {
+        snprintf(path, sizeof(path), "%s/small/d%02d", dir, i);
+        make_dir(path);
+        for(j = 0; j < 200 * scale; j++) {
+            snprintf(path, sizeof(path), "%s/small/d%02d/f%05d", dir, i, j);
+            make_file(path, next_rand() % 8193, 0);
+        }
+    }
+
+    snprintf(path, sizeof(path), "%s/huge", dir);
+    make_dir(path);
+    for(i = 0; i < 4; i++) {
+        snprintf(path, sizeof(path), "%s/huge/h%d", dir, i);
+        make_file(path, (unsigned long long)scale << 26, 0);
+    }
+
+    len = (size_t)snprintf(path, sizeof(path), "%s/deep", dir);
+    make_dir(path);
+    for(i = 0; i < 256; i++) {
+        len += (size_t)snprintf(path + len, sizeof(path) - len, "/d%d", i % 10);
+        make_dir(path);
+        for(j = 0; j < 2; j++) {
+            snprintf(path + len, sizeof(path) - len, "/f%d", j);
+            make_file(path, next_rand() % 4097, 0);
+        }
+        path[len] = '\0';
+    }
+
+    snprintf(path, sizeof(path), "%s/wide", dir);
+    make_dir(path);
+    for(i = 0; i < 20000 * scale; i++) {
+        snprintf(path, sizeof(path), "%s/wide/e%06d", dir, i);
+        make_file(path, 0, 0);
+    }
+
+    snprintf(path, sizeof(path), "%s/sparse", dir);
+    make_dir(path);
+    for(i = 0; i < 2; i++) {
+        snprintf(path, sizeof(path), "%s/sparse/s%d", dir, i);
+        make_file(path, (unsigned long long)scale << 30, 1);
+    }
+    return;
+}
+
+static int evict(const char *path, const struct stat *sb, int flag, struct FTW *ftw)
+{
+    int fd;
+
+    (void)ftw;
+    if(flag != FTW_F || !S_ISREG(sb->st_mode)) return 0;
+    if((fd = open(path, O_RDONLY)) < 0) return 0;
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    int c, scale = 1, evict_only = 0;
+    char stamp[4096], summary[256], old[256];
+    FILE *fp;
+
+    while((c = getopt(argc, argv, "es:")) != -1) {
+        switch(c) {
+            case 'e':
+                evict_only = 1;
+                break;
+            case 's':
+                if((scale = atoi(optarg)) < 1) {
+                    fprintf(stderr, "%s: invalid scale (%s).\n", progname, optarg);
+                    return 1;
+                }
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-s scale] dir | -e dir\n", progname);
+                return 1;
+        }
+    }
+    if(optind != argc - 1) {
+        fprintf(stderr, "usage: %s [-s scale] dir | -e dir\n", progname);
+        return 1;
+    }
+
+    if(evict_only) {
+        /* Clean pages only: the tree is synced first */
+        sync();
+        return nftw(argv[optind], evict, 64, FTW_PHYS) == 0 ? 0 : 1;
+    }
+
+    /* A tree of the same scale is already there */
+    snprintf(stamp, sizeof(stamp), "%s/.gentree", argv[optind]);
+    snprintf(summary, sizeof(summary), "{\"scale\": %d,", scale);
+    if((fp = fopen(stamp, "r")) != (FILE *)NULL) {
+        if(fgets(old, sizeof(old), fp) == (char *)NULL) old[0] = '\0';
+        fclose(fp);
+        if(strncmp(old, summary, strlen(summary)) == 0) {
+            fputs(old, stdout);
+            return 0;
+        }
+    }
+
+    generate(argv[optind], scale);
+    snprintf(summary, sizeof(summary), "{\"scale\": %d, \"files\": %lu, \"dirs\": %lu, \"bytes\": %llu}\n",
+             scale, nfiles, ndirs, nbytes);
+    if((fp = fopen(stamp, "w")) == (FILE *)NULL) {
+        perror(stamp);
+        return 1;
+    }
+    fputs(summary, fp);
+    fclose(fp);
+    fputs(summary, stdout);
+    return 0;
+}
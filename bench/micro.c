@@ -0,0 +1,454 @@
+/*
+# +-------------------------------------------------------------------+
+# | Program Name  :  micro.c                                          |
+# | Author        :  Bhaskar Bhaumik (web.bhaskar.bhaumik@gmail.com)  |
+# | Version       :  0.1                                              |
+# | Date Created  :  October 13, 2018                                 |
+# | Description   :  Microbenchmarks of the digest, timestamp and     |
+# |                  record formatting routines, as JSON.             |
+# +-------------------------------------------------------------------+
+*/
+/*
+    micro [-c] [-n megabytes] [file]
+
+    The digests run on a buffer of random bytes in memory (fmemopen), so
+    only the routine is measured, not the disk; BLAKE3 and XXH3 once per
+    kernel the CPU has, and the multi-buffer MD5 and SHA256 per kernel on
+    the buffer cut in 4K files. The formatters format the
+    record of file (default /etc/passwd) with every field, into a buffer
+    that is never written out.
+
+    Before that, every kernel the CPU has is checked against the portable
+    one (CRC, BLAKE3, XXH3) or OpenSSL (multi-buffer MD5 and SHA256) over
+    odd lengths and offsets, in one update and in uneven pieces; the
+    portable ones are checked against known digests first. A mismatch is
+    reported on stderr and nothing is measured. With -c only the checks
+    run; the exit status is 1 if one failed.
+*/
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <openssl/md5.h>
+#include <openssl/sha.h>
+
+#include "filestat.h"
+
+#define TS_CALLS        1000000
+#define FMT_CALLS       200000
+#define CHECK_MAXLEN    ((1 << 20) + 7)
+
+static int first = 1;
+static unsigned long checks, failures;
+
+/* Lengths around the block, stripe, chunk and padding boundaries of the digests */
+static const size_t check_lens[] = {
+    0, 1, 2, 3, 7, 15, 16, 17, 31, 32, 33, 55, 56, 57, 63, 64, 65, 119, 120, 127, 128, 129, 191, 239, 240, 241,
+    255, 256, 257, 1023, 1024, 1025, 2047, 2048, 2049, 4095, 4096, 4097, 8191, 16383, 16384, 16385, 65535,
+    65536, 65537, 3 * 65536 + 123, CHECK_MAXLEN
+};
+static const size_t check_offs[] = { 0, 1, 3, 7 };
+static const size_t check_pieces[] = { 1, 7, 63, 64, 65, 1000, 4097 };
+
+#define NELEM(a)        (sizeof(a) / sizeof((a)[0]))
+
+/* One digest of any of the engines: kind (0 CRC, 1 BLAKE3, 2 XXH3) of buf, in one update or in pieces */
+static void check_digest(int kind, const unsigned char *buf, size_t len, int split, unsigned char out[SHA256_LEN])
+{
+    size_t i, n, p = 0;
+    uint_fast32_t crc = 0;
+    uint32_t c32;
+    uint64_t x64;
+    BLAKE3_CTX b3;
+    XXH3_CTX xx;
+
+    memset(out, 0, SHA256_LEN);
+    if(kind == 1) blake3_init(&b3);
+    if(kind == 2) xxh3_init(&xx);
+    for(i = 0; i < len || (i == 0 && len == 0); i += n) {
+        n = split ? check_pieces[p++ % NELEM(check_pieces)] : len;
+        if(n > len - i) n = len - i;
+        if(kind == 0) crc = cksum_update(crc, buf + i, n);
+        else if(kind == 1) blake3_update(&b3, buf + i, n);
+        else xxh3_update(&xx, buf + i, n);
+        if(len == 0) break;
+    }
+    if(kind == 0) {
+        c32 = cksum_finish(crc, len);
+        memcpy(out, &c32, sizeof(c32));
+    } else if(kind == 1) {
+        blake3_final(&b3, out);
+    } else {
+        x64 = xxh3_final(&xx);
+        memcpy(out, &x64, sizeof(x64));
+    }
+    return;
+}
+
+static void check_result(int ok, const char *what, const char *kernel, size_t len, size_t off, const char *how)
+{
+    checks++;
+    if(ok) return;
+    fprintf(stderr, "%s: %s %s: wrong digest for %lu bytes at offset %lu, %s\n", progname, what, kernel,
+            (unsigned long)len, (unsigned long)off, how);
+    failures++;
+    return;
+}
+
+static void hex(const unsigned char *d, size_t n, char *s)
+{
+    size_t i;
+    for(i = 0; i < n; i++) sprintf(s + 2 * i, "%02x", d[i]);
+    return;
+}
+
+/*
+    The portable kernels against published digests: cksum of "123456789"
+    and BLAKE3 and XXH3 of the official test input, bytes i % 251.
+*/
+static void check_known(unsigned char *pattern)
+{
+    static const struct { size_t len; const char *blake3; const char *xxh3; } known[] = {
+        { 0, "af1349b9f5f9a1a6a0404dea36dcc9499bcb25c9adc112b7cc9a93cae41f3262", "2d06800538d394c2" },
+        { 1, "2d3adedff11b61f14c886e35afa036736dcd87a74d27b5c1510225d0f592e213", "c44bdff4074eecdb" },
+        { 1023, "10108970eeda3eb932baac1428c7a2163b0e924c9a9e25b35bba72b28f70bd11", "d3d91d80ac495685" },
+        { 1025, "d00278ae47eb27b34faecf67b4fe263f82d5412916c1ffd97c8cb7fb814b8444", "e95c42288f28186e" },
+        { 65531, "d39318745406949f46bdcdad334fcd8d4515e5d8fdd00424a8f9e2bf83eed8b4", "92214f5ae2656dd8" }
+    };
+    unsigned char d[SHA256_LEN];
+    char s[2 * SHA256_LEN + 1];
+    uint32_t c32;
+    uint64_t x64;
+    size_t i;
+
+    for(i = 0; i < 65536; i++) pattern[i] = (unsigned char)(i % 251);
+    cksum_set_engine("table");
+    check_digest(0, (const unsigned char *)"123456789", 9, 0, d);
+    memcpy(&c32, d, sizeof(c32));
+    check_result(c32 == 930766865U, "cksum", "table", 9, 0, "not as POSIX cksum");
+    blake3_set_engine("portable");
+    xxh3_set_engine("scalar");
+    for(i = 0; i < NELEM(known); i++) {
+        check_digest(1, pattern, known[i].len, 0, d);
+        hex(d, BLAKE3_LEN, s);
+        check_result(strcmp(s, known[i].blake3) == 0, "blake3", "portable", known[i].len, 0, "not the test vector");
+        check_digest(2, pattern, known[i].len, 0, d);
+        memcpy(&x64, d, sizeof(x64));
+        sprintf(s, "%016llx", (unsigned long long)x64);
+        check_result(strcmp(s, known[i].xxh3) == 0, "xxh3", "scalar", known[i].len, 0, "not the test vector");
+    }
+    return;
+}
+
+/* The multi-buffer kernels against OpenSSL, on batches of n lanes of mixed lengths and offsets */
+static void check_mbhash(const unsigned char *buf)
+{
+    static const char *kernels[] = { "portable", "sse2", "avx2", "avx512" };
+    static const size_t lanes[] = { 1, 2, 3, 5, 8, 16, 17, 31, 63, MB_BATCH };
+    const unsigned char *data[MB_BATCH];
+    unsigned char out[MB_BATCH][SHA256_LEN], *outp[MB_BATCH], ref[SHA256_LEN];
+    size_t len[MB_BATCH], off[MB_BATCH], n, j, l;
+    char what[48];
+    int k, e;
+
+    for(j = 0; j < MB_BATCH; j++) outp[j] = out[j];
+    for(k = 0; k < 4; k++) {
+        if(mbhash_set_engine(kernels[k]) != 0) continue;
+        for(l = 0; l < NELEM(lanes); l++) {
+            n = lanes[l];
+            for(j = 0; j < n; j++) {
+                /* Lengths up to MB_SMALL and a bit over, spread over the lanes */
+                len[j] = check_lens[(j * 7 + l) % NELEM(check_lens)] % (MB_SMALL + 2);
+                off[j] = check_offs[(j + l) % NELEM(check_offs)];
+                data[j] = buf + off[j] + j * 64;
+            }
+            for(e = 0; e < 2; e++) {
+                if(e == 0) mb_md5(data, len, n, outp);
+                else mb_sha256(data, len, n, outp);
+                for(j = 0; j < n; j++) {
+                    if(e == 0) MD5(data[j], len[j], ref);
+                    else SHA256(data[j], len[j], ref);
+                    snprintf(what, sizeof(what), "%s (%lu lanes)", e == 0 ? "mb_md5" : "mb_sha256", (unsigned long)n);
+                    check_result(memcmp(out[j], ref, (e == 0) ? MD5_LEN : SHA256_LEN) == 0, what, kernels[k],
+                                 len[j], off[j] + j * 64, "not as OpenSSL");
+                }
+            }
+        }
+    }
+    mbhash_set_engine("auto");
+    return;
+}
+
+/* Every kernel of the CPU against the reference one; returns the number of failures */
+static unsigned long check_kernels(void)
+{
+    static const char *kernels[3][4] = {
+        { "table", "slice16", "pclmul", "vpclmul" },
+        { "portable", "sse41", "avx2", "avx512" },
+        { "scalar", "sse2", "avx2", "avx512" }
+    };
+    static const char *names[3] = { "cksum", "blake3", "xxh3" };
+    int (*set_engine[3])(const char *) = { cksum_set_engine, blake3_set_engine, xxh3_set_engine };
+    unsigned char *buf, ref[SHA256_LEN], got[SHA256_LEN];
+    size_t i, l, o;
+    int kind, k, split;
+
+    if((buf = (unsigned char *)malloc(CHECK_MAXLEN + 8 + MB_BATCH * 64)) == (unsigned char *)NULL) {
+        perror(progname);
+        exit(1);
+    }
+    check_known(buf);
+    srand(2);
+    for(i = 0; i < CHECK_MAXLEN + 8 + MB_BATCH * 64; i++) buf[i] = (unsigned char)rand();
+
+    for(kind = 0; kind < 3; kind++) {
+        for(l = 0; l < NELEM(check_lens); l++) {
+            for(o = 0; o < NELEM(check_offs); o++) {
+                set_engine[kind](kernels[kind][0]);
+                check_digest(kind, buf + check_offs[o], check_lens[l], 0, ref);
+                for(k = 0; k < 4; k++) {
+                    if(set_engine[kind](kernels[kind][k]) != 0) continue;
+                    for(split = (k == 0); split < 2; split++) {
+                        check_digest(kind, buf + check_offs[o], check_lens[l], split, got);
+                        check_result(memcmp(ref, got, SHA256_LEN) == 0, names[kind], kernels[kind][k],
+                                     check_lens[l], check_offs[o], split ? "in pieces" : "in one update");
+                    }
+                }
+            }
+        }
+        set_engine[kind]("auto");
+    }
+    check_mbhash(buf);
+    free(buf);
+    return failures;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void result(const char *name, unsigned long calls, unsigned long long bytes, double secs)
+{
+    printf("%s\n    {\"name\": \"%s\", \"calls\": %lu, \"bytes\": %llu, \"seconds\": %.6f, "
+           "\"calls_per_s\": %.0f, \"mb_per_s\": %.1f}",
+           first ? "" : ",", name, calls, bytes, secs,
+           secs > 0 ? calls / secs : 0.0, secs > 0 ? bytes / secs / 1e6 : 0.0);
+    first = 0;
+    return;
+}
+
+static FILE *open_buf(unsigned char *buf, size_t len)
+{
+    FILE *fp;
+
+    if((fp = fmemopen(buf, len, "r")) == (FILE *)NULL) {
+        perror(progname);
+        exit(1);
+    }
+    return fp;
+}
+
+static void bench_digests(size_t len)
+{
+    static const char *b3_kernels[] = { "portable", "sse41", "avx2", "avx512" };
+    static const char *xxh_kernels[] = { "scalar", "sse2", "avx2", "avx512" };
+    static const char *mb_kernels[] = { "portable", "sse2", "avx2", "avx512" };
+    unsigned char *buf, digest[SHA256_LEN], mbout[MB_BATCH][SHA256_LEN];
+    const unsigned char *mbdata[MB_BATCH];
+    unsigned char *mbdigest[MB_BATCH];
+    size_t mblen[MB_BATCH], n, j;
+    char cs[64], name[32];
+    int k;
+    size_t i;
+    double t;
+    volatile uint64_t sink;
+    FILE *fp;
+    BLAKE3_CTX b3;
+    XXH3_CTX xx;
+
+    if((buf = (unsigned char *)malloc(len)) == (unsigned char *)NULL) {
+        perror(progname);
+        exit(1);
+    }
+    srand(1);
+    for(i = 0; i < len; i++) buf[i] = (unsigned char)rand();
+
+    fp = open_buf(buf, len);
+    t = now();
+    cksum(fp, cs);
+    result("cksum", 1, len, now() - t);
+    fclose(fp);
+
+    fp = open_buf(buf, len);
+    t = now();
+    mdfile(fp, digest);
+    result("mdfile", 1, len, now() - t);
+    fclose(fp);
+
+    fp = open_buf(buf, len);
+    t = now();
+    sha256file(fp, digest);
+    result("sha256file", 1, len, now() - t);
+    fclose(fp);
+
+    for(k = 0; k < 4; k++) {
+        if(blake3_set_engine(b3_kernels[k]) != 0) continue;
+        t = now();
+        blake3_init(&b3);
+        for(i = 0; i < len; i += DIGEST_BUFLEN)
+            blake3_update(&b3, buf + i, len - i < DIGEST_BUFLEN ? len - i : DIGEST_BUFLEN);
+        blake3_final(&b3, digest);
+        snprintf(name, sizeof(name), "blake3_%s", b3_kernels[k]);
+        result(name, 1, len, now() - t);
+    }
+    blake3_set_engine("auto");
+
+    for(k = 0; k < 4; k++) {
+        if(xxh3_set_engine(xxh_kernels[k]) != 0) continue;
+        t = now();
+        xxh3_init(&xx);
+        for(i = 0; i < len; i += DIGEST_BUFLEN)
+            xxh3_update(&xx, buf + i, len - i < DIGEST_BUFLEN ? len - i : DIGEST_BUFLEN);
+        sink = xxh3_final(&xx);
+        snprintf(name, sizeof(name), "xxh3_%s", xxh_kernels[k]);
+        result(name, 1, len, now() - t);
+    }
+    xxh3_set_engine("auto");
+    (void)sink;
+
+    for(j = 0; j < MB_BATCH; j++) {
+        mblen[j] = 4096;
+        mbdigest[j] = mbout[j];
+    }
+    for(k = 0; k < 4; k++) {
+        if(mbhash_set_engine(mb_kernels[k]) != 0) continue;
+        t = now();
+        for(i = 0; i + MB_BATCH * 4096 <= len; i += n * 4096) {
+            for(n = 0; n < MB_BATCH; n++) mbdata[n] = buf + i + n * 4096;
+            mb_md5(mbdata, mblen, n, mbdigest);
+        }
+        snprintf(name, sizeof(name), "mb_md5_%s", mb_kernels[k]);
+        result(name, i / 4096, i, now() - t);
+        t = now();
+        for(i = 0; i + MB_BATCH * 4096 <= len; i += n * 4096) {
+            for(n = 0; n < MB_BATCH; n++) mbdata[n] = buf + i + n * 4096;
+            mb_sha256(mbdata, mblen, n, mbdigest);
+        }
+        snprintf(name, sizeof(name), "mb_sha256_%s", mb_kernels[k]);
+        result(name, i / 4096, i, now() - t);
+    }
+    mbhash_set_engine("auto");
+
+    free(buf);
+    return;
+}
+
+static void bench_timestamps(void)
+{
+    int i;
+    double t;
+    char ts[64];
+    volatile char sink = 0;
+
+    t = now();
+    for(i = 0; i < TS_CALLS; i++) sink ^= tm2isots(1539388800 + i, i)[0];
+    result("tm2isots", TS_CALLS, 0, now() - t);
+
+    t = now();
+    for(i = 0; i < TS_CALLS; i++) sink ^= tm2isots_r(1539388800 + i, i, ts)[0];
+    result("tm2isots_r", TS_CALLS, 0, now() - t);
+
+    t = now();
+    for(i = 0; i < TS_CALLS; i++) sink ^= fmt_isots(1539388800 + i, i, ts)[0];
+    result("fmt_isots", TS_CALLS, 0, now() - t);
+    (void)sink;
+    return;
+}
+
+static void bench_formatters(const char *filename)
+{
+    static const char *types[] = { "raw", "txt", "tab", "csv", "htm", "xml" };
+    int otyp, i;
+    unsigned long long bytes;
+    char name[32];
+    double t;
+    FSREC rec;
+    OBUF ob;
+
+    out_fields = FLDM_ALL;
+    if(collect_file_stat(&rec, filename, FLDM_ALL) != 0) {
+        collect_perror(&rec, filename);
+        exit(1);
+    }
+    obuf_init(&ob, -1);
+    for(otyp = OUT_TYPE_RAW; otyp <= OUT_TYPE_XML; otyp++) {
+        bytes = 0;
+        t = now();
+        for(i = 0; i < FMT_CALLS; i++) {
+            format_record(&ob, otyp, &rec);
+            if(ob.len >= OBUF_LEN) {
+                bytes += ob.len;
+                ob.len = 0;
+            }
+        }
+        bytes += ob.len;
+        ob.len = 0;
+        snprintf(name, sizeof(name), "format_%s", types[otyp - OUT_TYPE_RAW]);
+        result(name, FMT_CALLS, bytes, now() - t);
+    }
+    obuf_free(&ob);
+    free_file_stat(&rec);
+    return;
+}
+
+int main(int argc, char *argv[])
+{
+    int c, check_only = 0;
+    size_t mb = 32;
+
+    progname = "micro";
+    while((c = getopt(argc, argv, "cn:")) != -1) {
+        switch(c) {
+            case 'c':
+                check_only = 1;
+                break;
+            case 'n':
+                if((mb = (size_t)atol(optarg)) == 0) {
+                    fprintf(stderr, "%s: invalid size (%s).\n", progname, optarg);
+                    return 1;
+                }
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-c] [-n megabytes] [file]\n", progname);
+                return 1;
+        }
+    }
+
+    if(check_kernels() != 0) {
+        fprintf(stderr, "%s: %lu of %lu kernel checks failed\n", progname, failures, checks);
+        return 1;
+    }
+    if(check_only) {
+        printf("%s: %lu kernel checks passed\n", progname, checks);
+        return 0;
+    }
+
+    printf("[");
+    bench_digests(mb << 20);
+    bench_timestamps();
+    bench_formatters(optind < argc ? argv[optind] : "/etc/passwd");
+    printf("\n]\n");
+    return 0;
+}
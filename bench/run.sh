@@ -0,0 +1,56 @@
+#!/bin/sh
+#
+# run.sh - bench
+#
+#   Generates the tree in $BENCH_DIR (once per scale), and prints one JSON
+#   document with the microbenchmarks and, per subtree, the end to end
+#   entries/s and MB/s of a recursive scan, cold (evicted from the page
+#   cache) and warm.
+#
+BENCH_DIR=${BENCH_DIR:-/tmp/filestat-bench}
+BENCH_SCALE=${BENCH_SCALE:-1}
+FILESTAT=../src/filestat
+
+tree=`./gentree -s "$BENCH_SCALE" "$BENCH_DIR"` || exit 1
+micro=`./micro | sed '2,$s/^/  /'` || exit 1
+
+now() {
+    date +%s%N
+}
+
+# scan subtree mode: one JSON object
+scan() {
+    entries=`find "$BENCH_DIR/$1" | wc -l`
+    bytes=`find "$BENCH_DIR/$1" -type f -printf '%s\n' | awk '{ n += $1 } END { printf "%.0f", n }'`
+    if [ "$2" = cold ]; then
+        ./gentree -e "$BENCH_DIR/$1"
+        [ "`id -u`" = 0 ] && sync && echo 3 > /proc/sys/vm/drop_caches 2> /dev/null
+    else
+        $FILESTAT -t csv -r -o /dev/null $BENCH_OPTS "$BENCH_DIR/$1" 2> /dev/null
+    fi
+    t0=`now`
+    $FILESTAT -t csv -r -o /dev/null $BENCH_OPTS "$BENCH_DIR/$1" 2> /dev/null
+    t1=`now`
+    awk -v s="$1" -v m="$2" -v f="$entries" -v b="$bytes" -v ns=`expr $t1 - $t0` 'BEGIN {
+        t = ns / 1e9
+        printf "    {\"tree\": \"%s\", \"cache\": \"%s\", \"entries\": %d, \"bytes\": %.0f, \"seconds\": %.6f, \"entries_per_s\": %.0f, \"mb_per_s\": %.1f}",
+               s, m, f, b, t, (t > 0 ? f / t : 0), (t > 0 ? b / t / 1e6 : 0)
+    }'
+}
+
+echo "{"
+echo "  \"build\": {\"rev\": \"`git rev-parse --short HEAD 2> /dev/null`\", \"opts\": \"$BENCH_OPTS\"},"
+echo "  \"tree\": $tree,"
+echo "  \"micro\": $micro,"
+echo "  \"end_to_end\": ["
+sep=""
+for s in small huge deep wide sparse; do
+    for m in cold warm; do
+        printf "$sep"
+        scan $s $m
+        sep=",\n"
+    done
+done
+echo ""
+echo "  ]"
+echo "}"
@@ -0,0 +1,378 @@
+/*
+# +-------------------------------------------------------------------+
+# | Program Name  :  blake3.c                                         |
+# | Author        :  Bhaskar Bhaumik (web.bhaskar.bhaumik@gmail.com)  |
+# | Version       :  0.1                                              |
+# | Date Created  :  October 13, 2018                                 |
+# | Description   :  Streaming BLAKE3 hash (256 bit output) with      |
+# |                  portable, SSE4.1, AVX2 and AVX-512 kernels that  |
+# |                  hash 4, 8 or 16 chunks at once, picked at run    |
+# |                  time.                                            |
+# +-------------------------------------------------------------------+
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define B3_X86              1
+#include <immintrin.h>
+#endif
+
+#include "filestat.h"
+
+/*
+    The input is cut in 1K chunks, each hashed on its own into an 8 word
+    chaining value (CV) with a 64 byte block compression per block, and
+    the CVs are merged pairwise up a binary tree. The chunks of a large
+    input are independent, so the kernels hash a batch of them side by
+    side, one chunk per 32 bit vector lane. Merging is done on a stack:
+    after chunk n (counting from 1), a parent is formed for every trailing
+    zero bit of n. A chunk is only finished once more input is known to
+    follow it, as the last one takes the ROOT flag when it is alone.
+*/
+#define B3_CHUNK_START      1
+#define B3_CHUNK_END        2
+#define B3_PARENT           4
+#define B3_ROOT             8
+
+#define B3_MAX_LANES        16
+
+typedef void (*b3_chunks_fn)(const unsigned char *in, size_t n, uint64_t counter, uint32_t (*cv)[8]);
+
+static const uint32_t b3_iv[8] = {
+    0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A, 0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19
+};
+
+static const uint8_t b3_schedule[7][16] = {
+    { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 },
+    { 2, 6, 3, 10, 7, 0, 4, 13, 1, 11, 12, 5, 9, 14, 15, 8 },
+    { 3, 4, 10, 12, 13, 2, 7, 14, 6, 5, 9, 0, 11, 15, 8, 1 },
+    { 10, 7, 12, 9, 14, 3, 13, 15, 4, 0, 11, 2, 5, 8, 1, 6 },
+    { 12, 13, 9, 11, 15, 10, 14, 8, 7, 2, 5, 3, 0, 1, 6, 4 },
+    { 9, 14, 11, 5, 8, 12, 15, 1, 13, 3, 0, 10, 2, 6, 4, 7 },
+    { 11, 15, 5, 0, 1, 9, 8, 6, 14, 10, 2, 12, 3, 4, 7, 13 },
+};
+
+static pthread_once_t b3_once = PTHREAD_ONCE_INIT;
+static b3_chunks_fn b3_chunks;
+static const char *b3_engine_name;
+
+static inline uint32_t load32(const unsigned char *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline void store32(unsigned char *p, uint32_t v)
+{
+    p[0] = (unsigned char)v;
+    p[1] = (unsigned char)(v >> 8);
+    p[2] = (unsigned char)(v >> 16);
+    p[3] = (unsigned char)(v >> 24);
+}
+
+#define B3_ROTR(x, c)       (((x) >> (c)) | ((x) << (32 - (c))))
+
+#define B3_G(v, a, b, c, d, x, y) do { \
+        v[a] = v[a] + v[b] + (x); v[d] = B3_ROTR(v[d] ^ v[a], 16); \
+        v[c] = v[c] + v[d];       v[b] = B3_ROTR(v[b] ^ v[c], 12); \
+        v[a] = v[a] + v[b] + (y); v[d] = B3_ROTR(v[d] ^ v[a], 8);  \
+        v[c] = v[c] + v[d];       v[b] = B3_ROTR(v[b] ^ v[c], 7);  \
+    } while(0)
+
+#define B3_ROUND(v, m, s) do { \
+        B3_G(v, 0, 4, 8, 12, m[s[0]], m[s[1]]);   \
+        B3_G(v, 1, 5, 9, 13, m[s[2]], m[s[3]]);   \
+        B3_G(v, 2, 6, 10, 14, m[s[4]], m[s[5]]);  \
+        B3_G(v, 3, 7, 11, 15, m[s[6]], m[s[7]]);  \
+        B3_G(v, 0, 5, 10, 15, m[s[8]], m[s[9]]);  \
+        B3_G(v, 1, 6, 11, 12, m[s[10]], m[s[11]]); \
+        B3_G(v, 2, 7, 8, 13, m[s[12]], m[s[13]]); \
+        B3_G(v, 3, 4, 9, 14, m[s[14]], m[s[15]]); \
+    } while(0)
+
+/* The compression function, truncated to the 8 words of a CV */
+static void b3_compress(const uint32_t cv[8], const unsigned char block[B3_BLOCK_LEN], uint32_t blen,
+                        uint64_t counter, uint32_t flags, uint32_t out[8])
+{
+    int i;
+    uint32_t m[16], v[16];
+
+    for(i = 0; i < 16; i++) m[i] = load32(block + 4 * i);
+    for(i = 0; i < 8; i++) v[i] = cv[i];
+    for(i = 0; i < 4; i++) v[8 + i] = b3_iv[i];
+    v[12] = (uint32_t)counter;
+    v[13] = (uint32_t)(counter >> 32);
+    v[14] = blen;
+    v[15] = flags;
+    for(i = 0; i < 7; i++) B3_ROUND(v, m, b3_schedule[i]);
+    for(i = 0; i < 8; i++) out[i] = v[i] ^ v[i + 8];
+    return;
+}
+
+static void b3_parent(const uint32_t left[8], const uint32_t right[8], uint32_t flags, uint32_t out[8])
+{
+    int i;
+    unsigned char block[B3_BLOCK_LEN];
+
+    for(i = 0; i < 8; i++) {
+        store32(block + 4 * i, left[i]);
+        store32(block + 32 + 4 * i, right[i]);
+    }
+    b3_compress(b3_iv, block, B3_BLOCK_LEN, 0, B3_PARENT | flags, out);
+    return;
+}
+
+/* n whole chunks, one after another */
+static void b3_chunks_portable(const unsigned char *in, size_t n, uint64_t counter, uint32_t (*cv)[8])
+{
+    int b;
+    uint32_t flags;
+
+    for(; n > 0; n--, in += B3_CHUNK_LEN, counter++, cv++) {
+        memcpy(*cv, b3_iv, sizeof(b3_iv));
+        for(b = 0; b < B3_CHUNK_LEN / B3_BLOCK_LEN; b++) {
+            flags = (b == 0 ? B3_CHUNK_START : 0) | (b == B3_CHUNK_LEN / B3_BLOCK_LEN - 1 ? B3_CHUNK_END : 0);
+            b3_compress(*cv, in + b * B3_BLOCK_LEN, B3_BLOCK_LEN, counter, flags, *cv);
+        }
+    }
+    return;
+}
+
+#ifdef B3_X86
+/*
+    The same rounds on vectors of W words, word i of lane j belonging to
+    chunk j: the message words are gathered across the chunks of the
+    batch (a hardware gather on AVX2, a transpose in registers on
+    AVX-512), and the CVs scattered back at the end. A batch smaller than W goes to the next
+    narrower kernel.
+*/
+#define B3_GATHER_SCALAR(m, p, idx) \
+    for(i = 0; i < 16; i++) \
+        for(j = 0; j < (int)(sizeof(m[i]) / 4); j++) m[i][j] = load32((p) + 4 * i + idx[j])
+#define B3_GATHER_AVX2(m, p, idx) \
+    for(i = 0; i < 16; i++) \
+        m[i] = (__typeof__(m[i]))_mm256_i32gather_epi32((const int *)((p) + 4 * i), (__m256i)idx, 1)
+#define B3_GATHER_AVX512(m, p, idx) \
+    (void)idx; b3_transpose16((__m512i *)m, p)
+
+/*
+    Word i of the block of each of 16 chunks: the 16 x 16 matrix of the
+    blocks is transposed in registers, swapping the off diagonal
+    quarters of every 2b x 2b square for b = 8, 4, 2, 1.
+*/
+__attribute__((target("avx512f")))
+static inline void b3_transpose16(__m512i *m, const unsigned char *p)
+{
+    int b, i, k;
+    __m512i t, lo[4], hi[4];
+    uint32_t ilo[16], ihi[16];
+
+    for(b = 8, k = 0; b > 0; b >>= 1, k++) {
+        for(i = 0; i < 16; i++) {
+            ilo[i] = (i & b) ? 16 + i - b : i;
+            ihi[i] = (i & b) ? 16 + i : i + b;
+        }
+        lo[k] = _mm512_loadu_si512((const void *)ilo);
+        hi[k] = _mm512_loadu_si512((const void *)ihi);
+    }
+    for(i = 0; i < 16; i++) m[i] = _mm512_loadu_si512((const void *)(p + i * B3_CHUNK_LEN));
+    for(b = 8, k = 0; b > 0; b >>= 1, k++) {
+        for(i = 0; i < 16; i++) {
+            if(i & b) continue;
+            t = _mm512_permutex2var_epi32(m[i], lo[k], m[i + b]);
+            m[i + b] = _mm512_permutex2var_epi32(m[i], hi[k], m[i + b]);
+            m[i] = t;
+        }
+    }
+    return;
+}
+
+#define B3_KERNEL(name, isa, W, next, gather) \
+typedef uint32_t name##_vec __attribute__((vector_size(4 * W))); \
+__attribute__((target(isa))) \
+static void name(const unsigned char *in, size_t n, uint64_t counter, uint32_t (*cv)[8]) \
+{ \
+    int b, i, j; \
+    uint32_t lane[8][W] __attribute__((aligned(4 * W))); \
+    name##_vec h[8], m[16], v[16], lo, hi, idx; \
+    \
+    for(j = 0; j < W; j++) idx[j] = j * B3_CHUNK_LEN; \
+    for(; n >= W; n -= W, in += W * B3_CHUNK_LEN, counter += W, cv += W) { \
+        for(j = 0; j < W; j++) { \
+            lane[0][j] = (uint32_t)(counter + j); \
+            lane[1][j] = (uint32_t)((counter + j) >> 32); \
+        } \
+        memcpy(&lo, lane[0], sizeof(lo)); \
+        memcpy(&hi, lane[1], sizeof(hi)); \
+        for(i = 0; i < 8; i++) h[i] = b3_iv[i] + (name##_vec){ 0 }; \
+        for(b = 0; b < B3_CHUNK_LEN / B3_BLOCK_LEN; b++) { \
+            gather(m, in + b * B3_BLOCK_LEN, idx); \
+            for(i = 0; i < 8; i++) v[i] = h[i]; \
+            for(i = 0; i < 4; i++) v[8 + i] = b3_iv[i] + (name##_vec){ 0 }; \
+            v[12] = lo; \
+            v[13] = hi; \
+            v[14] = B3_BLOCK_LEN + (name##_vec){ 0 }; \
+            v[15] = (uint32_t)((b == 0 ? B3_CHUNK_START : 0) \
+                               | (b == B3_CHUNK_LEN / B3_BLOCK_LEN - 1 ? B3_CHUNK_END : 0)) + (name##_vec){ 0 }; \
+            _Pragma("GCC unroll 7") \
+            for(i = 0; i < 7; i++) B3_ROUND(v, m, b3_schedule[i]); \
+            for(i = 0; i < 8; i++) h[i] = v[i] ^ v[i + 8]; \
+        } \
+        for(i = 0; i < 8; i++) memcpy(lane[i], &h[i], sizeof(h[i])); \
+        for(j = 0; j < W; j++) \
+            for(i = 0; i < 8; i++) cv[j][i] = lane[i][j]; \
+    } \
+    if(n > 0) next(in, n, counter, cv); \
+    return; \
+}
+
+B3_KERNEL(b3_chunks_sse41, "sse4.1", 4, b3_chunks_portable, B3_GATHER_SCALAR)
+B3_KERNEL(b3_chunks_avx2, "avx2", 8, b3_chunks_sse41, B3_GATHER_AVX2)
+B3_KERNEL(b3_chunks_avx512, "avx512f", 16, b3_chunks_avx2, B3_GATHER_AVX512)
+#endif
+
+static int b3_supported(const char *name)
+{
+    if(strcmp(name, "portable") == 0) return 1;
+#ifdef B3_X86
+    __builtin_cpu_init();
+    if(strcmp(name, "sse41") == 0) return __builtin_cpu_supports("sse4.1");
+    if(strcmp(name, "avx2") == 0) return __builtin_cpu_supports("avx2");
+    if(strcmp(name, "avx512") == 0) return __builtin_cpu_supports("avx512f");
+#endif
+    return 0;
+}
+
+static void b3_use(const char *name)
+{
+    b3_engine_name = name;
+    if(strcmp(name, "portable") == 0) b3_chunks = b3_chunks_portable;
+#ifdef B3_X86
+    else if(strcmp(name, "sse41") == 0) b3_chunks = b3_chunks_sse41;
+    else if(strcmp(name, "avx2") == 0) b3_chunks = b3_chunks_avx2;
+    else if(strcmp(name, "avx512") == 0) b3_chunks = b3_chunks_avx512;
+#endif
+    return;
+}
+
+static const char *b3_best(void)
+{
+    return b3_supported("avx512") ? "avx512" : b3_supported("avx2") ? "avx2"
+           : b3_supported("sse41") ? "sse41" : "portable";
+}
+
+static void b3_init(void)
+{
+    b3_use(b3_best());
+    return;
+}
+
+/*
+    Select a BLAKE3 kernel by name: portable, sse41, avx2, avx512 or auto.
+    Returns 0, or -1 if the kernel is unknown or the CPU lacks it.
+*/
+int blake3_set_engine(const char *name)
+{
+    pthread_once(&b3_once, b3_init);
+    if(strcmp(name, "auto") == 0) name = b3_best();
+    if(!b3_supported(name)) return -1;
+    b3_use(name);
+    return 0;
+}
+
+const char *blake3_engine(void)
+{
+    pthread_once(&b3_once, b3_init);
+    return b3_engine_name;
+}
+
+void blake3_init(BLAKE3_CTX *c)
+{
+    pthread_once(&b3_once, b3_init);
+    memcpy(c->cv, b3_iv, sizeof(b3_iv));
+    memset(c->block, 0, sizeof(c->block));
+    c->chunk = 0;
+    c->blen = 0;
+    c->blocks = 0;
+    c->depth = 0;
+    return;
+}
+
+/* The CV of a finished chunk, merged into the stack */
+static void b3_push(BLAKE3_CTX *c, const uint32_t cv[8])
+{
+    uint64_t n;
+    uint32_t h[8];
+
+    memcpy(h, cv, sizeof(h));
+    for(n = ++c->chunk; (n & 1) == 0; n >>= 1)
+        b3_parent(c->stack[--c->depth], h, 0, h);
+    memcpy(c->stack[c->depth++], h, sizeof(h));
+    return;
+}
+
+static uint32_t b3_chunk_flags(const BLAKE3_CTX *c)
+{
+    return c->blocks == 0 ? B3_CHUNK_START : 0;
+}
+
+void blake3_update(BLAKE3_CTX *c, const unsigned char *buf, size_t len)
+{
+    size_t i, n;
+    uint32_t cv[B3_MAX_LANES][8];
+
+    while(len > 0) {
+        /* A full block is only compressed once more input follows */
+        if(c->blen == B3_BLOCK_LEN) {
+            if(c->blocks == B3_CHUNK_LEN / B3_BLOCK_LEN - 1) {
+                b3_compress(c->cv, c->block, B3_BLOCK_LEN, c->chunk, b3_chunk_flags(c) | B3_CHUNK_END, cv[0]);
+                b3_push(c, cv[0]);
+                memcpy(c->cv, b3_iv, sizeof(b3_iv));
+                c->blocks = 0;
+            } else {
+                b3_compress(c->cv, c->block, B3_BLOCK_LEN, c->chunk, b3_chunk_flags(c), c->cv);
+                c->blocks++;
+            }
+            memset(c->block, 0, sizeof(c->block));
+            c->blen = 0;
+        }
+
+        /* Whole chunks with more input after them go to the kernel */
+        if(c->blocks == 0 && c->blen == 0 && len > B3_CHUNK_LEN) {
+            n = (len - 1) / B3_CHUNK_LEN;
+            if(n > B3_MAX_LANES) n = B3_MAX_LANES;
+            b3_chunks(buf, n, c->chunk, cv);
+            buf += n * B3_CHUNK_LEN;
+            len -= n * B3_CHUNK_LEN;
+            for(i = 0; i < n; i++) b3_push(c, cv[i]);
+            continue;
+        }
+
+        n = B3_BLOCK_LEN - c->blen;
+        if(n > len) n = len;
+        memcpy(c->block + c->blen, buf, n);
+        c->blen += n;
+        buf += n;
+        len -= n;
+    }
+    return;
+}
+
+void blake3_final(const BLAKE3_CTX *c, unsigned char digest[BLAKE3_LEN])
+{
+    int i, d;
+    uint32_t h[8];
+
+    if(c->depth == 0) {
+        b3_compress(c->cv, c->block, c->blen, c->chunk, b3_chunk_flags(c) | B3_CHUNK_END | B3_ROOT, h);
+    } else {
+        b3_compress(c->cv, c->block, c->blen, c->chunk, b3_chunk_flags(c) | B3_CHUNK_END, h);
+        for(d = c->depth - 1; d >= 0; d--)
+            b3_parent(c->stack[d], h, d == 0 ? B3_ROOT : 0, h);
+    }
+    for(i = 0; i < 8; i++) store32(digest + 4 * i, h[i]);
+    return;
+}
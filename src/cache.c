@@ -0,0 +1,423 @@
+/*
+# +-------------------------------------------------------------------+
+# | Program Name  :  cache.c                                          |
+# | Author        :  Bhaskar Bhaumik (web.bhaskar.bhaumik@gmail.com)  |
+# | Version       :  0.1                                              |
+# | Date Created  :  October 13, 2018                                 |
+# | Description   :  Persistent digest cache (option --cache), keyed  |
+# |                  by device, inode, size, mtime and ctime.         |
+# +-------------------------------------------------------------------+
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "filestat.h"
+
+/*
+    The cache file is an open addressing hash table that is used straight
+    from a read-only mapping:
+
+        header   struct dcheader, DCACHE_HDRLEN bytes
+        slots    nslots x struct dcentry, probed linearly from the hash
+                 of (dev, ino); gen == 0 marks an empty slot
+
+    There is at most one entry per (dev, ino); it is valid only while the
+    size, mtime and ctime still match. fields tells which digests it
+    holds: a run that asks for others hashes only those and stores the
+    union. gen is the run that last used an entry.
+
+    Writers serialize on an flock() of "<file>.lock" and update the file
+    in one of two ways. A run that added entries, or that has entries to
+    drop (--cache-compact drops those not used in the last N runs),
+    merges its entries into whatever is current at that point, writes
+    "<file>.tmp" and renames it over the cache. A run that only hit
+    entries sets their gen in the file in place instead, without a sync
+    (see dcache_touch()). Readers never lock: a rename leaves the mapping
+    they hold as it was, and an update in place only changes the gen of
+    entries that are in use, which is never 0 before or after, so no
+    lookup sees an entry come or go.
+*/
+#define DCACHE_MAGIC        "FSDCACHE"
+#define DCACHE_VERSION      2
+#define DCACHE_HDRLEN       64
+#define DCACHE_MIN_SLOTS    1024
+
+struct dcheader {
+    char magic[8];
+    uint32_t version;
+    uint32_t entsize;
+    uint64_t nslots;
+    uint64_t count;
+    uint32_t gen;
+};
+
+struct dcentry {
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t size;
+    int64_t mtime_ns;
+    int64_t ctime_ns;
+    uint32_t gen;
+    uint32_t crc;
+    unsigned char md5[MD5_LEN];
+    unsigned char sha256[SHA256_LEN];
+    unsigned char blake3[BLAKE3_LEN];
+    uint64_t xxh3;
+    uint32_t fields;            /* FLDM_* of the digests held */
+    uint32_t pad;
+};
+
+struct dcache {
+    char *path;
+    int keep_runs;              /* compaction: 0 keeps everything */
+    unsigned char *map;
+    size_t maplen;
+    dev_t dev;                  /* the file mapped */
+    ino_t ino;
+    struct dcheader *hdr;
+    struct dcentry *slot;
+    uint64_t nslots;
+    unsigned char *used;        /* bitmap of the mapped slots hit this run */
+    struct dcentry *added;      /* misses hashed this run */
+    size_t nadded;
+    size_t cadded;
+    pthread_mutex_t lock;
+    unsigned long hits;
+    unsigned long misses;
+};
+
+DCACHE *dcache = (DCACHE *)NULL;
+
+static uint64_t dcache_hash(uint64_t dev, uint64_t ino)
+{
+    uint64_t h = ino * 0x9E3779B97F4A7C15ULL ^ dev;
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    return h;
+}
+
+/*
+    Map a cache file; returns the mapping or NULL if missing or not a
+    cache. Its stat goes to sbp.
+*/
+static unsigned char *dcache_map(const char *path, size_t *maplen, struct stat *sbp)
+{
+    int fd;
+    struct stat sb;
+    unsigned char *map;
+    struct dcheader *h;
+
+    if((fd = open(path, O_RDONLY)) < 0) return (unsigned char *)NULL;
+    if(fstat(fd, &sb) != 0 || sb.st_size < DCACHE_HDRLEN) {
+        close(fd);
+        return (unsigned char *)NULL;
+    }
+    *sbp = sb;
+    map = (unsigned char *)mmap(NULL, (size_t)sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(map == (unsigned char *)MAP_FAILED) return (unsigned char *)NULL;
+
+    h = (struct dcheader *)map;
+    if(memcmp(h->magic, DCACHE_MAGIC, 8) != 0 || h->version != DCACHE_VERSION
+            || h->entsize != sizeof(struct dcentry) || h->nslots == 0 || (h->nslots & (h->nslots - 1)) != 0
+            || (uint64_t)sb.st_size != DCACHE_HDRLEN + h->nslots * sizeof(struct dcentry)) {
+        fprintf(stderr, "%s: %s: not a digest cache; it will be rewritten\n", progname, path);
+        munmap(map, (size_t)sb.st_size);
+        return (unsigned char *)NULL;
+    }
+    *maplen = (size_t)sb.st_size;
+    return map;
+}
+
+DCACHE *dcache_open(const char *path, int keep_runs)
+{
+    DCACHE *dc;
+    struct stat sb;
+
+    if((dc = (DCACHE *)calloc(1, sizeof(DCACHE))) == (DCACHE *)NULL) return (DCACHE *)NULL;
+    dc->path = strdup(path);
+    dc->keep_runs = keep_runs;
+    pthread_mutex_init(&dc->lock, NULL);
+    if((dc->map = dcache_map(path, &dc->maplen, &sb)) != (unsigned char *)NULL) {
+        dc->dev = sb.st_dev;
+        dc->ino = sb.st_ino;
+        dc->hdr = (struct dcheader *)dc->map;
+        dc->slot = (struct dcentry *)(dc->map + DCACHE_HDRLEN);
+        dc->nslots = dc->hdr->nslots;
+        madvise(dc->map, dc->maplen, MADV_RANDOM);
+        if((dc->used = (unsigned char *)calloc((dc->nslots + 7) / 8, 1)) == (unsigned char *)NULL) {
+            munmap(dc->map, dc->maplen);
+            dc->map = (unsigned char *)NULL;
+            dc->nslots = 0;
+        }
+    }
+    return dc;
+}
+
+void dcache_key(DCKEY *k, const struct stat *sb, const FTS *ts)
+{
+    k->dev = (uint64_t)sb->st_dev;
+    k->ino = (uint64_t)sb->st_ino;
+    k->size = (uint64_t)sb->st_size;
+    k->mtime_ns = (int64_t)ts->mts_sec * 1000000000LL + ts->mts_nsec;
+    k->ctime_ns = (int64_t)ts->cts_sec * 1000000000LL + ts->cts_nsec;
+    return;
+}
+
+/*
+    The digests of an entry still current for k, into dg. Returns their
+    FLDM_* mask, 0 if there is none; it is a hit if it covers want.
+*/
+uint32_t dcache_lookup(DCACHE *dc, const DCKEY *k, uint32_t want, FDIGEST *dg)
+{
+    uint64_t i, n;
+    struct dcentry *e;
+
+    for(i = dcache_hash(k->dev, k->ino) & (dc->nslots - 1), n = 0; n < dc->nslots; n++, i = (i + 1) & (dc->nslots - 1)) {
+        e = &dc->slot[i];
+        if(e->gen == 0) break;
+        if(e->dev != k->dev || e->ino != k->ino) continue;
+        if(e->size != k->size || e->mtime_ns != k->mtime_ns || e->ctime_ns != k->ctime_ns) break;
+        dg->crc = e->crc;
+        dg->length = e->size;
+        memcpy(dg->md5, e->md5, MD5_LEN);
+        memcpy(dg->sha256, e->sha256, SHA256_LEN);
+        memcpy(dg->blake3, e->blake3, BLAKE3_LEN);
+        dg->xxh3 = e->xxh3;
+        if((want & ~e->fields) == 0) {
+            __atomic_fetch_or(&dc->used[i / 8], (unsigned char)(1 << (i % 8)), __ATOMIC_RELAXED);
+            __atomic_add_fetch(&dc->hits, 1, __ATOMIC_RELAXED);
+        } else {
+            __atomic_add_fetch(&dc->misses, 1, __ATOMIC_RELAXED);
+        }
+        return e->fields;
+    }
+    __atomic_add_fetch(&dc->misses, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+/* Add the digests of fields (an FLDM_* mask) of a file that was hashed */
+void dcache_insert(DCACHE *dc, const DCKEY *k, uint32_t fields, const FDIGEST *dg)
+{
+    struct dcentry *e;
+
+    pthread_mutex_lock(&dc->lock);
+    if(dc->nadded == dc->cadded) {
+        size_t c = dc->cadded ? 2 * dc->cadded : 1024;
+        if((e = (struct dcentry *)realloc(dc->added, c * sizeof(struct dcentry))) == (struct dcentry *)NULL) {
+            pthread_mutex_unlock(&dc->lock);
+            return;
+        }
+        dc->added = e;
+        dc->cadded = c;
+    }
+    e = &dc->added[dc->nadded++];
+    memset(e, 0, sizeof(struct dcentry));
+    e->dev = k->dev;
+    e->ino = k->ino;
+    e->size = k->size;
+    e->mtime_ns = k->mtime_ns;
+    e->ctime_ns = k->ctime_ns;
+    e->crc = dg->crc;
+    memcpy(e->md5, dg->md5, MD5_LEN);
+    memcpy(e->sha256, dg->sha256, SHA256_LEN);
+    memcpy(e->blake3, dg->blake3, BLAKE3_LEN);
+    e->xxh3 = dg->xxh3;
+    e->fields = fields & FLDM_ENGINE;
+    pthread_mutex_unlock(&dc->lock);
+    return;
+}
+
+/* Insert into a table being built unless (dev, ino) is already there */
+static void dcache_put(struct dcentry *tab, uint64_t nslots, const struct dcentry *e, uint32_t gen, uint64_t *count)
+{
+    uint64_t i;
+
+    for(i = dcache_hash(e->dev, e->ino) & (nslots - 1); tab[i].gen != 0; i = (i + 1) & (nslots - 1))
+        if(tab[i].dev == e->dev && tab[i].ino == e->ino) return;
+    tab[i] = *e;
+    tab[i].gen = gen;
+    (*count)++;
+    return;
+}
+
+/*
+    Whether the run only needs to mark its hits in the file it mapped,
+    whose current stat is sb: nothing was added, the file was not replaced
+    since, and compaction drops nothing up to oldgen.
+*/
+static int dcache_in_place(DCACHE *dc, const struct stat *sb, uint32_t oldgen)
+{
+    uint64_t i;
+
+    if(dc->nadded > 0 || dc->map == (unsigned char *)NULL || sb->st_dev != dc->dev || sb->st_ino != dc->ino) return 0;
+    if(oldgen > 0) {
+        for(i = 0; i < dc->nslots; i++)
+            if(dc->slot[i].gen != 0 && dc->slot[i].gen <= oldgen && !(dc->used[i / 8] & (1 << (i % 8)))) return 0;
+    }
+    return 1;
+}
+
+/* Set the gen of the entries hit and of the header in the file; under the lock. Returns 0 or -1 */
+static int dcache_touch(DCACHE *dc, uint32_t gen)
+{
+    int fd;
+    uint64_t i;
+    unsigned char *map;
+    struct dcentry *slot;
+
+    if((fd = open(dc->path, O_RDWR)) < 0) {
+        perror(dc->path);
+        return -1;
+    }
+    map = (unsigned char *)mmap(NULL, dc->maplen, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(map == (unsigned char *)MAP_FAILED) {
+        perror(dc->path);
+        return -1;
+    }
+    slot = (struct dcentry *)(map + DCACHE_HDRLEN);
+    for(i = 0; i < dc->nslots; i++)
+        if(dc->used[i / 8] & (1 << (i % 8)))
+            slot[i].gen = gen;
+    ((struct dcheader *)map)->gen = gen;
+    munmap(map, dc->maplen);
+    return 0;
+}
+
+/*
+    Write the entries used or added in this run back to the cache file,
+    merged with the current contents of the file. Returns 0 or -1.
+*/
+static int dcache_flush(DCACHE *dc)
+{
+    int lfd, tfd, rc = -1;
+    char *lpath, *tpath;
+    size_t plen, curlen = 0, newlen;
+    unsigned char *cur = (unsigned char *)NULL, *out;
+    struct dcheader *ch = (struct dcheader *)NULL, *nh;
+    struct dcentry *ce = (struct dcentry *)NULL, *tab;
+    uint64_t i, want, nslots, count = 0, curslots = 0;
+    uint32_t gen, oldgen;
+    struct stat sb;
+
+    plen = strlen(dc->path);
+    lpath = (char *)malloc(plen + 6);
+    tpath = (char *)malloc(plen + 5);
+    sprintf(lpath, "%s.lock", dc->path);
+    sprintf(tpath, "%s.tmp", dc->path);
+
+    if((lfd = open(lpath, O_RDWR | O_CREAT, 0644)) < 0 || flock(lfd, LOCK_EX) != 0) {
+        perror(lpath);
+        goto out_lock;
+    }
+
+    /* Another run may have replaced the file since it was opened */
+    if((cur = dcache_map(dc->path, &curlen, &sb)) != (unsigned char *)NULL) {
+        ch = (struct dcheader *)cur;
+        ce = (struct dcentry *)(cur + DCACHE_HDRLEN);
+        curslots = ch->nslots;
+    }
+    gen = (ch ? ch->gen : 0);
+    if(dc->hdr && dc->hdr->gen > gen) gen = dc->hdr->gen;
+    gen++;
+    oldgen = (dc->keep_runs > 0 && gen > (uint32_t)dc->keep_runs) ? gen - (uint32_t)dc->keep_runs : 0;
+    if(cur != (unsigned char *)NULL && dcache_in_place(dc, &sb, oldgen)) {
+        rc = dcache_touch(dc, gen);
+        goto out_cur;
+    }
+
+    want = dc->nadded + (ch ? ch->count : 0) + (dc->hdr ? dc->hdr->count : 0);
+    for(nslots = DCACHE_MIN_SLOTS; nslots < 2 * want; nslots <<= 1)
+        ;
+    newlen = DCACHE_HDRLEN + nslots * sizeof(struct dcentry);
+
+    if((tfd = open(tpath, O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0) {
+        perror(tpath);
+        goto out_cur;
+    }
+    if(ftruncate(tfd, (off_t)newlen) != 0
+            || (out = (unsigned char *)mmap(NULL, newlen, PROT_READ | PROT_WRITE, MAP_SHARED, tfd, 0)) == (unsigned char *)MAP_FAILED) {
+        perror(tpath);
+        close(tfd);
+        unlink(tpath);
+        goto out_cur;
+    }
+    tab = (struct dcentry *)(out + DCACHE_HDRLEN);
+
+    /* Newest first: hashed this run, hit this run, then whatever else survives */
+    for(i = 0; i < dc->nadded; i++)
+        dcache_put(tab, nslots, &dc->added[i], gen, &count);
+    for(i = 0; i < dc->nslots; i++)
+        if(dc->used[i / 8] & (1 << (i % 8)))
+            dcache_put(tab, nslots, &dc->slot[i], gen, &count);
+    for(i = 0; i < curslots; i++)
+        if(ce[i].gen != 0 && ce[i].gen > oldgen)
+            dcache_put(tab, nslots, &ce[i], ce[i].gen, &count);
+
+    nh = (struct dcheader *)out;
+    memcpy(nh->magic, DCACHE_MAGIC, 8);
+    nh->version = DCACHE_VERSION;
+    nh->entsize = sizeof(struct dcentry);
+    nh->nslots = nslots;
+    nh->count = count;
+    nh->gen = gen;
+
+    if(msync(out, newlen, MS_SYNC) != 0 || fsync(tfd) != 0 || rename(tpath, dc->path) != 0) {
+        perror(dc->path);
+        unlink(tpath);
+    } else {
+        rc = 0;
+    }
+    munmap(out, newlen);
+    close(tfd);
+
+out_cur:
+    if(cur != (unsigned char *)NULL) munmap(cur, curlen);
+out_lock:
+    if(lfd >= 0) close(lfd);
+    free(lpath);
+    free(tpath);
+    return rc;
+}
+
+/* Write back (if anything changed or compaction was asked for) and free */
+int dcache_close(DCACHE *dc)
+{
+    int rc = 0;
+    uint64_t i;
+    int touched = 0;
+
+    if(dc == (DCACHE *)NULL) return 0;
+    for(i = 0; i < (dc->nslots + 7) / 8 && !touched; i++)
+        touched = (dc->used[i] != 0);
+    if(dc->nadded > 0 || dc->keep_runs > 0 || touched)
+        rc = dcache_flush(dc);
+
+    if(dc->map != (unsigned char *)NULL) munmap(dc->map, dc->maplen);
+    pthread_mutex_destroy(&dc->lock);
+    free(dc->used);
+    free(dc->added);
+    free(dc->path);
+    free(dc);
+    return rc;
+}
+
+void dcache_counts(DCACHE *dc, unsigned long *hits, unsigned long *misses)
+{
+    *hits = dc ? dc->hits : 0;
+    *misses = dc ? dc->misses : 0;
+    return;
+}
@@ -0,0 +1,394 @@
+/*
+# +-------------------------------------------------------------------+
+# | Program Name  :  collect.c                                        |
+# | Author        :  Bhaskar Bhaumik (web.bhaskar.bhaumik@gmail.com)  |
+# | Version       :  0.1                                              |
+# | Date Created  :  October 13, 2018                                 |
+# | Description   :  Record collection core of libfilestat: fills an  |
+# |                  FSREC for a file, alone or in batches, without   |
+# |                  printing anything.                               |
+# +-------------------------------------------------------------------+
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <grp.h>
+#include <limits.h>
+#include <pwd.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include <sys/param.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "filestat.h"
+
+/* Name in messages; the program sets its own */
+char *progname = "filestat";
+
+/*
+    Fill a record for filename with what the fields mask needs and nothing
+    more: the path is only canonicalized for FLD_PATH, owners are only
+    looked up for FLD_USER/FLD_GROUP and the contents are only read for
+    the digests. Returns 1 for a directory, 0 for anything else and -1 on
+    error (the record then needs no free_file_stat()).
+
+    Nothing is printed: r->err is the errno of a failure, which is either
+    the whole record (-1 returned) or the digests (r->dgstat is DG_ERR).
+    Safe to call from any number of threads.
+*/
+int collect_file_stat(FSREC *r, const char *filename, uint32_t fields)
+{
+    return collect_file_stat_at(r, (const FSDIR *)NULL, filename, DT_UNKNOWN, filename, fields);
+}
+
+/*
+    collect_file_stat() of name in the directory dir (NULL for a name
+    relative to the working directory); filename is the name shown for it
+    and dtype its DT_* type from the directory, or DT_UNKNOWN.
+
+    The canonical path of an entry that is not a symbolic link is just
+    dir->path/name: realpath() is only needed for the links and for the
+    arguments themselves. stat is only asked for what the fields need, and
+    is not called at all when the type from the directory is all they need.
+*/
+static int collect_at(FSREC *r, const FSDIR *dir, const char *name, int dtype, const char *filename, uint32_t fields,
+                      const struct stat *sb, DBATCH *b)
+{
+    int dirfd = (dir != (const FSDIR *)NULL) ? dir->fd : AT_FDCWD;
+    int netfs = (dir != (const FSDIR *)NULL) ? dir->netfs : 0;
+    const FSOPTS *opts = (b != (DBATCH *)NULL) ? b->opts : (const FSOPTS *)NULL;
+    int filter = filtering && opts == (const FSOPTS *)NULL;
+    uint32_t sfields = fields | (filter ? filter_fields : 0);
+    int byparent = (fields & FLDM(FLD_PATH)) && dir != (const FSDIR *)NULL && dir->path != (char *)NULL;
+    int islink = (dtype == DT_LNK);
+    int nofollow = (sum_mode && dir != (const FSDIR *)NULL) ? AT_SYMLINK_NOFOLLOW : 0;
+    int stated = 0;
+    uint64_t t0;
+
+    memset(r, 0, sizeof(FSREC));
+    r->name = filename;
+    r->fields = fields;
+    r->shared = (dir != (const FSDIR *)NULL) ? dir->shared : 0;
+    if(name == (const char *)NULL || filename == (const char *)NULL) {
+        r->err = EINVAL;
+        return -1;
+    }
+
+    if(byparent && dtype == DT_UNKNOWN) {
+        if(stat_at(dirfd, name, &r->sb, AT_SYMLINK_NOFOLLOW, sfields, netfs) != 0) {
+            r->err = errno;
+            return -1;
+        }
+        islink = S_ISLNK(r->sb.st_mode);
+        stated = !islink || nofollow;
+    }
+    if(fields & FLDM(FLD_PATH)) {
+        t0 = PROF_START();
+        if(byparent && !islink) r->path = path_join(dir->path, name);
+        else if((r->path = get_realpath_at(dirfd, name, filename)) == (char *)NULL) {
+            r->err = errno;
+            PROF_STOP(PH_REALPATH, t0);
+            return -1;
+        }
+        PROF_STOP(PH_REALPATH, t0);
+    }
+
+    /* Get the file stats; links are followed, but for the entries with --summarize (see summary.c) */
+    if(sb != (const struct stat *)NULL) {
+        r->sb = *sb;
+        stated = 1;
+    }
+    if(!stated && dtype != DT_UNKNOWN && !islink
+            && (sfields & ~(FLDM(FLD_NAME) | FLDM(FLD_PATH) | FLDM(FLD_TYPE))) == 0) {
+        r->sb.st_mode = DTTOIF(dtype);
+        stated = 1;
+    }
+    if(!stated && stat_at(dirfd, name, &r->sb, nofollow, sfields, netfs) != 0) {
+        r->err = errno;
+        free(r->path);
+        r->path = (char *)NULL;
+        return -1;
+    }
+
+#if defined(__linux__)
+    r->ts.ats_sec = r->sb.st_atim.tv_sec;
+    r->ts.ats_nsec = r->sb.st_atim.tv_nsec;
+    r->ts.mts_sec = r->sb.st_mtim.tv_sec;
+    r->ts.mts_nsec = r->sb.st_mtim.tv_nsec;
+    r->ts.cts_sec = r->sb.st_ctim.tv_sec;
+    r->ts.cts_nsec = r->sb.st_ctim.tv_nsec;
+#elif defined(__APPLE__) && defined(__MACH__)
+    r->ts.ats_sec = r->sb.st_atimespec.tv_sec;
+    r->ts.ats_nsec = r->sb.st_atimespec.tv_nsec;
+    r->ts.mts_sec = r->sb.st_mtimespec.tv_sec;
+    r->ts.mts_nsec = r->sb.st_mtimespec.tv_nsec;
+    r->ts.cts_sec = r->sb.st_ctimespec.tv_sec;
+    r->ts.cts_nsec = r->sb.st_ctimespec.tv_nsec;
+#endif
+
+    /* The filters come before the names and the contents; a directory keeps its path for its entries */
+    if(filter && !filter_stat(r)) {
+        r->filtered = 1;
+        return (int)S_ISDIR(r->sb.st_mode);
+    }
+
+    /* Get the file owner user and group names; unknown ids show as numbers */
+    if(fields & FLDM(FLD_USER)) r->user = uid_name(r->sb.st_uid);
+    if(fields & FLDM(FLD_GROUP)) r->group = gid_name(r->sb.st_gid);
+
+    r->dgstat = DG_NA;
+    if((fields & FLDM_DIGESTS) && S_ISREG(r->sb.st_mode)) {
+        DCKEY key;
+        int rc = 0;
+        dcache_key(&key, &r->sb, &r->ts);
+        /* A batch of filestat_batch() keeps nothing of the traversal, see inode.c */
+        if(opts == (const FSOPTS *)NULL && (since_digests(r, &r->dg) == 0 || inode_digests(r, &r->dg) == 0)) {
+            r->dgstat = DG_OK;
+        } else if((rc = dbatch_digests(b, r, dirfd, name, &key)) == 0) {
+            r->dgstat = DG_OK;
+            if(opts == (const FSOPTS *)NULL) inode_keep(r);
+        } else if(rc > 0) {
+            r->dgstat = DG_PENDING;
+        } else {
+            r->dgstat = DG_ERR;
+            r->err = errno;
+        }
+    }
+
+    return (int)S_ISDIR(r->sb.st_mode);
+}
+
+int collect_file_stat_at(FSREC *r, const FSDIR *dir, const char *name, int dtype, const char *filename, uint32_t fields)
+{
+    return collect_file_stat_batch(r, dir, name, dtype, filename, fields, (DBATCH *)NULL);
+}
+
+/*
+    collect_file_stat_at() that may leave the digests of a small file to
+    the batch b: r->dgstat is then DG_PENDING, and r must stay where it is
+    until dbatch_flush(b) has filled them in. b may be NULL.
+*/
+int collect_file_stat_batch(FSREC *r, const FSDIR *dir, const char *name, int dtype, const char *filename, uint32_t fields,
+                            DBATCH *b)
+{
+    int rc = collect_at(r, dir, name, dtype, filename, fields, (const struct stat *)NULL, b);
+
+    if(profiling) prof_commit((rc < 0) ? PT_ERROR : prof_type(r->sb.st_mode));
+    return rc;
+}
+
+/*
+    collect_file_stat_at() of an entry that was stat'ed already, links
+    followed, into sb (see uring.c); dtype must not be DT_UNKNOWN.
+*/
+int collect_file_stat_stated(FSREC *r, const FSDIR *dir, const char *name, int dtype, const char *filename, uint32_t fields,
+                             const struct stat *sb)
+{
+    int rc = collect_at(r, dir, name, dtype, filename, fields, sb, (DBATCH *)NULL);
+
+    if(profiling) prof_commit((rc < 0) ? PT_ERROR : prof_type(r->sb.st_mode));
+    return rc;
+}
+
+void free_file_stat(FSREC *r)
+{
+    /* user and group belong to the name caches */
+    free(r->path);
+    r->path = (char *)NULL;
+    return;
+}
+
+/* Print the failure of a collected record, if any, like perror(filename) */
+void collect_perror(const FSREC *r, const char *filename)
+{
+    if(r->err != 0) fprintf(stderr, "%s: %s\n", filename, strerror(r->err));
+    return;
+}
+
+struct batch {
+    const char * const *paths;
+    FSREC *recs;
+    size_t n;
+    size_t next;
+    size_t chunk;               /* paths taken at a time, at most MB_BATCH */
+    uint32_t fields;
+    const FSOPTS *opts;
+    int failed;
+};
+
+static const FSOPTS batch_defaults = { READ_MODE_READ, (DCACHE *)NULL };
+
+/* The small files of a chunk have their digests computed together */
+static void *batch_worker(void *arg)
+{
+    size_t i, j, end;
+    struct batch *b = (struct batch *)arg;
+    DBATCH db;
+
+    memset(&db, 0, sizeof(db));
+    db.opts = b->opts;
+    while((i = __atomic_fetch_add(&b->next, b->chunk, __ATOMIC_RELAXED)) < b->n) {
+        end = (b->n - i < b->chunk) ? b->n : i + b->chunk;
+        for(j = i; j < end; j++)
+            collect_file_stat_batch(&b->recs[j], (const FSDIR *)NULL, b->paths[j], DT_UNKNOWN, b->paths[j], b->fields, &db);
+        dbatch_flush(&db);
+        for(j = i; j < end; j++)
+            if(b->recs[j].err != 0) __atomic_add_fetch(&b->failed, 1, __ATOMIC_RELAXED);
+    }
+    dbatch_free(&db);
+    return (void *)NULL;
+}
+
+/*
+    Batch collection for programs that link libfilestat (see
+    libfilestat.h): recs[i] is filled for paths[i] with the fields mask,
+    by up to jobs threads, reading as opts tells (NULL for the defaults).
+    Nothing else of the process is used or kept from one call to the
+    next, so calls may run side by side. The names of the records point
+    to the paths. Returns the number of records with an error (see
+    collect_file_stat()); every record is to be released with
+    filestat_batch_free().
+*/
+int filestat_batch(const char * const *paths, size_t n, uint32_t fields, int jobs, const FSOPTS *opts, FSREC *recs)
+{
+    int i, started = 0;
+    struct batch b;
+    pthread_t tid[JOBS_MAX];
+
+    memset(&b, 0, sizeof(b));
+    b.paths = paths;
+    b.recs = recs;
+    b.n = n;
+    b.fields = fields & FLDM_STORED;
+    b.opts = (opts != (const FSOPTS *)NULL) ? opts : &batch_defaults;
+    if(jobs > JOBS_MAX) jobs = JOBS_MAX;
+    if((size_t)jobs > n) jobs = (int)n;
+    b.chunk = n / (4 * (size_t)(jobs > 0 ? jobs : 1));
+    if(b.chunk > MB_BATCH) b.chunk = MB_BATCH;
+    if(b.chunk == 0) b.chunk = 1;
+
+    /* The caller is one of the workers */
+    for(i = 1; i < jobs; i++)
+        if(pthread_create(&tid[started], NULL, batch_worker, &b) == 0) started++;
+    batch_worker(&b);
+    for(i = 0; i < started; i++) pthread_join(tid[i], NULL);
+    return b.failed;
+}
+
+void filestat_batch_free(FSREC *recs, size_t n)
+{
+    size_t i;
+    for(i = 0; i < n; i++) free_file_stat(&recs[i]);
+    return;
+}
+
+char *get_realpath(const char *filename)
+{
+    int path_max;
+    char *resolved_path;
+#ifdef PATH_MAX
+    path_max = PATH_MAX;
+#else
+    path_max = pathconf(filename, _PC_PATH_MAX);
+    if (path_max <= 0)
+        path_max = 4096;
+#endif
+    if((resolved_path = (char *)malloc(path_max * sizeof(char))) == (char *)NULL) return (char *)NULL;
+    PROF_COUNT(0, 1, 0);
+    if(!realpath(filename, resolved_path)) {
+        free(resolved_path);
+        return (char *)NULL;
+    }
+    return resolved_path;
+}
+
+/*
+    get_realpath() of name relative to the directory dirfd. On Linux the
+    file is opened with O_PATH and the kernel reports the path of the
+    descriptor, which works at any depth; elsewhere, or without /proc,
+    this is realpath() of filename. Returns NULL with errno set.
+*/
+char *get_realpath_at(int dirfd, const char *name, const char *filename)
+{
+#if defined(__linux__) && defined(O_PATH)
+    int fd;
+    ssize_t n;
+    size_t len = 256;
+    char proc[32], *buf = (char *)NULL;
+
+    if((fd = openat(dirfd, name, O_PATH | O_CLOEXEC)) < 0) return (char *)NULL;
+    sprintf(proc, "/proc/self/fd/%d", fd);
+    for(;;) {
+        if((buf = (char *)realloc(buf, len)) == (char *)NULL) {
+            perror(progname);
+            exit(1);
+        }
+        PROF_COUNT(1, 1, 0);
+        if((n = readlink(proc, buf, len)) < 0 || (size_t)n < len) break;
+        len *= 2;
+    }
+    close(fd);
+    PROF_COUNT(2, 0, 0);
+    if(n > 0 && buf[0] == DIR_PATH_CHAR) {
+        buf[n] = '\0';
+        return buf;
+    }
+    free(buf);
+#endif
+    return get_realpath(filename);
+}
+
+/* dir/name in a new string, without doubling the root's slash */
+char *path_join(const char *dir, const char *name)
+{
+    size_t dlen = strlen(dir), nlen = strlen(name);
+    char *path;
+
+    if(dlen > 0 && dir[dlen - 1] == DIR_PATH_CHAR) dlen--;
+    if((path = (char *)malloc(dlen + nlen + 2)) == (char *)NULL) {
+        perror(progname);
+        exit(1);
+    }
+    PROF_COUNT(0, 1, 0);
+    memcpy(path, dir, dlen);
+    path[dlen] = DIR_PATH_CHAR;
+    memcpy(path + dlen + 1, name, nlen + 1);
+    return path;
+}
+
+/* Thread safe getpwuid(); returns a malloc'ed name or NULL */
+char *get_username(uid_t uid)
+{
+    long len;
+    char *buf, *name = (char *)NULL;
+    struct passwd pw, *res = (struct passwd *)NULL;
+
+    if((len = sysconf(_SC_GETPW_R_SIZE_MAX)) <= 0) len = 16384;
+    if((buf = (char *)malloc(len)) == (char *)NULL) return (char *)NULL;
+    if(getpwuid_r(uid, &pw, buf, len, &res) == 0 && res != (struct passwd *)NULL)
+        name = strdup(pw.pw_name);
+    free(buf);
+    return name;
+}
+
+/* Thread safe getgrgid(); returns a malloc'ed name or NULL */
+char *get_groupname(gid_t gid)
+{
+    long len;
+    char *buf, *name = (char *)NULL;
+    struct group gr, *res = (struct group *)NULL;
+
+    if((len = sysconf(_SC_GETGR_R_SIZE_MAX)) <= 0) len = 16384;
+    if((buf = (char *)malloc(len)) == (char *)NULL) return (char *)NULL;
+    if(getgrgid_r(gid, &gr, buf, len, &res) == 0 && res != (struct group *)NULL)
+        name = strdup(gr.gr_name);
+    free(buf);
+    return name;
+}
+
@@ -0,0 +1,347 @@
+/*
+# +-------------------------------------------------------------------+
+# | Program Name  :  crc.c                                            |
+# | Author        :  Bhaskar Bhaumik (web.bhaskar.bhaumik@gmail.com)  |
+# | Version       :  0.1                                              |
+# | Date Created  :  October 13, 2018                                 |
+# | Description   :  POSIX cksum CRC engines: byte table, slicing-by- |
+# |                  16 and carry-less multiply folding, picked at    |
+# |                  run time.                                        |
+# +-------------------------------------------------------------------+
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CRC_X86             1
+#include <immintrin.h>
+#endif
+
+#include "filestat.h"
+
+static const uint_fast32_t crctab[256] = {
+    0x00000000,
+    0x04c11db7, 0x09823b6e, 0x0d4326d9, 0x130476dc, 0x17c56b6b,
+    0x1a864db2, 0x1e475005, 0x2608edb8, 0x22c9f00f, 0x2f8ad6d6,
+    0x2b4bcb61, 0x350c9b64, 0x31cd86d3, 0x3c8ea00a, 0x384fbdbd,
+    0x4c11db70, 0x48d0c6c7, 0x4593e01e, 0x4152fda9, 0x5f15adac,
+    0x5bd4b01b, 0x569796c2, 0x52568b75, 0x6a1936c8, 0x6ed82b7f,
+    0x639b0da6, 0x675a1011, 0x791d4014, 0x7ddc5da3, 0x709f7b7a,
+    0x745e66cd, 0x9823b6e0, 0x9ce2ab57, 0x91a18d8e, 0x95609039,
+    0x8b27c03c, 0x8fe6dd8b, 0x82a5fb52, 0x8664e6e5, 0xbe2b5b58,
+    0xbaea46ef, 0xb7a96036, 0xb3687d81, 0xad2f2d84, 0xa9ee3033,
+    0xa4ad16ea, 0xa06c0b5d, 0xd4326d90, 0xd0f37027, 0xddb056fe,
+    0xd9714b49, 0xc7361b4c, 0xc3f706fb, 0xceb42022, 0xca753d95,
+    0xf23a8028, 0xf6fb9d9f, 0xfbb8bb46, 0xff79a6f1, 0xe13ef6f4,
+    0xe5ffeb43, 0xe8bccd9a, 0xec7dd02d, 0x34867077, 0x30476dc0,
+    0x3d044b19, 0x39c556ae, 0x278206ab, 0x23431b1c, 0x2e003dc5,
+    0x2ac12072, 0x128e9dcf, 0x164f8078, 0x1b0ca6a1, 0x1fcdbb16,
+    0x018aeb13, 0x054bf6a4, 0x0808d07d, 0x0cc9cdca, 0x7897ab07,
+    0x7c56b6b0, 0x71159069, 0x75d48dde, 0x6b93dddb, 0x6f52c06c,
+    0x6211e6b5, 0x66d0fb02, 0x5e9f46bf, 0x5a5e5b08, 0x571d7dd1,
+    0x53dc6066, 0x4d9b3063, 0x495a2dd4, 0x44190b0d, 0x40d816ba,
+    0xaca5c697, 0xa864db20, 0xa527fdf9, 0xa1e6e04e, 0xbfa1b04b,
+    0xbb60adfc, 0xb6238b25, 0xb2e29692, 0x8aad2b2f, 0x8e6c3698,
+    0x832f1041, 0x87ee0df6, 0x99a95df3, 0x9d684044, 0x902b669d,
+    0x94ea7b2a, 0xe0b41de7, 0xe4750050, 0xe9362689, 0xedf73b3e,
+    0xf3b06b3b, 0xf771768c, 0xfa325055, 0xfef34de2, 0xc6bcf05f,
+    0xc27dede8, 0xcf3ecb31, 0xcbffd686, 0xd5b88683, 0xd1799b34,
+    0xdc3abded, 0xd8fba05a, 0x690ce0ee, 0x6dcdfd59, 0x608edb80,
+    0x644fc637, 0x7a089632, 0x7ec98b85, 0x738aad5c, 0x774bb0eb,
+    0x4f040d56, 0x4bc510e1, 0x46863638, 0x42472b8f, 0x5c007b8a,
+    0x58c1663d, 0x558240e4, 0x51435d53, 0x251d3b9e, 0x21dc2629,
+    0x2c9f00f0, 0x285e1d47, 0x36194d42, 0x32d850f5, 0x3f9b762c,
+    0x3b5a6b9b, 0x0315d626, 0x07d4cb91, 0x0a97ed48, 0x0e56f0ff,
+    0x1011a0fa, 0x14d0bd4d, 0x19939b94, 0x1d528623, 0xf12f560e,
+    0xf5ee4bb9, 0xf8ad6d60, 0xfc6c70d7, 0xe22b20d2, 0xe6ea3d65,
+    0xeba91bbc, 0xef68060b, 0xd727bbb6, 0xd3e6a601, 0xdea580d8,
+    0xda649d6f, 0xc423cd6a, 0xc0e2d0dd, 0xcda1f604, 0xc960ebb3,
+    0xbd3e8d7e, 0xb9ff90c9, 0xb4bcb610, 0xb07daba7, 0xae3afba2,
+    0xaafbe615, 0xa7b8c0cc, 0xa379dd7b, 0x9b3660c6, 0x9ff77d71,
+    0x92b45ba8, 0x9675461f, 0x8832161a, 0x8cf30bad, 0x81b02d74,
+    0x857130c3, 0x5d8a9099, 0x594b8d2e, 0x5408abf7, 0x50c9b640,
+    0x4e8ee645, 0x4a4ffbf2, 0x470cdd2b, 0x43cdc09c, 0x7b827d21,
+    0x7f436096, 0x7200464f, 0x76c15bf8, 0x68860bfd, 0x6c47164a,
+    0x61043093, 0x65c52d24, 0x119b4be9, 0x155a565e, 0x18197087,
+    0x1cd86d30, 0x029f3d35, 0x065e2082, 0x0b1d065b, 0x0fdc1bec,
+    0x3793a651, 0x3352bbe6, 0x3e119d3f, 0x3ad08088, 0x2497d08d,
+    0x2056cd3a, 0x2d15ebe3, 0x29d4f654, 0xc5a92679, 0xc1683bce,
+    0xcc2b1d17, 0xc8ea00a0, 0xd6ad50a5, 0xd26c4d12, 0xdf2f6bcb,
+    0xdbee767c, 0xe3a1cbc1, 0xe760d676, 0xea23f0af, 0xeee2ed18,
+    0xf0a5bd1d, 0xf464a0aa, 0xf9278673, 0xfde69bc4, 0x89b8fd09,
+    0x8d79e0be, 0x803ac667, 0x84fbdbd0, 0x9abc8bd5, 0x9e7d9662,
+    0x933eb0bb, 0x97ffad0c, 0xafb010b1, 0xab710d06, 0xa6322bdf,
+    0xa2f33668, 0xbcb4666d, 0xb8757bda, 0xb5365d03, 0xb1f740b4
+};
+
+#define CRC_POLY            0x04C11DB7
+#define CRC_PCLMUL_MIN      64          /* shorter buffers go to the tables */
+#define CRC_VPCLMUL_MIN     256
+
+typedef uint32_t (*crc_fn)(uint32_t crc, const unsigned char *buf, size_t len);
+
+static uint32_t crc_slice[16][256];     /* crc_slice[k][b]: byte b followed by k zero bytes */
+static uint32_t crc_k128, crc_k192;     /* fold constants, x^n mod P */
+static uint32_t crc_k512, crc_k576;
+static uint32_t crc_k2048, crc_k2112;
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+static crc_fn crc_engine;
+static const char *crc_engine_name;
+
+static inline uint32_t load_be32(const unsigned char *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+/* x^n mod P */
+static uint32_t crc_xpow(int n)
+{
+    uint32_t r = 1;
+    while(n--)
+        r = (r & 0x80000000) ? (r << 1) ^ CRC_POLY : (r << 1);
+    return r;
+}
+
+static uint32_t crc_bytewise(uint32_t crc, const unsigned char *p, size_t len)
+{
+    while(len--)
+        crc = (crc << 8) ^ (uint32_t)crctab[((crc >> 24) ^ *p++) & 0xFF];
+    return crc;
+}
+
+static uint32_t crc_slice16(uint32_t crc, const unsigned char *p, size_t len)
+{
+    uint32_t a, b, c, d;
+
+    while(len >= 16) {
+        a = crc ^ load_be32(p);
+        b = load_be32(p + 4);
+        c = load_be32(p + 8);
+        d = load_be32(p + 12);
+        crc = crc_slice[15][a >> 24] ^ crc_slice[14][(a >> 16) & 0xFF]
+            ^ crc_slice[13][(a >> 8) & 0xFF] ^ crc_slice[12][a & 0xFF]
+            ^ crc_slice[11][b >> 24] ^ crc_slice[10][(b >> 16) & 0xFF]
+            ^ crc_slice[9][(b >> 8) & 0xFF] ^ crc_slice[8][b & 0xFF]
+            ^ crc_slice[7][c >> 24] ^ crc_slice[6][(c >> 16) & 0xFF]
+            ^ crc_slice[5][(c >> 8) & 0xFF] ^ crc_slice[4][c & 0xFF]
+            ^ crc_slice[3][d >> 24] ^ crc_slice[2][(d >> 16) & 0xFF]
+            ^ crc_slice[1][(d >> 8) & 0xFF] ^ crc_slice[0][d & 0xFF];
+        p += 16;
+        len -= 16;
+    }
+    if(len >= 8) {
+        a = crc ^ load_be32(p);
+        b = load_be32(p + 4);
+        crc = crc_slice[7][a >> 24] ^ crc_slice[6][(a >> 16) & 0xFF]
+            ^ crc_slice[5][(a >> 8) & 0xFF] ^ crc_slice[4][a & 0xFF]
+            ^ crc_slice[3][b >> 24] ^ crc_slice[2][(b >> 16) & 0xFF]
+            ^ crc_slice[1][(b >> 8) & 0xFF] ^ crc_slice[0][b & 0xFF];
+        p += 8;
+        len -= 8;
+    }
+    return crc_bytewise(crc, p, len);
+}
+
+#ifdef CRC_X86
+/*
+    Carry-less multiply folding (Gopal et al., "Fast CRC Computation for
+    Generic Polynomials Using PCLMULQDQ"). cksum shifts the most significant
+    bit first, so each 16 byte block is byte reversed to put the first bit
+    of the stream at bit 127. An accumulator A stands for the data folded so
+    far modulo P; moving it n bits further is
+
+        A_hi * (x^(n+64) mod P)  ^  A_lo * (x^n mod P)
+
+    which stays below 96 bits. The last accumulator is turned back into 16
+    bytes and finished with the tables, which also handles the tail.
+*/
+#define CRC_TARGET_PCLMUL   __attribute__((target("pclmul,ssse3,sse4.1")))
+#define CRC_TARGET_VPCLMUL  __attribute__((target("pclmul,ssse3,sse4.1,avx2,avx512f,avx512bw,vpclmulqdq")))
+
+CRC_TARGET_PCLMUL
+static inline __m128i crc_fold128(__m128i a, __m128i k, __m128i data)
+{
+    return _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(a, k, 0x11),
+                                       _mm_clmulepi64_si128(a, k, 0x00)), data);
+}
+
+CRC_TARGET_PCLMUL
+static uint32_t crc_fold_finish(__m128i x0, __m128i x1, __m128i x2, __m128i x3,
+                                const unsigned char *p, size_t len)
+{
+    unsigned char tail[16];
+    const __m128i bswap = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    const __m128i k1 = _mm_set_epi64x(crc_k192, crc_k128);
+
+    x1 = crc_fold128(x0, k1, x1);
+    x2 = crc_fold128(x1, k1, x2);
+    x3 = crc_fold128(x2, k1, x3);
+    for(; len >= 16; p += 16, len -= 16)
+        x3 = crc_fold128(x3, k1, _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)p), bswap));
+
+    _mm_storeu_si128((__m128i *)tail, _mm_shuffle_epi8(x3, bswap));
+    return crc_slice16(crc_slice16(0, tail, 16), p, len);
+}
+
+CRC_TARGET_PCLMUL
+static uint32_t crc_pclmul(uint32_t crc, const unsigned char *p, size_t len)
+{
+    __m128i x0, x1, x2, x3;
+    const __m128i bswap = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    const __m128i k4 = _mm_set_epi64x(crc_k576, crc_k512);
+
+    if(len < CRC_PCLMUL_MIN) return crc_slice16(crc, p, len);
+
+    x0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)p), bswap);
+    x1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(p + 16)), bswap);
+    x2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(p + 32)), bswap);
+    x3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(p + 48)), bswap);
+    x0 = _mm_xor_si128(x0, _mm_set_epi32((int)crc, 0, 0, 0));
+    p += 64;
+    len -= 64;
+
+    for(; len >= 64; p += 64, len -= 64) {
+        x0 = crc_fold128(x0, k4, _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)p), bswap));
+        x1 = crc_fold128(x1, k4, _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(p + 16)), bswap));
+        x2 = crc_fold128(x2, k4, _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(p + 32)), bswap));
+        x3 = crc_fold128(x3, k4, _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(p + 48)), bswap));
+    }
+    return crc_fold_finish(x0, x1, x2, x3, p, len);
+}
+
+CRC_TARGET_VPCLMUL
+static inline __m512i crc_fold512(__m512i a, __m512i k, __m512i data)
+{
+    return _mm512_ternarylogic_epi64(_mm512_clmulepi64_epi128(a, k, 0x11),
+                                     _mm512_clmulepi64_epi128(a, k, 0x00), data, 0x96);
+}
+
+/* Same folding, four 128 bit lanes per register and four registers */
+CRC_TARGET_VPCLMUL
+static uint32_t crc_vpclmul(uint32_t crc, const unsigned char *p, size_t len)
+{
+    __m512i z0, z1, z2, z3, k16, k4;
+    const __m512i bswap = _mm512_broadcast_i32x4(
+            _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15));
+
+    if(len < CRC_VPCLMUL_MIN) return crc_pclmul(crc, p, len);
+
+    k16 = _mm512_broadcast_i32x4(_mm_set_epi64x(crc_k2112, crc_k2048));
+    k4 = _mm512_broadcast_i32x4(_mm_set_epi64x(crc_k576, crc_k512));
+
+    z0 = _mm512_shuffle_epi8(_mm512_loadu_si512((const void *)p), bswap);
+    z1 = _mm512_shuffle_epi8(_mm512_loadu_si512((const void *)(p + 64)), bswap);
+    z2 = _mm512_shuffle_epi8(_mm512_loadu_si512((const void *)(p + 128)), bswap);
+    z3 = _mm512_shuffle_epi8(_mm512_loadu_si512((const void *)(p + 192)), bswap);
+    z0 = _mm512_xor_si512(z0, _mm512_inserti32x4(_mm512_setzero_si512(), _mm_set_epi32((int)crc, 0, 0, 0), 0));
+    p += 256;
+    len -= 256;
+
+    for(; len >= 256; p += 256, len -= 256) {
+        z0 = crc_fold512(z0, k16, _mm512_shuffle_epi8(_mm512_loadu_si512((const void *)p), bswap));
+        z1 = crc_fold512(z1, k16, _mm512_shuffle_epi8(_mm512_loadu_si512((const void *)(p + 64)), bswap));
+        z2 = crc_fold512(z2, k16, _mm512_shuffle_epi8(_mm512_loadu_si512((const void *)(p + 128)), bswap));
+        z3 = crc_fold512(z3, k16, _mm512_shuffle_epi8(_mm512_loadu_si512((const void *)(p + 192)), bswap));
+    }
+    z1 = crc_fold512(z0, k4, z1);
+    z2 = crc_fold512(z1, k4, z2);
+    z3 = crc_fold512(z2, k4, z3);
+
+    /* Lane 0 holds the earliest bytes */
+    return crc_fold_finish(_mm512_extracti32x4_epi32(z3, 0), _mm512_extracti32x4_epi32(z3, 1),
+                           _mm512_extracti32x4_epi32(z3, 2), _mm512_extracti32x4_epi32(z3, 3), p, len);
+}
+#endif /* CRC_X86 */
+
+static int crc_supported(const char *name)
+{
+    if(strcmp(name, "table") == 0 || strcmp(name, "slice16") == 0) return 1;
+#ifdef CRC_X86
+    __builtin_cpu_init();
+    if(strcmp(name, "pclmul") == 0)
+        return __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1");
+    if(strcmp(name, "vpclmul") == 0)
+        return __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("vpclmulqdq")
+            && __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw");
+#endif
+    return 0;
+}
+
+static void crc_use(const char *name)
+{
+    crc_engine_name = name;
+    if(strcmp(name, "table") == 0) crc_engine = crc_bytewise;
+    else if(strcmp(name, "slice16") == 0) crc_engine = crc_slice16;
+#ifdef CRC_X86
+    else if(strcmp(name, "pclmul") == 0) crc_engine = crc_pclmul;
+    else if(strcmp(name, "vpclmul") == 0) crc_engine = crc_vpclmul;
+#endif
+    return;
+}
+
+static void crc_init(void)
+{
+    int b, k;
+
+    for(b = 0; b < 256; b++) crc_slice[0][b] = (uint32_t)crctab[b];
+    for(k = 1; k < 16; k++)
+        for(b = 0; b < 256; b++)
+            crc_slice[k][b] = (crc_slice[k-1][b] << 8) ^ crc_slice[0][crc_slice[k-1][b] >> 24];
+
+    crc_k128 = crc_xpow(128);
+    crc_k192 = crc_xpow(192);
+    crc_k512 = crc_xpow(512);
+    crc_k576 = crc_xpow(576);
+    crc_k2048 = crc_xpow(2048);
+    crc_k2112 = crc_xpow(2112);
+
+    if(crc_supported("vpclmul")) crc_use("vpclmul");
+    else if(crc_supported("pclmul")) crc_use("pclmul");
+    else crc_use("slice16");
+    return;
+}
+
+/*
+    Select a CRC engine by name: table, slice16, pclmul, vpclmul or auto.
+    Returns 0, or -1 if the engine is unknown or the CPU lacks it.
+*/
+int cksum_set_engine(const char *name)
+{
+    pthread_once(&crc_once, crc_init);
+    if(strcmp(name, "auto") == 0) {
+        crc_use(crc_supported("vpclmul") ? "vpclmul" : crc_supported("pclmul") ? "pclmul" : "slice16");
+        return 0;
+    }
+    if(!crc_supported(name)) return -1;
+    crc_use(name);
+    return 0;
+}
+
+const char *cksum_engine(void)
+{
+    pthread_once(&crc_once, crc_init);
+    return crc_engine_name;
+}
+
+/* Feed a buffer into a running (not yet finished) cksum CRC */
+uint_fast32_t cksum_update(uint_fast32_t crc, const unsigned char *buf, size_t len)
+{
+    pthread_once(&crc_once, crc_init);
+    return crc_engine((uint32_t)crc, buf, len);
+}
+
+/* Append the length trailer and complement, as POSIX cksum does */
+uint32_t cksum_finish(uint_fast32_t crc, uintmax_t length)
+{
+    unsigned char c;
+    uint32_t r = (uint32_t)crc;
+
+    for(; length; length >>= 8) {
+        c = (unsigned char)(length & 0xFF);
+        r = crc_bytewise(r, &c, 1);
+    }
+    return ~r;
+}
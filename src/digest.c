@@ -0,0 +1,794 @@
+/*
+# +-------------------------------------------------------------------+
+# | Program Name  :  digest.c                                         |
+# | Author        :  Bhaskar Bhaumik (web.bhaskar.bhaumik@gmail.com)  |
+# | Version       :  0.1                                              |
+# | Date Created  :  October 13, 2018                                 |
+# | Description   :  Single pass digest engine. Each file is read     |
+# |                  once and every buffer is fed to the contexts of  |
+# |                  the digests asked for (CRC, MD5, SHA256, BLAKE3, |
+# |                  XXH3) together.                                  |
+# +-------------------------------------------------------------------+
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <ctype.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <fcntl.h>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <openssl/md5.h>
+#include <openssl/sha.h>
+
+#include "filestat.h"
+
+#define DIGEST_CRC          0
+#define DIGEST_MD5          1
+#define DIGEST_SHA256       2
+#define DIGEST_BLAKE3       3
+#define DIGEST_XXH3         4
+#define DIGEST_COUNT        5
+
+/* Field and --profile phase of each kind */
+static const int digest_field[DIGEST_COUNT] = { FLD_CKSUM, FLD_MD5, FLD_SHA256, FLD_BLAKE3, FLD_XXH3 };
+static const int digest_phase[DIGEST_COUNT] = { PH_CKSUM, PH_MD5, PH_SHA256, PH_BLAKE3, PH_XXH3 };
+
+size_t digest_buflen = DIGEST_BUFLEN;
+int digest_mode = DIGEST_MODE_SERIAL;
+
+static __thread unsigned char *serial_buf;
+static __thread size_t serial_buflen;
+static pthread_key_t serial_key;        /* frees serial_buf when its thread exits */
+static pthread_once_t serial_once = PTHREAD_ONCE_INIT;
+
+struct dslot {
+    unsigned char *buf;
+    const unsigned char *data;          /* buf, or the mapping in mmap mode */
+    size_t len;
+};
+
+/*
+    Parallel mode: the caller reads into a ring of DIGEST_RING buffers and
+    one thread per digest consumes every buffer in order. A slot is reused
+    only after all the consumers are done with it, so the time to hash a
+    file is bounded by the slowest digest instead of the sum of them all.
+    Only the kinds in the kinds mask are computed, serial or parallel.
+*/
+struct dpipe {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct dslot slot[DIGEST_RING];
+    unsigned long produced;
+    unsigned long consumed[DIGEST_COUNT];
+    int eof;
+    unsigned int kinds;                 /* bit k for DIGEST_k */
+    uint_fast32_t crc;
+    MD5_CTX md5;
+    SHA256_CTX sha256;
+    BLAKE3_CTX blake3;
+    XXH3_CTX xxh3;
+};
+
+struct dworker {
+    struct dpipe *pipe;
+    int kind;
+    uint64_t ns;                        /* --profile */
+};
+
+static void digest_update(struct dpipe *dp, int kind, const unsigned char *buf, size_t len)
+{
+    switch(kind) {
+        case DIGEST_CRC:
+            dp->crc = cksum_update(dp->crc, buf, len);
+            break;
+        case DIGEST_MD5:
+            MD5_Update(&dp->md5, buf, len);
+            break;
+        case DIGEST_SHA256:
+            SHA256_Update(&dp->sha256, buf, len);
+            break;
+        case DIGEST_BLAKE3:
+            blake3_update(&dp->blake3, buf, len);
+            break;
+        case DIGEST_XXH3:
+            xxh3_update(&dp->xxh3, buf, len);
+            break;
+    }
+    return;
+}
+
+static void *digest_worker(void *arg)
+{
+    struct dworker *w = (struct dworker *)arg;
+    struct dpipe *dp = w->pipe;
+    struct dslot *s;
+    uint64_t t0;
+
+    for(;;) {
+        pthread_mutex_lock(&dp->lock);
+        while(dp->consumed[w->kind] == dp->produced && !dp->eof)
+            pthread_cond_wait(&dp->cond, &dp->lock);
+        if(dp->consumed[w->kind] == dp->produced) {
+            pthread_mutex_unlock(&dp->lock);
+            break;
+        }
+        s = &dp->slot[dp->consumed[w->kind] % DIGEST_RING];
+        pthread_mutex_unlock(&dp->lock);
+
+        t0 = PROF_START();
+        digest_update(dp, w->kind, s->data, s->len);
+        if(profiling) w->ns += prof_lap(t0);
+
+        pthread_mutex_lock(&dp->lock);
+        dp->consumed[w->kind]++;
+        pthread_cond_broadcast(&dp->cond);
+        pthread_mutex_unlock(&dp->lock);
+    }
+    return (void *)NULL;
+}
+
+static unsigned long digest_slowest(struct dpipe *dp)
+{
+    int k;
+    unsigned long m = dp->produced;
+    for(k = 0; k < DIGEST_COUNT; k++)
+        if((dp->kinds & (1U << k)) && dp->consumed[k] < m) m = dp->consumed[k];
+    return m;
+}
+
+static int digest_serial(FREADER *rd, struct dpipe *dp, uintmax_t *length)
+{
+    int k;
+    ssize_t n;
+    uint64_t t0;
+    const unsigned char *data;
+
+    for(;;) {
+        t0 = PROF_START();
+        n = freader_next(rd, dp->slot[0].buf, digest_buflen, &data);
+        PROF_STOP(PH_READ, t0);
+        if(n <= 0) break;
+        if(*length + n < *length) {
+            errno = EFBIG;
+            return -1;
+        }
+        *length += n;
+        for(k = 0; k < DIGEST_COUNT; k++) {
+            if((dp->kinds & (1U << k)) == 0) continue;
+            t0 = PROF_START();
+            digest_update(dp, k, data, n);
+            PROF_STOP(digest_phase[k], t0);
+        }
+    }
+    return (n < 0) ? -1 : 0;
+}
+
+static int digest_parallel(FREADER *rd, struct dpipe *dp, uintmax_t *length)
+{
+    int k, rc = 0;
+    ssize_t n;
+    uint64_t t0;
+    struct dslot *s;
+    pthread_t tid[DIGEST_COUNT];
+    struct dworker w[DIGEST_COUNT];
+
+    pthread_mutex_init(&dp->lock, NULL);
+    pthread_cond_init(&dp->cond, NULL);
+    for(k = 0; k < DIGEST_COUNT; k++) {
+        w[k].pipe = dp;
+        w[k].kind = k;
+        w[k].ns = 0;
+        if((dp->kinds & (1U << k)) == 0) continue;
+        if(pthread_create(&tid[k], NULL, digest_worker, &w[k]) != 0) {
+            /* Stop the workers started so far and hash every kind inline */
+            pthread_mutex_lock(&dp->lock);
+            dp->eof = 1;
+            pthread_cond_broadcast(&dp->cond);
+            pthread_mutex_unlock(&dp->lock);
+            while(k--)
+                if(dp->kinds & (1U << k)) pthread_join(tid[k], NULL);
+            pthread_mutex_destroy(&dp->lock);
+            pthread_cond_destroy(&dp->cond);
+            return digest_serial(rd, dp, length);
+        }
+    }
+
+    for(;;) {
+        pthread_mutex_lock(&dp->lock);
+        while(dp->produced - digest_slowest(dp) == DIGEST_RING)
+            pthread_cond_wait(&dp->cond, &dp->lock);
+        s = &dp->slot[dp->produced % DIGEST_RING];
+        pthread_mutex_unlock(&dp->lock);
+
+        t0 = PROF_START();
+        n = freader_next(rd, s->buf, digest_buflen, &s->data);
+        PROF_STOP(PH_READ, t0);
+        if(n > 0 && *length + n < *length) {
+            errno = EFBIG;
+            n = -1;
+        }
+        if(n < 0) rc = -1;
+
+        pthread_mutex_lock(&dp->lock);
+        if(n <= 0) {
+            dp->eof = 1;
+        } else {
+            *length += n;
+            s->len = n;
+            dp->produced++;
+        }
+        pthread_cond_broadcast(&dp->cond);
+        pthread_mutex_unlock(&dp->lock);
+        if(n <= 0) break;
+    }
+
+    for(k = 0; k < DIGEST_COUNT; k++) {
+        if((dp->kinds & (1U << k)) == 0) continue;
+        pthread_join(tid[k], NULL);
+        if(profiling) prof_add(digest_phase[k], w[k].ns);
+    }
+    pthread_mutex_destroy(&dp->lock);
+    pthread_cond_destroy(&dp->cond);
+    return rc;
+}
+
+/* Start the digests of fields; returns how many kinds that is */
+static int dpipe_init(struct dpipe *dp, uint32_t fields)
+{
+    int k, nkinds = 0;
+
+    memset(dp, 0, sizeof(struct dpipe));
+    for(k = 0; k < DIGEST_COUNT; k++) {
+        if(fields & FLDM(digest_field[k])) {
+            dp->kinds |= 1U << k;
+            nkinds++;
+        }
+    }
+    if(dp->kinds & (1U << DIGEST_MD5)) MD5_Init(&dp->md5);
+    if(dp->kinds & (1U << DIGEST_SHA256)) SHA256_Init(&dp->sha256);
+    if(dp->kinds & (1U << DIGEST_BLAKE3)) blake3_init(&dp->blake3);
+    if(dp->kinds & (1U << DIGEST_XXH3)) xxh3_init(&dp->xxh3);
+    return nkinds;
+}
+
+static void dpipe_final(struct dpipe *dp, uintmax_t length, FDIGEST *dg)
+{
+    dg->length = length;
+    if(dp->kinds & (1U << DIGEST_CRC)) dg->crc = cksum_finish(dp->crc, length);
+    if(dp->kinds & (1U << DIGEST_MD5)) MD5_Final(dg->md5, &dp->md5);
+    if(dp->kinds & (1U << DIGEST_SHA256)) SHA256_Final(dg->sha256, &dp->sha256);
+    if(dp->kinds & (1U << DIGEST_BLAKE3)) blake3_final(&dp->blake3, dg->blake3);
+    if(dp->kinds & (1U << DIGEST_XXH3)) dg->xxh3 = xxh3_final(&dp->xxh3);
+    return;
+}
+
+/*
+    The digests of fields over the contents of a file fed in order by a
+    reader of its own (see uring.c): digest_begin(), digest_feed() for
+    every buffer, then digest_end(), which frees the stream. Returns NULL
+    when out of memory.
+*/
+DSTREAM *digest_begin(uint32_t fields)
+{
+    struct dpipe *dp;
+
+    if((dp = (struct dpipe *)malloc(sizeof(struct dpipe))) == (struct dpipe *)NULL) return (DSTREAM *)NULL;
+    PROF_COUNT(0, 1, 0);
+    dpipe_init(dp, fields);
+    return dp;
+}
+
+void digest_feed(DSTREAM *dp, const unsigned char *buf, size_t len)
+{
+    int k;
+    uint64_t t0;
+
+    for(k = 0; k < DIGEST_COUNT; k++) {
+        if((dp->kinds & (1U << k)) == 0) continue;
+        t0 = PROF_START();
+        digest_update(dp, k, buf, len);
+        /* Not part of the collection of a record: a sample per buffer */
+        PROF_EVENT(digest_phase[k], PT_REG, t0, 0, 0);
+    }
+    return;
+}
+
+void digest_end(DSTREAM *dp, uintmax_t length, FDIGEST *dg)
+{
+    if(dg != (FDIGEST *)NULL) dpipe_final(dp, length, dg);
+    free(dp);
+    return;
+}
+
+static void serial_key_init(void)
+{
+    pthread_key_create(&serial_key, free);
+    return;
+}
+
+/* The read mode and the digest cache of opts, or of the program for NULL */
+static int opts_read_mode(const FSOPTS *opts)
+{
+    return (opts != (const FSOPTS *)NULL) ? opts->read_mode : read_mode;
+}
+
+static DCACHE *opts_dcache(const FSOPTS *opts)
+{
+    return (opts != (const FSOPTS *)NULL) ? opts->dcache : dcache;
+}
+
+/*
+    Read the file name, relative to the directory dirfd, once with mode
+    (a READ_MODE_*) and compute the digests of fields (an FLDM_* mask:
+    the POSIX cksum CRC, MD5, SHA256, BLAKE3 and XXH3) into dg; the
+    others are left alone. Returns 0 on success and -1 (with errno set)
+    on failure.
+*/
+static int digest_file_mode(int dirfd, const char *name, uint32_t fields, int mode, FDIGEST *dg)
+{
+    int i, rc, nslot, nkinds;
+    FREADER rd;
+    struct dpipe dp;
+    uintmax_t length = 0;
+    uint64_t t0;
+
+    t0 = PROF_START();
+    rc = freader_open(&rd, dirfd, name, mode);
+    PROF_STOP(PH_READ, t0);
+    if(rc != 0) return -1;
+
+    nkinds = dpipe_init(&dp, fields);
+
+    /* Threads only pay off once a file spans several buffers, for several digests */
+    nslot = 1;
+    if(digest_mode == DIGEST_MODE_PARALLEL && nkinds > 1 && (uintmax_t)rd.size > (uintmax_t)digest_buflen * 2)
+        nslot = DIGEST_RING;
+
+    /*
+        A mapped file is hashed in place. The serial buffer is kept for the
+        next file of the thread: a buffer this size is mmap()ed by malloc,
+        which would cost two system calls per file.
+    */
+    if(rd.mode != READ_MODE_MMAP && nslot == 1) {
+        if(serial_buf == (unsigned char *)NULL || serial_buflen != digest_buflen) {
+            free(serial_buf);
+            serial_buflen = digest_buflen;
+            serial_buf = freader_alloc(digest_buflen);
+            pthread_once(&serial_once, serial_key_init);
+            pthread_setspecific(serial_key, serial_buf);
+            PROF_COUNT(0, 1, 0);
+        }
+        if((dp.slot[0].buf = serial_buf) == (unsigned char *)NULL) {
+            freader_close(&rd);
+            errno = ENOMEM;
+            return -1;
+        }
+    }
+    for(i = 0; i < nslot && nslot > 1 && rd.mode != READ_MODE_MMAP; i++) {
+        if((dp.slot[i].buf = freader_alloc(digest_buflen)) == (unsigned char *)NULL) {
+            while(i--) free(dp.slot[i].buf);
+            freader_close(&rd);
+            errno = ENOMEM;
+            return -1;
+        }
+        PROF_COUNT(0, 1, 0);
+    }
+
+    rc = (nslot > 1) ? digest_parallel(&rd, &dp, &length) : digest_serial(&rd, &dp, &length);
+
+    for(i = 0; i < nslot && nslot > 1; i++) free(dp.slot[i].buf);
+    t0 = PROF_START();
+    freader_close(&rd);
+    PROF_STOP(PH_READ, t0);
+    if(rc != 0) return -1;
+
+    dpipe_final(&dp, length, dg);
+    return 0;
+}
+
+/* digest_file_mode() with --read-mode */
+int digest_file_at(int dirfd, const char *name, uint32_t fields, FDIGEST *dg)
+{
+    return digest_file_mode(dirfd, name, fields, read_mode, dg);
+}
+
+char *digest2hex(const unsigned char *digest, int len)
+{
+    char *sum;
+
+    if((sum = (char *)malloc((2 * len + 1) * sizeof(char))) == (char *)NULL) return (char *)NULL;
+    return digest2hex_r(digest, len, sum);
+}
+
+/* digest2hex() into a caller buffer of at least 2 * len + 1 chars */
+char *digest2hex_r(const unsigned char *digest, int len, char *sum)
+{
+    int i;
+    static const char hex[] = "0123456789abcdef";
+
+    for(i = 0; i < len; i++) {
+        sum[2*i] = hex[digest[i] >> 4];
+        sum[2*i+1] = hex[digest[i] & 0x0F];
+    }
+    sum[2*len] = '\0';
+    return sum;
+}
+
+/*
+    Digests of the regular file name in the directory dirfd that the
+    fields mask asks for. The engine digests come from the digest cache
+    when key (may be NULL) is still current there; the ones it does not
+    hold are computed in one pass and added to the cache. The tree hash
+    is a pass of its own (see tree.c). Returns 0, or -1 with errno set.
+    opts, when not NULL, are those of a filestat_batch(), which leaves
+    the tree store alone.
+*/
+static int get_digests_rest(int dirfd, const char *name, const DCKEY *key, uint32_t fields, uint32_t have,
+                            const FSOPTS *opts, FDIGEST *dg)
+{
+    uint32_t want = fields & FLDM_ENGINE;
+    DCACHE *dc = opts_dcache(opts);
+
+    if(want & ~have) {
+        if(digest_file_mode(dirfd, name, want & ~have, opts_read_mode(opts), dg) != 0) return -1;
+        /* A file that changed size while it was read is not cached */
+        if(dc != (DCACHE *)NULL && key != (const DCKEY *)NULL && dg->length == key->size)
+            dcache_insert(dc, key, have | want, dg);
+    }
+    if((fields & FLDM(FLD_TREE))
+            && tree_hash_at(dirfd, name, (opts == (const FSOPTS *)NULL) ? key : (const DCKEY *)NULL, dg) != 0)
+        return -1;
+    return 0;
+}
+
+static int get_digests_opts(int dirfd, const char *name, const DCKEY *key, uint32_t fields, const FSOPTS *opts,
+                            FDIGEST *dg)
+{
+    uint32_t want = fields & FLDM_ENGINE, have = 0;
+    DCACHE *dc = opts_dcache(opts);
+
+    if(want && dc != (DCACHE *)NULL && key != (const DCKEY *)NULL)
+        have = dcache_lookup(dc, key, want, dg);
+    return get_digests_rest(dirfd, name, key, fields, have, opts, dg);
+}
+
+int get_digests(int dirfd, const char *name, const DCKEY *key, uint32_t fields, FDIGEST *dg)
+{
+    return get_digests_opts(dirfd, name, key, fields, (const FSOPTS *)NULL, dg);
+}
+
+/*
+    get_digests() for the record r of a regular file, put off when the
+    file is small and needs MD5 or SHA256: its contents are read into the
+    batch b now, while name is valid relative to dirfd, and hashed with
+    the rest of the batch by dbatch_flush(), one file per vector lane
+    (see mbhash.c). Returns 0 with the digests in r->dg, 1 if they are
+    pending until dbatch_flush(), or -1 on error. b may be NULL.
+*/
+int dbatch_digests(DBATCH *b, FSREC *r, int dirfd, const char *name, const DCKEY *key)
+{
+    uint32_t fields = r->fields, want = fields & FLDM_ENGINE, have = 0;
+    const FSOPTS *opts = (b != (DBATCH *)NULL) ? b->opts : (const FSOPTS *)NULL;
+    int mode = opts_read_mode(opts);
+    DCACHE *dc = opts_dcache(opts);
+    struct dbitem *it;
+    ssize_t n;
+    uint64_t t0;
+    int i;
+
+    if(b == (DBATCH *)NULL || b->n == MB_BATCH || (want & (FLDM(FLD_MD5) | FLDM(FLD_SHA256))) == 0
+            || r->sb.st_size > MB_SMALL || (mode != READ_MODE_READ && mode != READ_MODE_AUTO && mode != READ_MODE_URING))
+        return get_digests_opts(dirfd, name, key, fields, opts, &r->dg);
+
+    /* Another link of a file of the batch takes its digests at the flush */
+    if(r->sb.st_nlink > 1) {
+        for(i = 0; i < b->n; i++) {
+            if(b->item[i].link >= 0 || b->item[i].r->fields != fields || memcmp(&b->item[i].key, key, sizeof(DCKEY)) != 0)
+                continue;
+            it = &b->item[b->n];
+            *it = b->item[i];
+            it->r = r;
+            it->link = i;
+            b->n++;
+            return 1;
+        }
+    }
+
+    if(dc != (DCACHE *)NULL) have = dcache_lookup(dc, key, want, &r->dg);
+    if((want & ~have & (FLDM(FLD_MD5) | FLDM(FLD_SHA256))) == 0)
+        return get_digests_rest(dirfd, name, key, fields, have, opts, &r->dg);
+    if(b->buf == (unsigned char *)NULL) {
+        if((b->buf = (unsigned char *)malloc(MB_BATCH * MB_SMALL + 1)) == (unsigned char *)NULL)
+            return get_digests_rest(dirfd, name, key, fields, have, opts, &r->dg);
+        PROF_COUNT(0, 1, 0);
+    }
+
+    /* A file that grew past MB_SMALL since its stat is hashed on its own */
+    t0 = PROF_START();
+    n = freader_slurp(dirfd, name, b->buf + b->used, MB_SMALL + 1);
+    PROF_STOP(PH_READ, t0);
+    if(n < 0) return (errno == EFBIG) ? get_digests_rest(dirfd, name, key, fields, have, opts, &r->dg) : -1;
+    if((fields & FLDM(FLD_TREE))
+            && tree_hash_at(dirfd, name, (opts == (const FSOPTS *)NULL) ? key : (const DCKEY *)NULL, &r->dg) != 0)
+        return -1;
+
+    it = &b->item[b->n++];
+    it->r = r;
+    it->key = *key;
+    it->have = have;
+    it->want = want & ~have;
+    it->off = b->used;
+    it->len = (size_t)n;
+    it->link = -1;
+    b->used += n;
+    return 1;
+}
+
+/* Compute the digests of every file of the batch, which is then empty */
+void dbatch_flush(DBATCH *b)
+{
+    int i, k, nmd5 = 0, nsha = 0;
+    uint32_t any = 0;
+    struct dbitem *it;
+    FDIGEST *dg;
+    DCACHE *dc = opts_dcache(b->opts);
+    const unsigned char *data[2][MB_BATCH];
+    size_t len[2][MB_BATCH];
+    unsigned char *out[2][MB_BATCH];
+    BLAKE3_CTX b3;
+    XXH3_CTX xx;
+    uint64_t t0;
+
+    if(b->n == 0) return;
+    for(i = 0; i < b->n; i++) {
+        it = &b->item[i];
+        if(it->link >= 0) continue;
+        dg = &it->r->dg;
+        dg->length = it->len;
+        any |= it->want;
+        if(it->want & FLDM(FLD_MD5)) {
+            data[0][nmd5] = b->buf + it->off;
+            len[0][nmd5] = it->len;
+            out[0][nmd5++] = dg->md5;
+        }
+        if(it->want & FLDM(FLD_SHA256)) {
+            data[1][nsha] = b->buf + it->off;
+            len[1][nsha] = it->len;
+            out[1][nsha++] = dg->sha256;
+        }
+    }
+    if(nmd5 > 0) {
+        t0 = PROF_START();
+        mb_md5(data[0], len[0], nmd5, out[0]);
+        PROF_EVENT(PH_MD5, PT_REG, t0, 0, 0);
+    }
+    if(nsha > 0) {
+        t0 = PROF_START();
+        mb_sha256(data[1], len[1], nsha, out[1]);
+        PROF_EVENT(PH_SHA256, PT_REG, t0, 0, 0);
+    }
+
+    /* The other digests of a small file are a single update each */
+    for(k = 0; k < DIGEST_COUNT; k++) {
+        if(k == DIGEST_MD5 || k == DIGEST_SHA256 || (any & FLDM(digest_field[k])) == 0) continue;
+        t0 = PROF_START();
+        for(i = 0; i < b->n; i++) {
+            it = &b->item[i];
+            dg = &it->r->dg;
+            if(it->link >= 0 || (it->want & FLDM(digest_field[k])) == 0) continue;
+            switch(k) {
+                case DIGEST_CRC:
+                    dg->crc = cksum_finish(cksum_update(0, b->buf + it->off, it->len), it->len);
+                    break;
+                case DIGEST_BLAKE3:
+                    blake3_init(&b3);
+                    blake3_update(&b3, b->buf + it->off, it->len);
+                    blake3_final(&b3, dg->blake3);
+                    break;
+                case DIGEST_XXH3:
+                    xxh3_init(&xx);
+                    xxh3_update(&xx, b->buf + it->off, it->len);
+                    dg->xxh3 = xxh3_final(&xx);
+                    break;
+            }
+        }
+        PROF_EVENT(digest_phase[k], PT_REG, t0, 0, 0);
+    }
+
+    for(i = 0; i < b->n; i++) {
+        it = &b->item[i];
+        it->r->dgstat = DG_OK;
+        if(it->link >= 0) {
+            it->r->dg = b->item[it->link].r->dg;
+            if(b->opts == (const FSOPTS *)NULL) inode_reused();
+            continue;
+        }
+        if(dc != (DCACHE *)NULL && it->len == it->key.size)
+            dcache_insert(dc, &it->key, it->have | it->want, &it->r->dg);
+        if(b->opts == (const FSOPTS *)NULL) inode_keep(it->r);
+    }
+    b->n = 0;
+    b->used = 0;
+    return;
+}
+
+void dbatch_free(DBATCH *b)
+{
+    free(b->buf);
+    b->buf = (unsigned char *)NULL;
+    b->n = 0;
+    b->used = 0;
+    return;
+}
+
+/*
+    The original one digest at a time helpers, on stdio streams; the
+    digest engine above has replaced them in the walk.
+*/
+char *compute_cksum(const char *filename)
+{
+    FILE *fp;
+    char *sum;
+    if((fp = fopen(filename, "r")) == (FILE *)NULL) {
+        perror(filename);
+        return (char *)"-";
+    }
+    sum = (char *)calloc(12, sizeof(char));
+    if(cksum(fp, sum) != 0) {
+        fprintf(stderr, "%s: can't compute the checksum for the input file '%s'\n", progname, filename);
+        return (char *)"-";
+    }
+    if(fp != (FILE *)NULL) {
+        fclose(fp);
+    }
+
+    return sum;
+}
+
+char *compute_md5sum(const char *filename)
+{
+    int i;
+    FILE *fp;
+    char *sum;
+    unsigned char *digest;
+    if((fp = fopen(filename, "r")) == (FILE *)NULL) {
+        perror(filename);
+        return (char *)"-";
+    }
+    digest = (unsigned char *)calloc(17, sizeof(unsigned char));
+    if(mdfile(fp, digest) != 0) {
+        fprintf(stderr, "%s: can't compute the md5 message digest for the input file '%s'\n", progname, filename);
+        return (char *)"-";
+    }
+    if(fp != (FILE *)NULL) {
+        fclose(fp);
+    }
+
+    sum = (char *)malloc(33 * sizeof(char));
+    for (i = 0; i < 16; ++i) {
+        sprintf(&(sum[2*i]), "%02x", digest[i]);
+    }
+    sum[32] = '\0';
+    free(digest);
+
+    return sum;
+}
+
+int mdfile(FILE *fp, unsigned char *digest)
+{
+    unsigned char buf[1024];
+    MD5_CTX ctx;
+    int n;
+
+    MD5_Init(&ctx);
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+        MD5_Update(&ctx, buf, n);
+    MD5_Final(digest, &ctx);
+    if (ferror(fp))
+        return -1;
+    return 0;
+}
+
+/* Calculate and print the checksum and length in bytes
+   of file FILE, or of the standard input if FILE is "-".
+   If PRINT_NAME is true, print FILE next to the checksum and size.
+   Return true if successful.  */
+
+int cksum(FILE *fp, char *cs)
+{
+    unsigned char buf[BUFLEN];
+    uint_fast32_t crc = 0;
+    uintmax_t length = 0;
+    size_t bytes_read;
+
+    while ((bytes_read = fread(buf, 1, BUFLEN, fp)) > 0) {
+        if (length + bytes_read < length) {
+            perror("file too long");
+            return 1;
+        }
+        length += bytes_read;
+        crc = cksum_update(crc, buf, bytes_read);
+        if (feof(fp))
+            break;
+    }
+
+    if (ferror(fp)) {
+        perror("error");
+        return 1;
+    }
+
+    sprintf(cs, "%u", (unsigned int) cksum_finish(crc, length));
+
+    return 0;
+}
+
+char *compute_sha256sum(const char *filename)
+{
+    int i;
+    FILE *fp;
+    char *sum;
+    unsigned char *digest;
+    if((fp = fopen(filename, "r")) == (FILE *)NULL) {
+        perror(filename);
+        return (char *)"-";
+    }
+    digest = (unsigned char *)calloc(33, sizeof(unsigned char));
+    if(sha256file(fp, digest) != 0) {
+        fprintf(stderr, "%s: can't compute the SHA256 message digest for the input file '%s'\n", progname, filename);
+        return (char *)"-";
+    }
+    if(fp != (FILE *)NULL) {
+        fclose(fp);
+    }
+
+    sum = (char *)malloc(65 * sizeof(char));
+    for (i = 0; i < 32; ++i) {
+        sprintf(&(sum[2*i]), "%02x", digest[i]);
+    }
+    sum[64] = '\0';
+    free(digest);
+    return sum;
+}
+
+int sha256file(FILE *fp, unsigned char *digest)
+{
+    unsigned char buf[1024];
+    SHA256_CTX ctx;
+    int n;
+
+    SHA256_Init(&ctx);
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+        SHA256_Update(&ctx, buf, n);
+    SHA256_Final(digest, &ctx);
+    if (ferror(fp))
+        return -1;
+    return 0;
+}
+
+/*
+    Parse a size like 65536, 64k or 1M.
+    Returns 0 if the string is not a valid size.
+*/
+size_t parse_size(const char *s)
+{
+    char *end;
+    unsigned long long v;
+
+    errno = 0;
+    v = strtoull(s, &end, 10);
+    if(errno != 0 || end == s) return 0;
+    switch(toupper((unsigned char)*end)) {
+        case 'G': v <<= 10; /* fall through */
+        case 'M': v <<= 10; /* fall through */
+        case 'K': v <<= 10; end++; break;
+        case '\0': break;
+        default: return 0;
+    }
+    if(*end != '\0' && !(toupper((unsigned char)*end) == 'B' && end[1] == '\0')) return 0;
+    return (size_t)v;
+}
@@ -0,0 +1,218 @@
+/*
+# +-------------------------------------------------------------------+
+# | Program Name  :  dirread.c                                        |
+# | Author        :  Bhaskar Bhaumik (web.bhaskar.bhaumik@gmail.com)  |
+# | Version       :  0.1                                              |
+# | Date Created  :  October 13, 2018                                 |
+# | Description   :  Directory reading in getdents64 batches, and     |
+# |                  stat with only the attributes the fields need.   |
+# +-------------------------------------------------------------------+
+*/
+#define _GNU_SOURCE                     /* statx() */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <stdint.h>
+#include <limits.h>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/sysmacros.h>
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
+
+#include "filestat.h"
+
+#if defined(__linux__) && defined(SYS_getdents64)
+#define HAVE_GETDENTS64
+#endif
+
+#ifdef HAVE_GETDENTS64
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+#endif
+
+/*
+    Open the directory name relative to dirfd (or AT_FDCWD) for reading.
+    Returns 0, or -1 with errno set.
+*/
+int dreader_open(DREADER *d, int dirfd, const char *name)
+{
+    memset(d, 0, sizeof(DREADER));
+    if((d->fd = openat(dirfd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0) return -1;
+#ifndef HAVE_GETDENTS64
+    if((d->dp = (void *)fdopendir(d->fd)) == NULL) {
+        close(d->fd);
+        d->fd = -1;
+        return -1;
+    }
+#endif
+    return 0;
+}
+
+/*
+    Next entry but "." and "..": its name, valid until the next call, and
+    its DT_* type (DT_UNKNOWN if the file system does not tell). Most
+    directories fit in the first, small batch; a directory that does not
+    is read on in DIR_BUFLEN batches, so a directory with millions of
+    entries costs a few hundred getdents64() calls.
+    Returns 1, 0 at the end, or -1 on error.
+*/
+int dreader_next(DREADER *d, const char **name, int *dtype)
+{
+#ifdef HAVE_GETDENTS64
+    long n;
+    uint64_t t0;
+    struct linux_dirent64 *e;
+
+    for(;;) {
+        while(d->pos < d->len) {
+            e = (struct linux_dirent64 *)(d->buf + d->pos);
+            d->pos += e->d_reclen;
+            if(e->d_name[0] == '.' && (e->d_name[1] == '\0' || (e->d_name[1] == '.' && e->d_name[2] == '\0')))
+                continue;
+            *name = e->d_name;
+            *dtype = e->d_type;
+            return 1;
+        }
+        if(d->buf == (char *)NULL || (d->cap < DIR_BUFLEN && d->len + sizeof(struct linux_dirent64) + NAME_MAX >= d->cap)) {
+            /* The first batch came back full: this directory is large */
+            d->cap = (d->buf == (char *)NULL) ? DIR_BUFLEN_MIN : DIR_BUFLEN;
+            free(d->buf);
+            if((d->buf = (char *)malloc(d->cap)) == (char *)NULL) return -1;
+        }
+        do {
+            t0 = PROF_START();
+            n = syscall(SYS_getdents64, d->fd, d->buf, d->cap);
+            PROF_EVENT(PH_READDIR, PT_DIR, t0, 1, (n > 0) ? (uint64_t)n : 0);
+        } while(n < 0 && errno == EINTR);
+        if(n <= 0) {
+            d->len = d->pos = 0;
+            return (n < 0) ? -1 : 0;
+        }
+        d->len = (size_t)n;
+        d->pos = 0;
+    }
+#else
+    struct dirent *e;
+
+    for(;;) {
+        errno = 0;
+        if((e = readdir((DIR *)d->dp)) == (struct dirent *)NULL) return (errno != 0) ? -1 : 0;
+        if(strcmp(e->d_name, ".") == 0 || strcmp(e->d_name, "..") == 0) continue;
+        *name = e->d_name;
+#ifdef _DIRENT_HAVE_D_TYPE
+        *dtype = e->d_type;
+#else
+        *dtype = DT_UNKNOWN;
+#endif
+        return 1;
+    }
+#endif
+}
+
+void dreader_close(DREADER *d)
+{
+    if(d->dp != NULL) closedir((DIR *)d->dp);
+    else if(d->fd >= 0) close(d->fd);
+    free(d->buf);
+    d->buf = (char *)NULL;
+    d->dp = NULL;
+    d->fd = -1;
+    return;
+}
+
+#ifdef STATX_BASIC_STATS
+/* The statx() attributes the selected fields and the walk depend on */
+unsigned int statx_mask(uint32_t fields)
+{
+    unsigned int m = STATX_TYPE;
+
+    if(fields & FLDM(FLD_SIZE)) m |= STATX_SIZE;
+    if(fields & (FLDM(FLD_USER) | FLDM(FLD_UID))) m |= STATX_UID;
+    if(fields & (FLDM(FLD_GROUP) | FLDM(FLD_GID))) m |= STATX_GID;
+    if(fields & (FLDM(FLD_PERM) | FLDM(FLD_OCTAL) | FLDM(FLD_STICKY))) m |= STATX_MODE;
+    if(fields & FLDM(FLD_ATIME)) m |= STATX_ATIME;
+    if(fields & FLDM(FLD_MTIME)) m |= STATX_MTIME;
+    if(fields & FLDM(FLD_CTIME)) m |= STATX_CTIME;
+    if(fields & FLDM(FLD_INODE)) m |= STATX_INO;
+    if(fields & FLDM(FLD_LINKS)) m |= STATX_NLINK;
+    if(fields & FLDM(FLD_BLOCKS)) m |= STATX_BLOCKS;
+    /* The digest cache key, and the links that share digests (see inode.c) */
+    if(fields & FLDM_DIGESTS) m |= STATX_SIZE | STATX_INO | STATX_MTIME | STATX_CTIME | STATX_NLINK;
+    return m;
+}
+
+void statx_to_stat(const struct statx *sx, struct stat *sb)
+{
+    memset(sb, 0, sizeof(struct stat));
+    sb->st_dev = makedev(sx->stx_dev_major, sx->stx_dev_minor);
+    sb->st_ino = sx->stx_ino;
+    sb->st_mode = sx->stx_mode;
+    sb->st_nlink = sx->stx_nlink;
+    sb->st_uid = sx->stx_uid;
+    sb->st_gid = sx->stx_gid;
+    sb->st_rdev = makedev(sx->stx_rdev_major, sx->stx_rdev_minor);
+    sb->st_size = sx->stx_size;
+    sb->st_blksize = sx->stx_blksize;
+    sb->st_blocks = sx->stx_blocks;
+    sb->st_atim.tv_sec = sx->stx_atime.tv_sec;
+    sb->st_atim.tv_nsec = sx->stx_atime.tv_nsec;
+    sb->st_mtim.tv_sec = sx->stx_mtime.tv_sec;
+    sb->st_mtim.tv_nsec = sx->stx_mtime.tv_nsec;
+    sb->st_ctim.tv_sec = sx->stx_ctime.tv_sec;
+    sb->st_ctim.tv_nsec = sx->stx_ctime.tv_nsec;
+    return;
+}
+
+static int no_statx;
+#endif
+
+/*
+    fstatat() that only asks for what the fields mask needs. On a network
+    file system (netfs) the attributes are taken from the client cache
+    rather than fetched from the server again. Attributes that were not
+    asked for may be left zero.
+*/
+static int stat_fields(int dirfd, const char *name, struct stat *sb, int flags, uint32_t fields, int netfs)
+{
+#ifdef STATX_BASIC_STATS
+    struct statx sx;
+
+    if(!__atomic_load_n(&no_statx, __ATOMIC_RELAXED)) {
+        PROF_COUNT(1, 0, 0);
+        if(statx(dirfd, name, flags | (netfs ? AT_STATX_DONT_SYNC : 0), statx_mask(fields), &sx) == 0) {
+            statx_to_stat(&sx, sb);
+            return 0;
+        }
+        if(errno != ENOSYS) return -1;
+        __atomic_store_n(&no_statx, 1, __ATOMIC_RELAXED);
+    }
+#else
+    (void)fields;
+    (void)netfs;
+#endif
+    PROF_COUNT(1, 0, 0);
+    return fstatat(dirfd, name, sb, flags);
+}
+
+int stat_at(int dirfd, const char *name, struct stat *sb, int flags, uint32_t fields, int netfs)
+{
+    int rc;
+    uint64_t t0 = PROF_START();
+
+    rc = stat_fields(dirfd, name, sb, flags, fields, netfs);
+    PROF_STOP(PH_STAT, t0);
+    return rc;
+}
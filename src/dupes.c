@@ -0,0 +1,300 @@
+/*
+# +-------------------------------------------------------------------+
+# | Program Name  :  dupes.c                                          |
+# | Author        :  Bhaskar Bhaumik (web.bhaskar.bhaumik@gmail.com)  |
+# | Version       :  0.1                                              |
+# | Date Created  :  October 13, 2018                                 |
+# | Description   :  Duplicate file finder (--duplicates): files are  |
+# |                  told apart by size, then by a hash of both ends, |
+# |                  and only the rest are hashed in full.            |
+# +-------------------------------------------------------------------+
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdint.h>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "filestat.h"
+
+/*
+    The traversal only stats (DUP_WALK_FIELDS) and hands every record to
+    dup_add(). dup_report() then narrows the regular files down in three
+    rounds, each only over the files the one before left with a match:
+
+      1. size: a file of a size no other file has is unique, unread;
+      2. XXH3 of the first and last DUP_PROBE bytes, for files bigger
+         than both ends together (the smaller ones go straight to 3);
+      3. the digests of the output fields, with the full record, by
+         filestat_batch() on the jobs threads.
+
+    Names of one inode (hard links) are one file: it is probed once, and
+    they only form a group together with a copy on another inode. Empty
+    files are left out. Groups are numbered from 1, largest files first,
+    and their records written in the order the traversal met them.
+*/
+int dup_mode;
+
+struct dupfile {
+    char *name;
+    uint64_t size;
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t probe;             /* XXH3 of both ends, 0 if not probed */
+    size_t seq;                 /* order of the traversal */
+    size_t rec;                 /* its record, and that of the name read for its inode */
+    size_t rep;
+    int skip;                   /* unreadable */
+};
+
+static struct dupfile *dfiles;
+static size_t ndfiles, dfcap;
+static unsigned long dup_files, dup_groups;
+static uint64_t dup_bytes, dup_probed, dup_hashed;
+
+void dup_add(const FSREC *r)
+{
+    struct dupfile *d;
+
+    if(!S_ISREG(r->sb.st_mode) || r->sb.st_size == 0) return;
+    if(ndfiles == dfcap) {
+        dfcap = dfcap ? 2 * dfcap : 1024;
+        if((dfiles = (struct dupfile *)realloc(dfiles, dfcap * sizeof(struct dupfile))) == (struct dupfile *)NULL) {
+            perror(progname);
+            exit(1);
+        }
+    }
+    d = &dfiles[ndfiles];
+    memset(d, 0, sizeof(struct dupfile));
+    if((d->name = strdup(r->name)) == (char *)NULL) {
+        perror(progname);
+        exit(1);
+    }
+    d->size = (uint64_t)r->sb.st_size;
+    d->dev = (uint64_t)r->sb.st_dev;
+    d->ino = (uint64_t)r->sb.st_ino;
+    d->seq = ndfiles++;
+    dup_files++;
+    dup_bytes += d->size;
+    return;
+}
+
+void dup_counts(unsigned long *files, unsigned long *groups, uint64_t *bytes, uint64_t *probed, uint64_t *hashed)
+{
+    *files = dup_files;
+    *groups = dup_groups;
+    *bytes = dup_bytes;
+    *probed = dup_probed;
+    *hashed = dup_hashed;
+    return;
+}
+
+#define CMP(a, b)           (((a) > (b)) - ((a) < (b)))
+
+/* Largest first, then by the probe; the inodes of a size together */
+static int dup_cmp(const void *x, const void *y)
+{
+    const struct dupfile *a = (const struct dupfile *)x, *b = (const struct dupfile *)y;
+    int c;
+
+    if((c = CMP(b->size, a->size)) != 0) return c;
+    if((c = CMP(a->probe, b->probe)) != 0) return c;
+    if((c = CMP(a->dev, b->dev)) != 0) return c;
+    if((c = CMP(a->ino, b->ino)) != 0) return c;
+    return CMP(a->seq, b->seq);
+}
+
+/* Whether dfiles[from..to) holds more than one inode */
+static int dup_inodes(size_t from, size_t to)
+{
+    size_t i;
+
+    for(i = from + 1; i < to; i++)
+        if(dfiles[i].dev != dfiles[from].dev || dfiles[i].ino != dfiles[from].ino) return 1;
+    return 0;
+}
+
+/* XXH3 of the first and the last DUP_PROBE bytes of the file */
+static int dup_probe(struct dupfile *d)
+{
+    int i, fd, err, flags = O_RDONLY;
+    ssize_t n;
+    unsigned char buf[DUP_PROBE];
+    XXH3_CTX c;
+
+#ifdef O_CLOEXEC
+    flags |= O_CLOEXEC;
+#endif
+    if((fd = open(d->name, flags)) < 0) return -1;
+    xxh3_init(&c);
+    for(i = 0; i < 2; i++) {
+        if((n = pread(fd, buf, DUP_PROBE, i ? (off_t)(d->size - DUP_PROBE) : 0)) != DUP_PROBE) {
+            /* Short: the file shrank since its stat */
+            err = (n < 0) ? errno : EIO;
+            close(fd);
+            errno = err;
+            return -1;
+        }
+        xxh3_update(&c, buf, DUP_PROBE);
+    }
+    close(fd);
+    /* 0 is left for the files that are not probed */
+    d->probe = xxh3_final(&c) | 1;
+    dup_probed += 2 * DUP_PROBE;
+    return 0;
+}
+
+/* Order of the records of a candidate run: by digests, then by traversal */
+static uint32_t dg_fields;
+
+static int dg_cmp(const FSREC *a, const FSREC *b)
+{
+    int c;
+
+    if((dg_fields & FLDM(FLD_CKSUM)) && (c = CMP(a->dg.crc, b->dg.crc)) != 0) return c;
+    if((dg_fields & FLDM(FLD_MD5)) && (c = memcmp(a->dg.md5, b->dg.md5, MD5_LEN)) != 0) return c;
+    if((dg_fields & FLDM(FLD_SHA256)) && (c = memcmp(a->dg.sha256, b->dg.sha256, SHA256_LEN)) != 0) return c;
+    if((dg_fields & FLDM(FLD_TREE)) && (c = memcmp(a->dg.tree, b->dg.tree, SHA256_LEN)) != 0) return c;
+    if((dg_fields & FLDM(FLD_BLAKE3)) && (c = memcmp(a->dg.blake3, b->dg.blake3, BLAKE3_LEN)) != 0) return c;
+    if((dg_fields & FLDM(FLD_XXH3)) && (c = CMP(a->dg.xxh3, b->dg.xxh3)) != 0) return c;
+    return 0;
+}
+
+struct duprec {
+    FSREC *r;
+    struct dupfile *d;
+};
+
+static int duprec_cmp(const void *x, const void *y)
+{
+    const struct duprec *a = (const struct duprec *)x, *b = (const struct duprec *)y;
+    int c;
+
+    if((c = dg_cmp(a->r, b->r)) != 0) return c;
+    return CMP(a->d->seq, b->d->seq);
+}
+
+static int duprec_inodes(const struct duprec *dr, size_t from, size_t to)
+{
+    size_t i;
+
+    for(i = from + 1; i < to; i++)
+        if(dr[i].d->dev != dr[from].d->dev || dr[i].d->ino != dr[from].d->ino) return 1;
+    return 0;
+}
+
+/*
+    Write the groups of identical files found among the ones dup_add()
+    was given, and release them.
+*/
+void dup_report(OBUF *out, int otyp, int jobs)
+{
+    size_t i, j, k, m, n, nlink, ncand = 0;
+    const char **paths;
+    FSREC *recs, *r;
+    struct dupfile **cand;
+    struct duprec *dr;
+    FSOPTS opts;
+
+    /* 1 and 2: the sizes, then the ends of the files of a shared size */
+    qsort(dfiles, ndfiles, sizeof(struct dupfile), dup_cmp);
+    for(i = 0; i < ndfiles; i = j) {
+        for(j = i + 1; j < ndfiles && dfiles[j].size == dfiles[i].size; j++)
+            ;
+        if(!dup_inodes(i, j) || dfiles[i].size <= 2 * DUP_PROBE) continue;
+        for(k = i; k < j; k++) {
+            if(k > i && dfiles[k].dev == dfiles[k - 1].dev && dfiles[k].ino == dfiles[k - 1].ino) {
+                dfiles[k].probe = dfiles[k - 1].probe;
+                dfiles[k].skip = dfiles[k - 1].skip;
+            } else if(dup_probe(&dfiles[k]) != 0) {
+                perror(dfiles[k].name);
+                dfiles[k].skip = 1;
+            }
+        }
+        qsort(dfiles + i, j - i, sizeof(struct dupfile), dup_cmp);
+    }
+
+    if((cand = (struct dupfile **)malloc((ndfiles + 1) * sizeof(struct dupfile *))) == (struct dupfile **)NULL) {
+        perror(progname);
+        exit(1);
+    }
+    for(i = 0; i < ndfiles; i = j) {
+        for(j = i + 1; j < ndfiles && dfiles[j].size == dfiles[i].size && dfiles[j].probe == dfiles[i].probe; j++)
+            ;
+        if(dfiles[i].skip || !dup_inodes(i, j)) continue;
+        for(k = i; k < j; k++) cand[ncand++] = &dfiles[k];
+    }
+
+    /*
+        3: the full digests of what is left, with the records to output.
+        One name per inode is read, the records of the others come first
+        without the digests, which are then copied from it.
+    */
+    paths = (const char **)malloc((ncand + 1) * sizeof(char *));
+    recs = (FSREC *)calloc(ncand + 1, sizeof(FSREC));
+    dr = (struct duprec *)malloc((ncand + 1) * sizeof(struct duprec));
+    if(paths == (const char **)NULL || recs == (FSREC *)NULL || dr == (struct duprec *)NULL) {
+        perror(progname);
+        exit(1);
+    }
+    for(i = 0, nlink = 0; i < ncand; i++)
+        if(i > 0 && cand[i]->dev == cand[i - 1]->dev && cand[i]->ino == cand[i - 1]->ino) nlink++;
+    for(i = 0, k = 0, m = nlink; i < ncand; i++) {
+        if(i > 0 && cand[i]->dev == cand[i - 1]->dev && cand[i]->ino == cand[i - 1]->ino) {
+            cand[i]->rec = k++;
+            cand[i]->rep = cand[i - 1]->rep;
+        } else {
+            cand[i]->rec = cand[i]->rep = m++;
+            dup_hashed += cand[i]->size;
+        }
+        paths[cand[i]->rec] = cand[i]->name;
+    }
+    dg_fields = out_fields & FLDM_DIGESTS;
+    opts.read_mode = read_mode;
+    opts.dcache = dcache;
+    filestat_batch(paths, nlink, out_fields & ~FLDM_DIGESTS, jobs, &opts, recs);
+    filestat_batch(paths + nlink, ncand - nlink, out_fields, jobs, &opts, recs + nlink);
+    for(i = 0; i < ncand; i++) {
+        if(cand[i]->rec == cand[i]->rep || recs[cand[i]->rec].err != 0) continue;
+        recs[cand[i]->rec].dgstat = recs[cand[i]->rep].dgstat;
+        recs[cand[i]->rec].dg = recs[cand[i]->rep].dg;
+    }
+
+    for(i = 0; i < ncand; i = j) {
+        for(j = i + 1; j < ncand && cand[j]->size == cand[i]->size && cand[j]->probe == cand[i]->probe; j++)
+            ;
+        for(k = i, n = 0; k < j; k++) {
+            r = &recs[cand[k]->rec];
+            collect_perror(r, cand[k]->name);
+            if(r->err != 0 || r->dgstat != DG_OK) continue;
+            dr[n].r = r;
+            dr[n++].d = cand[k];
+        }
+        qsort(dr, n, sizeof(struct duprec), duprec_cmp);
+        for(k = 0; k < n; k = m) {
+            for(m = k + 1; m < n && dg_cmp(dr[m].r, dr[k].r) == 0; m++)
+                ;
+            if(!duprec_inodes(dr, k, m)) continue;
+            dup_groups++;
+            for(; k < m; k++) {
+                dr[k].r->dup = dup_groups;
+                format_record(out, otyp, dr[k].r);
+            }
+        }
+    }
+
+    filestat_batch_free(recs, ncand);
+    free(dr);
+    free(paths);
+    free(cand);
+    for(i = 0; i < ndfiles; i++) free(dfiles[i].name);
+    free(dfiles);
+    dfiles = (struct dupfile *)NULL;
+    ndfiles = dfcap = 0;
+    return;
+}
@@ -15,21 +15,162 @@
 
     -r, --recursive Recursive traverse all the .
 
+    -x, --one-file-system
+                    With -r, do not descend into the directories on
+                    another file system than their parent, such as NFS
+                    mounts; their own record is still output.
+
+        --files-from
+                    Also process the names listed in the given file, or
+                    in stdin for "-" (as is an argument "-"), one per
+                    line. They are read as they are processed, so a
+                    list of any length, from find or a database, goes
+                    through one run in constant memory.
+
+    -0, --null      The names of --files-from end with a NUL instead of
+                    a newline, as from find -print0.
+
+        --file-type Only output the entries of these types, as with find
+                    -type: f, d, p, s, c, b ("f" or "f,d"...).
+
+        --min-size, --max-size
+                    Only output the entries of at least, or at most, the
+                    given size (1G, 64k...).
+
+        --newer, --older
+                    Only output the entries modified after, or before, a
+                    time: an age (30m, 2h, 1d, 1w), a date (2018-10-13,
+                    "2018-10-13 14:05:00") or the mtime of a file.
+
+        --name      Only output the entries whose name matches the glob
+                    (several --name are alternatives).
+
+        --prune     Leave out the entries whose name matches the glob,
+                    and do not read such a directory at all.
+
+                    Every filter is tested as early as it can be: on the
+                    name and the type from the directory before any stat,
+                    then on the stat before the owner lookup and the
+                    reads. Directories that do not match are descended
+                    all the same, as with find.
+
     -t, --type      Type of the output. One of the following options:
-                    raw, txt (default), tab, csv, html, xml
+                    raw, txt (default), tab, csv, html, xml, bin (binary
+                    columnar manifest; see manifest.c)
 
     -o, --output    Output file. stdout is default.
 
     -f, --format    Specify format. Applicable only with output type
                     raw.
 
+    -b, --buffer-size
+                    Read size of the digest engine (default 1M).
+
+    -p, --parallel-digest
+                    Hash large files with one thread per digest.
+
+    -j, --jobs      Number of threads to walk and process the files.
+
+        --order     Order of the records with -j: deterministic or
+                    completion.
+
+        --read-mode How the digests read a file: read, mmap (with
+                    MADV_SEQUENTIAL), fadvise (SEQUENTIAL, and DONTNEED
+                    on pages that were not cached), direct (O_DIRECT),
+                    auto (by file size and file system) or uring: the
+                    stats, opens, reads and closes of the entries of a
+                    directory are queued together on an io_uring, and
+                    hashed as they complete (serial traversal only).
+
+        --queue-depth
+                    Requests in flight with --read-mode uring (64).
+
+        --uring-buffers
+                    Read buffers of -b bytes registered with the kernel
+                    for --read-mode uring (16).
+
+        --fields    Comma separated list of the fields to output, in
+                    every output type. Fields that are not selected
+                    are not computed at all.
+
+        --hash      Comma separated list of the digests to compute in
+                    place of cksum, md5 and sha256: any of those and
+                    blake3, xxh3 and tree. The BLAKE3 and XXH3 kernels
+                    (SSE, AVX2 or AVX-512) are picked for the CPU at
+                    start; --stats shows which.
+
+        --stats     Print the hit rates of the owner, group, time zone
+                    and digest caches to stderr at the end.
+
+        --profile[=file]
+                    Time the phases of the run (stat, realpath, NSS,
+                    reads, each digest, directory reads, formatting and
+                    writes) and count records, bytes, syscalls and
+                    allocations by file type; a summary goes to stderr,
+                    or everything with the histograms as JSON to file.
+
+        --cache     Digest cache file. Files whose device, inode, size,
+                    mtime and ctime are unchanged reuse the stored
+                    digests and are not read at all.
+
+        --cache-compact[=runs]
+                    Drop the cache entries not used in the last runs
+                    (10 by default). Without it nothing is dropped, and
+                    a run that only reuses entries does not rewrite the
+                    cache.
+
+        --tree-store
+                    Store of the tree field. The roots of the files of
+                    more than one 4M chunk are kept, so a file whose
+                    size, mtime and ctime did not change is not read
+                    again.
+
+        --since     Only output what changed since the manifest of an
+                    earlier run with the same arguments: the records
+                    added, modified (any field but atime) or removed,
+                    with a Change column. Files with the size, times
+                    and inode of the earlier run keep its digests.
+
+        --duplicates
+                    Only output the files with identical contents, in
+                    groups numbered in a Duplicates column. Files are
+                    compared by size, then by a hash of their first and
+                    last 4K, and only those still alike are read in full
+                    for the digests (sha256 unless --hash or --fields
+                    name others). Hard links count as one file, empty
+                    files are left out.
+
+        --summarize[=depth]
+                    Only output one row per directory, down to depth
+                    levels under the arguments (all by default), with
+                    the totals of everything under it, added up during
+                    the traversal: size and blocks, newest (mtime) and
+                    oldest modification, files, dirs and other entries,
+                    and the bytes of each owner. Implies -r. Nothing is
+                    read unless digest fields are asked for. Symbolic
+                    links under the arguments count as themselves, as
+                    with du.
+
+        --watch     Stay resident: scan the arguments once, keep the
+                    records and digests current with inotify and answer
+                    queries on the given Unix socket until SIGTERM.
+
+        --query     Ask a --watch process on the given socket for the
+                    named files (all without names; "dir/" for all under
+                    dir) in the -t type.
+
+        --from-manifest
+                    Read the records from a manifest written with -t bin
+                    instead of the file system: the named files (looked
+                    up by name in its index), or all of them. A name
+                    that is not in it is reported, and the exit status
+                    is 1.
+
 */
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
-#include <setjmp.h>
-#include <signal.h>
 #include <getopt.h>
 #include <fcntl.h>
 #include <grp.h>
@@ -51,8 +192,6 @@
 
 #include "filestat.h"
 
-jmp_buf jump;
-
 extern char *optarg;
 extern int optind;
 extern int optopt;
@@ -64,91 +203,39 @@ struct option longopts[] = {
     {"type",      required_argument, NULL, 't'},
     {"output",    required_argument, NULL, 'o'},
     {"recursive", no_argument,       NULL, 'r'},
+    {"one-file-system", no_argument, NULL, 'x'},
+    {"files-from", required_argument, NULL, OPT_FILES_FROM},
+    {"null",      no_argument,       NULL, '0'},
+    {"file-type", required_argument, NULL, OPT_FILE_TYPE},
+    {"min-size",  required_argument, NULL, OPT_MIN_SIZE},
+    {"max-size",  required_argument, NULL, OPT_MAX_SIZE},
+    {"newer",     required_argument, NULL, OPT_NEWER},
+    {"older",     required_argument, NULL, OPT_OLDER},
+    {"name",      required_argument, NULL, OPT_NAME},
+    {"prune",     required_argument, NULL, OPT_PRUNE},
+    {"buffer-size", required_argument, NULL, 'b'},
+    {"parallel-digest", no_argument, NULL, 'p'},
+    {"jobs",      required_argument, NULL, 'j'},
+    {"order",     required_argument, NULL, OPT_ORDER},
+    {"read-mode", required_argument, NULL, OPT_READ_MODE},
+    {"queue-depth", required_argument, NULL, OPT_QUEUE_DEPTH},
+    {"uring-buffers", required_argument, NULL, OPT_URING_BUFFERS},
+    {"cache",     required_argument, NULL, OPT_CACHE},
+    {"cache-compact", optional_argument, NULL, OPT_CACHE_COMPACT},
+    {"tree-store", required_argument, NULL, OPT_TREE_STORE},
+    {"fields",    required_argument, NULL, OPT_FIELDS},
+    {"hash",      required_argument, NULL, OPT_HASH},
+    {"stats",     no_argument,       NULL, OPT_STATS},
+    {"profile",   optional_argument, NULL, OPT_PROFILE},
+    {"from-manifest", required_argument, NULL, OPT_FROM_MANIFEST},
+    {"since",     required_argument, NULL, OPT_SINCE},
+    {"duplicates", no_argument,      NULL, OPT_DUPLICATES},
+    {"summarize", optional_argument, NULL, OPT_SUMMARIZE},
+    {"watch",     required_argument, NULL, OPT_WATCH},
+    {"query",     required_argument, NULL, OPT_QUERY},
     {NULL, 0, NULL, 0}
 };
 
-char *header_text[] = {
-    "File Name",
-    "Full Path",
-    "File Size",
-    "File User",
-    "File UID",
-    "File Group",
-    "File GID",
-    "File Type",
-    "File Permission",
-    "Octal Permission",
-    "Sticky",
-    "Access Time",
-    "Modify Time",
-    "Change Time",
-    "Device ID",
-    "File Inode",
-    "Links",
-    "Block Size",
-    "Blocks",
-    "Checksum",
-    "MD5 Digest",
-    "SHA256 Digest",
-    (char *)NULL
-};
-
-const static uint_fast32_t crctab[256] = {
-    0x00000000,
-    0x04c11db7, 0x09823b6e, 0x0d4326d9, 0x130476dc, 0x17c56b6b,
-    0x1a864db2, 0x1e475005, 0x2608edb8, 0x22c9f00f, 0x2f8ad6d6,
-    0x2b4bcb61, 0x350c9b64, 0x31cd86d3, 0x3c8ea00a, 0x384fbdbd,
-    0x4c11db70, 0x48d0c6c7, 0x4593e01e, 0x4152fda9, 0x5f15adac,
-    0x5bd4b01b, 0x569796c2, 0x52568b75, 0x6a1936c8, 0x6ed82b7f,
-    0x639b0da6, 0x675a1011, 0x791d4014, 0x7ddc5da3, 0x709f7b7a,
-    0x745e66cd, 0x9823b6e0, 0x9ce2ab57, 0x91a18d8e, 0x95609039,
-    0x8b27c03c, 0x8fe6dd8b, 0x82a5fb52, 0x8664e6e5, 0xbe2b5b58,
-    0xbaea46ef, 0xb7a96036, 0xb3687d81, 0xad2f2d84, 0xa9ee3033,
-    0xa4ad16ea, 0xa06c0b5d, 0xd4326d90, 0xd0f37027, 0xddb056fe,
-    0xd9714b49, 0xc7361b4c, 0xc3f706fb, 0xceb42022, 0xca753d95,
-    0xf23a8028, 0xf6fb9d9f, 0xfbb8bb46, 0xff79a6f1, 0xe13ef6f4,
-    0xe5ffeb43, 0xe8bccd9a, 0xec7dd02d, 0x34867077, 0x30476dc0,
-    0x3d044b19, 0x39c556ae, 0x278206ab, 0x23431b1c, 0x2e003dc5,
-    0x2ac12072, 0x128e9dcf, 0x164f8078, 0x1b0ca6a1, 0x1fcdbb16,
-    0x018aeb13, 0x054bf6a4, 0x0808d07d, 0x0cc9cdca, 0x7897ab07,
-    0x7c56b6b0, 0x71159069, 0x75d48dde, 0x6b93dddb, 0x6f52c06c,
-    0x6211e6b5, 0x66d0fb02, 0x5e9f46bf, 0x5a5e5b08, 0x571d7dd1,
-    0x53dc6066, 0x4d9b3063, 0x495a2dd4, 0x44190b0d, 0x40d816ba,
-    0xaca5c697, 0xa864db20, 0xa527fdf9, 0xa1e6e04e, 0xbfa1b04b,
-    0xbb60adfc, 0xb6238b25, 0xb2e29692, 0x8aad2b2f, 0x8e6c3698,
-    0x832f1041, 0x87ee0df6, 0x99a95df3, 0x9d684044, 0x902b669d,
-    0x94ea7b2a, 0xe0b41de7, 0xe4750050, 0xe9362689, 0xedf73b3e,
-    0xf3b06b3b, 0xf771768c, 0xfa325055, 0xfef34de2, 0xc6bcf05f,
-    0xc27dede8, 0xcf3ecb31, 0xcbffd686, 0xd5b88683, 0xd1799b34,
-    0xdc3abded, 0xd8fba05a, 0x690ce0ee, 0x6dcdfd59, 0x608edb80,
-    0x644fc637, 0x7a089632, 0x7ec98b85, 0x738aad5c, 0x774bb0eb,
-    0x4f040d56, 0x4bc510e1, 0x46863638, 0x42472b8f, 0x5c007b8a,
-    0x58c1663d, 0x558240e4, 0x51435d53, 0x251d3b9e, 0x21dc2629,
-    0x2c9f00f0, 0x285e1d47, 0x36194d42, 0x32d850f5, 0x3f9b762c,
-    0x3b5a6b9b, 0x0315d626, 0x07d4cb91, 0x0a97ed48, 0x0e56f0ff,
-    0x1011a0fa, 0x14d0bd4d, 0x19939b94, 0x1d528623, 0xf12f560e,
-    0xf5ee4bb9, 0xf8ad6d60, 0xfc6c70d7, 0xe22b20d2, 0xe6ea3d65,
-    0xeba91bbc, 0xef68060b, 0xd727bbb6, 0xd3e6a601, 0xdea580d8,
-    0xda649d6f, 0xc423cd6a, 0xc0e2d0dd, 0xcda1f604, 0xc960ebb3,
-    0xbd3e8d7e, 0xb9ff90c9, 0xb4bcb610, 0xb07daba7, 0xae3afba2,
-    0xaafbe615, 0xa7b8c0cc, 0xa379dd7b, 0x9b3660c6, 0x9ff77d71,
-    0x92b45ba8, 0x9675461f, 0x8832161a, 0x8cf30bad, 0x81b02d74,
-    0x857130c3, 0x5d8a9099, 0x594b8d2e, 0x5408abf7, 0x50c9b640,
-    0x4e8ee645, 0x4a4ffbf2, 0x470cdd2b, 0x43cdc09c, 0x7b827d21,
-    0x7f436096, 0x7200464f, 0x76c15bf8, 0x68860bfd, 0x6c47164a,
-    0x61043093, 0x65c52d24, 0x119b4be9, 0x155a565e, 0x18197087,
-    0x1cd86d30, 0x029f3d35, 0x065e2082, 0x0b1d065b, 0x0fdc1bec,
-    0x3793a651, 0x3352bbe6, 0x3e119d3f, 0x3ad08088, 0x2497d08d,
-    0x2056cd3a, 0x2d15ebe3, 0x29d4f654, 0xc5a92679, 0xc1683bce,
-    0xcc2b1d17, 0xc8ea00a0, 0xd6ad50a5, 0xd26c4d12, 0xdf2f6bcb,
-    0xdbee767c, 0xe3a1cbc1, 0xe760d676, 0xea23f0af, 0xeee2ed18,
-    0xf0a5bd1d, 0xf464a0aa, 0xf9278673, 0xfde69bc4, 0x89b8fd09,
-    0x8d79e0be, 0x803ac667, 0x84fbdbd0, 0x9abc8bd5, 0x9e7d9662,
-    0x933eb0bb, 0x97ffad0c, 0xafb010b1, 0xab710d06, 0xa6322bdf,
-    0xa2f33668, 0xbcb4666d, 0xb8757bda, 0xb5365d03, 0xb1f740b4
-};
-
-char *progname;
 extern int errno;
 
 int main(int argc, char *argv[])
@@ -156,8 +243,29 @@ int main(int argc, char *argv[])
     int optc;
     int otyp;
     int recurse;
+    int jobs;
+    int order;
     int null_output;
+    int keep_runs;
+    int show_stats;
+    int show_profile;
+    int fields_given;
+    int status = 0;
+    uint32_t hash_fields = 0;
+    char *cache_file = (char *)NULL;
+    char *tree_file = (char *)NULL;
+    char *manifest_file = (char *)NULL;
+    char *since_file = (char *)NULL;
+    char *watch_sock = (char *)NULL;
+    char *query_sock = (char *)NULL;
+    char *profile_file = (char *)NULL;
+    char *files_from = (char *)NULL;
+    int delim = '\n';
+    int i, nargs;
+    PLIST *pl = (PLIST *)NULL;
+    MANIFEST *mf = (MANIFEST *)NULL;
     FILE *out_fp = (FILE *)NULL;
+    OBUF out;
     char *out_type = (char *)NULL;
     char *out_file = (char *)NULL;
 
@@ -169,9 +277,15 @@ int main(int argc, char *argv[])
 
     otyp = 0;
     recurse = 0;
+    jobs = 1;
+    order = ORDER_DETERMINISTIC;
+    keep_runs = 0;
+    show_stats = 0;
+    show_profile = 0;
+    fields_given = 0;
     null_output = 1;
 
-    while((optc = getopt_long(argc, argv, "vht:o:r", longopts, (int *)0)) != EOF) {
+    while((optc = getopt_long(argc, argv, "vht:o:rx0b:pj:", longopts, (int *)0)) != EOF) {
         switch (optc) {
             case 'v':
                 version();
@@ -213,6 +327,133 @@ int main(int argc, char *argv[])
             case 'r':
                 recurse = 1;
                 break;
+            case 'x':
+                one_file_system = 1;
+                break;
+            case 'b':
+                if((digest_buflen = parse_size(optarg)) < DIGEST_BUFLEN_MIN) {
+                    fprintf(stderr, "%s: invalid buffer size specified (%s); minimum is %d bytes.\n", progname, optarg, DIGEST_BUFLEN_MIN);
+                    exit(1);
+                }
+                /* O_DIRECT reads whole blocks */
+                digest_buflen = (digest_buflen + FREADER_ALIGN - 1) & ~((size_t)FREADER_ALIGN - 1);
+                break;
+            case 'p':
+                digest_mode = DIGEST_MODE_PARALLEL;
+                break;
+            case 'j':
+                jobs = atoi(optarg);
+                if(jobs < 1 || jobs > JOBS_MAX) {
+                    fprintf(stderr, "%s: invalid number of jobs specified (%s); must be 1 to %d.\n", progname, optarg, JOBS_MAX);
+                    exit(1);
+                }
+                tree_sharers = jobs;
+                break;
+            case OPT_READ_MODE:
+                if((read_mode = is_valid_read_mode(optarg)) < 0) {
+                    fprintf(stderr, "%s: invalid read mode specified (%s); please see the usage below:\n", progname, optarg);
+                    usage();
+                    exit(1);
+                }
+                break;
+            case OPT_FILES_FROM:
+                files_from = optarg;
+                break;
+            case '0':
+                delim = '\0';
+                break;
+            case OPT_FILE_TYPE:
+            case OPT_MIN_SIZE:
+            case OPT_MAX_SIZE:
+            case OPT_NEWER:
+            case OPT_OLDER:
+            case OPT_NAME:
+            case OPT_PRUNE:
+                filter_option(optc, optarg);
+                break;
+            case OPT_QUEUE_DEPTH:
+                uring_depth = atoi(optarg);
+                if(uring_depth < 1 || uring_depth > URING_DEPTH_MAX) {
+                    fprintf(stderr, "%s: invalid queue depth specified (%s); must be 1 to %d.\n", progname, optarg, URING_DEPTH_MAX);
+                    exit(1);
+                }
+                break;
+            case OPT_URING_BUFFERS:
+                uring_buffers = atoi(optarg);
+                if(uring_buffers < 1) {
+                    fprintf(stderr, "%s: invalid number of io_uring buffers specified (%s).\n", progname, optarg);
+                    exit(1);
+                }
+                break;
+            case OPT_CACHE:
+                cache_file = optarg;
+                break;
+            case OPT_CACHE_COMPACT:
+                keep_runs = (optarg != (char *)NULL) ? atoi(optarg) : DCACHE_KEEP_RUNS;
+                if(keep_runs < 1) {
+                    fprintf(stderr, "%s: invalid number of runs to keep specified (%s).\n", progname, optarg);
+                    exit(1);
+                }
+                break;
+            case OPT_HASH:
+                if((hash_fields = parse_fields(optarg)) == 0) {
+                    usage();
+                    exit(1);
+                }
+                if((hash_fields & ~FLDM_DIGESTS) != 0) {
+                    fprintf(stderr, "%s: --hash takes digests only (cksum, md5, sha256, blake3, xxh3, tree).\n", progname);
+                    exit(1);
+                }
+                break;
+            case OPT_TREE_STORE:
+                tree_file = optarg;
+                break;
+            case OPT_FIELDS:
+                if((out_fields = parse_fields(optarg)) == 0) {
+                    usage();
+                    exit(1);
+                }
+                fields_given = 1;
+                break;
+            case OPT_FROM_MANIFEST:
+                manifest_file = optarg;
+                break;
+            case OPT_SINCE:
+                since_file = optarg;
+                break;
+            case OPT_DUPLICATES:
+                dup_mode = 1;
+                break;
+            case OPT_SUMMARIZE:
+                if(optarg != (char *)NULL && ((sum_depth = atoi(optarg)) < 0 || strspn(optarg, "0123456789") != strlen(optarg))) {
+                    fprintf(stderr, "%s: invalid summary depth specified (%s).\n", progname, optarg);
+                    exit(1);
+                }
+                sum_mode = 1;
+                recurse = 1;
+                break;
+            case OPT_WATCH:
+                watch_sock = optarg;
+                break;
+            case OPT_QUERY:
+                query_sock = optarg;
+                break;
+            case OPT_STATS:
+                show_stats = 1;
+                break;
+            case OPT_PROFILE:
+                show_profile = 1;
+                profile_file = optarg;
+                break;
+            case OPT_ORDER:
+                if(strcasecmp(optarg, "deterministic") == 0) order = ORDER_DETERMINISTIC;
+                else if(strcasecmp(optarg, "completion") == 0) order = ORDER_COMPLETION;
+                else {
+                    fprintf(stderr, "%s: invalid output order specified (%s); please see the usage below:\n", progname, optarg);
+                    usage();
+                    exit(1);
+                }
+                break;
             default:
                 usage();
                 exit(1);
@@ -222,23 +463,145 @@ int main(int argc, char *argv[])
     if(out_file == (char *)NULL) {
         out_fp = stdout;
     }
+    if(hash_fields != 0) out_fields = (out_fields & ~FLDM_DIGESTS) | hash_fields;
+    /* An argument "-" is the list of names in stdin */
+    for(i = nargs = optind; i < argc; i++) {
+        if(strcmp(argv[i], STD_OUTPUT) != 0) argv[nargs++] = argv[i];
+        else if(files_from == (char *)NULL || strcmp(files_from, STD_OUTPUT) == 0) files_from = STD_OUTPUT;
+        else {
+            fprintf(stderr, "%s: only one list of names can be given (--files-from %s and -).\n", progname, files_from);
+            exit(1);
+        }
+    }
+    argc = nargs;
+    if(files_from != (char *)NULL) {
+        if(query_sock != (char *)NULL || watch_sock != (char *)NULL || manifest_file != (char *)NULL) {
+            fprintf(stderr, "%s: --files-from does not go with --watch, --query or --from-manifest.\n", progname);
+            exit(1);
+        }
+        if((pl = plist_open(files_from, delim)) == (PLIST *)NULL) {
+            perror(files_from);
+            exit(1);
+        }
+        null_output = 0;
+    }
     if(optind < argc) null_output = 0;
+    if(filtering && (watch_sock != (char *)NULL || manifest_file != (char *)NULL || since_file != (char *)NULL)) {
+        fprintf(stderr, "%s: the filters do not go with --watch, --since or --from-manifest.\n", progname);
+        exit(1);
+    }
+    if(query_sock != (char *)NULL) {
+        fflush(out_fp);
+        exit(watch_query(query_sock, out_type ? out_type : "txt", &argv[optind], argc - optind, fileno(out_fp)) == 0 ? 0 : 1);
+    }
+    if(watch_sock != (char *)NULL) {
+        if(null_output || manifest_file != (char *)NULL || since_file != (char *)NULL || sum_mode) {
+            fprintf(stderr, "%s: --watch needs files or directories, and no --since, --summarize or --from-manifest.\n", progname);
+            exit(1);
+        }
+        exit(watch_run(watch_sock, recurse, &argv[optind], argc - optind) == 0 ? 0 : 1);
+    }
+    if(manifest_file != (char *)NULL) {
+        if((mf = manifest_open(manifest_file)) == (MANIFEST *)NULL) {
+            if(errno == EINVAL) fprintf(stderr, "%s: %s: not a valid manifest.\n", progname, manifest_file);
+            else perror(manifest_file);
+            exit(1);
+        }
+        if(!fields_given) {
+            out_fields = manifest_fields(mf);
+        } else if((out_fields & ~manifest_fields(mf)) != 0) {
+            fprintf(stderr, "%s: %s: the manifest does not have all the fields asked for.\n", progname, manifest_file);
+            exit(1);
+        }
+        null_output = 0;
+    }
+    if(since_file != (char *)NULL) {
+        if(mf != (MANIFEST *)NULL) {
+            fprintf(stderr, "%s: --since does not go with --from-manifest.\n", progname);
+            exit(1);
+        }
+        if(since_open(since_file, out_fields) != 0) exit(1);
+        out_fields |= FLDM(FLD_CHANGE);
+    }
+    if(dup_mode) {
+        if(mf != (MANIFEST *)NULL || since_file != (char *)NULL) {
+            fprintf(stderr, "%s: --duplicates does not go with --since or --from-manifest.\n", progname);
+            exit(1);
+        }
+        /* Compared by SHA256 unless other digests were asked for */
+        if(hash_fields == 0 && !fields_given) out_fields &= ~FLDM_DIGESTS;
+        if((out_fields & FLDM_DIGESTS) == 0) out_fields |= FLDM(FLD_SHA256);
+        out_fields |= FLDM(FLD_DUP);
+    }
+    if(sum_mode) {
+        if(mf != (MANIFEST *)NULL || since_file != (char *)NULL || dup_mode || otyp == OUT_TYPE_BIN) {
+            fprintf(stderr, "%s: --summarize does not go with --since, --duplicates, --from-manifest or -t bin.\n", progname);
+            exit(1);
+        }
+        if(!fields_given) out_fields = SUM_FIELDS | hash_fields;
+    }
+    if(cache_file != (char *)NULL) {
+        if((dcache = dcache_open(cache_file, keep_runs)) == (DCACHE *)NULL) {
+            perror(cache_file);
+            exit(1);
+        }
+    } else if(keep_runs > 0) {
+        fprintf(stderr, "%s: --cache-compact needs --cache.\n", progname);
+        exit(1);
+    }
+    if(tree_file != (char *)NULL) {
+        if((tstore = tstore_open(tree_file)) == (TSTORE *)NULL) {
+            perror(tree_file);
+            exit(1);
+        }
+    }
 
-    /* Main processing */
-    if(!null_output) print_file_stat_header(out_fp, otyp);
-    while(optind < argc) {
-        process_arg(out_fp, otyp, recurse, argv[optind++]);
+    /* Main processing; all the output goes through out */
+    if(show_profile) prof_init();
+    fflush(out_fp);
+    obuf_init(&out, fileno(out_fp));
+    if(!null_output) print_file_stat_header(&out, otyp);
+    if(mf != (MANIFEST *)NULL) {
+        /* Names that are not in it are reported, and fail the run */
+        if(print_manifest(&out, otyp, mf, &argv[optind], argc - optind) > 0) status = 1;
+    } else if(dup_mode) {
+        process_args(&out, otyp, recurse, &argv[optind], argc - optind, pl);
+        dup_report(&out, otyp, jobs);
+    } else if(jobs > 1 && !null_output && !sum_mode) {
+        walk_parallel(&out, otyp, recurse, &argv[optind], argc - optind, pl, jobs, order);
+    } else {
+        process_args(&out, otyp, recurse, &argv[optind], argc - optind, pl);
     }
-    if(!null_output) print_file_stat_footer(out_fp, otyp);
+    since_removed(&out, otyp);
+    if(!null_output) print_file_stat_footer(&out, otyp);
+    obuf_flush(&out);
+    obuf_free(&out);
 
     /* Close files and do cleanup */
+    if(show_stats) print_stats(stderr);
+    if(show_profile) {
+        if(profile_file != (char *)NULL) prof_report_json(profile_file);
+        else prof_report(stderr);
+    }
+    manifest_close(mf);
+    plist_close(pl);
+    since_close();
+    uring_close();
+    if(dcache != (DCACHE *)NULL) {
+        dcache_close(dcache);
+        dcache = (DCACHE *)NULL;
+    }
+    if(tstore != (TSTORE *)NULL) {
+        if(tstore_close(tstore) != 0) perror(tree_file);
+        tstore = (TSTORE *)NULL;
+    }
     if(out_file != (char *)NULL) {
         free(out_file);
     }
     if(out_fp != (FILE *)NULL && out_fp != stdout) {
         fclose(out_fp);
     }
-    return 0;
+    return status;
 }
 
 char *get_progname(const char *path)
@@ -263,528 +626,383 @@ void usage()
 {
     version();
     printf("\
-\nusage: %s [-hrv] [-t type] [-o output-file] [file_or_dir_1 file_or_dir_2 ...]\n\
+\nusage: %s [-0hprvx] [-t type] [-o output-file] [-b buffer-size] [-j jobs] [file_or_dir_1 file_or_dir_2 ...]\n\
 \t-h --help      give this help\n\
 \t-r --recursive recursively traverse any input directory\n\
+\t-x --one-file-system\n\
+\t               with -r, stay on the file system of each input directory.\n\
+\t   --files-from\n\
+\t               also process the names listed in the given file ('-' for stdin), one per line.\n\
+\t-0 --null      the names of --files-from end with NUL, as from find -print0.\n\
+\t   --file-type only output entries of these types: f, d, p, s, c, b.\n\
+\t   --min-size, --max-size\n\
+\t               only output entries of at least, or at most, this size (accepts k, M, G).\n\
+\t   --newer, --older\n\
+\t               only output entries modified after, or before, an age (1d), a date or a file.\n\
+\t   --name      only output entries whose name matches the glob.\n\
+\t   --prune     leave out the entries whose name matches the glob, and their contents.\n\
 \t-v --version   display version number\n\
 \t-o --output    output file. stdout is default.\n\
 \t-t --type      type of the output; one of the following options:\n\
-\t               raw, txt (default), tab, csv, htm, xml.\n\
-If file name is specified as '" STD_OUTPUT "', input will be read from stdin.\n\n\
+\t               raw, txt (default), tab, csv, htm, xml, bin (binary manifest).\n\
+\t-b --buffer-size\n\
+\t               read size used for the digests (default 1M); accepts k, M, G.\n\
+\t-p --parallel-digest\n\
+\t               compute checksum, MD5 and SHA256 of large files on separate cores.\n\
+\t-j --jobs      number of threads for traversal and per-file work (default 1).\n\
+\t   --order     order of the records with -j; one of the following options:\n\
+\t               deterministic (default, same as -j 1), completion.\n\
+\t   --read-mode how files are read for the digests; one of the following options:\n\
+\t               read (default), mmap, fadvise, direct, auto, uring.\n\
+\t   --queue-depth\n\
+\t               requests in flight with --read-mode uring (default 64).\n\
+\t   --uring-buffers\n\
+\t               read buffers registered for --read-mode uring (default 16).\n\
+\t   --fields    comma separated fields to output (default all); one or more of:\n\
+\t               name, path, size, user, uid, group, gid, type, perm, octal,\n\
+\t               sticky, atime, mtime, ctime, dev, inode, links, blksize,\n\
+\t               blocks, cksum, md5, sha256, tree (chunked SHA256 hashed on all\n\
+\t               cores), blake3, xxh3; the last three are not in the default.\n\
+\t   --hash      comma separated digests to compute instead of cksum, md5 and sha256;\n\
+\t               any of those and blake3, xxh3, tree.\n\
+\t   --stats     print cache statistics to stderr at the end.\n\
+\t   --profile[=file]\n\
+\t               print per-phase timings and counts to stderr, or as JSON to file.\n\
+\t   --cache     digest cache file; unchanged files are not read again.\n\
+\t   --cache-compact[=runs]\n\
+\t               drop cache entries not used in the last runs (default 10).\n\
+\t   --tree-store\n\
+\t               tree hash store of the tree field; unchanged files are not read again.\n\
+\t   --since     output only the files added, modified or removed since a manifest\n\
+\t               written with -t bin by an earlier run on the same arguments.\n\
+\t   --duplicates\n\
+\t               output only the groups of files with identical contents.\n\
+\t   --summarize[=depth]\n\
+\t               output only the totals of each directory (down to depth levels):\n\
+\t               size, blocks, newest and oldest mtime, entries by type, bytes by owner.\n\
+\t   --watch     stay resident, keep the records current with inotify and\n\
+\t               answer --query on the given Unix socket.\n\
+\t   --query     ask a --watch process on the given socket for the named files\n\
+\t               (default all; dir/ for all under dir).\n\
+\t   --from-manifest\n\
+\t               print the named files (default all) from a manifest written with -t bin.\n\
+If file name is specified as '" STD_OUTPUT "', the names will be read from stdin (see --files-from).\n\n\
 Please contact " DEFAULT_CONTACT " for bug reporting or clarification.\n", progname);
     return;
 }
 
-int is_valid_out_type(char *out_type)
-{
-    if(out_type == (char *)NULL) return OUT_TYPE_UNKNOWN;
-    if(strcasecmp(out_type, "raw") == 0)      return OUT_TYPE_RAW;
-    else if(strcasecmp(out_type, "txt") == 0) return OUT_TYPE_TXT;
-    else if(strcasecmp(out_type, "tab") == 0) return OUT_TYPE_TAB;
-    else if(strcasecmp(out_type, "csv") == 0) return OUT_TYPE_CSV;
-    else if(strcasecmp(out_type, "htm") == 0) return OUT_TYPE_HTM;
-    else if(strcasecmp(out_type, "xml") == 0) return OUT_TYPE_XML;
-    else return OUT_TYPE_UNKNOWN;
-}
+/*
+    Records held back in order while the small files among them wait in
+    a batch for their digests, see dbatch_digests(). The queue is written
+    out when the batch is full, before a record that is not held (so a
+    directory comes after what precedes it and before its entries) and
+    by process_flush() at the end.
+*/
+struct rqueue {
+    int n;
+    FSREC rec[MB_BATCH];
+    char *name[MB_BATCH];       /* copies, the name buffer moves on */
+    DBATCH db;
+};
+
+static struct rqueue rqueue;
 
-void print_file_stat_header(FILE *out_fp, int otyp)
+static void rqueue_flush(OBUF *out, int otyp)
 {
-    int i = 0;
-    switch(otyp) {
-        case OUT_TYPE_TAB:
-        case OUT_TYPE_CSV:
-            fprintf(out_fp, "%s", header_text[i]);
-            while(header_text[++i] != (char *)NULL) {
-                fprintf(out_fp, (otyp == OUT_TYPE_TAB? "\t%s": ",%s"), header_text[i]);
-            }
-            fprintf(out_fp, "\r\n");
-            break;
-        case OUT_TYPE_HTM:
-            fprintf(out_fp, "<!doctype html public \"-//W3C//DTD HTML 4.0 Final//EN\">\n<html>\n<head>\n\t<title>File Statistics</title>\n</head>\n<body>\n\t");
-            fprintf(out_fp, "<table align='left' border='1' cellspacing='0' cellpadding='2' width='100%%' style='border-collapse: collapse'>\n\t\t<tr align='left' valign='middle'>\n");
-            fprintf(out_fp, "\t\t\t<th>%s</th>\n", header_text[i]);
-            while(header_text[i] != (char *)NULL) {
-                fprintf(out_fp, "\t\t\t<th>%s</th>\n", header_text[i]);
-                i++;
-            }
-            fprintf(out_fp, "\t\t</tr>\n");
-            break;
-        case OUT_TYPE_XML:
-            fprintf(out_fp, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<fileset>\n");
-            break;
-        case OUT_TYPE_RAW:
-        case OUT_TYPE_TXT:
-        default:
-            fprintf(out_fp, "F i l e   S t a t i s t i c s\n");
+    int i;
+
+    dbatch_flush(&rqueue.db);
+    for(i = 0; i < rqueue.n; i++) {
+        collect_perror(&rqueue.rec[i], rqueue.name[i]);
+        if(since_keep(&rqueue.rec[i])) format_record(out, otyp, &rqueue.rec[i]);
+        free_file_stat(&rqueue.rec[i]);
+        free(rqueue.name[i]);
     }
+    rqueue.n = 0;
     return;
 }
 
-void print_file_stat_footer(FILE *out_fp, int otyp)
+static uint32_t walk_fields(void)
 {
-    switch(otyp) {
-        case OUT_TYPE_HTM:
-            fprintf(out_fp, "\t</table>\n</body>\n</html>\n");
-            break;
-        case OUT_TYPE_XML:
-            fprintf(out_fp, "</fileset>\n");
-            break;
-        case OUT_TYPE_CSV:
-        case OUT_TYPE_TAB:
-        case OUT_TYPE_RAW:
-        case OUT_TYPE_TXT:
-        default:
-            break;
-    }
-    return;
+    return dup_mode ? DUP_WALK_FIELDS : sum_mode ? (out_fields | SUM_WALK_FIELDS) : out_fields;
 }
 
-void process_arg(FILE *out_fp, int otyp, int recurse, const char *filename)
+static void process_record(OBUF *out, int otyp, int recurse, const FSDIR *parent, const char *relname, int rc, FSREC *r,
+                           char **name, size_t *cap, size_t len, ROLLUP *up, int depth);
+static int process_uring(OBUF *out, int otyp, int recurse, DREADER *dr, const FSDIR *dir, char **name, size_t *cap,
+                         size_t len, ROLLUP *up, int depth);
+
+/*
+    Serial traversal. A directory is read in large batches relative to
+    the descriptor of its parent and its entries are stat'ed relative to
+    it, so the kernel never walks the full path again. The name shown for
+    an entry is kept in one growing buffer: a child only appends "/name"
+    to its parent's name, there is no length limit. The canonical path of
+    a directory is handed down to its entries, see collect_file_stat_at().
+*/
+static void process_entry(OBUF *out, int otyp, int recurse, const FSDIR *parent, const char *relname, int dtype,
+                          char **name, size_t *cap, size_t len, ROLLUP *up, int depth)
 {
-    if(print_file_stat(out_fp, otyp, filename) == 1 && recurse == 1) {
-        DIR *dp;
-        if((dp = opendir(filename)) == (DIR *)NULL) {
-            perror(filename);
-            return;
-        } else {
-            struct dirent *p;
-            char *newent = (char *)malloc(1024 * sizeof(char));
-            for(p = readdir(dp); p != (struct dirent *)NULL; p = readdir(dp)) {
-                if(strcmp(p->d_name, ".") == 0 || strcmp(p->d_name, "..") == 0) continue;
-                (void)strcpy(newent, filename);
-                (void)strcat(newent, "/");
-                (void)strcat(newent, (const char *)p->d_name);
-                process_arg(out_fp, otyp, recurse, newent);
-            }
-            free(newent);
-            closedir(dp); dp = (DIR *)NULL;
+    int rc;
+    FSREC rec, *held;
+    DBATCH *db = (sum_mode || read_mode == READ_MODE_URING) ? (DBATCH *)NULL : &rqueue.db;
+
+    if(!filter_entry(relname, dtype, recurse)) return;
+    /* Collected in place in the queue: a pending batch points to it */
+    held = &rqueue.rec[rqueue.n];
+    rc = collect_file_stat_batch(held, parent, relname, dtype, *name, walk_fields(), db);
+    if(rc == 0 && held->filtered) {
+        free_file_stat(held);
+        return;
+    }
+    if(rc == 0 && (held->dgstat == DG_PENDING || rqueue.n > 0)) {
+        if((rqueue.name[rqueue.n] = strdup(*name)) == (char *)NULL) {
+            perror(progname);
+            exit(1);
         }
+        held->name = rqueue.name[rqueue.n++];
+        if(rqueue.n == MB_BATCH) rqueue_flush(out, otyp);
+        return;
     }
+    rec = *held;
+    process_record(out, otyp, recurse, parent, relname, rc, &rec, name, cap, len, up, depth);
     return;
 }
 
-int print_file_stat(FILE *out_fp, int otyp, const char *filename)
+/* The rest of process_entry() once the record r is collected: its output, and its entries */
+static void process_record(OBUF *out, int otyp, int recurse, const FSDIR *parent, const char *relname, int rc, FSREC *r,
+                           char **name, size_t *cap, size_t len, ROLLUP *up, int depth)
 {
-    int rc, sep;
-    char *sticky;
-    char *fullpath;
-    char *filetype;
-    char *cksum_str;
-    char *md5sum_str;
-    char *sha256sum_str;
-    char *readable_perm;
-    struct stat statbuf;
-    FTS sbts;
-
-    struct passwd *usrptr;
-    struct group  *grpptr;
-
-    if(filename == (const char *)NULL) return -1;
-
-    fullpath = get_realpath(filename);
-    //fullpath = canonicalize_file_name(filename);
-
-    /* Get the file stats */
-    if(stat(filename, &statbuf) != 0) {
-        perror(filename);
-        return -1;
-    }
-
-#if defined(__linux__)
-    sbts.ats_sec = statbuf.st_atim.tv_sec;
-    sbts.ats_nsec = statbuf.st_atim.tv_nsec;
-    sbts.mts_sec = statbuf.st_mtim.tv_sec;
-    sbts.mts_nsec = statbuf.st_mtim.tv_nsec;
-    sbts.cts_sec = statbuf.st_ctim.tv_sec;
-    sbts.cts_nsec = statbuf.st_ctim.tv_nsec;
-#elif defined(__APPLE__) && defined(__MACH__)
-    sbts.ats_sec = statbuf.st_atimespec.tv_sec;
-    sbts.ats_nsec = statbuf.st_atimespec.tv_nsec;
-    sbts.mts_sec = statbuf.st_mtimespec.tv_sec;
-    sbts.mts_nsec = statbuf.st_mtimespec.tv_nsec;
-    sbts.cts_sec = statbuf.st_ctimespec.tv_sec;
-    sbts.cts_nsec = statbuf.st_ctimespec.tv_nsec;
-#endif
-
-    if((usrptr = getpwuid(statbuf.st_uid)) == (struct passwd *)NULL) return -1; /* Get the file owner user name */
-    if((grpptr = getgrgid(statbuf.st_gid)) == (struct group  *)NULL) return -1; /* Get the file owner group name */
-
-    filetype = (char *)malloc(23 * sizeof(char));
-    readable_perm = (char *)malloc(11 * sizeof(char));
-
-    /* Get the file type */
-    if(S_ISFIFO(statbuf.st_mode)) {
-        readable_perm[0] = 'p';
-        strcpy(filetype, "fifo file");
-    } else if(S_ISDIR(statbuf.st_mode)) {
-        readable_perm[0] = 'd';
-        strcpy(filetype, "directory");
-    } else if(S_ISCHR(statbuf.st_mode)) {
-        readable_perm[0] = 'c';
-        strcpy(filetype, "character special file");
-    } else if(S_ISBLK(statbuf.st_mode)) {
-        readable_perm[0] = 'b';
-        strcpy(filetype, "block special file");
-    } else if(S_ISLNK(statbuf.st_mode)) {
-        readable_perm[0] = 'l';
-        strcpy(filetype, "symbolic link file");
-    } else if(S_ISSOCK(statbuf.st_mode)) {
-        readable_perm[0] = 's';
-        strcpy(filetype, "socket file");
-    } else {
-        readable_perm[0] = '-';
-        strcpy(filetype, "regular file");
-    }
-
-    if(readable_perm[0] == '-') {
-        cksum_str = compute_cksum(filename);
-        md5sum_str = compute_md5sum(filename);
-        sha256sum_str = compute_sha256sum(filename);
-    } else {
-        cksum_str = strdup(CKSUM_NA);
-        md5sum_str = strdup(CKSUM_NA);
-        sha256sum_str = strdup(CKSUM_NA);
-    }
-    /* Get the file access */
-    readable_perm[1] = ((statbuf.st_mode)&(S_IRUSR))? 'r': '-';
-    readable_perm[2] = ((statbuf.st_mode)&(S_IWUSR))? 'w': '-';
-    readable_perm[3] = ((statbuf.st_mode)&(S_IXUSR))? 'x': '-';
-    readable_perm[4] = ((statbuf.st_mode)&(S_IRGRP))? 'r': '-';
-    readable_perm[5] = ((statbuf.st_mode)&(S_IWGRP))? 'w': '-';
-    readable_perm[6] = ((statbuf.st_mode)&(S_IXGRP))? 'x': '-';
-    readable_perm[7] = ((statbuf.st_mode)&(S_IROTH))? 'r': '-';
-    readable_perm[8] = ((statbuf.st_mode)&(S_IWOTH))? 'w': '-';
-    readable_perm[9] = ((statbuf.st_mode)&(S_IXOTH))? 'x': '-';
-
-    readable_perm[10] = '\0';
-
-    /* Get the sticky bit details */
-    sticky = (char *)malloc(25 * sizeof(char));
-
-    if((statbuf.st_mode)&(S_ISUID)) {
-        readable_perm[3] = 's';
-        strcpy(sticky, "set user on execution");
-    } else if((statbuf.st_mode)&(S_ISGID)) {
-        readable_perm[6] = 's';
-        strcpy(sticky, "set group on execution");
-    } else if((statbuf.st_mode)&(S_ISVTX)) {
-        readable_perm[9] = 't';
-        strcpy(sticky, "save text even after use");
-    } else {
-        sticky[0] = '\0';
-    }
-
-    rc = (int)(readable_perm[0] == 'd');
-
-    switch(otyp) {
-        case OUT_TYPE_TAB:
-        case OUT_TYPE_CSV:
-            sep = (otyp == OUT_TYPE_TAB)? '\t': ',';
-            fprintf(out_fp, "\"%s\"%c\"%s\"%c%d%c%s%c%d%c%s%c%d%c%s%c%s%c%o%c%s%c%s%c%s%c%s%c%d%c%d%c%d%c%d%c%d%c%s%c%s%c%s\r\n",
-                    filename, sep,
-                    fullpath, sep,
-                    (int)statbuf.st_size, sep,
-                    usrptr->pw_name, sep,
-                    (int)statbuf.st_uid, sep,
-                    grpptr->gr_name, sep,
-                    (int)statbuf.st_gid, sep,
-                    filetype, sep,
-                    readable_perm, sep,
-                    statbuf.st_mode, sep,
-                    sticky, sep,
-                    tm2isots(sbts.ats_sec, sbts.ats_nsec), sep,
-                    tm2isots(sbts.mts_sec, sbts.mts_nsec), sep,
-                    tm2isots(sbts.cts_sec, sbts.cts_nsec), sep,
-                    (int)statbuf.st_dev, sep,
-                    (int)statbuf.st_ino, sep,
-                    (int)statbuf.st_nlink, sep,
-                    (int)statbuf.st_blksize, sep,
-                    (int)statbuf.st_blocks, sep,
-                    cksum_str, sep,
-                    md5sum_str, sep,
-                    sha256sum_str);
-            break;
-        case OUT_TYPE_HTM:
-            fprintf(out_fp, "\t\t<tr align='left' valign='middle'>\n\t\t\t<td>%s</td>\n\t\t\t<td>%s</td>\n\t\t\t<td>%d</td>\n\t\t\t<td>%s</td>\n\t\t\t<td>%d</td>\n\t\t\t<td>%s</td>\n\t\t\t<td>%d</td>\n\t\t\t<td>%s</td>\n\t\t\t<td>%s</td>\n\t\t\t<td>%o</td>\n\t\t\t<td>%s</td>\n\t\t\t<td>%s</td>\n\t\t\t<td>%s</td>\n\t\t\t<td>%s</td>\n\t\t\t<td>%d</td>\n\t\t\t<td>%d</td>\n\t\t\t<td>%d</td>\n\t\t\t<td>%d</td>\n\t\t\t<td>%d</td>\n\t\t\t<td>%s</td>\n\t\t\t<td>%s</td>\n\t\t\t<td>%s</td>\n\t\t</tr>\n",
-                    filename,
-                    fullpath,
-                    (int)statbuf.st_size,
-                    usrptr->pw_name,
-                    (int)statbuf.st_uid,
-                    grpptr->gr_name,
-                    (int)statbuf.st_gid,
-                    filetype,
-                    readable_perm,
-                    statbuf.st_mode,
-                    sticky,
-                    tm2isots(sbts.ats_sec, sbts.ats_nsec),
-                    tm2isots(sbts.mts_sec, sbts.mts_nsec),
-                    tm2isots(sbts.cts_sec, sbts.cts_nsec),
-                    (int)statbuf.st_dev,
-                    (int)statbuf.st_ino,
-                    (int)statbuf.st_nlink,
-                    (int)statbuf.st_blksize,
-                    (int)statbuf.st_blocks,
-                    cksum_str,
-                    md5sum_str,
-                    sha256sum_str);
-            break;
-        case OUT_TYPE_XML:
-            fprintf(out_fp, "\t<file>\n\t\t<filename>%s</filename>\n\t\t<path>%s</path>\n\t\t<size>%d</size>\n\t\t<user>%s</user>\n\t\t<uid>%d</uid>\n\t\t<group>%s</group>\n\t\t<gid>%d</gid>\n\t\t<type>%s</type>\n\t\t<perm>%s</perm>\n\t\t<octalperm>%o</octalperm>\n\t\t<sticky>%s</sticky>\n\t\t<atime>%s</atime>\n\t\t<mtime>%s</mtime>\n\t\t<ctime>%s</ctime>\n\t\t<devid>%d</devid>\n\t\t<inode>%d</inode>\n\t\t<links>%d</links>\n\t\t<blocksize>%d</blocksize>\n\t\t<blocks>%d</blocks>\n\t\t<cksum>%s</cksum>\n\t\t<md5sum>%s</md5sum>\n\t\t<sha256sum>%s</sha256sum>\n\t</file>\n",
-                    filename,
-                    fullpath,
-                    (int)statbuf.st_size,
-                    usrptr->pw_name,
-                    statbuf.st_uid,
-                    grpptr->gr_name,
-                    statbuf.st_gid,
-                    filetype,
-                    readable_perm,
-                    statbuf.st_mode,
-                    sticky,
-                    tm2isots(sbts.ats_sec, sbts.ats_nsec),
-                    tm2isots(sbts.mts_sec, sbts.mts_nsec),
-                    tm2isots(sbts.cts_sec, sbts.cts_nsec),
-                    (int)statbuf.st_dev,
-                    (int)statbuf.st_ino,
-                    (int)statbuf.st_nlink,
-                    (int)statbuf.st_blksize,
-                    (int)statbuf.st_blocks,
-                    cksum_str,
-                    md5sum_str,
-                    sha256sum_str);
-            break;
-        case OUT_TYPE_RAW:
-        case OUT_TYPE_TXT:
-        default:
-            fprintf(out_fp, "File Name  : %s\n", filename);
-            fprintf(out_fp, "Full Path  : %s\n", fullpath);
-            fprintf(out_fp, "File Size  : %d bytes\n", (int)statbuf.st_size);
-            fprintf(out_fp, "File User  : %s [uid %d]\n", usrptr->pw_name, statbuf.st_uid);
-            fprintf(out_fp, "File Group : %s [gid %d]\n", grpptr->gr_name, statbuf.st_gid);
-            fprintf(out_fp, "File Type  : %s\n", filetype);
-            fprintf(out_fp, "File Access: %s [octal %o] %s\n", readable_perm, statbuf.st_mode, sticky);
-            fprintf(out_fp, "Access Time: %s [time of last access]\n", tm2isots(sbts.ats_sec, sbts.ats_nsec));
-            fprintf(out_fp, "Modify Time: %s [time of last data modification]\n", tm2isots(sbts.mts_sec, sbts.mts_nsec));
-            fprintf(out_fp, "Change Time: %s [time of last file status change]\n", tm2isots(sbts.cts_sec, sbts.cts_nsec));
-            fprintf(out_fp, "Device ID  : %d\n", (int)statbuf.st_dev);
-            fprintf(out_fp, "File i-Node: %d\n", (int)statbuf.st_ino);
-            fprintf(out_fp, "Links      : %d\n", (int)statbuf.st_nlink);
-            fprintf(out_fp, "Block Size : %d\n", (int)statbuf.st_blksize);
-            fprintf(out_fp, "Blocks     : %d\n", (int)statbuf.st_blocks);
-            fprintf(out_fp, "Checksum   : %s\n", cksum_str);
-            fprintf(out_fp, "MD5 Digest : %s\n", md5sum_str);
-            fprintf(out_fp, "SHA256 SUM : %s\n\n", sha256sum_str);
+    int ctype, descended = 0;
+    size_t nlen;
+    const char *cname;
+    DREADER dr;
+    FSDIR dir;
+    FSREC rec = *r;
+    ROLLUP roll;
+
+    if(rqueue.n > 0) rqueue_flush(out, otyp);
+    collect_perror(&rec, *name);
+    if(rc < 0) return;
+    if(rec.filtered) {
+        /* Not output, but descended all the same */
+    } else if(dup_mode) dup_add(&rec);
+    else if(sum_mode) {
+        if(up != (ROLLUP *)NULL) sum_add(up, &rec);
+    } else if(since_keep(&rec)) format_record(out, otyp, &rec);
+    dir.path = rec.path;
+    rec.path = (char *)NULL;
+    /* The record of a directory is its row with --summarize, once its entries are done */
+    if(!sum_mode) free_file_stat(&rec);
+    sum_init(&roll);
+
+    if(rc == 1 && recurse == 1) {
+        if(dreader_open(&dr, (parent != (const FSDIR *)NULL) ? parent->fd : AT_FDCWD, relname) != 0) {
+            perror(*name);
+            goto done;
+        }
+        dir.fd = dr.fd;
+        if(!visit_dir(&dir, parent, *name)) {
+            dreader_close(&dr);
+            goto done;
+        }
+        dir.netfs = fs_is_network(dr.fd);
+        descended = 1;
+        if(read_mode == READ_MODE_URING) rc = process_uring(out, otyp, recurse, &dr, &dir, name, cap, len, &roll, depth);
+        else while((rc = dreader_next(&dr, &cname, &ctype)) > 0) {
+            nlen = strlen(cname);
+            if(len + nlen + 2 > *cap) {
+                *cap = 2 * (len + nlen + 2);
+                if((*name = (char *)realloc(*name, *cap)) == (char *)NULL) {
+                    perror(progname);
+                    exit(1);
+                }
+            }
+            (*name)[len] = DIR_PATH_CHAR;
+            memcpy(*name + len + 1, cname, nlen + 1);
+            process_entry(out, otyp, recurse, &dir, cname, ctype, name, cap, len + 1 + nlen, &roll, depth + 1);
+        }
+        (*name)[len] = '\0';
+        if(rc < 0) perror(*name);
+        dreader_close(&dr);
     }
-    if(!memcheck(fullpath))      free(fullpath);
-    if(!memcheck(filetype))      free(filetype);
-    if(!memcheck(readable_perm)) free(readable_perm);
-    if(!memcheck(sticky))        free(sticky);
-    if(!memcheck(cksum_str))     free(cksum_str);
-    if(!memcheck(md5sum_str))    free(md5sum_str);
-    if(!memcheck(sha256sum_str)) free(sha256sum_str);
-
-    return rc;
+done:
+    if(sum_mode) {
+        rec.name = *name;
+        rec.path = dir.path;
+        if(descended || (up == (ROLLUP *)NULL && !rec.filtered)) sum_row(out, otyp, &rec, &roll, up, depth);
+        free_file_stat(&rec);
+    } else free(dir.path);
+    return;
 }
 
-char *get_realpath(const char *filename)
+/* Whether uring_collect() was tried; read_mode no longer tells once it fell back */
+static int uring_tried;
+
+/*
+    The entries of dir, read from dr, with --read-mode uring: they are
+    collected URING_BATCH at a time by uring_collect(), which queues the
+    stats and the reads of them all together, then each goes on as from
+    process_entry(). Without io_uring the traversal goes on with plain
+    reads. Returns as dreader_next() did last.
+*/
+static int process_uring(OBUF *out, int otyp, int recurse, DREADER *dr, const FSDIR *dir, char **name, size_t *cap,
+                         size_t len, ROLLUP *up, int depth)
 {
-    int path_max;
-    char *resolved_path;
-#ifdef PATH_MAX
-    path_max = PATH_MAX;
-#else
-    path_max = pathconf(filename, _PC_PATH_MAX);
-    if (path_max <= 0)
-        path_max = 4096;
-#endif
-    resolved_path = (char *)malloc(path_max * sizeof(char));
-    if(!realpath(filename, resolved_path)) {
-        perror(filename);
+    int i, n, rc, ctype, collected;
+    size_t nlen, used, acap = 0;
+    const char *cname;
+    char *arena = (char *)NULL;
+    size_t off[URING_BATCH];
+    UENTRY *e;
+
+    if((e = (UENTRY *)malloc(URING_BATCH * sizeof(UENTRY))) == (UENTRY *)NULL) {
+        perror(progname);
         exit(1);
     }
-    return resolved_path;
+    do {
+        /* The shown names, "dir/name", one after the other in arena */
+        for(n = 0, used = 0; n < URING_BATCH && (rc = dreader_next(dr, &cname, &ctype)) > 0; ) {
+            if(!filter_entry(cname, ctype, recurse)) continue;
+            nlen = strlen(cname);
+            if(used + len + nlen + 2 > acap) {
+                acap = 2 * (used + len + nlen + 2);
+                if((arena = (char *)realloc(arena, acap)) == (char *)NULL) {
+                    perror(progname);
+                    exit(1);
+                }
+            }
+            off[n] = used;
+            memcpy(arena + used, *name, len);
+            arena[used + len] = DIR_PATH_CHAR;
+            memcpy(arena + used + len + 1, cname, nlen + 1);
+            used += len + nlen + 2;
+            e[n++].dtype = ctype;
+        }
+        for(i = 0; i < n; i++) {
+            e[i].filename = arena + off[i];
+            e[i].name = e[i].filename + len + 1;
+        }
+        if(n > 0 && read_mode == READ_MODE_URING) uring_tried = 1;
+        collected = (n > 0 && read_mode == READ_MODE_URING && uring_collect(dir, e, n, walk_fields()) == 0);
+        if(n > 0 && !collected) read_mode = READ_MODE_READ;
+
+        for(i = 0; i < n; i++) {
+            nlen = strlen(e[i].name);
+            if(len + nlen + 2 > *cap) {
+                *cap = 2 * (len + nlen + 2);
+                if((*name = (char *)realloc(*name, *cap)) == (char *)NULL) {
+                    perror(progname);
+                    exit(1);
+                }
+            }
+            (*name)[len] = DIR_PATH_CHAR;
+            memcpy(*name + len + 1, e[i].name, nlen + 1);
+            if(!collected) {
+                process_entry(out, otyp, recurse, dir, e[i].name, e[i].dtype, name, cap, len + 1 + nlen, up, depth + 1);
+                continue;
+            }
+            e[i].rec.name = *name;
+            process_record(out, otyp, recurse, dir, e[i].name, e[i].rc, &e[i].rec, name, cap, len + 1 + nlen, up,
+                           depth + 1);
+        }
+    } while(n == URING_BATCH);
+    free(arena);
+    free(e);
+    return rc;
 }
 
-char *tm2isots(time_t sec, long nanosec)
+void process_arg(OBUF *out, int otyp, int recurse, const char *filename)
 {
-    char *ts;
-    struct tm *t;
-    ts = (char *)malloc(30 * sizeof(char));
-    t = localtime(&sec);
-    if(!strftime(ts, 29, "%Y-%m-%d %H:%M:%S.", t)) {
-        fprintf(stderr, "error: can't format timestamp");
-        return (char *)NULL;
-    }
-    sprintf(&ts[20], "%09ld", nanosec);
-    ts[29] = '\0';
-    return ts;
-}
+    size_t len = strlen(filename);
+    size_t cap = len + 256;
+    char *name;
 
-char *compute_cksum(const char *filename)
-{
-    FILE *fp;
-    char *sum;
-    if((fp = fopen(filename, "r")) == (FILE *)NULL) {
-        perror(filename);
-        return (char *)"-";
-    }
-    sum = (char *)calloc(12, sizeof(char));
-    if(cksum(fp, sum) != 0) {
-        fprintf(stderr, "%s: can't compute the checksum for the input file '%s'\n", progname, filename);
-        return (char *)"-";
-    }
-    if(fp != (FILE *)NULL) {
-        fclose(fp);
+    if((name = (char *)malloc(cap)) == (char *)NULL) {
+        perror(progname);
+        exit(1);
     }
-
-    return sum;
+    memcpy(name, filename, len + 1);
+    process_entry(out, otyp, recurse, (const FSDIR *)NULL, filename, DT_UNKNOWN, &name, &cap, len, (ROLLUP *)NULL, 0);
+    free(name);
+    return;
 }
 
-char *compute_md5sum(const char *filename)
+/* process_arg() for the nargs arguments args, then the names of the list pl (may be NULL), and process_flush() */
+void process_args(OBUF *out, int otyp, int recurse, char **args, int nargs, PLIST *pl)
 {
     int i;
-    FILE *fp;
-    char *sum;
-    unsigned char *digest;
-    if((fp = fopen(filename, "r")) == (FILE *)NULL) {
-        perror(filename);
-        return (char *)"-";
-    }
-    digest = (unsigned char *)calloc(17, sizeof(unsigned char));
-    if(mdfile(fp, digest) != 0) {
-        fprintf(stderr, "%s: can't compute the md5 message digest for the input file '%s'\n", progname, filename);
-        return (char *)"-";
-    }
-    if(fp != (FILE *)NULL) {
-        fclose(fp);
-    }
-
-    sum = (char *)malloc(33 * sizeof(char));
-    for (i = 0; i < 16; ++i) {
-        sprintf(&(sum[2*i]), "%02x", digest[i]);
-    }
-    sum[32] = '\0';
-    free(digest);
+    const char *name;
 
-    return sum;
+    for(i = 0; i < nargs; i++) process_arg(out, otyp, recurse, args[i]);
+    while(pl != (PLIST *)NULL && (name = plist_next(pl)) != (const char *)NULL) process_arg(out, otyp, recurse, name);
+    process_flush(out, otyp);
+    return;
 }
 
-int mdfile(FILE *fp, unsigned char *digest)
+/* Write the records still held back by process_arg() */
+void process_flush(OBUF *out, int otyp)
 {
-    unsigned char buf[1024];
-    MD5_CTX ctx;
-    int n;
-
-    MD5_Init(&ctx);
-    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
-        MD5_Update(&ctx, buf, n);
-    MD5_Final(digest, &ctx);
-    if (ferror(fp))
-        return -1;
-    return 0;
+    rqueue_flush(out, otyp);
+    dbatch_free(&rqueue.db);
+    return;
 }
 
-/* Calculate and print the checksum and length in bytes
-   of file FILE, or of the standard input if FILE is "-".
-   If PRINT_NAME is true, print FILE next to the checksum and size.
-   Return true if successful.  */
-
-int cksum(FILE *fp, char *cs)
+static void print_hit_rate(FILE *fp, const char *what, unsigned long hits, unsigned long misses)
 {
-    unsigned char buf[BUFLEN];
-    uint_fast32_t crc = 0;
-    uintmax_t length = 0;
-    size_t bytes_read;
-
-    while ((bytes_read = fread(buf, 1, BUFLEN, fp)) > 0) {
-        unsigned char *cp = buf;
-
-        if (length + bytes_read < length) {
-            perror("file too long");
-            return 1;
-        }
-        length += bytes_read;
-        while (bytes_read--)
-            crc = (crc << 8) ^ crctab[((crc >> 24) ^ *cp++) & 0xFF];
-        if (feof(fp))
-            break;
-    }
-
-    if (ferror(fp)) {
-        perror("error");
-        return 1;
-    }
-
-    for (; length; length >>= 8)
-        crc = (crc << 8) ^ crctab[((crc >> 24) ^ length) & 0xFF];
-
-    crc = ~crc & 0xFFFFFFFF;
-
-    sprintf(cs, "%u", (unsigned int) crc);
-
-    return 0;
+    unsigned long n = hits + misses;
+    fprintf(fp, "  %-13s: %lu lookups, %lu hits (%.1f%%)", what, n, hits, n ? 100.0 * hits / n : 0.0);
+    return;
 }
 
-char *compute_sha256sum(const char *filename)
+/* Instrumentation summary for --stats */
+void print_stats(FILE *fp)
 {
-    int i;
-    FILE *fp;
-    char *sum;
-    unsigned char *digest;
-    if((fp = fopen(filename, "r")) == (FILE *)NULL) {
-        perror(filename);
-        return (char *)"-";
+    unsigned long hits, misses, unknown;
+
+    fprintf(fp, "%s: statistics\n", progname);
+    fprintf(fp, "  %-13s: cksum %s, blake3 %s, xxh3 %s, small files %s\n", "kernels", cksum_engine(), blake3_engine(),
+            xxh3_engine(), mbhash_engine());
+    name_cache_counts(0, &hits, &misses, &unknown);
+    print_hit_rate(fp, "user names", hits, misses);
+    fprintf(fp, ", %lu unknown\n", unknown);
+    name_cache_counts(1, &hits, &misses, &unknown);
+    print_hit_rate(fp, "group names", hits, misses);
+    fprintf(fp, ", %lu unknown\n", unknown);
+    tz_cache_counts(&hits, &misses);
+    print_hit_rate(fp, "time zone", hits, misses);
+    fprintf(fp, "\n");
+    if(dcache != (DCACHE *)NULL) {
+        dcache_counts(dcache, &hits, &misses);
+        print_hit_rate(fp, "digest cache", hits, misses);
+        fprintf(fp, "\n");
     }
-    digest = (unsigned char *)calloc(33, sizeof(unsigned char));
-    if(sha256file(fp, digest) != 0) {
-        fprintf(stderr, "%s: can't compute the SHA256 message digest for the input file '%s'\n", progname, filename);
-        return (char *)"-";
+    {
+        unsigned long dirs, loops, mounts, links;
+        inode_counts(&dirs, &loops, &mounts, &links);
+        fprintf(fp, "  %-13s: %lu directories read, %lu directory loops skipped, %lu mount points not crossed, %lu hard links not hashed again\n",
+                "inodes", dirs, loops, mounts, links);
     }
-    if(fp != (FILE *)NULL) {
-        fclose(fp);
+    if(filtering) {
+        unsigned long entries, stated;
+        filter_counts(&entries, &stated);
+        fprintf(fp, "  %-13s: %lu entries left out before the stat, %lu after it\n", "filters", entries, stated);
     }
-
-    sum = (char *)malloc(65 * sizeof(char));
-    for (i = 0; i < 32; ++i) {
-        sprintf(&(sum[2*i]), "%02x", digest[i]);
+    if(uring_tried) {
+        unsigned long enters, requests;
+        int fixed;
+        uring_counts(&enters, &requests, &fixed);
+        fprintf(fp, "  %-13s: %lu requests in %lu system calls (%.1f each), %s buffers%s\n", "io_uring", requests, enters,
+                enters ? (double)requests / enters : 0.0, fixed ? "registered" : "plain",
+                (read_mode != READ_MODE_URING) ? "; then plain reads" : "");
     }
-    sum[64] = '\0';
-    free(digest);
-    return sum;
-}
-
-int sha256file(FILE *fp, unsigned char *digest)
-{
-    unsigned char buf[1024];
-    SHA256_CTX ctx;
-    int n;
-
-    SHA256_Init(&ctx);
-    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
-        SHA256_Update(&ctx, buf, n);
-    SHA256_Final(digest, &ctx);
-    if (ferror(fp))
-        return -1;
-    return 0;
-}
-
-void segv(int sig)
-{
-    longjmp(jump, 1);
-    return;
-}
-
-int memcheck(void *x)
-{
-    volatile char c;
-    int illegal = 0;
-    signal(SIGSEGV, segv);
-    if(!setjmp(jump)) {
-        c = *(char *) (x);
-    } else {
-        illegal = 1;
+    if(dup_mode) {
+        unsigned long files, groups;
+        uint64_t bytes, probed, hashed;
+        dup_counts(&files, &groups, &bytes, &probed, &hashed);
+        fprintf(fp, "  %-13s: %lu files of %llu bytes, %llu bytes probed, %llu hashed (%.1f%%), %lu groups\n",
+                "duplicates", files, (unsigned long long)bytes, (unsigned long long)probed,
+                (unsigned long long)hashed, bytes ? 100.0 * (probed + hashed) / bytes : 0.0, groups);
     }
-    signal(SIGSEGV, SIG_DFL);
-    return illegal;
+    return;
 }
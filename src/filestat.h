@@ -16,6 +16,13 @@
 
 #define _GNU_SOURCE
 
+#include <stdio.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "libfilestat.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -39,6 +46,10 @@ extern "C" {
 #define S_ISVTX         0001000         /* save text even after use */
 #endif
 
+#ifndef DTTOIF
+#define DTTOIF(t)       ((t) << 12)     /* DT_* to S_IF* */
+#endif
+
 #define __S_ISLNK(m)      (((m)&(S_IFMT)) == (S_IFLNK))
 #define __S_ISSOCK(m)     (((m)&(S_IFMT)) == (S_IFSOCK))
 
@@ -57,40 +68,443 @@ extern "C" {
 #define OUT_TYPE_CSV        4
 #define OUT_TYPE_HTM        5
 #define OUT_TYPE_XML        6
+#define OUT_TYPE_BIN        7           /* binary columnar manifest */
+
+#define ORDER_DETERMINISTIC 0
+#define ORDER_COMPLETION    1
+#define JOBS_MAX            256
+#define PLIST_QUEUE         1024        /* names of --files-from in flight with -j */
+#define WALK_HELD           4096        /* records formatted ahead of the output with -j */
+
+#define OPT_ORDER           256         /* long options without a short form */
+#define OPT_READ_MODE       257
+#define OPT_CACHE           258
+#define OPT_CACHE_COMPACT   259
+#define OPT_FIELDS          260
+#define OPT_STATS           261
+#define OPT_FROM_MANIFEST   262
+#define OPT_SINCE           263
+#define OPT_WATCH           264
+#define OPT_QUERY           265
+#define OPT_PROFILE         266
+#define OPT_TREE_STORE      267
+#define OPT_HASH            268
+#define OPT_DUPLICATES      269
+#define OPT_SUMMARIZE       270
+#define OPT_QUEUE_DEPTH     271
+#define OPT_URING_BUFFERS   272
+#define OPT_FILES_FROM      273
+#define OPT_FILE_TYPE       274
+#define OPT_MIN_SIZE        275
+#define OPT_MAX_SIZE        276
+#define OPT_NEWER           277
+#define OPT_OLDER           278
+#define OPT_NAME            279
+#define OPT_PRUNE           280
+
+#define FIELD_TMPLEN        80          /* longest formatted field but names */
+
+#define CHG_NONE            0           /* FSREC change with --since */
+#define CHG_ADDED           1
+#define CHG_REMOVED         2
+#define CHG_MODIFIED        3
+
+#define READ_AUTO_SMALL     (1 << 20)   /* auto: plain reads up to this size */
+#define READ_AUTO_LARGE     (256 << 20) /* auto: mmap up to this size, fadvise above */
+#define FREADER_ALIGN       4096        /* buffer and length alignment for O_DIRECT */
+
+#define DIR_BUFLEN_MIN      (1 << 15)   /* first getdents64() batch of a directory */
+#define DIR_BUFLEN          (1 << 20)   /* later batches of a large directory */
+
+#define OBUF_LEN            (1 << 18)   /* output is written in chunks of this size */
+
+#define WATCH_SETTLE_MS     100         /* quiet time before dirty names are collected */
+#define WATCH_DELAY_MAX_MS  1000        /* ... but no later than this after the first */
+#define WATCH_DIRTY_MAX     65536       /* pending names; past this, rescan */
+#define WATCH_REQ_MAX       (1 << 20)   /* bytes of a query */
+#define WATCH_CLIENT_TIMEOUT 5          /* seconds */
+
+/* --profile phases, timed exclusive of each other; see profile.c */
+#define PH_STAT             0
+#define PH_REALPATH         1
+#define PH_NSS              2
+#define PH_READ             3           /* open, read and close for the digests */
+#define PH_CKSUM            4
+#define PH_MD5              5
+#define PH_SHA256           6
+#define PH_READDIR          7
+#define PH_FORMAT           8
+#define PH_WRITE            9
+#define PH_TREE             10          /* the whole tree hash of a file, reads included */
+#define PH_BLAKE3           11
+#define PH_XXH3             12
+#define PH_COUNT            13
+
+/* --profile record types */
+#define PT_REG              0
+#define PT_DIR              1
+#define PT_LNK              2
+#define PT_OTHER            3
+#define PT_ERROR            4           /* not collected */
+#define PT_OUTPUT           5           /* the output writes, no record */
+#define PT_COUNT            6
+#define PROF_BUCKETS        48          /* log2 nanosecond buckets of the histograms */
+
+/*
+    Instrumentation points; with --profile off each one is a test of a
+    global and nothing else.
+*/
+#define PROF_START()        (profiling ? prof_start() : 0)
+#define PROF_STOP(ph, t0)   do { if(profiling) prof_stop((ph), (t0)); } while(0)
+#define PROF_COUNT(sys, allocs, bytes) \
+                            do { if(profiling) prof_count((sys), (allocs), (bytes)); } while(0)
+#define PROF_EVENT(ph, pt, t0, sys, bytes) \
+                            do { if(profiling) prof_event((ph), (pt), (t0), (sys), (bytes)); } while(0)
 
 #define BUFLEN              (1 << 16)
 #define CKSUM_NA            "N/A"
+#define CKSUM_ERR           "-"
+
+#define B3_BLOCK_LEN        64          /* BLAKE3 compression block */
+#define B3_CHUNK_LEN        1024        /* BLAKE3 leaf of the tree */
+#define B3_MAX_DEPTH        54          /* CVs on the stack for 2^64 bytes */
+
+#define XXH3_STRIPE         64
+#define XXH3_BLOCK_STRIPES  16          /* (192 byte secret - 64) / 8 */
+#define XXH3_BUFLEN         256         /* bytes held back by the stream */
+
+#define DIGEST_BUFLEN       (1 << 20)   /* default read size of the digest engine */
+#define DIGEST_BUFLEN_MIN   (1 << 12)
+#define DIGEST_RING         4           /* buffers in flight in parallel mode */
+#define DIGEST_MODE_SERIAL  0
+#define DIGEST_MODE_PARALLEL 1
+
+#define URING_DEPTH         64          /* --queue-depth: requests in flight with --read-mode uring */
+#define URING_DEPTH_MAX     4096
+#define URING_BUFFERS       16          /* --uring-buffers: registered read buffers of -b bytes */
+#define URING_WINDOW        4           /* reads in flight per file */
+#define URING_BATCH         256         /* entries of a directory per uring_collect() */
+
+#define MB_SMALL            (16 << 10)  /* files up to this size are hashed in batches */
+#define MB_BATCH            64          /* files of a batch, see mbhash.c */
+
+#define DUP_PROBE           4096        /* --duplicates: bytes hashed at each end first */
+#define DUP_WALK_FIELDS     (FLDM(FLD_NAME) | FLDM(FLD_TYPE) | FLDM(FLD_SIZE) | FLDM(FLD_DEV) | FLDM(FLD_INODE))
+
+/* --summarize: what every entry is stat'ed for, and the default fields of a row */
+#define SUM_WALK_FIELDS     (FLDM(FLD_NAME) | FLDM(FLD_TYPE) | FLDM(FLD_SIZE) | FLDM(FLD_UID) | FLDM(FLD_MTIME) \
+                             | FLDM(FLD_DEV) | FLDM(FLD_INODE) | FLDM(FLD_LINKS) | FLDM(FLD_BLOCKS))
+#define SUM_FIELDS          (FLDM(FLD_NAME) | FLDM(FLD_SIZE) | FLDM(FLD_BLOCKS) | FLDM(FLD_MTIME) | FLDM(FLD_FILES) \
+                             | FLDM(FLD_DIRS) | FLDM(FLD_OTHERS) | FLDM(FLD_OLDEST) | FLDM(FLD_OWNERS))
+
+#define TREE_CHUNK_LOG2     22          /* tree hash chunks of 4M; the root depends on it */
+#define TREE_CHUNK          ((size_t)1 << TREE_CHUNK_LOG2)
 
-struct fts {
-    time_t ats_sec;
-    long ats_nsec;
-    time_t mts_sec;
-    long mts_nsec;
-    time_t cts_sec;
-    long cts_nsec;
+struct blake3 {
+    uint32_t cv[8];                     /* of the chunk being hashed */
+    uint64_t chunk;                     /* its number */
+    unsigned char block[B3_BLOCK_LEN];
+    uint32_t blen;
+    uint32_t blocks;                    /* compressed in the chunk */
+    int depth;
+    uint32_t stack[B3_MAX_DEPTH][8];
 };
-typedef struct fts FTS;
+typedef struct blake3 BLAKE3_CTX;
+
+struct xxh3 {
+    uint64_t acc[8];
+    uint64_t total;
+    size_t stripes;                     /* consumed in the current block */
+    size_t buflen;
+    unsigned char buf[XXH3_BUFLEN];     /* input not consumed yet */
+    unsigned char last[XXH3_STRIPE];    /* the last stripe consumed */
+};
+typedef struct xxh3 XXH3_CTX;
+
+struct freader {
+    int fd;
+    int mode;                   /* READ_MODE_* in use, never AUTO */
+    off_t size;
+    off_t pos;
+    unsigned char *map;
+};
+typedef struct freader FREADER;
+
+struct dckey {
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t size;
+    int64_t mtime_ns;
+    int64_t ctime_ns;
+};
+typedef struct dckey DCKEY;
+
+/* Totals of the entries under a directory, see summary.c */
+struct rollup {
+    unsigned long files;        /* regular files */
+    unsigned long dirs;
+    unsigned long others;       /* devices, fifos and sockets */
+    uint64_t bytes;
+    uint64_t blocks;
+    int timed;                  /* newest and oldest mtime are set */
+    time_t new_sec;
+    long new_nsec;
+    time_t old_sec;
+    long old_nsec;
+    struct owner *owner;        /* bytes by uid, sorted by uid */
+    size_t nowners;
+    size_t cowners;
+    char *owners;               /* text of the field, see sum_record() */
+};
+typedef struct rollup ROLLUP;
+
+typedef struct tstore TSTORE;
+
+struct dreader {
+    int fd;
+    char *buf;
+    size_t cap;
+    size_t len;
+    size_t pos;
+    void *dp;                   /* DIR *, where there is no getdents64() */
+};
+typedef struct dreader DREADER;
+
+/* An open directory that entries are looked up in */
+struct fsdir {
+    int fd;
+    char *path;                 /* canonical path, or NULL if not wanted */
+    int netfs;                  /* on a network file system */
+    uint64_t dev;               /* its inode, see visit_dir() */
+    uint64_t ino;
+    const struct fsdir *up;     /* the directory it was found in */
+    int shared;                 /* more names may lead into it, see visit_dir() */
+};
+typedef struct fsdir FSDIR;
+
+struct obuf {
+    char *buf;
+    size_t len;
+    size_t cap;
+    int fd;                     /* -1: collect only */
+    int interactive;            /* flush after every record */
+    int err;
+};
+typedef struct obuf OBUF;
+
+/* Small files read ahead and hashed together, see dbatch_digests() */
+struct dbitem {
+    FSREC *r;
+    DCKEY key;
+    uint32_t have;              /* digests found in the cache */
+    uint32_t want;              /* digests to compute */
+    size_t off;                 /* contents in the buffer of the batch */
+    size_t len;
+    int link;                   /* earlier item of the same inode, or -1 */
+};
+
+struct dbatch {
+    const FSOPTS *opts;         /* of filestat_batch(), or NULL: those of the program */
+    int n;
+    size_t used;
+    unsigned char *buf;         /* MB_BATCH * MB_SMALL + 1 bytes */
+    struct dbitem item[MB_BATCH];
+};
+typedef struct dbatch DBATCH;
+
+typedef struct manifest MANIFEST;
+
+/* A list of names read as they are processed (--files-from), see plist.c */
+struct plist {
+    FILE *fp;
+    const char *name;
+    int delim;                  /* '\n', or '\0' with -0 */
+    char *buf;
+    size_t cap;
+    unsigned long count;        /* names read */
+};
+typedef struct plist PLIST;
+
+/* An entry of a directory, see uring_collect() */
+struct uentry {
+    const char *name;           /* relative to the directory */
+    const char *filename;       /* as shown */
+    int dtype;
+    int rc;                     /* as from collect_file_stat_at() */
+    FSREC rec;
+};
+typedef struct uentry UENTRY;
+
+typedef struct dpipe DSTREAM;
+struct statx;
 
 extern char *progname;
+extern char *header_text[];
+extern char *field_name[];
+extern uint32_t out_fields;
+extern size_t digest_buflen;
+extern int digest_mode;
+extern int read_mode;
+extern DCACHE *dcache;
+extern TSTORE *tstore;
+extern int tree_sharers;
+extern int profiling;
+extern int dup_mode;
+extern int one_file_system;
+extern int sum_mode;
+extern int sum_depth;
+extern int uring_depth;
+extern int uring_buffers;
+extern int filtering;
+extern uint32_t filter_fields;
 
 char *get_progname(const char *path);
 void version(void);
 void usage(void);
 int is_valid_out_type(char *out_type);
-void print_file_stat_header(FILE *out_fp, int otyp);
-void print_file_stat_footer(FILE *out_fp, int otyp);
-void process_arg(FILE *out_fp, int otyp, int recurse, const char *filename);
-int print_file_stat(FILE *out_fp, int otyp, const char *filename);
+void print_file_stat_header(OBUF *ob, int otyp);
+void print_file_stat_footer(OBUF *ob, int otyp);
+void process_arg(OBUF *out, int otyp, int recurse, const char *filename);
+void process_flush(OBUF *out, int otyp);
+void process_args(OBUF *out, int otyp, int recurse, char **args, int nargs, PLIST *pl);
+int collect_file_stat(FSREC *r, const char *filename, uint32_t fields);
+int collect_file_stat_at(FSREC *r, const FSDIR *dir, const char *name, int dtype, const char *filename, uint32_t fields);
+int collect_file_stat_stated(FSREC *r, const FSDIR *dir, const char *name, int dtype, const char *filename, uint32_t fields,
+                             const struct stat *sb);
+int collect_file_stat_batch(FSREC *r, const FSDIR *dir, const char *name, int dtype, const char *filename, uint32_t fields,
+                            DBATCH *b);
+char *path_join(const char *dir, const char *name);
+void free_file_stat(FSREC *r);
+void collect_perror(const FSREC *r, const char *filename);
+void format_record(OBUF *ob, int otyp, const FSREC *r);
+void obuf_init(OBUF *ob, int fd);
+int obuf_flush(OBUF *ob);
+void obuf_free(OBUF *ob);
+void obuf_write(OBUF *ob, const char *s, size_t n);
+uint32_t parse_fields(const char *list);
+const char *field_str(const FSREC *r, int f, char *tmp);
+const char *file_type_str(mode_t mode);
+void file_perm_str(mode_t mode, char *perm);
+const char *file_sticky_str(mode_t mode);
 char *get_realpath(const char *file_name);
+char *get_realpath_at(int dirfd, const char *name, const char *filename);
+char *get_username(uid_t uid);
+char *get_groupname(gid_t gid);
+const char *uid_name(uid_t uid);
+const char *gid_name(gid_t gid);
+char *fmt_isots(time_t sec, long nanosec, char *ts);
+void name_cache_counts(int is_group, unsigned long *hits, unsigned long *misses, unsigned long *unknown);
+void tz_cache_counts(unsigned long *hits, unsigned long *misses);
+void print_stats(FILE *fp);
+int walk_parallel(OBUF *out, int otyp, int recurse, char **args, int nargs, PLIST *pl, int jobs, int order);
+PLIST *plist_open(const char *filename, int delim);
+const char *plist_next(PLIST *pl);
+void plist_close(PLIST *pl);
 char *tm2isots(time_t sec, long nanosec);
+char *tm2isots_r(time_t sec, long nanosec, char *ts);
 char *compute_cksum(const char *filename);
 char *compute_md5sum(const char *filename);
 char *compute_sha256sum(const char *filename);
 int mdfile(FILE *fp, unsigned char *digest);
 int sha256file(FILE *fp, unsigned char *digest);
 int cksum(FILE *fp, char *cs);
-void segv(int sig);
-int memcheck(void *x);
+uint_fast32_t cksum_update(uint_fast32_t crc, const unsigned char *buf, size_t len);
+uint32_t cksum_finish(uint_fast32_t crc, uintmax_t length);
+int cksum_set_engine(const char *name);
+const char *cksum_engine(void);
+int blake3_set_engine(const char *name);
+const char *blake3_engine(void);
+void blake3_init(BLAKE3_CTX *c);
+void blake3_update(BLAKE3_CTX *c, const unsigned char *buf, size_t len);
+void blake3_final(const BLAKE3_CTX *c, unsigned char digest[BLAKE3_LEN]);
+int xxh3_set_engine(const char *name);
+const char *xxh3_engine(void);
+void xxh3_init(XXH3_CTX *c);
+void xxh3_update(XXH3_CTX *c, const unsigned char *buf, size_t len);
+uint64_t xxh3_final(const XXH3_CTX *c);
+int mbhash_set_engine(const char *name);
+const char *mbhash_engine(void);
+void mb_md5(const unsigned char * const *data, const size_t *len, size_t n, unsigned char **out);
+void mb_sha256(const unsigned char * const *data, const size_t *len, size_t n, unsigned char **out);
+int digest_file_at(int dirfd, const char *name, uint32_t fields, FDIGEST *dg);
+DSTREAM *digest_begin(uint32_t fields);
+void digest_feed(DSTREAM *dp, const unsigned char *buf, size_t len);
+void digest_end(DSTREAM *dp, uintmax_t length, FDIGEST *dg);
+char *digest2hex(const unsigned char *digest, int len);
+int get_digests(int dirfd, const char *name, const DCKEY *key, uint32_t fields, FDIGEST *dg);
+int dbatch_digests(DBATCH *b, FSREC *r, int dirfd, const char *name, const DCKEY *key);
+void dbatch_flush(DBATCH *b);
+void dbatch_free(DBATCH *b);
+size_t parse_size(const char *s);
+int is_valid_read_mode(const char *name);
+const char *read_mode_name(int mode);
+int freader_open(FREADER *r, int dirfd, const char *filename, int mode);
+ssize_t freader_next(FREADER *r, unsigned char *buf, size_t len, const unsigned char **data);
+void freader_close(FREADER *r);
+ssize_t freader_slurp(int dirfd, const char *filename, unsigned char *buf, size_t len);
+unsigned char *freader_alloc(size_t len);
+int fs_is_network(int fd);
+int dreader_open(DREADER *d, int dirfd, const char *name);
+int dreader_next(DREADER *d, const char **name, int *dtype);
+void dreader_close(DREADER *d);
+int stat_at(int dirfd, const char *name, struct stat *sb, int flags, uint32_t fields, int netfs);
+unsigned int statx_mask(uint32_t fields);
+void statx_to_stat(const struct statx *sx, struct stat *sb);
+void dcache_key(DCKEY *k, const struct stat *sb, const FTS *ts);
+uint32_t dcache_lookup(DCACHE *dc, const DCKEY *k, uint32_t want, FDIGEST *dg);
+void dcache_insert(DCACHE *dc, const DCKEY *k, uint32_t fields, const FDIGEST *dg);
+void dcache_counts(DCACHE *dc, unsigned long *hits, unsigned long *misses);
+int tree_hash_at(int dirfd, const char *name, const DCKEY *key, FDIGEST *dg);
+TSTORE *tstore_open(const char *path);
+int tstore_close(TSTORE *ts);
+void manifest_begin(OBUF *ob);
+void manifest_put(OBUF *ob, const FSREC *r);
+void manifest_end(OBUF *ob);
+MANIFEST *manifest_open(const char *filename);
+void manifest_close(MANIFEST *mf);
+uint64_t manifest_rows(const MANIFEST *mf);
+uint32_t manifest_fields(const MANIFEST *mf);
+int manifest_get(const MANIFEST *mf, uint64_t row, FSREC *r);
+int64_t manifest_find(const MANIFEST *mf, const char *name);
+int print_manifest(OBUF *out, int otyp, const MANIFEST *mf, char **names, int nnames);
+const char *manifest_key(const MANIFEST *mf, uint64_t row);
+int since_open(const char *filename, uint32_t fields);
+void since_close(void);
+int since_digests(const FSREC *r, FDIGEST *dg);
+int since_keep(FSREC *r);
+void since_removed(OBUF *out, int otyp);
+void dup_add(const FSREC *r);
+void dup_report(OBUF *out, int otyp, int jobs);
+void dup_counts(unsigned long *files, unsigned long *groups, uint64_t *bytes, uint64_t *probed, uint64_t *hashed);
+int visit_dir(FSDIR *dir, const FSDIR *up, const char *name);
+int inode_digests(const FSREC *r, FDIGEST *dg);
+void inode_keep(const FSREC *r);
+void inode_reused(void);
+int inode_first(const FSREC *r);
+void sum_init(ROLLUP *s);
+void sum_add(ROLLUP *s, const FSREC *r);
+void sum_row(OBUF *out, int otyp, FSREC *r, ROLLUP *s, ROLLUP *up, int depth);
+int uring_collect(const FSDIR *dir, UENTRY *e, int n, uint32_t fields);
+void uring_close(void);
+void uring_counts(unsigned long *enters, unsigned long *requests, int *fixed);
+void filter_option(int opt, const char *arg);
+int filter_entry(const char *name, int dtype, int descend);
+int filter_stat(const FSREC *r);
+void filter_counts(unsigned long *entries, unsigned long *stated);
+void inode_counts(unsigned long *visited, unsigned long *loops, unsigned long *mounts, unsigned long *reused);
+int watch_run(const char *sockpath, int recurse, char **args, int nargs);
+int watch_query(const char *sockpath, const char *out_type, char **names, int nnames, int fd);
+void prof_init(void);
+uint64_t prof_start(void);
+uint64_t prof_lap(uint64_t t0);
+void prof_stop(int ph, uint64_t t0);
+void prof_add(int ph, uint64_t ns);
+void prof_count(uint64_t sys, uint64_t allocs, uint64_t bytes);
+void prof_event(int ph, int pt, uint64_t t0, uint64_t sys, uint64_t bytes);
+void prof_commit(int pt);
+int prof_type(mode_t mode);
+void prof_report(FILE *fp);
+int prof_report_json(const char *filename);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,265 @@
+/*
+# +-------------------------------------------------------------------+
+# | Program Name  :  filter.c                                         |
+# | Author        :  Bhaskar Bhaumik (web.bhaskar.bhaumik@gmail.com)  |
+# | Version       :  0.1                                              |
+# | Date Created  :  October 13, 2018                                 |
+# | Description   :  Entry filters (--file-type, --min-size, --newer, |
+# |                  --name, --prune ...), each tested as early in    |
+# |                  the collection as it can be.                     |
+# +-------------------------------------------------------------------+
+*/
+#define _GNU_SOURCE                     /* strptime() */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fnmatch.h>
+#include <limits.h>
+#include <time.h>
+#include <dirent.h>
+#include <stdint.h>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "filestat.h"
+
+/*
+    A record is output when it passes every filter given; filters of one
+    kind given several times (--name, --prune) are alternatives. They
+    are tested at the cheapest point of the collection:
+
+      1. filter_entry(), on the name and the type from the directory:
+         --prune and, for what is known not to be a directory, --name and
+         --file-type. What fails is neither stat'ed nor opened, and a
+         pruned directory is not read;
+      2. filter_stat(), in collect_file_stat_at() right after the stat,
+         before the owner names and the digests: the rest, on the record.
+         A directory that fails is still descended (as with find), but
+         only its path is kept; the record is flagged r->filtered.
+
+    The stat only asks for what the filters need beyond the fields (see
+    filter_fields). With --summarize, the filters pick the entries that
+    are counted, and every directory still has its row.
+*/
+int filtering;
+uint32_t filter_fields;         /* FLDM_* the filters need from the stat */
+
+static unsigned types;          /* 1 << (S_IFMT bits >> 12) of --file-type, 0 for all */
+static int have_min, have_max, have_newer, have_older;
+static uint64_t min_size, max_size;
+static struct timespec newer, older;
+static const char **names, **prunes;
+static int nnames, nprunes;
+static unsigned long nentry, nstat;
+
+#define TYPE_BIT(mode)      (1U << (((mode) & S_IFMT) >> 12))
+
+static void glob_add(const char ***list, int *n, const char *glob)
+{
+    if((*list = (const char **)realloc(*list, (*n + 1) * sizeof(char *))) == (const char **)NULL) {
+        perror(progname);
+        exit(1);
+    }
+    (*list)[(*n)++] = glob;
+    return;
+}
+
+static int glob_any(const char **list, int n, const char *name)
+{
+    int i;
+
+    for(i = 0; i < n; i++)
+        if(fnmatch(list[i], name, 0) == 0) return 1;
+    return 0;
+}
+
+/*
+    Types like find -type: f, d, p, s, c, b, in one word or separated by
+    commas. There is no l: symbolic links are followed, as everywhere.
+*/
+static int parse_types(const char *s)
+{
+    for(; *s != '\0'; s++) {
+        switch(*s) {
+            case 'f': types |= TYPE_BIT(S_IFREG); break;
+            case 'd': types |= TYPE_BIT(S_IFDIR); break;
+            case 'p': types |= TYPE_BIT(S_IFIFO); break;
+            case 's': types |= TYPE_BIT(S_IFSOCK); break;
+            case 'c': types |= TYPE_BIT(S_IFCHR); break;
+            case 'b': types |= TYPE_BIT(S_IFBLK); break;
+            case ',': break;
+            default: return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+    A point in time: an age (30s, 15m, 2h, 1d or 1w before now), a local
+    date as in the output ("2018-10-13", "2018-10-13 14:05:00", also with
+    a T), or the mtime of a file.
+*/
+static int parse_time(const char *s, struct timespec *ts)
+{
+    char *end;
+    unsigned long long v;
+    struct tm tm;
+    struct stat sb;
+    static const char *formats[] = { "%Y-%m-%d %H:%M:%S", "%Y-%m-%dT%H:%M:%S", "%Y-%m-%d %H:%M", "%Y-%m-%d", (char *)NULL };
+    int i;
+
+    errno = 0;
+    v = strtoull(s, &end, 10);
+    if(errno == 0 && end != s && end[0] != '\0' && end[1] == '\0' && strchr("smhdw", end[0]) != (char *)NULL) {
+        switch(end[0]) {
+            case 'w': v *= 7; /* fall through */
+            case 'd': v *= 24; /* fall through */
+            case 'h': v *= 60; /* fall through */
+            case 'm': v *= 60; break;
+        }
+        clock_gettime(CLOCK_REALTIME, ts);
+        ts->tv_sec -= (time_t)v;
+        return 0;
+    }
+    for(i = 0; formats[i] != (char *)NULL; i++) {
+        memset(&tm, 0, sizeof(tm));
+        if((end = strptime(s, formats[i], &tm)) != (char *)NULL && *end == '\0') {
+            tm.tm_isdst = -1;
+            ts->tv_sec = mktime(&tm);
+            ts->tv_nsec = 0;
+            return 0;
+        }
+    }
+    if(stat(s, &sb) == 0) {
+#if defined(__APPLE__) && defined(__MACH__)
+        *ts = sb.st_mtimespec;
+#else
+        *ts = sb.st_mtim;
+#endif
+        return 0;
+    }
+    return -1;
+}
+
+/* Take the argument of the filter option opt (OPT_FILE_TYPE ...); exits if it is not valid */
+void filter_option(int opt, const char *arg)
+{
+    size_t v;
+
+    switch(opt) {
+        case OPT_FILE_TYPE:
+            if(parse_types(arg) != 0) {
+                fprintf(stderr, "%s: invalid file type specified (%s); one or more of f, d, p, s, c, b.\n", progname, arg);
+                exit(1);
+            }
+            filter_fields |= FLDM(FLD_TYPE);
+            break;
+        case OPT_MIN_SIZE:
+        case OPT_MAX_SIZE:
+            if((v = parse_size(arg)) == 0 && strcmp(arg, "0") != 0) {
+                fprintf(stderr, "%s: invalid size specified (%s).\n", progname, arg);
+                exit(1);
+            }
+            if(opt == OPT_MIN_SIZE) {
+                min_size = v;
+                have_min = 1;
+            } else {
+                max_size = v;
+                have_max = 1;
+            }
+            filter_fields |= FLDM(FLD_SIZE);
+            break;
+        case OPT_NEWER:
+        case OPT_OLDER:
+            if(parse_time(arg, (opt == OPT_NEWER) ? &newer : &older) != 0) {
+                fprintf(stderr, "%s: invalid time specified (%s); an age such as 1d, a date or a file.\n", progname, arg);
+                exit(1);
+            }
+            if(opt == OPT_NEWER) have_newer = 1;
+            else have_older = 1;
+            filter_fields |= FLDM(FLD_MTIME);
+            break;
+        case OPT_NAME:
+            glob_add(&names, &nnames, arg);
+            filter_fields |= FLDM(FLD_TYPE);
+            break;
+        case OPT_PRUNE:
+            glob_add(&prunes, &nprunes, arg);
+            break;
+    }
+    filtering = 1;
+    return;
+}
+
+/* The last component of a name as shown, for the globs */
+static const char *base_name(const char *name, char *tmp, size_t len)
+{
+    size_t n = strlen(name);
+    const char *p;
+
+    while(n > 1 && name[n - 1] == DIR_PATH_CHAR) n--;
+    for(p = name + n; p > name && p[-1] != DIR_PATH_CHAR; p--)
+        ;
+    if(name[n] == '\0' || (size_t)(name + n - p) >= len) return p;
+    memcpy(tmp, p, name + n - p);
+    tmp[name + n - p] = '\0';
+    return tmp;
+}
+
+/*
+    1: whether the entry name of type dtype (DT_*, or DT_UNKNOWN) may be
+    output or, for a directory and with descend, lead to some. 0 if it
+    is to be left alone entirely.
+*/
+int filter_entry(const char *name, int dtype, int descend)
+{
+    char tmp[NAME_MAX + 1];
+    int isdir = (dtype == DT_DIR), known = (dtype != DT_UNKNOWN && dtype != DT_LNK);
+
+    if(!filtering) return 1;
+    name = base_name(name, tmp, sizeof(tmp));
+    if(nprunes > 0 && glob_any(prunes, nprunes, name)) goto skip;
+    if(!known || (isdir && (descend || sum_mode))) return 1;
+    if(types != 0 && (types & TYPE_BIT(DTTOIF(dtype))) == 0) goto skip;
+    if(nnames > 0 && !glob_any(names, nnames, name)) goto skip;
+    return 1;
+skip:
+    __atomic_add_fetch(&nentry, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+static int mtime_cmp(const FSREC *r, const struct timespec *t)
+{
+    if(r->ts.mts_sec != t->tv_sec) return (r->ts.mts_sec > t->tv_sec) ? 1 : -1;
+    return (r->ts.mts_nsec > t->tv_nsec) - (r->ts.mts_nsec < t->tv_nsec);
+}
+
+/* 2: whether the record r, stat'ed, passes the filters */
+int filter_stat(const FSREC *r)
+{
+    char tmp[NAME_MAX + 1];
+    mode_t mode = r->sb.st_mode;
+
+    if(!filtering || (sum_mode && S_ISDIR(mode))) return 1;
+    if(types != 0 && (types & TYPE_BIT(mode)) == 0) goto skip;
+    if(have_min && (uint64_t)r->sb.st_size < min_size) goto skip;
+    if(have_max && (uint64_t)r->sb.st_size > max_size) goto skip;
+    if(have_newer && mtime_cmp(r, &newer) <= 0) goto skip;
+    if(have_older && mtime_cmp(r, &older) >= 0) goto skip;
+    if(nnames > 0 && !glob_any(names, nnames, base_name(r->name, tmp, sizeof(tmp)))) goto skip;
+    return 1;
+skip:
+    __atomic_add_fetch(&nstat, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+void filter_counts(unsigned long *entries, unsigned long *stated)
+{
+    *entries = nentry;
+    *stated = nstat;
+    return;
+}
@@ -0,0 +1,727 @@
+/*
+# +-------------------------------------------------------------------+
+# | Program Name  :  format.c                                         |
+# | Author        :  Bhaskar Bhaumik (web.bhaskar.bhaumik@gmail.com)  |
+# | Version       :  0.1                                              |
+# | Date Created  :  October 13, 2018                                 |
+# | Description   :  Output formats: header, records and footer for   |
+# |                  each of the OUT_TYPE_* types.                    |
+# +-------------------------------------------------------------------+
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "filestat.h"
+
+/* Indexed by FLD_*; only the selected fields (out_fields) are written */
+char *header_text[] = {
+    "File Name",
+    "Full Path",
+    "File Size",
+    "File User",
+    "File UID",
+    "File Group",
+    "File GID",
+    "File Type",
+    "File Permission",
+    "Octal Permission",
+    "Sticky",
+    "Access Time",
+    "Modify Time",
+    "Change Time",
+    "Device ID",
+    "File Inode",
+    "Links",
+    "Block Size",
+    "Blocks",
+    "Checksum",
+    "MD5 Digest",
+    "SHA256 Digest",
+    "Tree SHA256",
+    "BLAKE3 Digest",
+    "XXH3 Digest",
+    "Change",
+    "Duplicate Group",
+    "Files",
+    "Directories",
+    "Other Entries",
+    "Oldest Modify Time",
+    "Owner Usage",
+    (char *)NULL
+};
+
+/* Names accepted by --fields */
+char *field_name[] = {
+    "name", "path", "size", "user", "uid", "group", "gid", "type",
+    "perm", "octal", "sticky", "atime", "mtime", "ctime", "dev", "inode",
+    "links", "blksize", "blocks", "cksum", "md5", "sha256", "tree", "blake3", "xxh3", "change", "dup",
+    "files", "dirs", "others", "oldest", "owners",
+    (char *)NULL
+};
+
+static char *xml_tag[] = {
+    "filename", "path", "size", "user", "uid", "group", "gid", "type",
+    "perm", "octalperm", "sticky", "atime", "mtime", "ctime", "devid", "inode",
+    "links", "blocksize", "blocks", "cksum", "md5sum", "sha256sum", "treesha256", "blake3sum", "xxh3sum", "change", "dupgroup",
+    "files", "dirs", "others", "oldest", "owners",
+    (char *)NULL
+};
+
+uint32_t out_fields = FLDM_ALL;
+
+/*
+    Parse a comma separated list of field names (or "all") into a FLDM_*
+    mask. Returns 0 and prints a message if a name is unknown.
+*/
+uint32_t parse_fields(const char *list)
+{
+    int f;
+    size_t len;
+    uint32_t mask = 0;
+    const char *p, *e;
+
+    for(p = list; *p != '\0'; p = (*e == ',') ? e + 1 : e) {
+        if((e = strchr(p, ',')) == (char *)NULL) e = p + strlen(p);
+        len = (size_t)(e - p);
+        if(len == 3 && strncasecmp(p, "all", 3) == 0) {
+            mask |= FLDM_ALL;
+            continue;
+        }
+        for(f = 0; field_name[f] != (char *)NULL; f++)
+            if(strlen(field_name[f]) == len && strncasecmp(p, field_name[f], len) == 0) break;
+        if(field_name[f] == (char *)NULL) {
+            fprintf(stderr, "%s: unknown field '%.*s'; valid fields are:", progname, (int)len, p);
+            for(f = 0; field_name[f] != (char *)NULL; f++) fprintf(stderr, " %s", field_name[f]);
+            fprintf(stderr, "\n");
+            return 0;
+        }
+        mask |= FLDM(f);
+    }
+    return mask;
+}
+
+int is_valid_out_type(char *out_type)
+{
+    if(out_type == (char *)NULL) return OUT_TYPE_UNKNOWN;
+    if(strcasecmp(out_type, "raw") == 0)      return OUT_TYPE_RAW;
+    else if(strcasecmp(out_type, "txt") == 0) return OUT_TYPE_TXT;
+    else if(strcasecmp(out_type, "tab") == 0) return OUT_TYPE_TAB;
+    else if(strcasecmp(out_type, "csv") == 0) return OUT_TYPE_CSV;
+    else if(strcasecmp(out_type, "htm") == 0) return OUT_TYPE_HTM;
+    else if(strcasecmp(out_type, "xml") == 0) return OUT_TYPE_XML;
+    else if(strcasecmp(out_type, "bin") == 0) return OUT_TYPE_BIN;
+    else return OUT_TYPE_UNKNOWN;
+}
+
+const char *file_type_str(mode_t mode)
+{
+    if(S_ISFIFO(mode)) return "fifo file";
+    else if(S_ISDIR(mode)) return "directory";
+    else if(S_ISCHR(mode)) return "character special file";
+    else if(S_ISBLK(mode)) return "block special file";
+    else if(S_ISLNK(mode)) return "symbolic link file";
+    else if(S_ISSOCK(mode)) return "socket file";
+    else return "regular file";
+}
+
+/* ls style permission string, e.g. drwxr-xr-x; perm must hold 11 chars */
+void file_perm_str(mode_t mode, char *perm)
+{
+    if(S_ISFIFO(mode)) perm[0] = 'p';
+    else if(S_ISDIR(mode)) perm[0] = 'd';
+    else if(S_ISCHR(mode)) perm[0] = 'c';
+    else if(S_ISBLK(mode)) perm[0] = 'b';
+    else if(S_ISLNK(mode)) perm[0] = 'l';
+    else if(S_ISSOCK(mode)) perm[0] = 's';
+    else perm[0] = '-';
+
+    perm[1] = (mode & S_IRUSR) ? 'r' : '-';
+    perm[2] = (mode & S_IWUSR) ? 'w' : '-';
+    perm[3] = (mode & S_IXUSR) ? 'x' : '-';
+    perm[4] = (mode & S_IRGRP) ? 'r' : '-';
+    perm[5] = (mode & S_IWGRP) ? 'w' : '-';
+    perm[6] = (mode & S_IXGRP) ? 'x' : '-';
+    perm[7] = (mode & S_IROTH) ? 'r' : '-';
+    perm[8] = (mode & S_IWOTH) ? 'w' : '-';
+    perm[9] = (mode & S_IXOTH) ? 'x' : '-';
+    perm[10] = '\0';
+
+    /* Only the first special bit is shown, as in file_sticky_str() */
+    if(mode & S_ISUID) perm[3] = 's';
+    else if(mode & S_ISGID) perm[6] = 's';
+    else if(mode & S_ISVTX) perm[9] = 't';
+    return;
+}
+
+const char *file_sticky_str(mode_t mode)
+{
+    if(mode & S_ISUID) return "set user on execution";
+    else if(mode & S_ISGID) return "set group on execution";
+    else if(mode & S_ISVTX) return "save text even after use";
+    else return "";
+}
+
+/*
+    Integer encoders; each writes at p and returns the end (no NUL).
+    Records are formatted with these rather than printf(), which parses
+    its format string for every field of every record.
+*/
+static char *put_udec(char *p, unsigned long v)
+{
+    char *e, *q;
+    unsigned long t = v;
+
+    e = p;
+    do {
+        e++;
+        t /= 10;
+    } while(t != 0);
+    q = e;
+    do {
+        *--q = (char)('0' + v % 10);
+        v /= 10;
+    } while(v != 0);
+    return e;
+}
+
+/* "%d" */
+static char *put_dec(char *p, int v)
+{
+    if(v < 0) {
+        *p++ = '-';
+        return put_udec(p, (unsigned long)(-(long)v));
+    }
+    return put_udec(p, (unsigned long)v);
+}
+
+/* "%o" */
+static char *put_oct(char *p, unsigned int v)
+{
+    char *e, *q;
+    unsigned int t = v;
+
+    e = p;
+    do {
+        e++;
+        t >>= 3;
+    } while(t != 0);
+    q = e;
+    do {
+        *--q = (char)('0' + (v & 7));
+        v >>= 3;
+    } while(v != 0);
+    return e;
+}
+
+/*
+    Output buffer. Records are encoded straight into it and it is written
+    out with one write() per OBUF_LEN bytes, or after every record when
+    the output is a terminal. With fd -1 it only collects (and grows).
+*/
+void obuf_init(OBUF *ob, int fd)
+{
+    memset(ob, 0, sizeof(OBUF));
+    ob->fd = fd;
+    ob->interactive = (fd >= 0 && isatty(fd));
+    return;
+}
+
+int obuf_flush(OBUF *ob)
+{
+    ssize_t n;
+    size_t off = 0;
+    uint64_t t0;
+
+    while(off < ob->len && ob->fd >= 0 && !ob->err) {
+        t0 = PROF_START();
+        n = write(ob->fd, ob->buf + off, ob->len - off);
+        PROF_EVENT(PH_WRITE, PT_OUTPUT, t0, 1, (n > 0) ? (uint64_t)n : 0);
+        if(n < 0) {
+            if(errno == EINTR) continue;
+            fprintf(stderr, "%s: write error: %s\n", progname, strerror(errno));
+            ob->err = 1;
+            break;
+        }
+        off += (size_t)n;
+    }
+    ob->len = 0;
+    return ob->err ? -1 : 0;
+}
+
+void obuf_free(OBUF *ob)
+{
+    free(ob->buf);
+    ob->buf = (char *)NULL;
+    ob->len = ob->cap = 0;
+    return;
+}
+
+/* Room for n more bytes at ob->buf + ob->len */
+static char *obuf_reserve(OBUF *ob, size_t n)
+{
+    size_t cap;
+
+    if(ob->len + n <= ob->cap) return ob->buf + ob->len;
+    if(ob->fd >= 0 && ob->len > 0) {
+        obuf_flush(ob);
+        if(n <= ob->cap) return ob->buf;
+    }
+    cap = (ob->cap > 0) ? ob->cap : OBUF_LEN;
+    while(cap < ob->len + n) cap *= 2;
+    if((ob->buf = (char *)realloc(ob->buf, cap)) == (char *)NULL) {
+        perror(progname);
+        exit(1);
+    }
+    ob->cap = cap;
+    return ob->buf + ob->len;
+}
+
+void obuf_write(OBUF *ob, const char *s, size_t n)
+{
+    memcpy(obuf_reserve(ob, n), s, n);
+    ob->len += n;
+    return;
+}
+
+static void ob_puts(OBUF *ob, const char *s)
+{
+    obuf_write(ob, s, strlen(s));
+    return;
+}
+
+static void ob_putc(OBUF *ob, char c)
+{
+    *obuf_reserve(ob, 1) = c;
+    ob->len++;
+    return;
+}
+
+static void ob_putd(OBUF *ob, int v)
+{
+    char *p = obuf_reserve(ob, 12);
+    ob->len += (size_t)(put_dec(p, v) - p);
+    return;
+}
+
+static void ob_putu(OBUF *ob, unsigned long v)
+{
+    char *p = obuf_reserve(ob, 24);
+    ob->len += (size_t)(put_udec(p, v) - p);
+    return;
+}
+
+static void ob_puto(OBUF *ob, unsigned int v)
+{
+    char *p = obuf_reserve(ob, 12);
+    ob->len += (size_t)(put_oct(p, v) - p);
+    return;
+}
+
+/*
+    Text of field f of a record. Strings owned by the record are returned
+    as they are; anything formatted goes into tmp (FIELD_TMPLEN bytes).
+*/
+const char *field_str(const FSREC *r, int f, char *tmp)
+{
+    int i;
+    char *e = tmp;
+    unsigned char dg8[8];
+
+    switch(f) {
+        case FLD_NAME:   return r->name;
+        case FLD_PATH:   return r->path;
+        case FLD_SIZE:
+            /* The totals of a --summarize row pass 2 GB; a file keeps the int format */
+            if(r->sum != (const ROLLUP *)NULL) e = put_udec(tmp, (unsigned long)r->sb.st_size);
+            else e = put_dec(tmp, (int)r->sb.st_size);
+            break;
+        case FLD_USER:   return r->user;
+        case FLD_UID:    e = put_dec(tmp, (int)r->sb.st_uid); break;
+        case FLD_GROUP:  return r->group;
+        case FLD_GID:    e = put_dec(tmp, (int)r->sb.st_gid); break;
+        case FLD_TYPE:   return file_type_str(r->sb.st_mode);
+        case FLD_PERM:   file_perm_str(r->sb.st_mode, tmp); return tmp;
+        case FLD_OCTAL:  e = put_oct(tmp, (unsigned int)r->sb.st_mode); break;
+        case FLD_STICKY: return file_sticky_str(r->sb.st_mode);
+        case FLD_ATIME:  return fmt_isots(r->ts.ats_sec, r->ts.ats_nsec, tmp);
+        case FLD_MTIME:  return fmt_isots(r->ts.mts_sec, r->ts.mts_nsec, tmp);
+        case FLD_CTIME:  return fmt_isots(r->ts.cts_sec, r->ts.cts_nsec, tmp);
+        case FLD_DEV:    e = put_dec(tmp, (int)r->sb.st_dev); break;
+        case FLD_INODE:  e = put_dec(tmp, (int)r->sb.st_ino); break;
+        case FLD_LINKS:  e = put_dec(tmp, (int)r->sb.st_nlink); break;
+        case FLD_BLKSIZE: e = put_dec(tmp, (int)r->sb.st_blksize); break;
+        case FLD_BLOCKS:
+            if(r->sum != (const ROLLUP *)NULL) e = put_udec(tmp, (unsigned long)r->sb.st_blocks);
+            else e = put_dec(tmp, (int)r->sb.st_blocks);
+            break;
+        case FLD_CKSUM:
+            if(r->dgstat != DG_OK) return (r->dgstat == DG_NA) ? CKSUM_NA : CKSUM_ERR;
+            e = put_udec(tmp, (unsigned long)r->dg.crc);
+            break;
+        case FLD_MD5:
+        case FLD_SHA256:
+        case FLD_TREE:
+            if(r->dgstat != DG_OK) return (r->dgstat == DG_NA) ? CKSUM_NA : CKSUM_ERR;
+            return digest2hex_r(f == FLD_MD5 ? r->dg.md5 : f == FLD_SHA256 ? r->dg.sha256 : r->dg.tree,
+                                f == FLD_MD5 ? MD5_LEN : SHA256_LEN, tmp);
+        case FLD_BLAKE3:
+            if(r->dgstat != DG_OK) return (r->dgstat == DG_NA) ? CKSUM_NA : CKSUM_ERR;
+            return digest2hex_r(r->dg.blake3, BLAKE3_LEN, tmp);
+        case FLD_XXH3:
+            if(r->dgstat != DG_OK) return (r->dgstat == DG_NA) ? CKSUM_NA : CKSUM_ERR;
+            /* Big endian, as xxhsum prints it */
+            for(i = 0; i < 8; i++) dg8[i] = (unsigned char)(r->dg.xxh3 >> (56 - 8 * i));
+            return digest2hex_r(dg8, 8, tmp);
+        case FLD_CHANGE:
+            return (r->change == CHG_ADDED) ? "added" : (r->change == CHG_REMOVED) ? "removed"
+                   : (r->change == CHG_MODIFIED) ? "modified" : "";
+        case FLD_DUP:
+            if(r->dup == 0) return "";
+            e = put_udec(tmp, r->dup);
+            break;
+        case FLD_FILES:
+        case FLD_DIRS:
+        case FLD_OTHERS:
+            if(r->sum == (const ROLLUP *)NULL) return "";
+            e = put_udec(tmp, f == FLD_FILES ? r->sum->files : f == FLD_DIRS ? r->sum->dirs : r->sum->others);
+            break;
+        case FLD_OLDEST:
+            if(r->sum == (const ROLLUP *)NULL || !r->sum->timed) return "";
+            return fmt_isots(r->sum->old_sec, r->sum->old_nsec, tmp);
+        case FLD_OWNERS:
+            if(r->sum == (const ROLLUP *)NULL || r->sum->owners == (char *)NULL) return "";
+            return r->sum->owners;
+        default:
+            break;
+    }
+    *e = '\0';
+    return tmp;
+}
+
+/* Field f, encoded in place when it is not a string of the record */
+static void ob_field(OBUF *ob, const FSREC *r, int f)
+{
+    char *p = obuf_reserve(ob, FIELD_TMPLEN);
+    const char *s = field_str(r, f, p);
+
+    if(s == p) ob->len += strlen(p);
+    else ob_puts(ob, s != (const char *)NULL ? s : "(null)");
+    return;
+}
+
+#define SEL(f)  (out_fields & FLDM(f))
+
+static void format_txt_record(OBUF *ob, const FSREC *r)
+{
+    if(SEL(FLD_NAME)) {
+        ob_puts(ob, "File Name  : ");
+        ob_field(ob, r, FLD_NAME);
+        ob_putc(ob, '\n');
+    }
+    if(SEL(FLD_PATH)) {
+        ob_puts(ob, "Full Path  : ");
+        ob_field(ob, r, FLD_PATH);
+        ob_putc(ob, '\n');
+    }
+    if(SEL(FLD_SIZE)) {
+        ob_puts(ob, "File Size  : ");
+        if(r->sum != (const ROLLUP *)NULL) ob_putu(ob, (unsigned long)r->sb.st_size);
+        else ob_putd(ob, (int)r->sb.st_size);
+        ob_puts(ob, " bytes\n");
+    }
+    if(SEL(FLD_USER)) {
+        ob_puts(ob, "File User  : ");
+        ob_field(ob, r, FLD_USER);
+        if(SEL(FLD_UID)) {
+            ob_puts(ob, " [uid ");
+            ob_putd(ob, (int)r->sb.st_uid);
+            ob_putc(ob, ']');
+        }
+        ob_putc(ob, '\n');
+    } else if(SEL(FLD_UID)) {
+        ob_puts(ob, "File UID   : ");
+        ob_putd(ob, (int)r->sb.st_uid);
+        ob_putc(ob, '\n');
+    }
+    if(SEL(FLD_GROUP)) {
+        ob_puts(ob, "File Group : ");
+        ob_field(ob, r, FLD_GROUP);
+        if(SEL(FLD_GID)) {
+            ob_puts(ob, " [gid ");
+            ob_putd(ob, (int)r->sb.st_gid);
+            ob_putc(ob, ']');
+        }
+        ob_putc(ob, '\n');
+    } else if(SEL(FLD_GID)) {
+        ob_puts(ob, "File GID   : ");
+        ob_putd(ob, (int)r->sb.st_gid);
+        ob_putc(ob, '\n');
+    }
+    if(SEL(FLD_TYPE)) {
+        ob_puts(ob, "File Type  : ");
+        ob_puts(ob, file_type_str(r->sb.st_mode));
+        ob_putc(ob, '\n');
+    }
+    if(SEL(FLD_PERM) || SEL(FLD_OCTAL) || SEL(FLD_STICKY)) {
+        ob_puts(ob, "File Access:");
+        if(SEL(FLD_PERM)) {
+            ob_putc(ob, ' ');
+            ob_field(ob, r, FLD_PERM);
+        }
+        if(SEL(FLD_OCTAL)) {
+            ob_puts(ob, " [octal ");
+            ob_puto(ob, (unsigned int)r->sb.st_mode);
+            ob_putc(ob, ']');
+        }
+        if(SEL(FLD_STICKY)) {
+            ob_putc(ob, ' ');
+            ob_puts(ob, file_sticky_str(r->sb.st_mode));
+        }
+        ob_putc(ob, '\n');
+    }
+    if(SEL(FLD_ATIME)) {
+        ob_puts(ob, "Access Time: ");
+        ob_field(ob, r, FLD_ATIME);
+        ob_puts(ob, " [time of last access]\n");
+    }
+    if(SEL(FLD_MTIME)) {
+        ob_puts(ob, "Modify Time: ");
+        ob_field(ob, r, FLD_MTIME);
+        ob_puts(ob, " [time of last data modification]\n");
+    }
+    if(SEL(FLD_CTIME)) {
+        ob_puts(ob, "Change Time: ");
+        ob_field(ob, r, FLD_CTIME);
+        ob_puts(ob, " [time of last file status change]\n");
+    }
+    if(SEL(FLD_DEV)) {
+        ob_puts(ob, "Device ID  : ");
+        ob_field(ob, r, FLD_DEV);
+        ob_putc(ob, '\n');
+    }
+    if(SEL(FLD_INODE)) {
+        ob_puts(ob, "File i-Node: ");
+        ob_field(ob, r, FLD_INODE);
+        ob_putc(ob, '\n');
+    }
+    if(SEL(FLD_LINKS)) {
+        ob_puts(ob, "Links      : ");
+        ob_field(ob, r, FLD_LINKS);
+        ob_putc(ob, '\n');
+    }
+    if(SEL(FLD_BLKSIZE)) {
+        ob_puts(ob, "Block Size : ");
+        ob_field(ob, r, FLD_BLKSIZE);
+        ob_putc(ob, '\n');
+    }
+    if(SEL(FLD_BLOCKS)) {
+        ob_puts(ob, "Blocks     : ");
+        ob_field(ob, r, FLD_BLOCKS);
+        ob_putc(ob, '\n');
+    }
+    if(SEL(FLD_CKSUM)) {
+        ob_puts(ob, "Checksum   : ");
+        ob_field(ob, r, FLD_CKSUM);
+        ob_putc(ob, '\n');
+    }
+    if(SEL(FLD_MD5)) {
+        ob_puts(ob, "MD5 Digest : ");
+        ob_field(ob, r, FLD_MD5);
+        ob_putc(ob, '\n');
+    }
+    if(SEL(FLD_SHA256)) {
+        ob_puts(ob, "SHA256 SUM : ");
+        ob_field(ob, r, FLD_SHA256);
+        ob_putc(ob, '\n');
+    }
+    if(SEL(FLD_TREE)) {
+        ob_puts(ob, "Tree SHA256: ");
+        ob_field(ob, r, FLD_TREE);
+        ob_putc(ob, '\n');
+    }
+    if(SEL(FLD_BLAKE3)) {
+        ob_puts(ob, "BLAKE3 SUM : ");
+        ob_field(ob, r, FLD_BLAKE3);
+        ob_putc(ob, '\n');
+    }
+    if(SEL(FLD_XXH3)) {
+        ob_puts(ob, "XXH3 SUM   : ");
+        ob_field(ob, r, FLD_XXH3);
+        ob_putc(ob, '\n');
+    }
+    if(SEL(FLD_CHANGE)) {
+        ob_puts(ob, "Change     : ");
+        ob_field(ob, r, FLD_CHANGE);
+        ob_putc(ob, '\n');
+    }
+    if(SEL(FLD_DUP)) {
+        ob_puts(ob, "Duplicates : ");
+        ob_field(ob, r, FLD_DUP);
+        ob_putc(ob, '\n');
+    }
+    if(SEL(FLD_FILES)) {
+        ob_puts(ob, "Files      : ");
+        ob_field(ob, r, FLD_FILES);
+        ob_putc(ob, '\n');
+    }
+    if(SEL(FLD_DIRS)) {
+        ob_puts(ob, "Directories: ");
+        ob_field(ob, r, FLD_DIRS);
+        ob_putc(ob, '\n');
+    }
+    if(SEL(FLD_OTHERS)) {
+        ob_puts(ob, "Others     : ");
+        ob_field(ob, r, FLD_OTHERS);
+        ob_putc(ob, '\n');
+    }
+    if(SEL(FLD_OLDEST)) {
+        ob_puts(ob, "Oldest Time: ");
+        ob_field(ob, r, FLD_OLDEST);
+        ob_puts(ob, " [oldest data modification]\n");
+    }
+    if(SEL(FLD_OWNERS)) {
+        ob_puts(ob, "Owners     : ");
+        ob_field(ob, r, FLD_OWNERS);
+        ob_putc(ob, '\n');
+    }
+    ob_putc(ob, '\n');
+    return;
+}
+
+/* Append the record in the otyp format to ob */
+void format_record(OBUF *ob, int otyp, const FSREC *r)
+{
+    int f, sep, first = 1;
+    uint64_t t0 = PROF_START();
+
+    switch(otyp) {
+        case OUT_TYPE_BIN:
+            manifest_put(ob, r);
+            PROF_EVENT(PH_FORMAT, prof_type(r->sb.st_mode), t0, 0, 0);
+            return;
+        case OUT_TYPE_TAB:
+        case OUT_TYPE_CSV:
+            sep = (otyp == OUT_TYPE_TAB)? '\t': ',';
+            for(f = 0; f < FLD_COUNT; f++) {
+                if(!SEL(f)) continue;
+                if(!first) ob_putc(ob, (char)sep);
+                first = 0;
+                if(f == FLD_NAME || f == FLD_PATH) {
+                    ob_putc(ob, '"');
+                    ob_field(ob, r, f);
+                    ob_putc(ob, '"');
+                } else ob_field(ob, r, f);
+            }
+            ob_puts(ob, "\r\n");
+            break;
+        case OUT_TYPE_HTM:
+            ob_puts(ob, "\t\t<tr align='left' valign='middle'>\n");
+            for(f = 0; f < FLD_COUNT; f++) {
+                if(!SEL(f)) continue;
+                ob_puts(ob, "\t\t\t<td>");
+                ob_field(ob, r, f);
+                ob_puts(ob, "</td>\n");
+            }
+            ob_puts(ob, "\t\t</tr>\n");
+            break;
+        case OUT_TYPE_XML:
+            ob_puts(ob, "\t<file>\n");
+            for(f = 0; f < FLD_COUNT; f++) {
+                if(!SEL(f)) continue;
+                ob_puts(ob, "\t\t<");
+                ob_puts(ob, xml_tag[f]);
+                ob_putc(ob, '>');
+                ob_field(ob, r, f);
+                ob_puts(ob, "</");
+                ob_puts(ob, xml_tag[f]);
+                ob_puts(ob, ">\n");
+            }
+            ob_puts(ob, "\t</file>\n");
+            break;
+        case OUT_TYPE_RAW:
+        case OUT_TYPE_TXT:
+        default:
+            format_txt_record(ob, r);
+    }
+    PROF_EVENT(PH_FORMAT, prof_type(r->sb.st_mode), t0, 0, 0);
+    if(ob->interactive) obuf_flush(ob);
+    return;
+}
+
+void print_file_stat_header(OBUF *ob, int otyp)
+{
+    int i, first = -1;
+
+    for(i = 0; header_text[i] != (char *)NULL && first < 0; i++)
+        if(SEL(i)) first = i;
+
+    switch(otyp) {
+        case OUT_TYPE_BIN:
+            manifest_begin(ob);
+            return;
+        case OUT_TYPE_TAB:
+        case OUT_TYPE_CSV:
+            for(i = 0; header_text[i] != (char *)NULL; i++) {
+                if(!SEL(i)) continue;
+                if(i != first) ob_putc(ob, (otyp == OUT_TYPE_TAB)? '\t': ',');
+                ob_puts(ob, header_text[i]);
+            }
+            ob_puts(ob, "\r\n");
+            break;
+        case OUT_TYPE_HTM:
+            ob_puts(ob, "<!doctype html public \"-//W3C//DTD HTML 4.0 Final//EN\">\n<html>\n<head>\n\t<title>File Statistics</title>\n</head>\n<body>\n\t");
+            ob_puts(ob, "<table align='left' border='1' cellspacing='0' cellpadding='2' width='100%' style='border-collapse: collapse'>\n\t\t<tr align='left' valign='middle'>\n");
+            /* The first heading is written twice, as it always has been */
+            if(first >= 0) {
+                ob_puts(ob, "\t\t\t<th>");
+                ob_puts(ob, header_text[first]);
+                ob_puts(ob, "</th>\n");
+            }
+            for(i = 0; header_text[i] != (char *)NULL; i++) {
+                if(!SEL(i)) continue;
+                ob_puts(ob, "\t\t\t<th>");
+                ob_puts(ob, header_text[i]);
+                ob_puts(ob, "</th>\n");
+            }
+            ob_puts(ob, "\t\t</tr>\n");
+            break;
+        case OUT_TYPE_XML:
+            ob_puts(ob, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<fileset>\n");
+            break;
+        case OUT_TYPE_RAW:
+        case OUT_TYPE_TXT:
+        default:
+            ob_puts(ob, "F i l e   S t a t i s t i c s\n");
+    }
+    if(ob->interactive) obuf_flush(ob);
+    return;
+}
+
+void print_file_stat_footer(OBUF *ob, int otyp)
+{
+    switch(otyp) {
+        case OUT_TYPE_BIN:
+            manifest_end(ob);
+            break;
+        case OUT_TYPE_HTM:
+            ob_puts(ob, "\t</table>\n</body>\n</html>\n");
+            break;
+        case OUT_TYPE_XML:
+            ob_puts(ob, "</fileset>\n");
+            break;
+        case OUT_TYPE_CSV:
+        case OUT_TYPE_TAB:
+        case OUT_TYPE_RAW:
+        case OUT_TYPE_TXT:
+        default:
+            break;
+    }
+    return;
+}
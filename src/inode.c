@@ -0,0 +1,253 @@
+/*
+# +-------------------------------------------------------------------+
+# | Program Name  :  inode.c                                          |
+# | Author        :  Bhaskar Bhaumik (web.bhaskar.bhaumik@gmail.com)  |
+# | Version       :  0.1                                              |
+# | Date Created  :  October 13, 2018                                 |
+# | Description   :  Visited inodes of a traversal: directories are   |
+# |                  descended once, hard links are hashed once.      |
+# +-------------------------------------------------------------------+
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "filestat.h"
+
+/*
+    Two sets of (st_dev, st_ino) pairs, open addressing with linear
+    probing, at most half full. (0, 0) is no file and marks a free slot.
+
+    dirs holds every directory that was descended into. A directory that
+    is one of its own ancestors is a loop: it is reported and not read
+    again. One met again elsewhere, through a symbolic link or a bind
+    mount, is read under each of its names, as any other directory; only
+    --summarize, which counts what is on the disk, reads it once.
+
+    files holds the digests of the files another name can lead to: those
+    with more than one link, and those in a shared directory, one that
+    was reached through a symbolic link or was met before. They are
+    reused for a name with the same size, mtime and ctime, so the second
+    name of a directory is not hashed again once the first one was read
+    through a link. links only tells whether a file with several links
+    was met, for --summarize to count it once. The traversal is all they
+    are for: filestat_batch() neither reads nor grows them.
+*/
+int one_file_system;
+
+struct ient {
+    uint64_t dev;
+    uint64_t ino;
+    void *data;                 /* struct ifile for files */
+};
+
+struct iset {
+    pthread_mutex_t lock;
+    struct ient *slot;
+    size_t nslots;
+    size_t used;
+};
+
+struct ifile {
+    DCKEY key;
+    uint32_t fields;            /* FLDM_* of dg */
+    FDIGEST dg;
+};
+
+static struct iset dirs = { PTHREAD_MUTEX_INITIALIZER, (struct ient *)NULL, 0, 0 };
+static struct iset files = { PTHREAD_MUTEX_INITIALIZER, (struct ient *)NULL, 0, 0 };
+static struct iset links = { PTHREAD_MUTEX_INITIALIZER, (struct ient *)NULL, 0, 0 };
+static unsigned long ndirs, nloops, nmounts, nreused;
+
+static uint64_t inode_hash(uint64_t dev, uint64_t ino)
+{
+    uint64_t h = ino * 0x9E3779B97F4A7C15ULL ^ dev;
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    return h;
+}
+
+static struct ient *iset_slot(struct ient *slot, size_t nslots, uint64_t dev, uint64_t ino)
+{
+    size_t i;
+
+    for(i = inode_hash(dev, ino) & (nslots - 1); ; i = (i + 1) & (nslots - 1)) {
+        if(slot[i].dev == 0 && slot[i].ino == 0) return &slot[i];
+        if(slot[i].dev == dev && slot[i].ino == ino) return &slot[i];
+    }
+}
+
+/*
+    Entry of (dev, ino) in s, which is added if add is set; NULL if it is
+    not there. *found tells whether it was. Called with s->lock held.
+*/
+static struct ient *iset_get(struct iset *s, uint64_t dev, uint64_t ino, int add, int *found)
+{
+    size_t i, n;
+    struct ient *e, *slot;
+
+    *found = 0;
+    if(s->nslots > 0) {
+        e = iset_slot(s->slot, s->nslots, dev, ino);
+        if(e->dev != 0 || e->ino != 0) {
+            *found = 1;
+            return e;
+        }
+    }
+    if(!add) return (struct ient *)NULL;
+    if(2 * (s->used + 1) > s->nslots) {
+        n = s->nslots ? 2 * s->nslots : 1024;
+        if((slot = (struct ient *)calloc(n, sizeof(struct ient))) == (struct ient *)NULL) {
+            perror(progname);
+            exit(1);
+        }
+        for(i = 0; i < s->nslots; i++) {
+            if(s->slot[i].dev == 0 && s->slot[i].ino == 0) continue;
+            *iset_slot(slot, n, s->slot[i].dev, s->slot[i].ino) = s->slot[i];
+        }
+        free(s->slot);
+        s->slot = slot;
+        s->nslots = n;
+    }
+    e = iset_slot(s->slot, s->nslots, dev, ino);
+    e->dev = dev;
+    e->ino = ino;
+    s->used++;
+    return e;
+}
+
+/*
+    Whether to read the directory open as dir->fd, an entry named name
+    of the directory up (NULL for an argument). Fills in the identity of
+    dir and links it to up, then marks it visited. Tells whether it is
+    shared: under a shared directory, met before, or itself a symbolic
+    link, the name of which is the last part of name.
+*/
+int visit_dir(FSDIR *dir, const FSDIR *up, const char *name)
+{
+    struct stat sb;
+    const FSDIR *a;
+    const char *base;
+    int found;
+
+    dir->up = up;
+    if(fstat(dir->fd, &sb) != 0) {
+        perror(name);
+        return 0;
+    }
+    dir->dev = (uint64_t)sb.st_dev;
+    dir->ino = (uint64_t)sb.st_ino;
+    if(one_file_system && up != (const FSDIR *)NULL && dir->dev != up->dev) {
+        __atomic_add_fetch(&nmounts, 1, __ATOMIC_RELAXED);
+        return 0;
+    }
+    for(a = up; a != (const FSDIR *)NULL; a = a->up) {
+        if(a->dev == dir->dev && a->ino == dir->ino) {
+            fprintf(stderr, "%s: %s: file system loop, not descended\n", progname, name);
+            __atomic_add_fetch(&nloops, 1, __ATOMIC_RELAXED);
+            return 0;
+        }
+    }
+
+    pthread_mutex_lock(&dirs.lock);
+    iset_get(&dirs, dir->dev, dir->ino, 1, &found);
+    pthread_mutex_unlock(&dirs.lock);
+    if(found && sum_mode) return 0;
+    __atomic_add_fetch(&ndirs, 1, __ATOMIC_RELAXED);
+    dir->shared = found || (up != (const FSDIR *)NULL && up->shared);
+    if(!dir->shared) {
+        base = (up != (const FSDIR *)NULL && (base = strrchr(name, DIR_PATH_CHAR)) != (const char *)NULL) ? base + 1 : name;
+        dir->shared = fstatat((up != (const FSDIR *)NULL) ? up->fd : AT_FDCWD, base, &sb, AT_SYMLINK_NOFOLLOW) == 0
+                      && S_ISLNK(sb.st_mode);
+    }
+    return 1;
+}
+
+/*
+    The digests of r kept for another link of its inode, if they are all
+    it asks for. Returns 0, or -1 if the file has to be read.
+*/
+int inode_digests(const FSREC *r, FDIGEST *dg)
+{
+    int found, rc = -1;
+    uint32_t want = r->fields & FLDM_DIGESTS;
+    struct ient *e;
+    struct ifile *f;
+    DCKEY key;
+
+    if(r->sb.st_nlink < 2 && !r->shared) return -1;
+    dcache_key(&key, &r->sb, &r->ts);
+    pthread_mutex_lock(&files.lock);
+    if((e = iset_get(&files, key.dev, key.ino, 0, &found)) != (struct ient *)NULL) {
+        f = (struct ifile *)e->data;
+        if(memcmp(&f->key, &key, sizeof(DCKEY)) == 0 && (want & ~f->fields) == 0) {
+            *dg = f->dg;
+            __atomic_add_fetch(&nreused, 1, __ATOMIC_RELAXED);
+            rc = 0;
+        }
+    }
+    pthread_mutex_unlock(&files.lock);
+    return rc;
+}
+
+/* Keep the digests of r for the other links of its inode */
+void inode_keep(const FSREC *r)
+{
+    int found;
+    struct ient *e;
+    struct ifile *f;
+    DCKEY key;
+
+    if((r->sb.st_nlink < 2 && !r->shared) || r->dgstat != DG_OK || !S_ISREG(r->sb.st_mode)) return;
+    dcache_key(&key, &r->sb, &r->ts);
+    pthread_mutex_lock(&files.lock);
+    e = iset_get(&files, key.dev, key.ino, 1, &found);
+    if((f = (struct ifile *)e->data) == (struct ifile *)NULL
+            && (f = (struct ifile *)calloc(1, sizeof(struct ifile))) == (struct ifile *)NULL) {
+        perror(progname);
+        exit(1);
+    }
+    e->data = f;
+    f->key = key;
+    f->fields = r->fields & FLDM_DIGESTS;
+    f->dg = r->dg;
+    pthread_mutex_unlock(&files.lock);
+    return;
+}
+
+/* Whether r is the first name of its inode that was met */
+int inode_first(const FSREC *r)
+{
+    int found;
+
+    if(r->sb.st_nlink < 2 || S_ISDIR(r->sb.st_mode)) return 1;
+    pthread_mutex_lock(&links.lock);
+    iset_get(&links, (uint64_t)r->sb.st_dev, (uint64_t)r->sb.st_ino, 1, &found);
+    pthread_mutex_unlock(&links.lock);
+    return !found;
+}
+
+/* Count the digests of a link taken from another one outside of the sets */
+void inode_reused(void)
+{
+    __atomic_add_fetch(&nreused, 1, __ATOMIC_RELAXED);
+    return;
+}
+
+void inode_counts(unsigned long *visited, unsigned long *loops, unsigned long *mounts, unsigned long *reused)
+{
+    *visited = ndirs;
+    *loops = nloops;
+    *mounts = nmounts;
+    *reused = nreused;
+    return;
+}
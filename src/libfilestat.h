@@ -0,0 +1,145 @@
+/*
+# +-------------------------------------------------------------------+
+# | Program Name  :  libfilestat.h                                    |
+# | Author        :  Bhaskar Bhaumik (web.bhaskar.bhaumik@gmail.com)  |
+# | Version       :  0.1                                              |
+# | Date Created  :  October 13, 2018                                 |
+# | Description   :  The interface of libfilestat.a for programs      |
+# |                  that link it: records of a list of paths.        |
+# +-------------------------------------------------------------------+
+*/
+#ifndef _LIBFILESTAT_H
+#define _LIBFILESTAT_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Output fields, in output order; indexes of header_text[] */
+#define FLD_NAME            0
+#define FLD_PATH            1
+#define FLD_SIZE            2
+#define FLD_USER            3
+#define FLD_UID             4
+#define FLD_GROUP           5
+#define FLD_GID             6
+#define FLD_TYPE            7
+#define FLD_PERM            8
+#define FLD_OCTAL           9
+#define FLD_STICKY          10
+#define FLD_ATIME           11
+#define FLD_MTIME           12
+#define FLD_CTIME           13
+#define FLD_DEV             14
+#define FLD_INODE           15
+#define FLD_LINKS           16
+#define FLD_BLKSIZE         17
+#define FLD_BLOCKS          18
+#define FLD_CKSUM           19
+#define FLD_MD5             20
+#define FLD_SHA256          21
+#define FLD_TREE            22          /* chunked tree hash, only when asked for */
+#define FLD_BLAKE3          23          /* only when asked for */
+#define FLD_XXH3            24          /* only when asked for */
+#define FLD_CHANGE          25          /* with --since only */
+#define FLD_DUP             26          /* with --duplicates only */
+#define FLD_FILES           27          /* with --summarize only */
+#define FLD_DIRS            28
+#define FLD_OTHERS          29
+#define FLD_OLDEST          30
+#define FLD_OWNERS          31
+#define FLD_COUNT           32          /* FLDM_* masks are 32 bits */
+
+#define FLDM(f)             ((uint32_t)1 << (f))
+#define FLDM_ALL            (FLDM(FLD_TREE) - 1)            /* "all", the default */
+#define FLDM_STORED         (FLDM_ALL | FLDM(FLD_TREE) | FLDM(FLD_BLAKE3) | FLDM(FLD_XXH3))  /* what a manifest can hold */
+#define FLDM_ENGINE         (FLDM(FLD_CKSUM) | FLDM(FLD_MD5) | FLDM(FLD_SHA256) | FLDM(FLD_BLAKE3) | FLDM(FLD_XXH3))
+#define FLDM_DIGESTS        (FLDM_ENGINE | FLDM(FLD_TREE))  /* the fields that read the file */
+
+#define DG_NA               0           /* not a regular file, or not asked for */
+#define DG_OK               1
+#define DG_ERR              2
+#define DG_PENDING          3           /* in a DBATCH until dbatch_flush() */
+
+#define READ_MODE_READ      0
+#define READ_MODE_MMAP      1
+#define READ_MODE_FADVISE   2
+#define READ_MODE_DIRECT    3
+#define READ_MODE_AUTO      4
+#define READ_MODE_URING     5           /* see uring.c */
+
+#define MD5_LEN             16
+#define SHA256_LEN          32
+#define BLAKE3_LEN          32
+
+#define DCACHE_KEEP_RUNS    10          /* --cache-compact: runs an unused entry survives */
+
+struct fts {
+    time_t ats_sec;
+    long ats_nsec;
+    time_t mts_sec;
+    long mts_nsec;
+    time_t cts_sec;
+    long cts_nsec;
+};
+typedef struct fts FTS;
+
+struct fdigest {
+    uint32_t crc;
+    uintmax_t length;
+    unsigned char md5[MD5_LEN];
+    unsigned char sha256[SHA256_LEN];
+    unsigned char tree[SHA256_LEN];     /* Merkle root, see tree.c */
+    unsigned char blake3[BLAKE3_LEN];
+    uint64_t xxh3;
+};
+typedef struct fdigest FDIGEST;
+
+typedef struct dcache DCACHE;
+
+/* One output record; see collect_file_stat() */
+struct fsrec {
+    const char *name;
+    uint32_t fields;            /* FLDM_* mask the record was collected for */
+    struct stat sb;
+    FTS ts;
+    char *path;
+    const char *user;           /* owned by the name cache */
+    const char *group;
+    int dgstat;                 /* DG_* */
+    FDIGEST dg;
+    int change;                 /* CHG_* */
+    unsigned long dup;          /* group of identical files with --duplicates, from 1 */
+    const struct rollup *sum;   /* totals of the row with --summarize, or NULL */
+    int err;                    /* errno of a failure, see collect_file_stat() */
+    int filtered;               /* failed a filter: not output, see filter.c */
+    int shared;                 /* found in a shared directory, see visit_dir() */
+};
+typedef struct fsrec FSREC;
+
+/*
+    What filestat_batch() reads the files with, in place of the options
+    of the program. NULL is plain reads and no digest cache. The filters
+    of the command line do not apply to the paths of a batch.
+*/
+struct fsopts {
+    int read_mode;              /* READ_MODE_*; URING reads plainly */
+    DCACHE *dcache;             /* from dcache_open(), or NULL */
+};
+typedef struct fsopts FSOPTS;
+
+int filestat_batch(const char * const *paths, size_t n, uint32_t fields, int jobs, const FSOPTS *opts, FSREC *recs);
+void filestat_batch_free(FSREC *recs, size_t n);
+DCACHE *dcache_open(const char *path, int keep_runs);
+int dcache_close(DCACHE *dc);
+char *digest2hex_r(const unsigned char *digest, int len, char *sum);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _LIBFILESTAT_H */
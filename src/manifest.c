@@ -0,0 +1,825 @@
+/*
+# +-------------------------------------------------------------------+
+# | Program Name  :  manifest.c                                       |
+# | Author        :  Bhaskar Bhaumik (web.bhaskar.bhaumik@gmail.com)  |
+# | Version       :  0.1                                              |
+# | Date Created  :  October 13, 2018                                 |
+# | Description   :  Binary columnar manifest (output type bin) and   |
+# |                  its reader, with a sorted name index.            |
+# +-------------------------------------------------------------------+
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "filestat.h"
+
+/*
+    File layout, in host byte order (endian tells it apart):
+
+        header          struct mfhdr, 64 bytes
+        section table   nsect times struct mfsect
+        sections        each starting on an 8 byte boundary
+
+    A section is a column of rows values of width bytes, or for the
+    string columns an offsets column (rows + 1 u64, into the data section)
+    and a data section of NUL terminated strings. User, group and type are
+    dictionary encoded: a u32 (u8 for type) index per row into a string
+    dictionary stored the same way. Digests are raw bytes. MF_INDEX holds
+    the row numbers (u64) sorted by name (or by path when there are no
+    names), so a name is found by binary search in the mapped file.
+    Only the sections of the fields the manifest was written with exist.
+*/
+#define MF_MAGIC            "FSMANFST"
+#define MF_VERSION          2
+#define MF_ENDIAN           0x01020304
+
+#define MF_NAME_OFF         1
+#define MF_NAME             2
+#define MF_PATH_OFF         3
+#define MF_PATH             4
+#define MF_SIZE             5
+#define MF_USER             6
+#define MF_USER_DICT_OFF    7
+#define MF_USER_DICT        8
+#define MF_UID              9
+#define MF_GROUP            10
+#define MF_GROUP_DICT_OFF   11
+#define MF_GROUP_DICT       12
+#define MF_GID              13
+#define MF_TYPE             14
+#define MF_TYPE_DICT_OFF    15
+#define MF_TYPE_DICT        16
+#define MF_MODE             17
+#define MF_ATIME            18
+#define MF_ATIME_NS         19
+#define MF_MTIME            20
+#define MF_MTIME_NS         21
+#define MF_CTIME            22
+#define MF_CTIME_NS         23
+#define MF_DEV              24
+#define MF_INODE            25
+#define MF_LINKS            26
+#define MF_BLKSIZE          27
+#define MF_BLOCKS           28
+#define MF_DGSTAT           29
+#define MF_CKSUM            30
+#define MF_MD5              31
+#define MF_SHA256           32
+#define MF_INDEX            33
+#define MF_TREE             34
+#define MF_BLAKE3           35
+#define MF_XXH3             36
+#define MF_SECTIONS         37
+
+struct mfhdr {
+    char magic[8];
+    uint32_t version;
+    uint32_t endian;
+    uint64_t rows;
+    uint32_t fields;            /* FLDM_* mask */
+    uint32_t nsect;
+    uint64_t reserved[4];
+};
+
+struct mfsect {
+    uint32_t id;
+    uint32_t width;             /* bytes per value; 1 for string data */
+    uint64_t offset;
+    uint64_t length;
+};
+
+/*
+    Writer. While the tree is walked, every record is appended to a
+    temporary row log (one struct mfrow and its strings); the columns can
+    only be written once all rows are known, in manifest_end().
+*/
+struct mfrow {
+    uint32_t reclen;            /* with the strings, a multiple of 8 */
+    uint32_t mode;
+    uint32_t uid;
+    uint32_t gid;
+    uint32_t blksize;
+    uint32_t crc;
+    uint32_t ansec;
+    uint32_t mnsec;
+    uint32_t cnsec;
+    uint32_t dgstat;
+    int64_t size;
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t nlink;
+    int64_t blocks;
+    int64_t asec;
+    int64_t msec;
+    int64_t csec;
+    unsigned char md5[MD5_LEN];
+    unsigned char sha256[SHA256_LEN];
+    unsigned char tree[SHA256_LEN];
+    unsigned char blake3[BLAKE3_LEN];
+    uint64_t xxh3;
+    uint32_t len[4];            /* name, path, user, group */
+};
+
+#define ROW_NAME            0
+#define ROW_PATH            1
+#define ROW_USER            2
+#define ROW_GROUP           3
+
+static int final_fd = -1;
+static FILE *row_log = (FILE *)NULL;
+
+/* Send the records of ob to a row log until manifest_end() */
+void manifest_begin(OBUF *ob)
+{
+    obuf_flush(ob);
+    if((row_log = tmpfile()) == (FILE *)NULL) {
+        fprintf(stderr, "%s: can't create a temporary file: %s\n", progname, strerror(errno));
+        exit(1);
+    }
+    final_fd = ob->fd;
+    ob->fd = fileno(row_log);
+    ob->interactive = 0;
+    return;
+}
+
+void manifest_put(OBUF *ob, const FSREC *r)
+{
+    int i;
+    struct mfrow m;
+    const char *s[4];
+    static const char pad[8];
+
+    memset(&m, 0, sizeof(m));
+    s[ROW_NAME] = r->name;
+    s[ROW_PATH] = r->path;
+    s[ROW_USER] = r->user;
+    s[ROW_GROUP] = r->group;
+    m.reclen = sizeof(m);
+    for(i = 0; i < 4; i++) {
+        m.len[i] = (s[i] != (const char *)NULL) ? (uint32_t)strlen(s[i]) : 0;
+        m.reclen += m.len[i] + 1;
+    }
+    m.reclen = (m.reclen + 7) & ~7U;
+    m.mode = (uint32_t)r->sb.st_mode;
+    m.uid = (uint32_t)r->sb.st_uid;
+    m.gid = (uint32_t)r->sb.st_gid;
+    m.blksize = (uint32_t)r->sb.st_blksize;
+    m.size = (int64_t)r->sb.st_size;
+    m.dev = (uint64_t)r->sb.st_dev;
+    m.ino = (uint64_t)r->sb.st_ino;
+    m.nlink = (uint64_t)r->sb.st_nlink;
+    m.blocks = (int64_t)r->sb.st_blocks;
+    m.asec = (int64_t)r->ts.ats_sec;
+    m.ansec = (uint32_t)r->ts.ats_nsec;
+    m.msec = (int64_t)r->ts.mts_sec;
+    m.mnsec = (uint32_t)r->ts.mts_nsec;
+    m.csec = (int64_t)r->ts.cts_sec;
+    m.cnsec = (uint32_t)r->ts.cts_nsec;
+    m.dgstat = (uint32_t)r->dgstat;
+    if(r->dgstat == DG_OK) {
+        m.crc = r->dg.crc;
+        memcpy(m.md5, r->dg.md5, MD5_LEN);
+        memcpy(m.sha256, r->dg.sha256, SHA256_LEN);
+        memcpy(m.tree, r->dg.tree, SHA256_LEN);
+        memcpy(m.blake3, r->dg.blake3, BLAKE3_LEN);
+        m.xxh3 = r->dg.xxh3;
+    }
+
+    obuf_write(ob, (const char *)&m, sizeof(m));
+    for(i = 0; i < 4; i++) {
+        if(m.len[i] > 0) obuf_write(ob, s[i], m.len[i]);
+        obuf_write(ob, pad, 1);
+    }
+    i = (int)((sizeof(m) + m.len[0] + m.len[1] + m.len[2] + m.len[3] + 4) & 7);
+    if(i != 0) obuf_write(ob, pad, 8 - i);
+    return;
+}
+
+/* String dictionary of the writer; strings point into the row log */
+struct mfdict {
+    const char **s;
+    uint32_t n;
+    uint32_t cap;
+    uint32_t *slot;             /* open addressing, index + 1 */
+    uint32_t nslot;
+    uint64_t bytes;
+};
+
+static uint32_t str_hash(const char *s)
+{
+    uint32_t h = 2166136261U;
+    while(*s) h = (h ^ (unsigned char)*s++) * 16777619U;
+    return h;
+}
+
+static uint32_t dict_index(struct mfdict *d, const char *s)
+{
+    uint32_t i, h;
+
+    if(d->n * 2 >= d->nslot) {
+        /* Grow and rehash */
+        free(d->slot);
+        d->nslot = d->nslot ? d->nslot * 2 : 64;
+        if((d->slot = (uint32_t *)calloc(d->nslot, sizeof(uint32_t))) == (uint32_t *)NULL) {
+            perror(progname);
+            exit(1);
+        }
+        for(i = 0; i < d->n; i++) {
+            for(h = str_hash(d->s[i]) & (d->nslot - 1); d->slot[h] != 0; h = (h + 1) & (d->nslot - 1));
+            d->slot[h] = i + 1;
+        }
+    }
+    for(h = str_hash(s) & (d->nslot - 1); d->slot[h] != 0; h = (h + 1) & (d->nslot - 1))
+        if(strcmp(d->s[d->slot[h] - 1], s) == 0) return d->slot[h] - 1;
+    if(d->n == d->cap) {
+        d->cap = d->cap ? d->cap * 2 : 64;
+        if((d->s = (const char **)realloc(d->s, d->cap * sizeof(char *))) == (const char **)NULL) {
+            perror(progname);
+            exit(1);
+        }
+    }
+    d->s[d->n] = s;
+    d->slot[h] = d->n + 1;
+    d->bytes += strlen(s) + 1;
+    return d->n++;
+}
+
+static void dict_free(struct mfdict *d)
+{
+    free(d->s);
+    free(d->slot);
+    memset(d, 0, sizeof(struct mfdict));
+    return;
+}
+
+struct mfwriter {
+    const unsigned char *log;
+    uint64_t *roff;             /* offset of every row in the log */
+    uint64_t rows;
+    uint64_t bytes[2];          /* name and path data */
+    int key;                    /* ROW_NAME or ROW_PATH, for the index */
+    struct mfdict dict[3];      /* user, group, type */
+};
+
+static const struct mfwriter *sort_w;
+
+static const char *row_str(const unsigned char *row, int k)
+{
+    int i;
+    const struct mfrow *m = (const struct mfrow *)row;
+    const char *s = (const char *)(row + sizeof(struct mfrow));
+    for(i = 0; i < k; i++) s += m->len[i] + 1;
+    return s;
+}
+
+static int cmp_rows(const void *a, const void *b)
+{
+    uint64_t ra = *(const uint64_t *)a, rb = *(const uint64_t *)b;
+    return strcmp(row_str(sort_w->log + sort_w->roff[ra], sort_w->key),
+                  row_str(sort_w->log + sort_w->roff[rb], sort_w->key));
+}
+
+/* Width of a fixed width section, or 0 if the fields do not have it */
+static uint32_t sect_width(int id, uint32_t fields)
+{
+    switch(id) {
+        case MF_NAME_OFF:   return (fields & FLDM(FLD_NAME)) ? 8 : 0;
+        case MF_PATH_OFF:   return (fields & FLDM(FLD_PATH)) ? 8 : 0;
+        case MF_SIZE:       return (fields & FLDM(FLD_SIZE)) ? 8 : 0;
+        case MF_USER:       return (fields & FLDM(FLD_USER)) ? 4 : 0;
+        case MF_UID:        return (fields & FLDM(FLD_UID)) ? 4 : 0;
+        case MF_GROUP:      return (fields & FLDM(FLD_GROUP)) ? 4 : 0;
+        case MF_GID:        return (fields & FLDM(FLD_GID)) ? 4 : 0;
+        case MF_TYPE:       return (fields & FLDM(FLD_TYPE)) ? 1 : 0;
+        case MF_MODE:       return (fields & (FLDM(FLD_PERM) | FLDM(FLD_OCTAL) | FLDM(FLD_STICKY))) ? 4 : 0;
+        case MF_ATIME:      return (fields & FLDM(FLD_ATIME)) ? 8 : 0;
+        case MF_ATIME_NS:   return (fields & FLDM(FLD_ATIME)) ? 4 : 0;
+        case MF_MTIME:      return (fields & FLDM(FLD_MTIME)) ? 8 : 0;
+        case MF_MTIME_NS:   return (fields & FLDM(FLD_MTIME)) ? 4 : 0;
+        case MF_CTIME:      return (fields & FLDM(FLD_CTIME)) ? 8 : 0;
+        case MF_CTIME_NS:   return (fields & FLDM(FLD_CTIME)) ? 4 : 0;
+        case MF_DEV:        return (fields & FLDM(FLD_DEV)) ? 8 : 0;
+        case MF_INODE:      return (fields & FLDM(FLD_INODE)) ? 8 : 0;
+        case MF_LINKS:      return (fields & FLDM(FLD_LINKS)) ? 8 : 0;
+        case MF_BLKSIZE:    return (fields & FLDM(FLD_BLKSIZE)) ? 4 : 0;
+        case MF_BLOCKS:     return (fields & FLDM(FLD_BLOCKS)) ? 8 : 0;
+        case MF_DGSTAT:     return (fields & FLDM_DIGESTS) ? 1 : 0;
+        case MF_CKSUM:      return (fields & FLDM(FLD_CKSUM)) ? 4 : 0;
+        case MF_MD5:        return (fields & FLDM(FLD_MD5)) ? MD5_LEN : 0;
+        case MF_SHA256:     return (fields & FLDM(FLD_SHA256)) ? SHA256_LEN : 0;
+        case MF_INDEX:      return (fields & (FLDM(FLD_NAME) | FLDM(FLD_PATH))) ? 8 : 0;
+        case MF_TREE:       return (fields & FLDM(FLD_TREE)) ? SHA256_LEN : 0;
+        case MF_BLAKE3:     return (fields & FLDM(FLD_BLAKE3)) ? BLAKE3_LEN : 0;
+        case MF_XXH3:       return (fields & FLDM(FLD_XXH3)) ? 8 : 0;
+        default:            return 0;
+    }
+}
+
+/* The dictionary (0 user, 1 group, 2 type) a section belongs to, or -1 */
+static int sect_dict(int id)
+{
+    switch(id) {
+        case MF_USER: case MF_USER_DICT_OFF: case MF_USER_DICT: return 0;
+        case MF_GROUP: case MF_GROUP_DICT_OFF: case MF_GROUP_DICT: return 1;
+        case MF_TYPE: case MF_TYPE_DICT_OFF: case MF_TYPE_DICT: return 2;
+        default: return -1;
+    }
+}
+
+static const int dict_column[3] = { MF_USER, MF_GROUP, MF_TYPE };
+
+/*
+    Width and length of section id for the fields. Returns 0 if a manifest
+    of those fields does not have the section.
+*/
+static int sect_size(const struct mfwriter *w, int id, uint32_t fields, uint32_t *width, uint64_t *length)
+{
+    int d = sect_dict(id);
+
+    switch(id) {
+        case MF_NAME:
+        case MF_PATH:
+            *width = 1;
+            *length = w->bytes[id == MF_PATH];
+            return sect_width(id - 1, fields) != 0;
+        case MF_USER_DICT_OFF:
+        case MF_GROUP_DICT_OFF:
+        case MF_TYPE_DICT_OFF:
+            *width = 8;
+            *length = 8 * ((uint64_t)w->dict[d].n + 1);
+            return sect_width(dict_column[d], fields) != 0;
+        case MF_USER_DICT:
+        case MF_GROUP_DICT:
+        case MF_TYPE_DICT:
+            *width = 1;
+            *length = w->dict[d].bytes;
+            return sect_width(dict_column[d], fields) != 0;
+        case MF_NAME_OFF:
+        case MF_PATH_OFF:
+            *width = 8;
+            *length = 8 * (w->rows + 1);
+            return sect_width(id, fields) != 0;
+        default:
+            *width = sect_width(id, fields);
+            *length = (uint64_t)*width * w->rows;
+            return *width != 0;
+    }
+}
+
+/* Value of the fixed width section id for a row of the log */
+static void sect_value(struct mfwriter *w, int id, const unsigned char *row, unsigned char *v)
+{
+    const struct mfrow *m = (const struct mfrow *)row;
+    uint32_t u32;
+    uint64_t u64;
+
+    switch(id) {
+        case MF_USER:       u32 = dict_index(&w->dict[0], row_str(row, ROW_USER)); break;
+        case MF_UID:        u32 = m->uid; break;
+        case MF_GROUP:      u32 = dict_index(&w->dict[1], row_str(row, ROW_GROUP)); break;
+        case MF_GID:        u32 = m->gid; break;
+        case MF_TYPE:       *v = (unsigned char)dict_index(&w->dict[2], file_type_str((mode_t)m->mode)); return;
+        case MF_MODE:       u32 = m->mode; break;
+        case MF_ATIME_NS:   u32 = m->ansec; break;
+        case MF_MTIME_NS:   u32 = m->mnsec; break;
+        case MF_CTIME_NS:   u32 = m->cnsec; break;
+        case MF_BLKSIZE:    u32 = m->blksize; break;
+        case MF_CKSUM:      u32 = m->crc; break;
+        case MF_DGSTAT:     *v = (unsigned char)m->dgstat; return;
+        case MF_MD5:        memcpy(v, m->md5, MD5_LEN); return;
+        case MF_SHA256:     memcpy(v, m->sha256, SHA256_LEN); return;
+        case MF_TREE:       memcpy(v, m->tree, SHA256_LEN); return;
+        case MF_BLAKE3:     memcpy(v, m->blake3, BLAKE3_LEN); return;
+        case MF_XXH3:       memcpy(v, &m->xxh3, 8); return;
+        case MF_SIZE:       u64 = (uint64_t)m->size; memcpy(v, &u64, 8); return;
+        case MF_ATIME:      u64 = (uint64_t)m->asec; memcpy(v, &u64, 8); return;
+        case MF_MTIME:      u64 = (uint64_t)m->msec; memcpy(v, &u64, 8); return;
+        case MF_CTIME:      u64 = (uint64_t)m->csec; memcpy(v, &u64, 8); return;
+        case MF_DEV:        u64 = m->dev; memcpy(v, &u64, 8); return;
+        case MF_INODE:      u64 = m->ino; memcpy(v, &u64, 8); return;
+        case MF_LINKS:      u64 = m->nlink; memcpy(v, &u64, 8); return;
+        case MF_BLOCKS:     u64 = (uint64_t)m->blocks; memcpy(v, &u64, 8); return;
+        default:            u32 = 0; break;
+    }
+    memcpy(v, &u32, 4);
+    return;
+}
+
+static void write_pad(OBUF *ob, uint64_t len)
+{
+    static const char zero[8];
+    if(len & 7) obuf_write(ob, zero, 8 - (len & 7));
+    return;
+}
+
+static void write_section(OBUF *ob, struct mfwriter *w, int id)
+{
+    int d, k;
+    uint32_t i, width;
+    uint64_t r, off, length;
+    uint64_t *idx;
+    const char *s;
+    unsigned char v[SHA256_LEN];
+
+    sect_size(w, id, out_fields, &width, &length);
+    switch(id) {
+        case MF_NAME_OFF:
+        case MF_PATH_OFF:
+            k = (id == MF_NAME_OFF) ? ROW_NAME : ROW_PATH;
+            for(r = 0, off = 0; r <= w->rows; r++) {
+                obuf_write(ob, (const char *)&off, 8);
+                if(r < w->rows) off += ((const struct mfrow *)(w->log + w->roff[r]))->len[k] + 1;
+            }
+            break;
+        case MF_NAME:
+        case MF_PATH:
+            k = (id == MF_NAME) ? ROW_NAME : ROW_PATH;
+            for(r = 0; r < w->rows; r++) {
+                s = row_str(w->log + w->roff[r], k);
+                obuf_write(ob, s, strlen(s) + 1);
+            }
+            break;
+        case MF_USER_DICT_OFF:
+        case MF_GROUP_DICT_OFF:
+        case MF_TYPE_DICT_OFF:
+            d = sect_dict(id);
+            for(i = 0, off = 0; i <= w->dict[d].n; i++) {
+                obuf_write(ob, (const char *)&off, 8);
+                if(i < w->dict[d].n) off += strlen(w->dict[d].s[i]) + 1;
+            }
+            break;
+        case MF_USER_DICT:
+        case MF_GROUP_DICT:
+        case MF_TYPE_DICT:
+            d = sect_dict(id);
+            for(i = 0; i < w->dict[d].n; i++)
+                obuf_write(ob, w->dict[d].s[i], strlen(w->dict[d].s[i]) + 1);
+            break;
+        case MF_INDEX:
+            if((idx = (uint64_t *)malloc((w->rows + 1) * sizeof(uint64_t))) == (uint64_t *)NULL) {
+                perror(progname);
+                exit(1);
+            }
+            for(r = 0; r < w->rows; r++) idx[r] = r;
+            sort_w = w;
+            qsort(idx, w->rows, sizeof(uint64_t), cmp_rows);
+            obuf_write(ob, (const char *)idx, w->rows * sizeof(uint64_t));
+            free(idx);
+            break;
+        default:
+            for(r = 0; r < w->rows; r++) {
+                sect_value(w, id, w->log + w->roff[r], v);
+                obuf_write(ob, (const char *)v, width);
+            }
+            break;
+    }
+    write_pad(ob, length);
+    return;
+}
+
+/*
+    Write the manifest of the logged rows to the real output of ob. The
+    dictionaries are built in a first pass over the log, so the section
+    table with all the offsets goes out first and the output does not
+    have to be seekable.
+*/
+void manifest_end(OBUF *ob)
+{
+    int d, id;
+    uint32_t width, nsect = 0;
+    uint64_t r, pos, off, length, cap = 0;
+    size_t loglen;
+    struct mfwriter w;
+    struct mfhdr h;
+    struct mfsect sect[MF_SECTIONS];
+    const struct mfrow *m;
+
+    obuf_flush(ob);
+    ob->fd = final_fd;
+    memset(&w, 0, sizeof(w));
+    w.key = (out_fields & FLDM(FLD_NAME)) ? ROW_NAME : ROW_PATH;
+
+    loglen = (size_t)lseek(fileno(row_log), 0, SEEK_END);
+    if(loglen > 0) {
+        w.log = (const unsigned char *)mmap(NULL, loglen, PROT_READ, MAP_PRIVATE, fileno(row_log), 0);
+        if(w.log == (const unsigned char *)MAP_FAILED) {
+            fprintf(stderr, "%s: can't map the temporary file: %s\n", progname, strerror(errno));
+            exit(1);
+        }
+    }
+    for(pos = 0; pos + sizeof(struct mfrow) <= loglen; pos += m->reclen) {
+        m = (const struct mfrow *)(w.log + pos);
+        if(w.rows == cap) {
+            cap = cap ? 2 * cap : 1024;
+            if((w.roff = (uint64_t *)realloc(w.roff, cap * sizeof(uint64_t))) == (uint64_t *)NULL) {
+                perror(progname);
+                exit(1);
+            }
+        }
+        w.roff[w.rows++] = pos;
+        w.bytes[0] += m->len[ROW_NAME] + 1;
+        w.bytes[1] += m->len[ROW_PATH] + 1;
+        if(out_fields & FLDM(FLD_USER)) dict_index(&w.dict[0], row_str(w.log + pos, ROW_USER));
+        if(out_fields & FLDM(FLD_GROUP)) dict_index(&w.dict[1], row_str(w.log + pos, ROW_GROUP));
+        if(out_fields & FLDM(FLD_TYPE)) dict_index(&w.dict[2], file_type_str((mode_t)m->mode));
+    }
+
+    for(id = 1; id < MF_SECTIONS; id++) {
+        if(!sect_size(&w, id, out_fields, &width, &length)) continue;
+        sect[nsect].id = (uint32_t)id;
+        sect[nsect].width = width;
+        sect[nsect].length = length;
+        nsect++;
+    }
+    off = sizeof(h) + (((uint64_t)nsect * sizeof(struct mfsect) + 7) & ~(uint64_t)7);
+    for(r = 0; r < nsect; r++) {
+        sect[r].offset = off;
+        off += (sect[r].length + 7) & ~(uint64_t)7;
+    }
+
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, MF_MAGIC, 8);
+    h.version = MF_VERSION;
+    h.endian = MF_ENDIAN;
+    h.rows = w.rows;
+    h.fields = out_fields & FLDM_STORED;
+    h.nsect = nsect;
+    obuf_write(ob, (const char *)&h, sizeof(h));
+    obuf_write(ob, (const char *)sect, nsect * sizeof(struct mfsect));
+    write_pad(ob, nsect * sizeof(struct mfsect));
+    for(r = 0; r < nsect; r++) write_section(ob, &w, (int)sect[r].id);
+    obuf_flush(ob);
+
+    if(loglen > 0) munmap((void *)w.log, loglen);
+    fclose(row_log);
+    row_log = (FILE *)NULL;
+    free(w.roff);
+    for(d = 0; d < 3; d++) dict_free(&w.dict[d]);
+    return;
+}
+
+/*
+    Reader. The file is mapped and the records are read straight out of
+    the columns; only the type dictionary is decoded when it is opened.
+*/
+struct manifest {
+    const unsigned char *map;
+    size_t len;
+    uint64_t rows;
+    uint32_t fields;
+    const unsigned char *sect[MF_SECTIONS];
+    uint64_t slen[MF_SECTIONS];
+    uint64_t ndict[3];
+    mode_t type_mode[256];      /* S_IF* of the type dictionary entries */
+};
+
+static const char *mf_str(const MANIFEST *mf, int off_id, uint64_t i)
+{
+    uint64_t off;
+    memcpy(&off, mf->sect[off_id] + 8 * i, 8);
+    return (const char *)mf->sect[off_id + 1] + off;
+}
+
+static uint64_t mf_u64(const MANIFEST *mf, int id, uint64_t row)
+{
+    uint64_t v;
+    memcpy(&v, mf->sect[id] + 8 * row, 8);
+    return v;
+}
+
+static uint32_t mf_u32(const MANIFEST *mf, int id, uint64_t row)
+{
+    uint32_t v;
+    memcpy(&v, mf->sect[id] + 4 * row, 4);
+    return v;
+}
+
+/* Check that the n strings of an offsets section lie in its data section */
+static int mf_check_strings(const MANIFEST *mf, int off_id, uint64_t n)
+{
+    uint64_t i, off, len = mf->slen[off_id + 1];
+    const unsigned char *data = mf->sect[off_id + 1];
+
+    if(mf->sect[off_id] == NULL || data == NULL || mf->slen[off_id] != 8 * (n + 1)) return -1;
+    for(i = 0; i < n; i++) {
+        memcpy(&off, mf->sect[off_id] + 8 * i, 8);
+        if(off >= len || memchr(data + off, '\0', len - off) == NULL) return -1;
+    }
+    return 0;
+}
+
+/*
+    Map and check the manifest filename.
+    Returns NULL with errno set; EINVAL if it is not a valid manifest.
+*/
+MANIFEST *manifest_open(const char *filename)
+{
+    int fd, d, id;
+    uint32_t i, width;
+    struct stat sb;
+    struct mfhdr h;
+    struct mfsect s;
+    MANIFEST *mf;
+    static const mode_t modes[] = { S_IFREG, S_IFDIR, S_IFLNK, S_IFIFO, S_IFCHR, S_IFBLK, S_IFSOCK };
+
+    if((fd = open(filename, O_RDONLY | O_CLOEXEC)) < 0) return (MANIFEST *)NULL;
+    if(fstat(fd, &sb) != 0 || (mf = (MANIFEST *)calloc(1, sizeof(MANIFEST))) == (MANIFEST *)NULL) {
+        close(fd);
+        return (MANIFEST *)NULL;
+    }
+    if((uint64_t)sb.st_size < sizeof(h)) {
+        close(fd);
+        goto invalid;
+    }
+    mf->len = (size_t)sb.st_size;
+    mf->map = (const unsigned char *)mmap(NULL, mf->len, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(mf->map == (const unsigned char *)MAP_FAILED) {
+        mf->map = (const unsigned char *)NULL;
+        manifest_close(mf);
+        return (MANIFEST *)NULL;
+    }
+
+    memcpy(&h, mf->map, sizeof(h));
+    if(memcmp(h.magic, MF_MAGIC, 8) != 0 || (h.version != 1 && h.version != MF_VERSION) || h.endian != MF_ENDIAN
+            || h.nsect >= MF_SECTIONS || sizeof(h) + (uint64_t)h.nsect * sizeof(s) > mf->len)
+        goto invalid;
+    mf->rows = h.rows;
+    /* Version 1 had no tree column; its bit was the change field then */
+    mf->fields = h.fields & (h.version == 1 ? FLDM_ALL : FLDM_STORED);
+    for(i = 0; i < h.nsect; i++) {
+        memcpy(&s, mf->map + sizeof(h) + i * sizeof(s), sizeof(s));
+        if(s.id == 0 || s.id >= MF_SECTIONS || (s.offset & 7) || s.offset > mf->len || s.length > mf->len - s.offset)
+            goto invalid;
+        mf->sect[s.id] = mf->map + s.offset;
+        mf->slen[s.id] = s.length;
+    }
+
+    /* Every fixed width column of the fields, one value per row */
+    for(id = 1; id < MF_SECTIONS; id++) {
+        if(id == MF_NAME_OFF || id == MF_PATH_OFF) continue;
+        if((d = sect_dict(id)) >= 0 && id != dict_column[d]) continue;
+        if((width = sect_width(id, mf->fields)) == 0) continue;
+        if(mf->sect[id] == NULL || mf->slen[id] / width != mf->rows) goto invalid;
+    }
+    if((mf->fields & FLDM(FLD_NAME)) && mf_check_strings(mf, MF_NAME_OFF, mf->rows) != 0) goto invalid;
+    if((mf->fields & FLDM(FLD_PATH)) && mf_check_strings(mf, MF_PATH_OFF, mf->rows) != 0) goto invalid;
+    for(d = 0; d < 3; d++) {
+        id = dict_column[d];
+        if(sect_width(id, mf->fields) == 0) continue;
+        if(mf->slen[id + 1] < 8) goto invalid;
+        mf->ndict[d] = mf->slen[id + 1] / 8 - 1;
+        if(mf_check_strings(mf, id + 1, mf->ndict[d]) != 0) goto invalid;
+    }
+    if(mf->ndict[2] > 256) goto invalid;
+    for(i = 0; i < mf->ndict[2]; i++) {
+        mf->type_mode[i] = 0;
+        for(d = 0; d < (int)(sizeof(modes) / sizeof(modes[0])); d++)
+            if(strcmp(file_type_str(modes[d]), mf_str(mf, MF_TYPE_DICT_OFF, i)) == 0) mf->type_mode[i] = modes[d];
+    }
+    return mf;
+
+invalid:
+    manifest_close(mf);
+    errno = EINVAL;
+    return (MANIFEST *)NULL;
+}
+
+void manifest_close(MANIFEST *mf)
+{
+    if(mf == (MANIFEST *)NULL) return;
+    if(mf->map != (const unsigned char *)NULL) munmap((void *)mf->map, mf->len);
+    free(mf);
+    return;
+}
+
+uint64_t manifest_rows(const MANIFEST *mf)
+{
+    return mf->rows;
+}
+
+uint32_t manifest_fields(const MANIFEST *mf)
+{
+    return mf->fields;
+}
+
+/*
+    Fill r with a row of the manifest. The strings of the record point
+    into the mapping, so it must not be given to free_file_stat().
+    Returns 0, or -1 if there is no such row.
+*/
+int manifest_get(const MANIFEST *mf, uint64_t row, FSREC *r)
+{
+    uint32_t i;
+
+    if(row >= mf->rows) return -1;
+    memset(r, 0, sizeof(FSREC));
+    r->fields = mf->fields;
+    if(mf->fields & FLDM(FLD_NAME)) r->name = mf_str(mf, MF_NAME_OFF, row);
+    if(mf->fields & FLDM(FLD_PATH)) r->path = (char *)mf_str(mf, MF_PATH_OFF, row);
+    if(mf->sect[MF_SIZE]) r->sb.st_size = (off_t)mf_u64(mf, MF_SIZE, row);
+    if(mf->sect[MF_USER] && (i = mf_u32(mf, MF_USER, row)) < mf->ndict[0])
+        r->user = mf_str(mf, MF_USER_DICT_OFF, i);
+    if(mf->sect[MF_UID]) r->sb.st_uid = (uid_t)mf_u32(mf, MF_UID, row);
+    if(mf->sect[MF_GROUP] && (i = mf_u32(mf, MF_GROUP, row)) < mf->ndict[1])
+        r->group = mf_str(mf, MF_GROUP_DICT_OFF, i);
+    if(mf->sect[MF_GID]) r->sb.st_gid = (gid_t)mf_u32(mf, MF_GID, row);
+    if(mf->sect[MF_MODE]) r->sb.st_mode = (mode_t)mf_u32(mf, MF_MODE, row);
+    else if(mf->sect[MF_TYPE] && mf->sect[MF_TYPE][row] < mf->ndict[2])
+        r->sb.st_mode = mf->type_mode[mf->sect[MF_TYPE][row]];
+    if(mf->sect[MF_ATIME]) {
+        r->ts.ats_sec = (time_t)mf_u64(mf, MF_ATIME, row);
+        r->ts.ats_nsec = (long)mf_u32(mf, MF_ATIME_NS, row);
+    }
+    if(mf->sect[MF_MTIME]) {
+        r->ts.mts_sec = (time_t)mf_u64(mf, MF_MTIME, row);
+        r->ts.mts_nsec = (long)mf_u32(mf, MF_MTIME_NS, row);
+    }
+    if(mf->sect[MF_CTIME]) {
+        r->ts.cts_sec = (time_t)mf_u64(mf, MF_CTIME, row);
+        r->ts.cts_nsec = (long)mf_u32(mf, MF_CTIME_NS, row);
+    }
+    if(mf->sect[MF_DEV]) r->sb.st_dev = (dev_t)mf_u64(mf, MF_DEV, row);
+    if(mf->sect[MF_INODE]) r->sb.st_ino = (ino_t)mf_u64(mf, MF_INODE, row);
+    if(mf->sect[MF_LINKS]) r->sb.st_nlink = (nlink_t)mf_u64(mf, MF_LINKS, row);
+    if(mf->sect[MF_BLKSIZE]) r->sb.st_blksize = (blksize_t)mf_u32(mf, MF_BLKSIZE, row);
+    if(mf->sect[MF_BLOCKS]) r->sb.st_blocks = (blkcnt_t)mf_u64(mf, MF_BLOCKS, row);
+    r->dgstat = mf->sect[MF_DGSTAT] ? mf->sect[MF_DGSTAT][row] : DG_NA;
+    if(r->dgstat == DG_OK) {
+        if(mf->sect[MF_CKSUM]) r->dg.crc = mf_u32(mf, MF_CKSUM, row);
+        if(mf->sect[MF_MD5]) memcpy(r->dg.md5, mf->sect[MF_MD5] + MD5_LEN * row, MD5_LEN);
+        if(mf->sect[MF_SHA256]) memcpy(r->dg.sha256, mf->sect[MF_SHA256] + SHA256_LEN * row, SHA256_LEN);
+        if(mf->sect[MF_TREE]) memcpy(r->dg.tree, mf->sect[MF_TREE] + SHA256_LEN * row, SHA256_LEN);
+        if(mf->sect[MF_BLAKE3]) memcpy(r->dg.blake3, mf->sect[MF_BLAKE3] + BLAKE3_LEN * row, BLAKE3_LEN);
+        if(mf->sect[MF_XXH3]) r->dg.xxh3 = mf_u64(mf, MF_XXH3, row);
+    }
+    return 0;
+}
+
+/*
+    Row of the record called name (its File Name, or its Full Path in a
+    manifest without names), by binary search of the index.
+    Returns -1 if there is none.
+*/
+int64_t manifest_find(const MANIFEST *mf, const char *name)
+{
+    int c, key = (mf->fields & FLDM(FLD_NAME)) ? MF_NAME_OFF : MF_PATH_OFF;
+    uint64_t lo = 0, hi = mf->rows, mid, row;
+
+    if(mf->sect[MF_INDEX] == NULL) return -1;
+    while(lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if((row = mf_u64(mf, MF_INDEX, mid)) >= mf->rows) return -1;
+        c = strcmp(name, mf_str(mf, key, row));
+        if(c == 0) return (int64_t)row;
+        if(c < 0) hi = mid;
+        else lo = mid + 1;
+    }
+    return -1;
+}
+
+/*
+    Write the records of the manifest called names (all of them if nnames
+    is 0) to out in the otyp format. Returns the number of names that are
+    not in the manifest.
+*/
+int print_manifest(OBUF *out, int otyp, const MANIFEST *mf, char **names, int nnames)
+{
+    int i, missing = 0;
+    int64_t row;
+    uint64_t r;
+    FSREC rec;
+
+    if(nnames == 0) {
+        for(r = 0; r < mf->rows; r++) {
+            manifest_get(mf, r, &rec);
+            format_record(out, otyp, &rec);
+        }
+        return 0;
+    }
+    for(i = 0; i < nnames; i++) {
+        if((row = manifest_find(mf, names[i])) < 0) {
+            fprintf(stderr, "%s: %s: not in the manifest\n", progname, names[i]);
+            missing++;
+            continue;
+        }
+        manifest_get(mf, (uint64_t)row, &rec);
+        format_record(out, otyp, &rec);
+    }
+    return missing;
+}
+
+/* The string a row is indexed by: its name, or its path without names */
+const char *manifest_key(const MANIFEST *mf, uint64_t row)
+{
+    return mf_str(mf, (mf->fields & FLDM(FLD_NAME)) ? MF_NAME_OFF : MF_PATH_OFF, row);
+}
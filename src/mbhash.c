@@ -0,0 +1,382 @@
+/*
+# +-------------------------------------------------------------------+
+# | Program Name  :  mbhash.c                                         |
+# | Author        :  Bhaskar Bhaumik (web.bhaskar.bhaumik@gmail.com)  |
+# | Version       :  0.1                                              |
+# | Date Created  :  October 13, 2018                                 |
+# | Description   :  Multi-buffer MD5 and SHA256 of many small        |
+# |                  messages at once, one message per vector lane,   |
+# |                  with SSE2, AVX2 and AVX-512 kernels picked at    |
+# |                  run time.                                        |
+# +-------------------------------------------------------------------+
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define MB_X86              1
+#endif
+
+#include <openssl/md5.h>
+#include <openssl/sha.h>
+
+#include "filestat.h"
+
+/*
+    MD5 and SHA256 are serial within a message, but the messages of a
+    batch are independent: the kernels run W of them side by side, one
+    per 32 bit lane, block by block. Every lane is padded on its own and
+    a lane whose message is shorter than the others keeps computing, its
+    result masked out of the state. The messages are sorted by length
+    first so the lanes of a group end at about the same block.
+
+    The portable engine hashes the messages one by one with OpenSSL. Its
+    SHA256 beats 4 lanes, and 8 lanes when the CPU has the SHA extensions,
+    so auto keeps it for SHA256 in those cases and only MD5 is batched.
+*/
+typedef void (*mb_fn)(const unsigned char **data, const size_t *len, int n, unsigned char **out);
+
+static const uint32_t md5_k[64] = {
+    0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+    0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+    0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+    0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+    0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+    0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+    0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+    0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391
+};
+
+static const uint8_t md5_s[64] = {
+    7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+    5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20,
+    4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+    6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21
+};
+
+/* Message word of each step */
+static const uint8_t md5_g[64] = {
+    0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+    1, 6, 11, 0, 5, 10, 15, 4, 9, 14, 3, 8, 13, 2, 7, 12,
+    5, 8, 11, 14, 1, 4, 7, 10, 13, 0, 3, 6, 9, 12, 15, 2,
+    0, 7, 14, 5, 12, 3, 10, 1, 8, 15, 6, 13, 4, 11, 2, 9
+};
+
+static const uint32_t md5_iv[4] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476 };
+
+static const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static const uint32_t sha256_iv[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+static pthread_once_t mb_once = PTHREAD_ONCE_INIT;
+static mb_fn mb_md5_fn;
+static mb_fn mb_sha256_fn;
+static const char *mb_engine_name;
+
+static void mb_md5_portable(const unsigned char **data, const size_t *len, int n, unsigned char **out)
+{
+    int j;
+    MD5_CTX c;
+
+    for(j = 0; j < n; j++) {
+        MD5_Init(&c);
+        MD5_Update(&c, data[j], len[j]);
+        MD5_Final(out[j], &c);
+    }
+    return;
+}
+
+static void mb_sha256_portable(const unsigned char **data, const size_t *len, int n, unsigned char **out)
+{
+    int j;
+    SHA256_CTX c;
+
+    for(j = 0; j < n; j++) {
+        SHA256_Init(&c);
+        SHA256_Update(&c, data[j], len[j]);
+        SHA256_Final(out[j], &c);
+    }
+    return;
+}
+
+#ifdef MB_X86
+/*
+    The last one or two blocks of a message: its tail, the 0x80 byte,
+    zeros and the length in bits, little endian for MD5 and big endian
+    for SHA256. Returns the number of blocks of the padded message.
+*/
+static size_t mb_pad(const unsigned char *data, size_t len, int bigendian, unsigned char pad[128])
+{
+    int i;
+    size_t full = len / 64, tail = len % 64, end;
+    uint64_t bits = (uint64_t)len << 3;
+
+    memset(pad, 0, 128);
+    memcpy(pad, data + full * 64, tail);
+    pad[tail] = 0x80;
+    end = (tail + 9 > 64) ? 128 : 64;
+    for(i = 0; i < 8; i++)
+        pad[end - 8 + i] = (unsigned char)(bigendian ? bits >> (56 - 8 * i) : bits >> (8 * i));
+    return full + end / 64;
+}
+
+#define MB_ROTL(x, c)       (((x) << (c)) | ((x) >> (32 - (c))))
+#define MB_ROTR(x, c)       (((x) >> (c)) | ((x) << (32 - (c))))
+
+/*
+    Set up the W lanes of a group: block b of lane j is read from data[j]
+    while b < full[j], then from its padding; nblocks is that of the
+    longest lane.
+*/
+#define MB_SETUP(W, bigendian) \
+    for(j = 0; j < W; j++) { \
+        nb[j] = mb_pad(data[j], len[j], bigendian, pad[j]); \
+        full[j] = len[j] / 64; \
+        if(nb[j] > nblocks) nblocks = nb[j]; \
+    }
+
+/* Word i of block b of every lane, and the mask of the lanes still running */
+#define MB_LOAD(W, m, b, swap) do { \
+        uint32_t w_[16][W] __attribute__((aligned(4 * W))), k_[W] __attribute__((aligned(4 * W))); \
+        const unsigned char *p_; \
+        for(j = 0; j < W; j++) { \
+            p_ = ((b) < full[j]) ? data[j] + (b) * 64 : pad[j] + (((b) < nb[j]) ? ((b) - full[j]) * 64 : 0); \
+            for(i = 0; i < 16; i++) { \
+                memcpy(&w_[i][j], p_ + 4 * i, 4); \
+                if(swap) w_[i][j] = __builtin_bswap32(w_[i][j]); \
+            } \
+            k_[j] = ((b) < nb[j]) ? 0xffffffff : 0; \
+        } \
+        for(i = 0; i < 16; i++) memcpy(&m[i], w_[i], sizeof(m[i])); \
+        memcpy(&live, k_, sizeof(live)); \
+    } while(0)
+
+#define MB_STORE(W, h, nh, out, swap) do { \
+        uint32_t s_[nh][W] __attribute__((aligned(4 * W))), v_; \
+        for(i = 0; i < nh; i++) memcpy(s_[i], &h[i], sizeof(h[i])); \
+        for(j = 0; j < W; j++) \
+            for(i = 0; i < nh; i++) { \
+                v_ = swap ? __builtin_bswap32(s_[i][j]) : s_[i][j]; \
+                memcpy(out[j] + 4 * i, &v_, 4); \
+            } \
+    } while(0)
+
+#define MD5_KERNEL(name, isa, W, next) \
+typedef uint32_t name##_vec __attribute__((vector_size(4 * W))); \
+__attribute__((target(isa))) \
+static void name(const unsigned char **data, const size_t *len, int n, unsigned char **out) \
+{ \
+    int i, j; \
+    size_t b, nblocks, nb[W], full[W]; \
+    unsigned char pad[W][128]; \
+    name##_vec h[4], m[16], a, bb, c, d, f, t, live; \
+    \
+    for(; n >= W; n -= W, data += W, len += W, out += W) { \
+        nblocks = 0; \
+        MB_SETUP(W, 0) \
+        for(i = 0; i < 4; i++) h[i] = md5_iv[i] + (name##_vec){ 0 }; \
+        for(b = 0; b < nblocks; b++) { \
+            MB_LOAD(W, m, b, 0); \
+            a = h[0]; bb = h[1]; c = h[2]; d = h[3]; \
+            _Pragma("GCC unroll 64") \
+            for(i = 0; i < 64; i++) { \
+                if(i < 16) f = d ^ (bb & (c ^ d)); \
+                else if(i < 32) f = c ^ (d & (bb ^ c)); \
+                else if(i < 48) f = bb ^ c ^ d; \
+                else f = c ^ (bb | ~d); \
+                t = a + f + md5_k[i] + m[md5_g[i]]; \
+                a = d; d = c; c = bb; \
+                bb = bb + MB_ROTL(t, md5_s[i]); \
+            } \
+            h[0] += a & live; h[1] += bb & live; h[2] += c & live; h[3] += d & live; \
+        } \
+        MB_STORE(W, h, 4, out, 0); \
+    } \
+    if(n > 0) next(data, len, n, out); \
+    return; \
+}
+
+#define SHA256_KERNEL(name, isa, W, next) \
+typedef uint32_t name##_vec __attribute__((vector_size(4 * W))); \
+__attribute__((target(isa))) \
+static void name(const unsigned char **data, const size_t *len, int n, unsigned char **out) \
+{ \
+    int i, j; \
+    size_t b, nblocks, nb[W], full[W]; \
+    unsigned char pad[W][128]; \
+    name##_vec h[8], w[16], v[8], t1, t2, s0, s1, live; \
+    \
+    for(; n >= W; n -= W, data += W, len += W, out += W) { \
+        nblocks = 0; \
+        MB_SETUP(W, 1) \
+        for(i = 0; i < 8; i++) h[i] = sha256_iv[i] + (name##_vec){ 0 }; \
+        for(b = 0; b < nblocks; b++) { \
+            MB_LOAD(W, w, b, 1); \
+            for(i = 0; i < 8; i++) v[i] = h[i]; \
+            _Pragma("GCC unroll 64") \
+            for(i = 0; i < 64; i++) { \
+                if(i >= 16) { \
+                    s0 = w[(i + 1) & 15]; \
+                    s0 = MB_ROTR(s0, 7) ^ MB_ROTR(s0, 18) ^ (s0 >> 3); \
+                    s1 = w[(i + 14) & 15]; \
+                    s1 = MB_ROTR(s1, 17) ^ MB_ROTR(s1, 19) ^ (s1 >> 10); \
+                    w[i & 15] += s0 + s1 + w[(i + 9) & 15]; \
+                } \
+                t1 = v[7] + (MB_ROTR(v[4], 6) ^ MB_ROTR(v[4], 11) ^ MB_ROTR(v[4], 25)) \
+                     + (v[6] ^ (v[4] & (v[5] ^ v[6]))) + sha256_k[i] + w[i & 15]; \
+                t2 = (MB_ROTR(v[0], 2) ^ MB_ROTR(v[0], 13) ^ MB_ROTR(v[0], 22)) \
+                     + ((v[0] & v[1]) | (v[2] & (v[0] | v[1]))); \
+                v[7] = v[6]; v[6] = v[5]; v[5] = v[4]; v[4] = v[3] + t1; \
+                v[3] = v[2]; v[2] = v[1]; v[1] = v[0]; v[0] = t1 + t2; \
+            } \
+            for(i = 0; i < 8; i++) h[i] += v[i] & live; \
+        } \
+        MB_STORE(W, h, 8, out, 1); \
+    } \
+    if(n > 0) next(data, len, n, out); \
+    return; \
+}
+
+MD5_KERNEL(mb_md5_sse2, "sse2", 4, mb_md5_portable)
+MD5_KERNEL(mb_md5_avx2, "avx2", 8, mb_md5_sse2)
+MD5_KERNEL(mb_md5_avx512, "avx512f", 16, mb_md5_avx2)
+SHA256_KERNEL(mb_sha256_sse2, "sse2", 4, mb_sha256_portable)
+SHA256_KERNEL(mb_sha256_avx2, "avx2", 8, mb_sha256_sse2)
+SHA256_KERNEL(mb_sha256_avx512, "avx512f", 16, mb_sha256_avx2)
+#endif
+
+static int mb_supported(const char *name)
+{
+    if(strcmp(name, "portable") == 0) return 1;
+#ifdef MB_X86
+    __builtin_cpu_init();
+    if(strcmp(name, "sse2") == 0) return __builtin_cpu_supports("sse2");
+    if(strcmp(name, "avx2") == 0) return __builtin_cpu_supports("avx2");
+    if(strcmp(name, "avx512") == 0) return __builtin_cpu_supports("avx512f");
+#endif
+    return 0;
+}
+
+static void mb_use(const char *name, int sha256)
+{
+    mb_engine_name = name;
+    mb_md5_fn = mb_md5_portable;
+    mb_sha256_fn = mb_sha256_portable;
+#ifdef MB_X86
+    if(strcmp(name, "sse2") == 0) {
+        mb_md5_fn = mb_md5_sse2;
+        if(sha256) mb_sha256_fn = mb_sha256_sse2;
+    } else if(strcmp(name, "avx2") == 0) {
+        mb_md5_fn = mb_md5_avx2;
+        if(sha256) mb_sha256_fn = mb_sha256_avx2;
+    } else if(strcmp(name, "avx512") == 0) {
+        mb_md5_fn = mb_md5_avx512;
+        if(sha256) mb_sha256_fn = mb_sha256_avx512;
+    }
+#else
+    (void)sha256;
+#endif
+    return;
+}
+
+static const char *mb_best(void)
+{
+    return mb_supported("avx512") ? "avx512" : mb_supported("avx2") ? "avx2"
+           : mb_supported("sse2") ? "sse2" : "portable";
+}
+
+/* Whether the SHA256 lanes of kernel name beat OpenSSL on this CPU */
+static int mb_sha256_wins(const char *name)
+{
+#ifdef MB_X86
+    __builtin_cpu_init();
+    if(strcmp(name, "avx512") == 0) return 1;
+    if(strcmp(name, "avx2") == 0) return !__builtin_cpu_supports("sha");
+#endif
+    return 0;
+}
+
+static void mb_init(void)
+{
+    mb_use(mb_best(), mb_sha256_wins(mb_best()));
+    return;
+}
+
+/*
+    Select the multi-buffer kernels by name: portable, sse2, avx2, avx512
+    or auto. Returns 0, or -1 if the kernel is unknown or the CPU lacks it.
+*/
+int mbhash_set_engine(const char *name)
+{
+    pthread_once(&mb_once, mb_init);
+    if(strcmp(name, "auto") == 0) {
+        mb_init();
+        return 0;
+    }
+    if(!mb_supported(name)) return -1;
+    mb_use(name, 1);
+    return 0;
+}
+
+const char *mbhash_engine(void)
+{
+    pthread_once(&mb_once, mb_init);
+    return mb_engine_name;
+}
+
+/*
+    Hash n messages in groups of similar length, shortest first: the
+    order only changes which lanes share a group, each digest lands in
+    out[] at the index of its message.
+*/
+static void mb_sorted(mb_fn fn, const unsigned char * const *data, const size_t *len, size_t n, unsigned char **out)
+{
+    size_t i, j, k, m;
+    size_t ord[MB_BATCH], slen[MB_BATCH];
+    const unsigned char *sdata[MB_BATCH];
+    unsigned char *sout[MB_BATCH];
+
+    for(; n > 0; n -= m, data += m, len += m, out += m) {
+        m = (n > MB_BATCH) ? MB_BATCH : n;
+        for(i = 0; i < m; i++) {
+            for(j = i; j > 0 && len[ord[j - 1]] > len[i]; j--) ord[j] = ord[j - 1];
+            ord[j] = i;
+        }
+        for(i = 0; i < m; i++) {
+            k = ord[i];
+            sdata[i] = data[k];
+            slen[i] = len[k];
+            sout[i] = out[k];
+        }
+        fn(sdata, slen, (int)m, sout);
+    }
+    return;
+}
+
+void mb_md5(const unsigned char * const *data, const size_t *len, size_t n, unsigned char **out)
+{
+    pthread_once(&mb_once, mb_init);
+    mb_sorted(mb_md5_fn, data, len, n, out);
+    return;
+}
+
+void mb_sha256(const unsigned char * const *data, const size_t *len, size_t n, unsigned char **out)
+{
+    pthread_once(&mb_once, mb_init);
+    mb_sorted(mb_sha256_fn, data, len, n, out);
+    return;
+}
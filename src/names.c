@@ -0,0 +1,255 @@
+/*
+# +-------------------------------------------------------------------+
+# | Program Name  :  names.c                                          |
+# | Author        :  Bhaskar Bhaumik (web.bhaskar.bhaumik@gmail.com)  |
+# | Version       :  0.1                                              |
+# | Date Created  :  October 13, 2018                                 |
+# | Description   :  Owner and group name caches and time stamp       |
+# |                  formatting with a cached time zone offset.       |
+# +-------------------------------------------------------------------+
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "filestat.h"
+
+#define NAME_BUCKETS        1024        /* power of 2 */
+#define TZ_SLOTS            4096        /* power of 2 */
+#define TZ_SPAN             900         /* seconds; offsets change on 15 minute boundaries */
+
+/*
+    uid/gid -> name. With LDAP or SSSD behind NSS every getpwuid() may be a
+    network round trip, and a tree has few distinct owners. Ids that do not
+    resolve are cached too (negative entries) and shown as the number, like
+    ls does. Entries live until exit, so the names can be used without
+    copying them.
+*/
+struct ncent {
+    unsigned long id;
+    int known;
+    char *name;
+    struct ncent *next;
+};
+
+struct ncache {
+    pthread_mutex_t lock;
+    struct ncent *bucket[NAME_BUCKETS];
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long unknown;
+};
+
+static struct ncache users = { PTHREAD_MUTEX_INITIALIZER };
+static struct ncache groups = { PTHREAD_MUTEX_INITIALIZER };
+
+static const char *ncache_get(struct ncache *nc, unsigned long id, int is_group)
+{
+    char *name, num[24];
+    unsigned long h = (id * 2654435761UL) & (NAME_BUCKETS - 1);
+    uint64_t t0;
+    struct ncent *e;
+
+    pthread_mutex_lock(&nc->lock);
+    for(e = nc->bucket[h]; e != (struct ncent *)NULL; e = e->next) {
+        if(e->id == id) {
+            nc->hits++;
+            pthread_mutex_unlock(&nc->lock);
+            return e->name;
+        }
+    }
+    pthread_mutex_unlock(&nc->lock);
+
+    /* Resolve without the lock; NSS may be slow */
+    t0 = PROF_START();
+    name = is_group ? get_groupname((gid_t)id) : get_username((uid_t)id);
+    PROF_STOP(PH_NSS, t0);
+    PROF_COUNT(0, 3, 0);
+
+    pthread_mutex_lock(&nc->lock);
+    for(e = nc->bucket[h]; e != (struct ncent *)NULL; e = e->next)
+        if(e->id == id) break;
+    if(e == (struct ncent *)NULL && (e = (struct ncent *)calloc(1, sizeof(struct ncent))) != (struct ncent *)NULL) {
+        e->id = id;
+        e->known = (name != (char *)NULL);
+        if(!e->known) {
+            sprintf(num, "%lu", id);
+            name = strdup(num);
+            nc->unknown++;
+        }
+        e->name = name;
+        e->next = nc->bucket[h];
+        nc->bucket[h] = e;
+        name = (char *)NULL;
+    }
+    nc->misses++;
+    pthread_mutex_unlock(&nc->lock);
+    free(name);
+    return (e != (struct ncent *)NULL) ? e->name : "?";
+}
+
+const char *uid_name(uid_t uid)
+{
+    return ncache_get(&users, (unsigned long)uid, 0);
+}
+
+const char *gid_name(gid_t gid)
+{
+    return ncache_get(&groups, (unsigned long)gid, 1);
+}
+
+/*
+    Time zone offsets. localtime_r() takes a lock and may stat the zone
+    file on every call; the offset only changes at transitions. A time is
+    looked up by its TZ_SPAN bucket, and a bucket is only cached when both
+    of its ends have the same offset, i.e. there is no transition inside.
+    Each thread has its own table, so there is no locking.
+*/
+struct tzent {
+    int64_t bucket;
+    long gmtoff;
+    int valid;
+};
+
+static __thread struct tzent tzcache[TZ_SLOTS];
+static unsigned long tz_hits;
+static unsigned long tz_misses;
+
+static int tz_offset(time_t sec, long *gmtoff)
+{
+    struct tm tmbuf;
+    time_t lo, hi;
+    long off_lo, off_hi;
+    int64_t b = (int64_t)sec / TZ_SPAN - ((int64_t)sec % TZ_SPAN < 0);
+    struct tzent *e = &tzcache[b & (TZ_SLOTS - 1)];
+
+    if(e->valid && e->bucket == b) {
+        __atomic_add_fetch(&tz_hits, 1, __ATOMIC_RELAXED);
+        *gmtoff = e->gmtoff;
+        return 0;
+    }
+    __atomic_add_fetch(&tz_misses, 1, __ATOMIC_RELAXED);
+    lo = (time_t)(b * TZ_SPAN);
+    hi = lo + TZ_SPAN - 1;
+    if(localtime_r(&lo, &tmbuf) == (struct tm *)NULL) return -1;
+    off_lo = tmbuf.tm_gmtoff;
+    if(localtime_r(&hi, &tmbuf) == (struct tm *)NULL) return -1;
+    off_hi = tmbuf.tm_gmtoff;
+    if(off_lo != off_hi) return -1;
+    e->bucket = b;
+    e->gmtoff = off_lo;
+    e->valid = 1;
+    *gmtoff = off_lo;
+    return 0;
+}
+
+char *tm2isots(time_t sec, long nanosec)
+{
+    char *ts;
+    ts = (char *)malloc(30 * sizeof(char));
+    if(tm2isots_r(sec, nanosec, ts) == (char *)NULL) {
+        free(ts);
+        return (char *)NULL;
+    }
+    return ts;
+}
+
+/* tm2isots() into a caller buffer of at least 30 chars */
+char *tm2isots_r(time_t sec, long nanosec, char *ts)
+{
+    struct tm tmbuf, *t;
+    t = localtime_r(&sec, &tmbuf);
+    if(t == (struct tm *)NULL || !strftime(ts, 29, "%Y-%m-%d %H:%M:%S.", t)) {
+        fprintf(stderr, "error: can't format timestamp");
+        return (char *)NULL;
+    }
+    sprintf(&ts[20], "%09ld", nanosec);
+    ts[29] = '\0';
+    return ts;
+}
+
+/* Days since 1970-01-01 to a civil date (H. Hinnant's algorithm) */
+static void civil_from_days(int64_t z, int *y, int *m, int *d)
+{
+    int64_t era, yoe, doy, mp;
+    z += 719468;
+    era = (z >= 0 ? z : z - 146096) / 146097;
+    yoe = z - era * 146097;
+    yoe = (yoe - yoe / 1460 + yoe / 36524 - yoe / 146096) / 365;
+    doy = (z - era * 146097) - (365 * yoe + yoe / 4 - yoe / 100);
+    mp = (5 * doy + 2) / 153;
+    *d = (int)(doy - (153 * mp + 2) / 5 + 1);
+    *m = (int)(mp < 10 ? mp + 3 : mp - 9);
+    *y = (int)(yoe + era * 400 + (*m <= 2));
+    return;
+}
+
+static void put_digits(char *p, unsigned long v, int n)
+{
+    while(n--) {
+        p[n] = (char)('0' + v % 10);
+        v /= 10;
+    }
+    return;
+}
+
+/*
+    Format "YYYY-MM-DD hh:mm:ss.nnnnnnnnn" in local time into ts (at least
+    30 chars), exactly like tm2isots_r() but with the cached offset.
+*/
+char *fmt_isots(time_t sec, long nanosec, char *ts)
+{
+    long gmtoff;
+    int64_t t, days, rem;
+    int y, m, d;
+
+    if(tz_offset(sec, &gmtoff) != 0) return tm2isots_r(sec, nanosec, ts);
+    t = (int64_t)sec + gmtoff;
+    days = t / 86400;
+    rem = t % 86400;
+    if(rem < 0) {
+        rem += 86400;
+        days--;
+    }
+    civil_from_days(days, &y, &m, &d);
+    if(y < 1000 || y > 9999 || nanosec < 0 || nanosec > 999999999)
+        return tm2isots_r(sec, nanosec, ts);
+
+    put_digits(ts, (unsigned long)y, 4);
+    ts[4] = '-';
+    put_digits(ts + 5, (unsigned long)m, 2);
+    ts[7] = '-';
+    put_digits(ts + 8, (unsigned long)d, 2);
+    ts[10] = ' ';
+    put_digits(ts + 11, (unsigned long)(rem / 3600), 2);
+    ts[13] = ':';
+    put_digits(ts + 14, (unsigned long)(rem / 60 % 60), 2);
+    ts[16] = ':';
+    put_digits(ts + 17, (unsigned long)(rem % 60), 2);
+    ts[19] = '.';
+    put_digits(ts + 20, (unsigned long)nanosec, 9);
+    ts[29] = '\0';
+    return ts;
+}
+
+void name_cache_counts(int is_group, unsigned long *hits, unsigned long *misses, unsigned long *unknown)
+{
+    struct ncache *nc = is_group ? &groups : &users;
+
+    pthread_mutex_lock(&nc->lock);
+    *hits = nc->hits;
+    *misses = nc->misses;
+    *unknown = nc->unknown;
+    pthread_mutex_unlock(&nc->lock);
+    return;
+}
+
+void tz_cache_counts(unsigned long *hits, unsigned long *misses)
+{
+    *hits = __atomic_load_n(&tz_hits, __ATOMIC_RELAXED);
+    *misses = __atomic_load_n(&tz_misses, __ATOMIC_RELAXED);
+    return;
+}
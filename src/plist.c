@@ -0,0 +1,70 @@
+/*
+# +-------------------------------------------------------------------+
+# | Program Name  :  plist.c                                          |
+# | Author        :  Bhaskar Bhaumik (web.bhaskar.bhaumik@gmail.com)  |
+# | Version       :  0.1                                              |
+# | Date Created  :  October 13, 2018                                 |
+# | Description   :  Path list input (--files-from): newline or NUL   |
+# |                  delimited names, read as they are processed.     |
+# +-------------------------------------------------------------------+
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <sys/types.h>
+
+#include "filestat.h"
+
+/*
+    The names are read one at a time into a buffer that is reused, so a
+    list of any length takes the memory of its longest name: the serial
+    traversal processes each name before the next is read, and -j keeps
+    at most PLIST_QUEUE of them in flight (see walk_parallel()). Empty
+    names are skipped; with newlines, so is the carriage return of a
+    list written on Windows.
+*/
+PLIST *plist_open(const char *filename, int delim)
+{
+    PLIST *pl;
+
+    if((pl = (PLIST *)calloc(1, sizeof(PLIST))) == (PLIST *)NULL) {
+        perror(progname);
+        exit(1);
+    }
+    pl->name = filename;
+    pl->delim = delim;
+    if(strcmp(filename, STD_OUTPUT) == 0) {
+        pl->fp = stdin;
+    } else if((pl->fp = fopen(filename, "r")) == (FILE *)NULL) {
+        free(pl);
+        return (PLIST *)NULL;
+    }
+    return pl;
+}
+
+/* The next name of the list, valid until the next call; NULL at the end */
+const char *plist_next(PLIST *pl)
+{
+    ssize_t n;
+
+    while((n = getdelim(&pl->buf, &pl->cap, pl->delim, pl->fp)) >= 0) {
+        if(n > 0 && pl->buf[n - 1] == (char)pl->delim) pl->buf[--n] = '\0';
+        if(pl->delim == '\n' && n > 0 && pl->buf[n - 1] == '\r') pl->buf[--n] = '\0';
+        if(n == 0) continue;
+        pl->count++;
+        return pl->buf;
+    }
+    if(ferror(pl->fp)) perror(pl->name);
+    return (const char *)NULL;
+}
+
+void plist_close(PLIST *pl)
+{
+    if(pl == (PLIST *)NULL) return;
+    if(pl->fp != stdin) fclose(pl->fp);
+    free(pl->buf);
+    free(pl);
+    return;
+}
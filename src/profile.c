@@ -0,0 +1,380 @@
+/*
+# +-------------------------------------------------------------------+
+# | Program Name  :  profile.c                                        |
+# | Author        :  Bhaskar Bhaumik (web.bhaskar.bhaumik@gmail.com)  |
+# | Version       :  0.1                                              |
+# | Date Created  :  October 13, 2018                                 |
+# | Description   :  --profile: per phase latency histograms, and     |
+# |                  record, byte, syscall and allocation counts by   |
+# |                  record type.                                     |
+# +-------------------------------------------------------------------+
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "filestat.h"
+
+/*
+    Every thread counts into its own block, so the instrumentation takes
+    no lock and shares no cache line; the blocks are only summed for the
+    report, after the walk. The block of a thread that exits (the helpers
+    started for one file, such as those of digest_parallel()) is added to
+    prof_gone and freed, so their number does not grow with the files.
+
+    The phases of collecting a record (stat, realpath, nss, read and the
+    digests) are held back until the record is done and then counted
+    under its type, one sample per phase per record. Reading directories,
+    formatting and writing are counted as they happen.
+
+    Syscalls and allocations are the ones filestat makes itself; those
+    inside realpath(3) and the NSS lookups are not seen.
+*/
+struct pphase {
+    uint64_t count;
+    uint64_t ns;
+    uint64_t max;
+    uint64_t hist[PROF_BUCKETS];        /* bucket b: ns < 2^b */
+};
+
+struct prof {
+    struct pphase ph[PT_COUNT][PH_COUNT];
+    uint64_t records[PT_COUNT];
+    uint64_t bytes[PT_COUNT];
+    uint64_t sys[PT_COUNT];
+    uint64_t allocs[PT_COUNT];
+    uint64_t pend_ns[PH_COUNT];         /* the record being collected */
+    unsigned int pend_mask;
+    uint64_t pend_sys;
+    uint64_t pend_allocs;
+    uint64_t pend_bytes;
+    uint64_t inner;                     /* ns attributed so far, see prof_start() */
+    struct prof *next;
+};
+
+int profiling = 0;
+
+static const char *phase_name[PH_COUNT] = {
+    "stat", "realpath", "nss", "read", "cksum", "md5", "sha256", "readdir", "format", "write", "tree", "blake3", "xxh3"
+};
+static const char *type_name[PT_COUNT] = {
+    "regular", "directory", "symlink", "other", "error", "output"
+};
+
+static struct prof *prof_list = (struct prof *)NULL;
+static struct prof prof_gone;           /* the threads that have exited */
+static pthread_mutex_t prof_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t prof_key;
+static pthread_once_t prof_once = PTHREAD_ONCE_INIT;
+static __thread struct prof *tprof;
+static uint64_t prof_begin;
+
+static void prof_sum(struct prof *to, const struct prof *from);
+
+static uint64_t prof_clock(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/* Thread exit: the block of the thread goes into prof_gone */
+static void prof_exit(void *arg)
+{
+    struct prof *p = (struct prof *)arg, **pp;
+
+    pthread_mutex_lock(&prof_lock);
+    for(pp = &prof_list; *pp != (struct prof *)NULL; pp = &(*pp)->next) {
+        if(*pp == p) {
+            *pp = p->next;
+            break;
+        }
+    }
+    prof_sum(&prof_gone, p);
+    pthread_mutex_unlock(&prof_lock);
+    free(p);
+    return;
+}
+
+static void prof_key_init(void)
+{
+    pthread_key_create(&prof_key, prof_exit);
+    return;
+}
+
+static struct prof *prof_self(void)
+{
+    if(tprof == (struct prof *)NULL) {
+        if((tprof = (struct prof *)calloc(1, sizeof(struct prof))) == (struct prof *)NULL) {
+            perror(progname);
+            exit(1);
+        }
+        pthread_once(&prof_once, prof_key_init);
+        pthread_setspecific(prof_key, tprof);
+        pthread_mutex_lock(&prof_lock);
+        tprof->next = prof_list;
+        prof_list = tprof;
+        pthread_mutex_unlock(&prof_lock);
+    }
+    return tprof;
+}
+
+void prof_init(void)
+{
+    prof_begin = prof_clock();
+    profiling = 1;
+    return;
+}
+
+/*
+    Times are exclusive of the phases timed inside them: the start is
+    shifted by what the thread has attributed so far, and prof_lap()
+    attributes only what was not attributed in between.
+*/
+uint64_t prof_start(void)
+{
+    return prof_clock() - prof_self()->inner;
+}
+
+uint64_t prof_lap(uint64_t t0)
+{
+    struct prof *p = prof_self();
+    uint64_t ns = prof_clock() - p->inner - t0;
+
+    p->inner += ns;
+    return ns;
+}
+
+void prof_stop(int ph, uint64_t t0)
+{
+    prof_add(ph, prof_lap(t0));
+    return;
+}
+
+/* ns of phase ph for the record being collected, e.g. from a helper thread */
+void prof_add(int ph, uint64_t ns)
+{
+    struct prof *p = prof_self();
+
+    p->pend_ns[ph] += ns;
+    p->pend_mask |= 1U << ph;
+    return;
+}
+
+void prof_count(uint64_t sys, uint64_t allocs, uint64_t bytes)
+{
+    struct prof *p = prof_self();
+
+    p->pend_sys += sys;
+    p->pend_allocs += allocs;
+    p->pend_bytes += bytes;
+    return;
+}
+
+static void sample(struct pphase *s, uint64_t ns)
+{
+    int b = (ns == 0) ? 0 : 64 - __builtin_clzll(ns);
+
+    s->count++;
+    s->ns += ns;
+    if(ns > s->max) s->max = ns;
+    s->hist[(b < PROF_BUCKETS) ? b : PROF_BUCKETS - 1]++;
+    return;
+}
+
+/* A phase outside the collection of a record, counted now under pt */
+void prof_event(int ph, int pt, uint64_t t0, uint64_t sys, uint64_t bytes)
+{
+    struct prof *p = prof_self();
+
+    sample(&p->ph[pt][ph], prof_lap(t0));
+    p->sys[pt] += sys;
+    p->bytes[pt] += bytes;
+    return;
+}
+
+/* The record being collected is done; count it under pt */
+void prof_commit(int pt)
+{
+    int ph;
+    struct prof *p = prof_self();
+
+    for(ph = 0; ph < PH_COUNT; ph++) {
+        if(p->pend_mask & (1U << ph)) sample(&p->ph[pt][ph], p->pend_ns[ph]);
+        p->pend_ns[ph] = 0;
+    }
+    p->records[pt]++;
+    p->sys[pt] += p->pend_sys;
+    p->allocs[pt] += p->pend_allocs;
+    p->bytes[pt] += p->pend_bytes;
+    p->pend_mask = 0;
+    p->pend_sys = p->pend_allocs = p->pend_bytes = 0;
+    return;
+}
+
+int prof_type(mode_t mode)
+{
+    if(S_ISREG(mode)) return PT_REG;
+    if(S_ISDIR(mode)) return PT_DIR;
+    if(S_ISLNK(mode)) return PT_LNK;
+    return PT_OTHER;
+}
+
+static void merge_phase(struct pphase *to, const struct pphase *from)
+{
+    int b;
+
+    to->count += from->count;
+    to->ns += from->ns;
+    if(from->max > to->max) to->max = from->max;
+    for(b = 0; b < PROF_BUCKETS; b++) to->hist[b] += from->hist[b];
+    return;
+}
+
+/* Add the counts of the block from to those of to */
+static void prof_sum(struct prof *to, const struct prof *from)
+{
+    int pt, ph;
+
+    for(pt = 0; pt < PT_COUNT; pt++) {
+        for(ph = 0; ph < PH_COUNT; ph++) merge_phase(&to->ph[pt][ph], &from->ph[pt][ph]);
+        to->records[pt] += from->records[pt];
+        to->bytes[pt] += from->bytes[pt];
+        to->sys[pt] += from->sys[pt];
+        to->allocs[pt] += from->allocs[pt];
+    }
+    return;
+}
+
+/* All the threads' blocks summed into m */
+static void prof_merge(struct prof *m)
+{
+    struct prof *p;
+
+    memset(m, 0, sizeof(struct prof));
+    pthread_mutex_lock(&prof_lock);
+    prof_sum(m, &prof_gone);
+    for(p = prof_list; p != (struct prof *)NULL; p = p->next)
+        prof_sum(m, p);
+    pthread_mutex_unlock(&prof_lock);
+    return;
+}
+
+/* Phase ph over all the types */
+static void phase_total(const struct prof *m, int ph, struct pphase *s)
+{
+    int pt;
+
+    memset(s, 0, sizeof(struct pphase));
+    for(pt = 0; pt < PT_COUNT; pt++) merge_phase(s, &m->ph[pt][ph]);
+    return;
+}
+
+/* Upper bound of the q quantile, from the histogram: within a factor of 2 */
+static uint64_t quantile(const struct pphase *s, double q)
+{
+    int b;
+    uint64_t n = 0, ub;
+
+    for(b = 0; b < PROF_BUCKETS; b++) {
+        n += s->hist[b];
+        if(n > 0 && (double)n >= q * (double)s->count) break;
+    }
+    ub = (b == 0) ? 0 : (b >= 63) ? UINT64_MAX : (1ULL << b) - 1;
+    return (ub < s->max) ? ub : s->max;
+}
+
+/* Summary table on fp, normally stderr */
+void prof_report(FILE *fp)
+{
+    int pt, ph;
+    struct prof *m;
+    struct pphase s;
+
+    if((m = (struct prof *)malloc(sizeof(struct prof))) == (struct prof *)NULL) return;
+    prof_merge(m);
+    fprintf(fp, "%s: profile, %.3f s\n", progname, (prof_clock() - prof_begin) / 1e9);
+    fprintf(fp, "  %-10s %12s %16s %12s %12s\n", "type", "records", "bytes", "syscalls", "allocs");
+    for(pt = 0; pt < PT_COUNT; pt++) {
+        if(m->records[pt] == 0 && m->sys[pt] == 0 && m->bytes[pt] == 0) continue;
+        fprintf(fp, "  %-10s %12llu %16llu %12llu %12llu\n", type_name[pt],
+                (unsigned long long)m->records[pt], (unsigned long long)m->bytes[pt],
+                (unsigned long long)m->sys[pt], (unsigned long long)m->allocs[pt]);
+    }
+    fprintf(fp, "  %-10s %12s %12s %10s %10s %10s %10s %10s\n", "phase", "samples", "total ms",
+            "mean us", "p50 us", "p90 us", "p99 us", "max us");
+    for(ph = 0; ph < PH_COUNT; ph++) {
+        phase_total(m, ph, &s);
+        if(s.count == 0) continue;
+        fprintf(fp, "  %-10s %12llu %12.3f %10.2f %10.2f %10.2f %10.2f %10.2f\n", phase_name[ph],
+                (unsigned long long)s.count, s.ns / 1e6, s.ns / 1e3 / s.count,
+                quantile(&s, 0.5) / 1e3, quantile(&s, 0.9) / 1e3, quantile(&s, 0.99) / 1e3, s.max / 1e3);
+    }
+    free(m);
+    return;
+}
+
+/* Everything, histograms included, as JSON to filename. Returns 0 or -1. */
+int prof_report_json(const char *filename)
+{
+    int pt, ph, b, first;
+    struct prof *m;
+    struct pphase s;
+    FILE *fp;
+
+    if((fp = fopen(filename, "w")) == (FILE *)NULL) {
+        perror(filename);
+        return -1;
+    }
+    if((m = (struct prof *)malloc(sizeof(struct prof))) == (struct prof *)NULL) {
+        perror(progname);
+        fclose(fp);
+        return -1;
+    }
+    prof_merge(m);
+    fprintf(fp, "{\n  \"seconds\": %.6f,\n  \"types\": {", (prof_clock() - prof_begin) / 1e9);
+    for(pt = 0; pt < PT_COUNT; pt++) {
+        fprintf(fp, "%s\n    \"%s\": {\"records\": %llu, \"bytes\": %llu, \"syscalls\": %llu, \"allocs\": %llu}",
+                pt ? "," : "", type_name[pt], (unsigned long long)m->records[pt], (unsigned long long)m->bytes[pt],
+                (unsigned long long)m->sys[pt], (unsigned long long)m->allocs[pt]);
+    }
+    fprintf(fp, "\n  },\n  \"phases\": {");
+    for(ph = 0; ph < PH_COUNT; ph++) {
+        phase_total(m, ph, &s);
+        fprintf(fp, "%s\n    \"%s\": {\"samples\": %llu, \"ns\": %llu, \"max_ns\": %llu, "
+                "\"p50_ns\": %llu, \"p90_ns\": %llu, \"p99_ns\": %llu,\n      \"by_type\": {",
+                ph ? "," : "", phase_name[ph], (unsigned long long)s.count, (unsigned long long)s.ns,
+                (unsigned long long)s.max, (unsigned long long)quantile(&s, 0.5),
+                (unsigned long long)quantile(&s, 0.9), (unsigned long long)quantile(&s, 0.99));
+        for(pt = 0, first = 1; pt < PT_COUNT; pt++) {
+            if(m->ph[pt][ph].count == 0) continue;
+            fprintf(fp, "%s\"%s\": {\"samples\": %llu, \"ns\": %llu}", first ? "" : ", ", type_name[pt],
+                    (unsigned long long)m->ph[pt][ph].count, (unsigned long long)m->ph[pt][ph].ns);
+            first = 0;
+        }
+        /* Non-empty buckets, by their upper bound */
+        fprintf(fp, "},\n      \"histogram\": [");
+        for(b = 0, first = 1; b < PROF_BUCKETS; b++) {
+            if(s.hist[b] == 0) continue;
+            fprintf(fp, "%s[%llu, %llu]", first ? "" : ", ",
+                    (unsigned long long)((b == 0) ? 0 : (1ULL << b) - 1), (unsigned long long)s.hist[b]);
+            first = 0;
+        }
+        fprintf(fp, "]}");
+    }
+    fprintf(fp, "\n  }\n}\n");
+    free(m);
+    if(fclose(fp) != 0) {
+        perror(filename);
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,317 @@
+/*
+# +-------------------------------------------------------------------+
+# | Program Name  :  reader.c                                         |
+# | Author        :  Bhaskar Bhaumik (web.bhaskar.bhaumik@gmail.com)  |
+# | Version       :  0.1                                              |
+# | Date Created  :  October 13, 2018                                 |
+# | Description   :  File reading strategies for the digest engine:   |
+# |                  read, mmap, fadvise, O_DIRECT and auto.          |
+# +-------------------------------------------------------------------+
+*/
+#define _GNU_SOURCE                     /* preadv2(), O_DIRECT */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#if defined(__linux__)
+#include <sys/vfs.h>
+#include <linux/magic.h>
+#endif
+
+#include "filestat.h"
+
+#ifndef NFS_SUPER_MAGIC
+#define NFS_SUPER_MAGIC     0x6969
+#endif
+#define SMB_MAGIC           0x517B
+#define CIFS_MAGIC          0xFF534D42
+#define SMB2_MAGIC          0xFE534D42
+#define FUSE_MAGIC          0x65735546
+#define CEPH_MAGIC          0x00C36400
+#define TMPFS_MAGIC_NUM     0x01021994
+#define RAMFS_MAGIC_NUM     0x858458F6
+
+int read_mode = READ_MODE_READ;
+
+static const char *read_mode_names[] = {
+    "read", "mmap", "fadvise", "direct", "auto", "uring", (char *)NULL
+};
+
+int is_valid_read_mode(const char *name)
+{
+    int i;
+    for(i = 0; read_mode_names[i] != (char *)NULL; i++)
+        if(strcasecmp(name, read_mode_names[i]) == 0) return i;
+    return -1;
+}
+
+const char *read_mode_name(int mode)
+{
+    return (mode >= 0 && mode <= READ_MODE_URING) ? read_mode_names[mode] : "unknown";
+}
+
+/* Returns 1 if fd is on a network file system */
+int fs_is_network(int fd)
+{
+#if defined(__linux__)
+    struct statfs fs;
+
+    if(fstatfs(fd, &fs) == 0) {
+        switch((unsigned long)fs.f_type) {
+            case NFS_SUPER_MAGIC:
+            case SMB_MAGIC:
+            case CIFS_MAGIC:
+            case SMB2_MAGIC:
+            case FUSE_MAGIC:
+            case CEPH_MAGIC:
+                return 1;
+            default:
+                break;
+        }
+    }
+#endif
+    return 0;
+}
+
+/*
+    auto: small files are read with plain read(2), which costs fewer
+    system calls than setting up a mapping. Network file systems get plain
+    reads as well, since mapping or bypassing the client cache there only
+    adds round trips. In-memory file systems are mapped, which avoids the
+    copy. Other large files are read with fadvise so a full scan does not
+    push the hot data out of the page cache.
+*/
+static int read_mode_auto(int fd, off_t size)
+{
+#if defined(__linux__)
+    struct statfs fs;
+
+    if(fstatfs(fd, &fs) == 0) {
+        switch((unsigned long)fs.f_type) {
+            case NFS_SUPER_MAGIC:
+            case SMB_MAGIC:
+            case CIFS_MAGIC:
+            case SMB2_MAGIC:
+            case FUSE_MAGIC:
+            case CEPH_MAGIC:
+                return READ_MODE_READ;
+            case TMPFS_MAGIC_NUM:
+            case RAMFS_MAGIC_NUM:
+                return size > 0 ? READ_MODE_MMAP : READ_MODE_READ;
+            default:
+                break;
+        }
+    }
+#endif
+    if(size <= READ_AUTO_SMALL) return READ_MODE_READ;
+    if(size <= READ_AUTO_LARGE) return READ_MODE_MMAP;
+    return READ_MODE_FADVISE;
+}
+
+/*
+    Open filename, relative to dirfd (or AT_FDCWD), for sequential reading
+    with the given strategy. When a
+    strategy is not available for the file (mmap of an empty file, O_DIRECT
+    on tmpfs) the reader quietly falls back to fadvise or plain reads.
+    Returns 0, or -1 with errno set.
+*/
+int freader_open(FREADER *r, int dirfd, const char *filename, int mode)
+{
+    struct stat sb;
+    int flags = O_RDONLY;
+
+    memset(r, 0, sizeof(FREADER));
+#ifdef O_CLOEXEC
+    flags |= O_CLOEXEC;
+#endif
+    PROF_COUNT(2, 0, 0);
+    if((r->fd = openat(dirfd, filename, flags)) < 0) return -1;
+    if(fstat(r->fd, &sb) != 0) {
+        close(r->fd);
+        return -1;
+    }
+    r->size = sb.st_size;
+    /* A file that uring.c does not read is read the plain way */
+    if(mode == READ_MODE_URING) mode = READ_MODE_READ;
+    if(mode == READ_MODE_AUTO) {
+        mode = read_mode_auto(r->fd, r->size);
+        PROF_COUNT(1, 0, 0);
+    }
+
+    if(mode == READ_MODE_MMAP) {
+        if(r->size > 0 && (uintmax_t)r->size <= (uintmax_t)SIZE_MAX
+                && (r->map = (unsigned char *)mmap(NULL, (size_t)r->size, PROT_READ, MAP_PRIVATE, r->fd, 0)) != (unsigned char *)MAP_FAILED) {
+            madvise(r->map, (size_t)r->size, MADV_SEQUENTIAL);
+            PROF_COUNT(2, 0, 0);
+        } else {
+            r->map = (unsigned char *)NULL;
+            mode = READ_MODE_READ;
+        }
+    }
+#if defined(__linux__) && defined(O_DIRECT)
+    if(mode == READ_MODE_DIRECT) {
+        int dfd;
+        /* Reopen rather than fcntl(): some file systems reject O_DIRECT only at open() */
+        PROF_COUNT(1, 0, 0);
+        if((dfd = openat(dirfd, filename, flags | O_DIRECT)) >= 0) {
+            close(r->fd);
+            PROF_COUNT(1, 0, 0);
+            r->fd = dfd;
+        } else {
+            mode = READ_MODE_FADVISE;
+        }
+    }
+#else
+    if(mode == READ_MODE_DIRECT) mode = READ_MODE_FADVISE;
+#endif
+    if(mode == READ_MODE_FADVISE) {
+#ifdef POSIX_FADV_SEQUENTIAL
+        posix_fadvise(r->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        PROF_COUNT(1, 0, 0);
+#endif
+    }
+    r->mode = mode;
+    return 0;
+}
+
+#if defined(__linux__) && defined(RWF_NOWAIT) && defined(POSIX_FADV_DONTNEED)
+/*
+    Read len bytes and drop them from the page cache afterwards, unless
+    they were already cached: RWF_NOWAIT only succeeds on cached pages,
+    and those are somebody else's hot data.
+*/
+static ssize_t freader_read_cold(FREADER *r, unsigned char *buf, size_t len)
+{
+    ssize_t n, m;
+    struct iovec iov;
+
+    iov.iov_base = buf;
+    iov.iov_len = len;
+    n = preadv2(r->fd, &iov, 1, r->pos, RWF_NOWAIT);
+    PROF_COUNT(1, 0, 0);
+    if(n < 0) {
+        if(errno != EAGAIN && errno != EOPNOTSUPP && errno != EINVAL) return -1;
+        n = 0;
+    }
+    if((size_t)n < len) {
+        if((m = pread(r->fd, buf + n, len - n, r->pos + n)) < 0) return -1;
+        posix_fadvise(r->fd, r->pos + n, m, POSIX_FADV_DONTNEED);
+        PROF_COUNT(2, 0, 0);
+        n += m;
+    }
+    return n;
+}
+#endif
+
+/*
+    Return the next chunk of at most len bytes in *data, either straight
+    from the mapping or read into buf. buf must be FREADER_ALIGN aligned
+    and len a multiple of FREADER_ALIGN for O_DIRECT.
+    Returns the chunk length, 0 at end of file, or -1 on error.
+*/
+ssize_t freader_next(FREADER *r, unsigned char *buf, size_t len, const unsigned char **data)
+{
+    ssize_t n;
+
+    switch(r->mode) {
+        case READ_MODE_MMAP:
+            if(r->pos >= r->size) return 0;
+            if((uintmax_t)(r->size - r->pos) < (uintmax_t)len) len = (size_t)(r->size - r->pos);
+            *data = r->map + r->pos;
+            r->pos += len;
+            PROF_COUNT(0, 0, len);
+            return (ssize_t)len;
+#if defined(__linux__) && defined(RWF_NOWAIT) && defined(POSIX_FADV_DONTNEED)
+        case READ_MODE_FADVISE:
+            do {
+                n = freader_read_cold(r, buf, len);
+            } while(n < 0 && errno == EINTR);
+            break;
+#endif
+        default:
+            do {
+                n = read(r->fd, buf, len);
+                PROF_COUNT(1, 0, 0);
+            } while(n < 0 && errno == EINTR);
+            break;
+    }
+    if(n > 0) {
+        r->pos += n;
+        PROF_COUNT(0, 0, (uint64_t)n);
+    }
+    *data = buf;
+    return n;
+}
+
+void freader_close(FREADER *r)
+{
+    if(r->map != (unsigned char *)NULL) {
+        munmap(r->map, (size_t)r->size);
+        PROF_COUNT(1, 0, 0);
+    }
+    if(r->fd >= 0) {
+        close(r->fd);
+        PROF_COUNT(1, 0, 0);
+    }
+    r->map = (unsigned char *)NULL;
+    r->fd = -1;
+    return;
+}
+
+/*
+    Read all of a small file into buf in one go: open, read and close. A
+    read shorter than asked for is taken as the end of the regular file,
+    which saves the read() that would return 0. Returns the length, or -1
+    with errno set, EFBIG if the file fills len bytes.
+*/
+ssize_t freader_slurp(int dirfd, const char *filename, unsigned char *buf, size_t len)
+{
+    int fd, flags = O_RDONLY, err;
+    size_t ask, got = 0;
+    ssize_t n;
+
+#ifdef O_CLOEXEC
+    flags |= O_CLOEXEC;
+#endif
+    PROF_COUNT(1, 0, 0);
+    if((fd = openat(dirfd, filename, flags)) < 0) return -1;
+    for(;;) {
+        ask = len - got;
+        do {
+            n = read(fd, buf + got, ask);
+            PROF_COUNT(1, 0, 0);
+        } while(n < 0 && errno == EINTR);
+        if(n <= 0) break;
+        got += n;
+        if((size_t)n < ask || got == len) break;
+    }
+    err = errno;
+    close(fd);
+    PROF_COUNT(1, 0, (uint64_t)got);
+    if(n < 0) {
+        errno = err;
+        return -1;
+    }
+    if(got == len) {
+        errno = EFBIG;
+        return -1;
+    }
+    return (ssize_t)got;
+}
+
+/* Allocate a read buffer usable by every strategy, O_DIRECT included */
+unsigned char *freader_alloc(size_t len)
+{
+    void *p;
+    if(posix_memalign(&p, FREADER_ALIGN, len) != 0) return (unsigned char *)NULL;
+    return (unsigned char *)p;
+}
@@ -0,0 +1,210 @@
+/*
+# +-------------------------------------------------------------------+
+# | Program Name  :  since.c                                          |
+# | Author        :  Bhaskar Bhaumik (web.bhaskar.bhaumik@gmail.com)  |
+# | Version       :  0.1                                              |
+# | Date Created  :  October 13, 2018                                 |
+# | Description   :  Incremental scan (--since): only the records     |
+# |                  added, removed or modified since a manifest.     |
+# +-------------------------------------------------------------------+
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "filestat.h"
+
+/*
+    The previous run stays mapped (see manifest.c); the only memory built
+    from it is an open addressing table of row numbers by key, at most
+    half full, and one bit per row for the rows seen by the walk. Both
+    scale with the manifest, not with the tree. The walk marks the rows it
+    finds, concurrently with -j; the rows left unmarked at the end are the
+    removed files.
+*/
+static MANIFEST *since_mf = (MANIFEST *)NULL;
+static uint32_t *since_slot;           /* row + 1, 0 if free */
+static uint64_t since_nslot;            /* power of 2 */
+static unsigned char *since_seen;
+static int since_bykey;                 /* FLD_NAME or FLD_PATH */
+static uint32_t since_cmp;              /* fields compared for a modification */
+static int since_reuse;                 /* the digests of unchanged files can be reused */
+
+static uint64_t key_hash(const char *s)
+{
+    uint64_t h = 14695981039346656037ULL;
+    while(*s) h = (h ^ (unsigned char)*s++) * 1099511628211ULL;
+    return h;
+}
+
+/*
+    Load the manifest filename for a scan of the fields. Returns 0, or -1
+    after printing the error.
+*/
+int since_open(const char *filename, uint32_t fields)
+{
+    uint32_t mfields;
+    uint64_t row, rows, h;
+
+    if((since_mf = manifest_open(filename)) == (MANIFEST *)NULL) {
+        if(errno == EINVAL) fprintf(stderr, "%s: %s: not a valid manifest.\n", progname, filename);
+        else perror(filename);
+        return -1;
+    }
+    mfields = manifest_fields(since_mf);
+    rows = manifest_rows(since_mf);
+    since_bykey = (mfields & FLDM(FLD_NAME)) ? FLD_NAME : FLD_PATH;
+    if((mfields & FLDM(since_bykey)) == 0 || (fields & FLDM(since_bykey)) == 0) {
+        fprintf(stderr, "%s: --since needs the field %s, which the manifest is indexed by.\n", progname, field_name[since_bykey]);
+        since_close();
+        return -1;
+    }
+    if(rows >= UINT32_MAX) {
+        fprintf(stderr, "%s: %s: too many records for --since.\n", progname, filename);
+        since_close();
+        return -1;
+    }
+
+    /* Everything both runs have but the key, and atime, which reading the files changes */
+    since_cmp = fields & mfields & ~(FLDM(since_bykey) | FLDM(FLD_ATIME) | FLDM(FLD_CHANGE));
+    since_reuse = (mfields & FLDM(FLD_SIZE)) && (mfields & FLDM(FLD_MTIME)) && (mfields & FLDM(FLD_CTIME))
+                  && (mfields & FLDM(FLD_INODE)) && (fields & FLDM_DIGESTS & ~mfields) == 0;
+
+    for(since_nslot = 64; since_nslot < 2 * rows; since_nslot *= 2);
+    since_slot = (uint32_t *)calloc(since_nslot, sizeof(uint32_t));
+    since_seen = (unsigned char *)calloc(rows / 8 + 1, 1);
+    if(since_slot == (uint32_t *)NULL || since_seen == (unsigned char *)NULL) {
+        perror(progname);
+        since_close();
+        return -1;
+    }
+    for(row = 0; row < rows; row++) {
+        for(h = key_hash(manifest_key(since_mf, row)) & (since_nslot - 1); since_slot[h] != 0; h = (h + 1) & (since_nslot - 1));
+        since_slot[h] = (uint32_t)(row + 1);
+    }
+    return 0;
+}
+
+void since_close(void)
+{
+    manifest_close(since_mf);
+    since_mf = (MANIFEST *)NULL;
+    free(since_slot);
+    since_slot = (uint32_t *)NULL;
+    free(since_seen);
+    since_seen = (unsigned char *)NULL;
+    return;
+}
+
+/* Row of the previous run for the record, or -1 */
+static int64_t since_find(const FSREC *r)
+{
+    uint64_t h;
+    const char *key = (since_bykey == FLD_NAME) ? r->name : r->path;
+
+    if(key == (const char *)NULL) return -1;
+    for(h = key_hash(key) & (since_nslot - 1); since_slot[h] != 0; h = (h + 1) & (since_nslot - 1))
+        if(strcmp(manifest_key(since_mf, since_slot[h] - 1), key) == 0) return (int64_t)since_slot[h] - 1;
+    return -1;
+}
+
+/*
+    The digests of a file that has the same size, mtime, ctime and inode
+    as in the previous run, which are then not computed again.
+    Returns 0, or -1 if the file has to be read.
+*/
+int since_digests(const FSREC *r, FDIGEST *dg)
+{
+    int64_t row;
+    FSREC old;
+
+    if(since_mf == (MANIFEST *)NULL || !since_reuse || (row = since_find(r)) < 0) return -1;
+    manifest_get(since_mf, (uint64_t)row, &old);
+    if(old.dgstat != DG_OK || old.sb.st_size != r->sb.st_size || old.sb.st_ino != r->sb.st_ino
+            || old.ts.mts_sec != r->ts.mts_sec || old.ts.mts_nsec != r->ts.mts_nsec
+            || old.ts.cts_sec != r->ts.cts_sec || old.ts.cts_nsec != r->ts.cts_nsec)
+        return -1;
+    *dg = old.dg;
+    dg->length = (uintmax_t)r->sb.st_size;
+    return 0;
+}
+
+static int str_differ(const char *a, const char *b)
+{
+    return strcmp(a != (const char *)NULL ? a : "", b != (const char *)NULL ? b : "") != 0;
+}
+
+#define CMP(f)  (since_cmp & FLDM(f))
+
+static int since_modified(const FSREC *r, const FSREC *old)
+{
+    if(CMP(FLD_NAME) && str_differ(r->name, old->name)) return 1;
+    if(CMP(FLD_PATH) && str_differ(r->path, old->path)) return 1;
+    if(CMP(FLD_SIZE) && r->sb.st_size != old->sb.st_size) return 1;
+    if(CMP(FLD_USER) && str_differ(r->user, old->user)) return 1;
+    if(CMP(FLD_UID) && r->sb.st_uid != old->sb.st_uid) return 1;
+    if(CMP(FLD_GROUP) && str_differ(r->group, old->group)) return 1;
+    if(CMP(FLD_GID) && r->sb.st_gid != old->sb.st_gid) return 1;
+    if(CMP(FLD_TYPE) && (r->sb.st_mode & S_IFMT) != (old->sb.st_mode & S_IFMT)) return 1;
+    if((CMP(FLD_PERM) || CMP(FLD_OCTAL) || CMP(FLD_STICKY)) && r->sb.st_mode != old->sb.st_mode) return 1;
+    if(CMP(FLD_MTIME) && (r->ts.mts_sec != old->ts.mts_sec || r->ts.mts_nsec != old->ts.mts_nsec)) return 1;
+    if(CMP(FLD_CTIME) && (r->ts.cts_sec != old->ts.cts_sec || r->ts.cts_nsec != old->ts.cts_nsec)) return 1;
+    if(CMP(FLD_DEV) && r->sb.st_dev != old->sb.st_dev) return 1;
+    if(CMP(FLD_INODE) && r->sb.st_ino != old->sb.st_ino) return 1;
+    if(CMP(FLD_LINKS) && r->sb.st_nlink != old->sb.st_nlink) return 1;
+    if(CMP(FLD_BLKSIZE) && r->sb.st_blksize != old->sb.st_blksize) return 1;
+    if(CMP(FLD_BLOCKS) && r->sb.st_blocks != old->sb.st_blocks) return 1;
+    if((since_cmp & FLDM_DIGESTS) && r->dgstat != old->dgstat) return 1;
+    if(r->dgstat == DG_OK) {
+        if(CMP(FLD_CKSUM) && r->dg.crc != old->dg.crc) return 1;
+        if(CMP(FLD_MD5) && memcmp(r->dg.md5, old->dg.md5, MD5_LEN) != 0) return 1;
+        if(CMP(FLD_SHA256) && memcmp(r->dg.sha256, old->dg.sha256, SHA256_LEN) != 0) return 1;
+        if(CMP(FLD_TREE) && memcmp(r->dg.tree, old->dg.tree, SHA256_LEN) != 0) return 1;
+        if(CMP(FLD_BLAKE3) && memcmp(r->dg.blake3, old->dg.blake3, BLAKE3_LEN) != 0) return 1;
+        if(CMP(FLD_XXH3) && r->dg.xxh3 != old->dg.xxh3) return 1;
+    }
+    return 0;
+}
+
+/*
+    Whether the record of the walk is output: it is marked as seen and
+    set CHG_ADDED or CHG_MODIFIED, or dropped if it did not change.
+*/
+int since_keep(FSREC *r)
+{
+    int64_t row;
+    FSREC old;
+
+    if(since_mf == (MANIFEST *)NULL) return 1;
+    if((row = since_find(r)) < 0) {
+        r->change = CHG_ADDED;
+        return 1;
+    }
+    __atomic_fetch_or(&since_seen[row / 8], (unsigned char)(1 << (row % 8)), __ATOMIC_RELAXED);
+    manifest_get(since_mf, (uint64_t)row, &old);
+    if(!since_modified(r, &old)) return 0;
+    r->change = CHG_MODIFIED;
+    return 1;
+}
+
+/* Output the records of the previous run that the walk did not find */
+void since_removed(OBUF *out, int otyp)
+{
+    uint64_t row, rows;
+    FSREC old;
+
+    if(since_mf == (MANIFEST *)NULL) return;
+    rows = manifest_rows(since_mf);
+    for(row = 0; row < rows; row++) {
+        if(since_seen[row / 8] & (1 << (row % 8))) continue;
+        manifest_get(since_mf, row, &old);
+        old.change = CHG_REMOVED;
+        format_record(out, otyp, &old);
+    }
+    return;
+}
@@ -0,0 +1,194 @@
+/*
+# +-------------------------------------------------------------------+
+# | Program Name  :  summary.c                                        |
+# | Author        :  Bhaskar Bhaumik (web.bhaskar.bhaumik@gmail.com)  |
+# | Version       :  0.1                                              |
+# | Date Created  :  October 13, 2018                                 |
+# | Description   :  Per directory totals (--summarize), added up     |
+# |                  during the traversal.                            |
+# +-------------------------------------------------------------------+
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "filestat.h"
+
+/*
+    process_entry() keeps one ROLLUP per directory it is in: every entry
+    is added to that of its directory with sum_add(), and a directory
+    that is done adds its own to that of its parent in sum_row(). So the
+    memory is that of the deepest path, whatever the number of files.
+
+    A row is the record of a directory (or of an argument) with its
+    totals: size and blocks of itself and everything under it, mtime of
+    the newest of those, the oldest one, the entries by type and the
+    bytes of each owner. Rows come after those of their subdirectories,
+    as with du. A file with several links is counted once. As with du,
+    symbolic links under the arguments are not followed but counted as
+    themselves, so what they point to in the tree is not counted again
+    (the arguments themselves are followed); a directory met twice is
+    still read once (see visit_dir()).
+*/
+int sum_mode;
+int sum_depth = -1;             /* rows down to this depth, -1 for all */
+
+struct owner {
+    uid_t uid;
+    uint64_t bytes;
+};
+
+void sum_init(ROLLUP *s)
+{
+    memset(s, 0, sizeof(ROLLUP));
+    return;
+}
+
+static void sum_free(ROLLUP *s)
+{
+    free(s->owner);
+    free(s->owners);
+    sum_init(s);
+    return;
+}
+
+static void sum_time(ROLLUP *s, time_t sec, long nsec)
+{
+    if(!s->timed || sec > s->new_sec || (sec == s->new_sec && nsec > s->new_nsec)) {
+        s->new_sec = sec;
+        s->new_nsec = nsec;
+    }
+    if(!s->timed || sec < s->old_sec || (sec == s->old_sec && nsec < s->old_nsec)) {
+        s->old_sec = sec;
+        s->old_nsec = nsec;
+    }
+    s->timed = 1;
+    return;
+}
+
+static void sum_owner(ROLLUP *s, uid_t uid, uint64_t bytes)
+{
+    size_t lo = 0, hi = s->nowners, mid;
+
+    while(lo < hi) {
+        mid = (lo + hi) / 2;
+        if(s->owner[mid].uid < uid) lo = mid + 1;
+        else hi = mid;
+    }
+    if(lo < s->nowners && s->owner[lo].uid == uid) {
+        s->owner[lo].bytes += bytes;
+        return;
+    }
+    if(s->nowners == s->cowners) {
+        s->cowners = s->cowners ? 2 * s->cowners : 8;
+        if((s->owner = (struct owner *)realloc(s->owner, s->cowners * sizeof(struct owner))) == (struct owner *)NULL) {
+            perror(progname);
+            exit(1);
+        }
+    }
+    memmove(&s->owner[lo + 1], &s->owner[lo], (s->nowners - lo) * sizeof(struct owner));
+    s->owner[lo].uid = uid;
+    s->owner[lo].bytes = bytes;
+    s->nowners++;
+    return;
+}
+
+/* Add r, an entry of the directory of s */
+void sum_add(ROLLUP *s, const FSREC *r)
+{
+    if(S_ISREG(r->sb.st_mode)) s->files++;
+    else if(S_ISDIR(r->sb.st_mode)) s->dirs++;
+    else s->others++;
+    sum_time(s, r->ts.mts_sec, r->ts.mts_nsec);
+    if(!inode_first(r)) return;
+    s->bytes += (uint64_t)r->sb.st_size;
+    s->blocks += (uint64_t)r->sb.st_blocks;
+    sum_owner(s, r->sb.st_uid, (uint64_t)r->sb.st_size);
+    return;
+}
+
+/* Add the totals of a subdirectory */
+static void sum_merge(ROLLUP *to, const ROLLUP *from)
+{
+    size_t i;
+
+    to->files += from->files;
+    to->dirs += from->dirs;
+    to->others += from->others;
+    to->bytes += from->bytes;
+    to->blocks += from->blocks;
+    if(from->timed) {
+        sum_time(to, from->new_sec, from->new_nsec);
+        sum_time(to, from->old_sec, from->old_nsec);
+    }
+    for(i = 0; i < from->nowners; i++) sum_owner(to, from->owner[i].uid, from->owner[i].bytes);
+    return;
+}
+
+static int owner_cmp(const void *x, const void *y)
+{
+    const struct owner *a = (const struct owner *)x, *b = (const struct owner *)y;
+
+    if(a->bytes != b->bytes) return (a->bytes < b->bytes) ? 1 : -1;
+    return (a->uid > b->uid) - (a->uid < b->uid);
+}
+
+/*
+    Make r the row of s: r itself is added, and its size, blocks and
+    mtime become the totals. The owners field is "name=bytes" by owner,
+    the largest first.
+*/
+static void sum_record(FSREC *r, ROLLUP *s)
+{
+    size_t i, len = 0, cap = 0;
+    const char *user;
+    char *p;
+
+    s->bytes += (uint64_t)r->sb.st_size;
+    s->blocks += (uint64_t)r->sb.st_blocks;
+    sum_time(s, r->ts.mts_sec, r->ts.mts_nsec);
+    sum_owner(s, r->sb.st_uid, (uint64_t)r->sb.st_size);
+    r->sb.st_size = (off_t)s->bytes;
+    r->sb.st_blocks = (blkcnt_t)s->blocks;
+    r->ts.mts_sec = s->new_sec;
+    r->ts.mts_nsec = s->new_nsec;
+    r->sum = s;
+
+    if((out_fields & FLDM(FLD_OWNERS)) == 0) return;
+    qsort(s->owner, s->nowners, sizeof(struct owner), owner_cmp);
+    for(i = 0; i < s->nowners; i++) {
+        user = uid_name(s->owner[i].uid);
+        if(len + strlen(user) + 24 > cap) {
+            cap = 2 * (len + strlen(user) + 24);
+            if((p = (char *)realloc(s->owners, cap)) == (char *)NULL) {
+                perror(progname);
+                exit(1);
+            }
+            s->owners = p;
+        }
+        len += sprintf(s->owners + len, "%s%s=%llu", i ? " " : "", user, (unsigned long long)s->owner[i].bytes);
+    }
+    return;
+}
+
+/*
+    A directory that was read, or an argument, at depth under the
+    arguments is done: its totals s go to those of its parent up (NULL
+    for an argument), and its row r is written if it is not deeper than
+    sum_depth. s is freed.
+*/
+void sum_row(OBUF *out, int otyp, FSREC *r, ROLLUP *s, ROLLUP *up, int depth)
+{
+    if(up != (ROLLUP *)NULL) sum_merge(up, s);
+    if(sum_depth < 0 || depth <= sum_depth) {
+        sum_record(r, s);
+        format_record(out, otyp, r);
+        r->sum = (const ROLLUP *)NULL;
+    }
+    sum_free(s);
+    return;
+}
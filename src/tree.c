@@ -0,0 +1,446 @@
+/*
+# +-------------------------------------------------------------------+
+# | Program Name  :  tree.c                                           |
+# | Author        :  Bhaskar Bhaumik (web.bhaskar.bhaumik@gmail.com)  |
+# | Version       :  0.1                                              |
+# | Date Created  :  October 13, 2018                                 |
+# | Description   :  Chunked tree hash (field tree), hashed on all    |
+# |                  cores, and the tree store (option --tree-store)  |
+# |                  that keeps the roots of the files left unchanged.|
+# +-------------------------------------------------------------------+
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <openssl/sha.h>
+
+#include "filestat.h"
+
+/*
+    The file is cut in TREE_CHUNK byte chunks and the chunks are combined
+    into a Merkle root as in RFC 6962:
+
+        leaf            SHA256(0x00 || chunk)
+        node            SHA256(0x01 || left || right)
+        root of n > 1   node(root of the first k, root of the other n - k),
+                        k the largest power of 2 below n
+
+    An empty file is one empty leaf. The chunks do not depend on each
+    other, so a file of several chunks is hashed by several threads, each
+    reading its chunks with pread(): one per core, shared with the other
+    tree_sharers threads (-j) that may be hashing a file at the same time.
+    The root only depends on the contents and TREE_CHUNK, never on the
+    number of threads.
+*/
+struct tjob {
+    int fd;
+    off_t size;
+    uint64_t next;              /* next chunk to hash */
+    uint64_t end;
+    unsigned char (*leaf)[SHA256_LEN];
+    uint64_t sys;               /* --profile */
+    int err;                    /* errno of the first failure */
+};
+
+TSTORE *tstore = (TSTORE *)NULL;
+int tree_sharers = 1;
+
+static __thread unsigned char *chunk_buf;
+static __thread size_t chunk_buflen;
+
+/* Leaf i of the file into leaf; buf holds TREE_CHUNK bytes */
+static int hash_chunk(struct tjob *j, uint64_t i, unsigned char *buf, unsigned char *leaf)
+{
+    off_t off = (off_t)(i << TREE_CHUNK_LOG2);
+    size_t len = 0, want;
+    ssize_t n;
+    SHA256_CTX c;
+
+    want = (j->size - off < (off_t)TREE_CHUNK) ? (size_t)(j->size - off) : TREE_CHUNK;
+    while(len < want) {
+        n = pread(j->fd, buf + len, want - len, off + (off_t)len);
+        __atomic_add_fetch(&j->sys, 1, __ATOMIC_RELAXED);
+        if(n < 0 && errno == EINTR) continue;
+        if(n < 0) return -1;
+        if(n == 0) break;       /* truncated while it was read, like the digest engine */
+        len += (size_t)n;
+    }
+    SHA256_Init(&c);
+    SHA256_Update(&c, "\0", 1);
+    SHA256_Update(&c, buf, len);
+    SHA256_Final(leaf, &c);
+    return 0;
+}
+
+static void *tree_worker(void *arg)
+{
+    struct tjob *j = (struct tjob *)arg;
+    unsigned char *buf;
+    uint64_t i;
+
+    if((buf = (unsigned char *)malloc(TREE_CHUNK)) == (unsigned char *)NULL) {
+        __atomic_store_n(&j->err, ENOMEM, __ATOMIC_RELAXED);
+        return (void *)NULL;
+    }
+    while(__atomic_load_n(&j->err, __ATOMIC_RELAXED) == 0
+            && (i = __atomic_fetch_add(&j->next, 1, __ATOMIC_RELAXED)) < j->end) {
+        if(hash_chunk(j, i, buf, j->leaf[i]) != 0) __atomic_store_n(&j->err, errno, __ATOMIC_RELAXED);
+    }
+    free(buf);
+    return (void *)NULL;
+}
+
+static void tree_root(unsigned char (*leaf)[SHA256_LEN], uint64_t n, unsigned char *root)
+{
+    uint64_t k;
+    unsigned char l[SHA256_LEN], r[SHA256_LEN];
+    SHA256_CTX c;
+
+    if(n == 1) {
+        memcpy(root, leaf[0], SHA256_LEN);
+        return;
+    }
+    for(k = 1; 2 * k < n; k *= 2)
+        ;
+    tree_root(leaf, k, l);
+    tree_root(leaf + k, n - k, r);
+    SHA256_Init(&c);
+    SHA256_Update(&c, "\1", 1);
+    SHA256_Update(&c, l, SHA256_LEN);
+    SHA256_Update(&c, r, SHA256_LEN);
+    SHA256_Final(root, &c);
+    return;
+}
+
+static int tree_jobs(void)
+{
+    static int ncpu;
+    long n;
+
+    if(ncpu == 0) {
+        n = sysconf(_SC_NPROCESSORS_ONLN);
+        ncpu = (n < 1) ? 1 : (n > JOBS_MAX) ? JOBS_MAX : (int)n;
+    }
+    return (ncpu > tree_sharers) ? ncpu / tree_sharers : 1;
+}
+
+static int tstore_get(TSTORE *ts, const DCKEY *k, unsigned char *root);
+static void tstore_put(TSTORE *ts, const DCKEY *k, const unsigned char *root);
+
+/*
+    Tree hash of the regular file name in the directory dirfd into
+    dg->tree. key (may be NULL) is what the tree store knows the file by:
+    a file of more than one chunk that it has the root of for the same
+    size, mtime and ctime is not read. Returns 0, or -1 with errno set.
+*/
+int tree_hash_at(int dirfd, const char *name, const DCKEY *key, FDIGEST *dg)
+{
+    int fd, i, started, threads;
+    uint64_t c, t0;
+    struct stat sb;
+    struct tjob j;
+    pthread_t tid[JOBS_MAX];
+
+    t0 = PROF_START();
+    if(tstore != (TSTORE *)NULL && key != (const DCKEY *)NULL && key->size > TREE_CHUNK
+            && tstore_get(tstore, key, dg->tree) == 0) {
+        PROF_STOP(PH_TREE, t0);
+        return 0;
+    }
+    if((fd = openat(dirfd, name, O_RDONLY | O_CLOEXEC)) < 0) return -1;
+    if(fstat(fd, &sb) != 0) {
+        close(fd);
+        return -1;
+    }
+    memset(&j, 0, sizeof(j));
+    j.fd = fd;
+    j.size = sb.st_size;
+    j.end = (sb.st_size > 0) ? ((uint64_t)sb.st_size + TREE_CHUNK - 1) >> TREE_CHUNK_LOG2 : 1;
+    j.sys = 2;
+    if((j.leaf = (unsigned char (*)[SHA256_LEN])malloc(j.end * SHA256_LEN)) == NULL) {
+        close(fd);
+        errno = ENOMEM;
+        return -1;
+    }
+    /* A key that is not the file opened (it changed since) is not stored */
+    if(key != (const DCKEY *)NULL && key->size != (uint64_t)sb.st_size) key = (const DCKEY *)NULL;
+
+    if(chunk_buflen < TREE_CHUNK && (j.end > 1 || chunk_buflen < (size_t)sb.st_size)) {
+        free(chunk_buf);
+        chunk_buflen = (j.end > 1) ? TREE_CHUNK : (size_t)sb.st_size;
+        if((chunk_buf = (unsigned char *)malloc(chunk_buflen)) == (unsigned char *)NULL) {
+            chunk_buflen = 0;
+            free(j.leaf);
+            close(fd);
+            errno = ENOMEM;
+            return -1;
+        }
+        PROF_COUNT(0, 1, 0);
+    }
+
+    threads = (j.end > (uint64_t)tree_jobs()) ? tree_jobs() : (int)j.end;
+    for(i = 1, started = 0; i < threads; i++)
+        if(pthread_create(&tid[started], NULL, tree_worker, &j) == 0) started++;
+    /* This thread hashes too, with its own buffer */
+    while(__atomic_load_n(&j.err, __ATOMIC_RELAXED) == 0 && (c = __atomic_fetch_add(&j.next, 1, __ATOMIC_RELAXED)) < j.end) {
+        if(hash_chunk(&j, c, chunk_buf, j.leaf[c]) != 0) __atomic_store_n(&j.err, errno, __ATOMIC_RELAXED);
+    }
+    for(i = 0; i < started; i++) pthread_join(tid[i], NULL);
+    close(fd);
+    PROF_COUNT(j.sys + 1, 0, (uint64_t)sb.st_size);
+
+    if(j.err != 0) {
+        free(j.leaf);
+        errno = j.err;
+        return -1;
+    }
+    tree_root(j.leaf, j.end, dg->tree);
+    if(tstore != (TSTORE *)NULL && key != (const DCKEY *)NULL && j.end > 1) tstore_put(tstore, key, dg->tree);
+    free(j.leaf);
+    PROF_STOP(PH_TREE, t0);
+    return 0;
+}
+
+/*
+    The tree store file:
+
+        header          struct tshdr
+        entries         struct tsrec, the root with the key of its file
+
+    It is read whole at the start and, if anything was hashed, written
+    whole at the end: under an flock() of "<file>.lock" the entries of the
+    current file (another run may have replaced it) that this run did not
+    hash are merged in, "<file>.tmp" is written and renamed over the
+    store, like the digest cache. Only the roots are kept: a file is
+    either unchanged, and not read, or read whole.
+*/
+#define TSTORE_MAGIC        "FSTROOTS"
+#define TSTORE_VERSION      1
+#define TSTORE_BUCKETS      (1 << 16)
+
+struct tshdr {
+    char magic[8];
+    uint32_t version;
+    uint32_t chunk_log2;
+    uint64_t count;
+};
+
+struct tsrec {
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t size;
+    int64_t mtime_ns;
+    int64_t ctime_ns;
+    unsigned char root[SHA256_LEN];
+};
+
+struct tsent {
+    struct tsrec r;
+    int hashed;                 /* this run */
+    struct tsent *next;
+};
+
+struct tstore {
+    char *path;
+    struct tsent **bucket;
+    uint64_t count;
+    int changed;
+    pthread_mutex_t lock;
+};
+
+static struct tsent **tstore_slot(TSTORE *ts, uint64_t dev, uint64_t ino)
+{
+    struct tsent **p;
+    uint64_t h = (ino * 0x9E3779B97F4A7C15ULL ^ dev) >> 48;
+
+    for(p = &ts->bucket[h & (TSTORE_BUCKETS - 1)]; *p != (struct tsent *)NULL; p = &(*p)->next)
+        if((*p)->r.dev == dev && (*p)->r.ino == ino) break;
+    return p;
+}
+
+/* Add the entries of the store file at path that ts does not have */
+static int tstore_load(TSTORE *ts, const char *path)
+{
+    FILE *fp;
+    struct tshdr h;
+    struct tsrec r;
+    struct tsent *e, **p;
+    uint64_t i;
+
+    if((fp = fopen(path, "r")) == (FILE *)NULL) return (errno == ENOENT) ? 0 : -1;
+    if(fread(&h, sizeof(h), 1, fp) != 1 || memcmp(h.magic, TSTORE_MAGIC, 8) != 0
+            || h.version != TSTORE_VERSION || h.chunk_log2 != TREE_CHUNK_LOG2) {
+        fprintf(stderr, "%s: %s: not a tree store; it will be rewritten\n", progname, path);
+        fclose(fp);
+        ts->changed = 1;
+        return 0;
+    }
+    for(i = 0; i < h.count; i++) {
+        if(fread(&r, sizeof(r), 1, fp) != 1) break;
+        if(*(p = tstore_slot(ts, r.dev, r.ino)) != (struct tsent *)NULL) continue;
+        if((e = (struct tsent *)calloc(1, sizeof(struct tsent))) == (struct tsent *)NULL) break;
+        e->r = r;
+        *p = e;
+        ts->count++;
+    }
+    if(i < h.count) fprintf(stderr, "%s: %s: truncated tree store; %llu entries read\n", progname, path, (unsigned long long)i);
+    fclose(fp);
+    return 0;
+}
+
+TSTORE *tstore_open(const char *path)
+{
+    TSTORE *ts;
+
+    if((ts = (TSTORE *)calloc(1, sizeof(TSTORE))) == (TSTORE *)NULL
+            || (ts->bucket = (struct tsent **)calloc(TSTORE_BUCKETS, sizeof(struct tsent *))) == (struct tsent **)NULL) {
+        free(ts);
+        return (TSTORE *)NULL;
+    }
+    ts->path = strdup(path);
+    pthread_mutex_init(&ts->lock, NULL);
+    if(tstore_load(ts, path) != 0) {
+        tstore_close(ts);
+        return (TSTORE *)NULL;
+    }
+    return ts;
+}
+
+/* The root of the file of key into root if it did not change: returns 0, else -1 */
+static int tstore_get(TSTORE *ts, const DCKEY *k, unsigned char *root)
+{
+    int rc = -1;
+    struct tsent *e;
+
+    pthread_mutex_lock(&ts->lock);
+    if((e = *tstore_slot(ts, k->dev, k->ino)) != (struct tsent *)NULL
+            && e->r.size == k->size && e->r.mtime_ns == k->mtime_ns && e->r.ctime_ns == k->ctime_ns) {
+        memcpy(root, e->r.root, SHA256_LEN);
+        rc = 0;
+    }
+    pthread_mutex_unlock(&ts->lock);
+    return rc;
+}
+
+static void tstore_put(TSTORE *ts, const DCKEY *k, const unsigned char *root)
+{
+    struct tsent *e, **p;
+
+    pthread_mutex_lock(&ts->lock);
+    if((e = *(p = tstore_slot(ts, k->dev, k->ino))) == (struct tsent *)NULL) {
+        if((e = (struct tsent *)calloc(1, sizeof(struct tsent))) == (struct tsent *)NULL) {
+            pthread_mutex_unlock(&ts->lock);
+            return;
+        }
+        *p = e;
+        ts->count++;
+    }
+    e->r.dev = k->dev;
+    e->r.ino = k->ino;
+    e->r.size = k->size;
+    e->r.mtime_ns = k->mtime_ns;
+    e->r.ctime_ns = k->ctime_ns;
+    memcpy(e->r.root, root, SHA256_LEN);
+    e->hashed = 1;
+    ts->changed = 1;
+    pthread_mutex_unlock(&ts->lock);
+    return;
+}
+
+static int tstore_flush(TSTORE *ts)
+{
+    int lfd, ok, rc = -1;
+    char *lpath, *tpath;
+    size_t plen;
+    uint64_t b;
+    struct tshdr h;
+    struct tsent *e, **p;
+    FILE *fp;
+
+    plen = strlen(ts->path);
+    if((lpath = (char *)malloc(plen + 6)) == (char *)NULL || (tpath = (char *)malloc(plen + 5)) == (char *)NULL) {
+        perror(progname);
+        exit(1);
+    }
+    sprintf(lpath, "%s.lock", ts->path);
+    sprintf(tpath, "%s.tmp", ts->path);
+
+    if((lfd = open(lpath, O_RDWR | O_CREAT, 0644)) < 0 || flock(lfd, LOCK_EX) != 0) {
+        perror(lpath);
+        goto out;
+    }
+    /* Everything this run did not hash again is taken from the current file */
+    for(b = 0; b < TSTORE_BUCKETS; b++) {
+        for(p = &ts->bucket[b]; (e = *p) != (struct tsent *)NULL; ) {
+            if(e->hashed) {
+                p = &e->next;
+                continue;
+            }
+            *p = e->next;
+            free(e);
+            ts->count--;
+        }
+    }
+    tstore_load(ts, ts->path);
+
+    if((fp = fopen(tpath, "w")) == (FILE *)NULL) {
+        perror(tpath);
+        goto out;
+    }
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, TSTORE_MAGIC, 8);
+    h.version = TSTORE_VERSION;
+    h.chunk_log2 = TREE_CHUNK_LOG2;
+    h.count = ts->count;
+    ok = (fwrite(&h, sizeof(h), 1, fp) == 1);
+    for(b = 0; ok && b < TSTORE_BUCKETS; b++)
+        for(e = ts->bucket[b]; ok && e != (struct tsent *)NULL; e = e->next)
+            ok = (fwrite(&e->r, sizeof(e->r), 1, fp) == 1);
+    /* Closed in any case; the old store stays unless all of the new one is on the disk */
+    if(ok && (fflush(fp) != 0 || fsync(fileno(fp)) != 0)) ok = 0;
+    if(fclose(fp) != 0) ok = 0;
+    if(!ok || rename(tpath, ts->path) != 0) {
+        perror(ts->path);
+        unlink(tpath);
+    } else {
+        rc = 0;
+    }
+
+out:
+    if(lfd >= 0) close(lfd);
+    free(lpath);
+    free(tpath);
+    return rc;
+}
+
+/* Write back if anything was hashed, and free */
+int tstore_close(TSTORE *ts)
+{
+    int rc = 0;
+    uint64_t b;
+    struct tsent *e, *next;
+
+    if(ts == (TSTORE *)NULL) return 0;
+    if(ts->changed) rc = tstore_flush(ts);
+    for(b = 0; b < TSTORE_BUCKETS; b++) {
+        for(e = ts->bucket[b]; e != (struct tsent *)NULL; e = next) {
+            next = e->next;
+            free(e);
+        }
+    }
+    pthread_mutex_destroy(&ts->lock);
+    free(ts->bucket);
+    free(ts->path);
+    free(ts);
+    return rc;
+}
@@ -0,0 +1,632 @@
+/*
+# +-------------------------------------------------------------------+
+# | Program Name  :  uring.c                                          |
+# | Author        :  Bhaskar Bhaumik (web.bhaskar.bhaumik@gmail.com)  |
+# | Version       :  0.1                                              |
+# | Date Created  :  October 13, 2018                                 |
+# | Description   :  io_uring pipeline (--read-mode uring): the stat, |
+# |                  open, reads and close of the entries of a        |
+# |                  directory are queued together.                   |
+# +-------------------------------------------------------------------+
+*/
+#define _GNU_SOURCE                     /* statx() */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <stdint.h>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "filestat.h"
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#if defined(__NR_io_uring_setup) && defined(STATX_BASIC_STATS)
+#define HAVE_URING
+#endif
+#endif
+#endif
+
+/*
+    The serial traversal hands uring_collect() up to URING_BATCH entries
+    of a directory at a time, in place of collecting them one by one:
+
+      1. a statx for each entry (that the fields need one for) is queued,
+         uring_depth at most in flight, and the records are filled in;
+      2. the regular files whose digests are not in the digest cache are
+         then opened, read and closed through the ring, uring_depth files
+         at a time and URING_WINDOW reads of -b bytes ahead in each. The
+         reads land in uring_buffers buffers registered with the kernel,
+         and a buffer is hashed in order as soon as it is complete, while
+         the others are still being read.
+
+    So a single thread keeps the device busy with many requests, which
+    is what NVMe queues and network file systems need. The ring is set
+    up on first use; where io_uring is not there (old kernel, seccomp)
+    the traversal goes on one file at a time, as do -j and the tree
+    field. The system calls are made directly, there is no liburing.
+*/
+int uring_depth = URING_DEPTH;
+int uring_buffers = URING_BUFFERS;
+
+#ifdef HAVE_URING
+
+#define OP_STATX            0
+#define OP_OPEN             1
+#define OP_READ             2
+#define OP_CLOSE            3
+
+/* user_data of a request: the operation, the entry and the read slot */
+#define TAG(op, i, slot)    ((uint64_t)(op) | (uint64_t)(slot) << 8 | (uint64_t)(i) << 16)
+#define TAG_OP(t)           ((int)((t) & 0xFF))
+#define TAG_SLOT(t)         ((int)(((t) >> 8) & 0xFF))
+#define TAG_INDEX(t)        ((int)((t) >> 16))
+
+struct ring {
+    int fd;
+    unsigned entries;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned sq_local;          /* tail of the requests prepared */
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_map;
+    void *cq_map;
+    size_t sq_maplen;
+    size_t cq_maplen;
+    size_t sqe_maplen;
+    unsigned queued;            /* prepared, not submitted */
+    unsigned inflight;          /* submitted, not completed */
+    unsigned char **buf;
+    int nbuf;
+    int fixed;                  /* buffers registered: IORING_OP_READ_FIXED */
+    int *freebuf;
+    int nfree;
+};
+
+struct uchunk {
+    int buf;
+    int done;
+    int res;
+};
+
+/* A regular file being read */
+struct ufile {
+    UENTRY *e;
+    DCKEY key;
+    uint32_t have;              /* digests from the cache */
+    uint32_t want;              /* digests to compute */
+    DSTREAM *ds;
+    int fd;
+    int state;
+    uint64_t next;              /* offset of the next read */
+    uint64_t hashed;
+    uint64_t limit;             /* reads start up to here: the size, or more if it grew */
+    unsigned head;              /* reads in flight are head..tail, in chunk[seq % URING_WINDOW] */
+    unsigned tail;
+    struct uchunk chunk[URING_WINDOW];
+    int eof;
+    int err;
+};
+
+#define UF_WAIT             0
+#define UF_OPENING          1
+#define UF_READING          2
+#define UF_DONE             3
+
+static struct ring ring = { -1 };
+static int ring_failed;
+static int ring_noopen;                 /* IORING_OP_OPENAT failed with EINVAL: before 5.6 */
+static unsigned long nenters, nrequests;
+
+static struct statx ustx[URING_BATCH];
+static int ures[URING_BATCH];
+static struct ufile ufile[URING_BATCH];
+static char udigest[URING_BATCH];      /* digests from the cache or the reads, tree hash to do */
+static int ulink[URING_BATCH];          /* an earlier entry of the same inode, or -1 */
+
+void uring_close(void)
+{
+    int i;
+
+    if(ring.sqes != (struct io_uring_sqe *)NULL) munmap(ring.sqes, ring.sqe_maplen);
+    if(ring.cq_map != NULL && ring.cq_map != ring.sq_map) munmap(ring.cq_map, ring.cq_maplen);
+    if(ring.sq_map != NULL) munmap(ring.sq_map, ring.sq_maplen);
+    if(ring.fd >= 0) close(ring.fd);
+    for(i = 0; i < ring.nbuf; i++) free(ring.buf[i]);
+    free(ring.buf);
+    free(ring.freebuf);
+    memset(&ring, 0, sizeof(ring));
+    ring.fd = -1;
+    return;
+}
+
+static void *ring_map(size_t len, off_t off)
+{
+    void *p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, off);
+    return (p == MAP_FAILED) ? NULL : p;
+}
+
+/* Set up the ring and its buffers. Returns 0, or -1 if io_uring is not to be had */
+static int ring_open(void)
+{
+    int i;
+    struct io_uring_params p;
+    struct iovec *iov;
+
+    if(ring.fd >= 0) return 0;
+    if(ring_failed) return -1;
+    memset(&p, 0, sizeof(p));
+    if((ring.fd = (int)syscall(__NR_io_uring_setup, (unsigned)uring_depth, &p)) < 0) goto fail;
+    ring.entries = p.sq_entries;
+    ring.sq_maplen = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ring.cq_maplen = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if(p.features & IORING_FEAT_SINGLE_MMAP) {
+        if(ring.cq_maplen > ring.sq_maplen) ring.sq_maplen = ring.cq_maplen;
+        ring.cq_maplen = ring.sq_maplen;
+    }
+    if((ring.sq_map = ring_map(ring.sq_maplen, IORING_OFF_SQ_RING)) == NULL) goto fail;
+    if(p.features & IORING_FEAT_SINGLE_MMAP) ring.cq_map = ring.sq_map;
+    else if((ring.cq_map = ring_map(ring.cq_maplen, IORING_OFF_CQ_RING)) == NULL) goto fail;
+    ring.sqe_maplen = p.sq_entries * sizeof(struct io_uring_sqe);
+    if((ring.sqes = (struct io_uring_sqe *)ring_map(ring.sqe_maplen, IORING_OFF_SQES)) == (struct io_uring_sqe *)NULL) goto fail;
+
+    ring.sq_head = (unsigned *)((char *)ring.sq_map + p.sq_off.head);
+    ring.sq_tail = (unsigned *)((char *)ring.sq_map + p.sq_off.tail);
+    ring.sq_mask = (unsigned *)((char *)ring.sq_map + p.sq_off.ring_mask);
+    ring.sq_array = (unsigned *)((char *)ring.sq_map + p.sq_off.array);
+    ring.sq_local = *ring.sq_tail;
+    ring.cq_head = (unsigned *)((char *)ring.cq_map + p.cq_off.head);
+    ring.cq_tail = (unsigned *)((char *)ring.cq_map + p.cq_off.tail);
+    ring.cq_mask = (unsigned *)((char *)ring.cq_map + p.cq_off.ring_mask);
+    ring.cqes = (struct io_uring_cqe *)((char *)ring.cq_map + p.cq_off.cqes);
+
+    if((ring.buf = (unsigned char **)calloc(uring_buffers, sizeof(unsigned char *))) == (unsigned char **)NULL
+            || (ring.freebuf = (int *)malloc(uring_buffers * sizeof(int))) == (int *)NULL
+            || (iov = (struct iovec *)malloc(uring_buffers * sizeof(struct iovec))) == (struct iovec *)NULL)
+        goto fail;
+    for(ring.nbuf = 0; ring.nbuf < uring_buffers; ring.nbuf++) {
+        if((ring.buf[ring.nbuf] = freader_alloc(digest_buflen)) == (unsigned char *)NULL) {
+            free(iov);
+            goto fail;
+        }
+        iov[ring.nbuf].iov_base = ring.buf[ring.nbuf];
+        iov[ring.nbuf].iov_len = digest_buflen;
+        ring.freebuf[ring.nbuf] = ring.nbuf;
+    }
+    ring.nfree = ring.nbuf;
+    /* Pinned for good, so a read does not map its buffer every time; plain reads if the limit says no */
+    ring.fixed = (syscall(__NR_io_uring_register, ring.fd, IORING_REGISTER_BUFFERS, iov, (unsigned)ring.nbuf) == 0);
+    free(iov);
+    return 0;
+
+fail:
+    fprintf(stderr, "%s: io_uring not available (%s); files are read one at a time.\n", progname, strerror(errno));
+    for(i = 0; i < ring.nbuf; i++) free(ring.buf[i]);
+    ring.nbuf = 0;
+    uring_close();
+    ring_failed = 1;
+    return -1;
+}
+
+/*
+    A request to fill in, or NULL when the ring is full. Requests are
+    never more than the entries, so the completion queue, twice that
+    size, cannot overflow.
+*/
+static struct io_uring_sqe *sqe_get(void)
+{
+    struct io_uring_sqe *sqe;
+    unsigned i;
+
+    if(ring.queued + ring.inflight >= ring.entries) return (struct io_uring_sqe *)NULL;
+    i = ring.sq_local & *ring.sq_mask;
+    sqe = &ring.sqes[i];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    ring.sq_array[i] = i;
+    ring.sq_local++;
+    ring.queued++;
+    nrequests++;
+    return sqe;
+}
+
+/* Submit what was prepared and, with wait, wait for a completion */
+static int ring_enter(int wait)
+{
+    int n;
+
+    if(ring.queued + ring.inflight == 0) return 0;
+    __atomic_store_n(ring.sq_tail, ring.sq_local, __ATOMIC_RELEASE);
+    do {
+        n = (int)syscall(__NR_io_uring_enter, ring.fd, ring.queued, wait ? 1 : 0, wait ? IORING_ENTER_GETEVENTS : 0,
+                         NULL, 0);
+    } while(n < 0 && errno == EINTR);
+    nenters++;
+    if(n < 0) return -1;
+    ring.queued -= (unsigned)n;
+    ring.inflight += (unsigned)n;
+    return 0;
+}
+
+static int cqe_next(struct io_uring_cqe *c)
+{
+    unsigned head = *ring.cq_head;
+
+    if(head == __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE)) return 0;
+    *c = ring.cqes[head & *ring.cq_mask];
+    __atomic_store_n(ring.cq_head, head + 1, __ATOMIC_RELEASE);
+    ring.inflight--;
+    return 1;
+}
+
+/* 1: statx the entries that need it, into ustx[] and ures[] (0 or -errno; 1 if not asked) */
+static void uring_stat(const FSDIR *dir, UENTRY *e, int n, uint32_t fields)
+{
+    int i, next = 0;
+    struct io_uring_sqe *sqe;
+    struct io_uring_cqe c;
+    uint64_t t0 = PROF_START();
+    unsigned long enters = nenters;
+
+    for(i = 0; i < n; i++)
+        ures[i] = (e[i].dtype == DT_UNKNOWN
+                   || (e[i].dtype != DT_LNK && (fields & ~(FLDM(FLD_NAME) | FLDM(FLD_PATH) | FLDM(FLD_TYPE))) == 0));
+    for(;;) {
+        for(; next < n; next++) {
+            if(ures[next] == 1) continue;
+            if((sqe = sqe_get()) == (struct io_uring_sqe *)NULL) break;
+            sqe->opcode = IORING_OP_STATX;
+            sqe->fd = dir->fd;
+            sqe->addr = (uint64_t)(uintptr_t)e[next].name;
+            sqe->len = statx_mask(fields);
+            sqe->statx_flags = (dir->netfs ? AT_STATX_DONT_SYNC : 0) | (sum_mode ? AT_SYMLINK_NOFOLLOW : 0);
+            sqe->off = (uint64_t)(uintptr_t)&ustx[next];
+            sqe->user_data = TAG(OP_STATX, next, 0);
+        }
+        if(ring.queued + ring.inflight == 0) break;
+        if(ring_enter(1) != 0) {
+            /* Left to the plain stat of collect_file_stat_at() */
+            for(; next < n; next++) ures[next] = -EIO;
+            break;
+        }
+        while(cqe_next(&c)) ures[TAG_INDEX(c.user_data)] = (c.res < 0) ? c.res : 0;
+    }
+    PROF_EVENT(PH_STAT, PT_OTHER, t0, nenters - enters, 0);
+    return;
+}
+
+static void ufile_finish(struct ufile *f)
+{
+    FSREC *r = &f->e->rec;
+
+    f->state = UF_DONE;
+    if(f->err != 0) {
+        digest_end(f->ds, 0, (FDIGEST *)NULL);
+        r->dgstat = DG_ERR;
+        r->err = f->err;
+        return;
+    }
+    digest_end(f->ds, f->hashed, &r->dg);
+    /* A file that changed size while it was read is not cached */
+    if(dcache != (DCACHE *)NULL && f->hashed == f->key.size) dcache_insert(dcache, &f->key, f->have | f->want, &r->dg);
+    r->dgstat = DG_OK;
+    return;
+}
+
+/* Queue the reads of f that the window and the free buffers allow */
+static void ufile_reads(struct ufile *f)
+{
+    int b;
+    struct io_uring_sqe *sqe;
+
+    while(!f->eof && f->err == 0 && f->tail - f->head < URING_WINDOW && ring.nfree > 0 && f->next <= f->limit) {
+        if((sqe = sqe_get()) == (struct io_uring_sqe *)NULL) return;
+        b = ring.freebuf[--ring.nfree];
+        f->chunk[f->tail % URING_WINDOW].buf = b;
+        f->chunk[f->tail % URING_WINDOW].done = 0;
+        sqe->opcode = ring.fixed ? IORING_OP_READ_FIXED : IORING_OP_READ;
+        sqe->fd = f->fd;
+        sqe->addr = (uint64_t)(uintptr_t)ring.buf[b];
+        sqe->len = (unsigned)digest_buflen;
+        sqe->off = f->next;
+        sqe->buf_index = (unsigned short)b;
+        sqe->user_data = TAG(OP_READ, f - ufile, f->tail % URING_WINDOW);
+        f->next += digest_buflen;
+        f->tail++;
+    }
+    return;
+}
+
+/* Hash the reads of f that are complete, in order; a short one is the end of the file */
+static void ufile_hash(struct ufile *f)
+{
+    struct uchunk *ch;
+
+    while(f->head != f->tail && (ch = &f->chunk[f->head % URING_WINDOW])->done) {
+        if(!f->eof && f->err == 0) {
+            if(ch->res < 0) {
+                f->err = -ch->res;
+            } else {
+                digest_feed(f->ds, ring.buf[ch->buf], (size_t)ch->res);
+                f->hashed += (uint64_t)ch->res;
+                if((size_t)ch->res < digest_buflen) f->eof = 1;
+                else if(f->hashed > f->limit) f->limit = f->hashed;
+            }
+        }
+        ring.freebuf[ring.nfree++] = ch->buf;
+        f->head++;
+    }
+    return;
+}
+
+/* Read and hash f with plain reads, for a kernel without IORING_OP_OPENAT (nor IORING_OP_READ) */
+static void ufile_plain(const FSDIR *dir, struct ufile *f)
+{
+    unsigned char *buf;
+    ssize_t len;
+    int fd;
+
+    if((fd = openat(dir->fd, f->e->name, O_RDONLY | O_CLOEXEC)) < 0) {
+        f->err = errno;
+        return;
+    }
+    if((buf = (unsigned char *)malloc(digest_buflen)) == (unsigned char *)NULL) {
+        f->err = ENOMEM;
+        close(fd);
+        return;
+    }
+    while((len = read(fd, buf, digest_buflen)) != 0) {
+        if(len < 0) {
+            if(errno == EINTR) continue;
+            f->err = errno;
+            break;
+        }
+        digest_feed(f->ds, buf, (size_t)len);
+        f->hashed += (uint64_t)len;
+    }
+    free(buf);
+    close(fd);
+    return;
+}
+
+/* 2: read and hash the nf files of ufile[] */
+static void uring_read(const FSDIR *dir, int nf)
+{
+    int i, next = 0, active = 0, done = 0;
+    struct io_uring_sqe *sqe;
+    struct io_uring_cqe c;
+    struct ufile *f;
+    uint64_t t0, bytes;
+
+    while(done < nf) {
+        for(; next < nf && active < uring_depth; next++) {
+            f = &ufile[next];
+            if(ring_noopen) {
+                ufile_plain(dir, f);
+                ufile_finish(f);
+                done++;
+                continue;
+            }
+            if((sqe = sqe_get()) == (struct io_uring_sqe *)NULL) break;
+            sqe->opcode = IORING_OP_OPENAT;
+            sqe->fd = dir->fd;
+            sqe->addr = (uint64_t)(uintptr_t)f->e->name;
+            sqe->open_flags = O_RDONLY | O_CLOEXEC;
+            sqe->user_data = TAG(OP_OPEN, next, 0);
+            f->state = UF_OPENING;
+            active++;
+        }
+        for(i = 0; i < next; i++) {
+            f = &ufile[i];
+            if(f->state != UF_READING) continue;
+            if((f->eof || f->err != 0) && f->head == f->tail) {
+                if((sqe = sqe_get()) == (struct io_uring_sqe *)NULL) break;
+                sqe->opcode = IORING_OP_CLOSE;
+                sqe->fd = f->fd;
+                sqe->user_data = TAG(OP_CLOSE, i, 0);
+                ufile_finish(f);
+                active--;
+                done++;
+            } else ufile_reads(f);
+        }
+        if(done == nf) break;
+
+        t0 = PROF_START();
+        if(ring_enter(1) != 0) {
+            /* Nothing more can be read; what is left fails with the error */
+            for(i = 0; i < nf; i++) {
+                if(ufile[i].state == UF_DONE) continue;
+                if(ufile[i].err == 0) ufile[i].err = errno;
+                ufile[i].head = ufile[i].tail;
+                if(ufile[i].state == UF_READING) close(ufile[i].fd);
+                ufile_finish(&ufile[i]);
+            }
+            break;
+        }
+        bytes = 0;
+        while(cqe_next(&c)) {
+            f = &ufile[TAG_INDEX(c.user_data)];
+            switch(TAG_OP(c.user_data)) {
+                case OP_OPEN:
+                    if(c.res == -EINVAL) {
+                        /* The opcode is unknown: this file and the rest are read plainly */
+                        ring_noopen = 1;
+                        ufile_plain(dir, f);
+                        ufile_finish(f);
+                        active--;
+                        done++;
+                    } else if(c.res < 0) {
+                        f->err = -c.res;
+                        ufile_finish(f);
+                        active--;
+                        done++;
+                    } else {
+                        f->fd = c.res;
+                        f->state = UF_READING;
+                    }
+                    break;
+                case OP_READ:
+                    f->chunk[TAG_SLOT(c.user_data)].done = 1;
+                    f->chunk[TAG_SLOT(c.user_data)].res = c.res;
+                    if(c.res > 0) bytes += (uint64_t)c.res;
+                    ufile_hash(f);
+                    break;
+                default:
+                    break;
+            }
+        }
+        PROF_EVENT(PH_READ, PT_REG, t0, 1, bytes);
+    }
+    /* The closes */
+    while(ring.queued + ring.inflight > 0 && ring_enter(1) == 0)
+        while(cqe_next(&c))
+            ;
+    return;
+}
+
+/*
+    Collect the records of the n (at most URING_BATCH) entries e of the
+    directory dir for fields, into e[i].rec and e[i].rc, as the same
+    collect_file_stat_at() calls would. Returns 0, or -1 if there is no
+    io_uring, and nothing was collected.
+*/
+int uring_collect(const FSDIR *dir, UENTRY *e, int n, uint32_t fields)
+{
+    int i, j, nf = 0;
+    uint32_t want = fields & FLDM_ENGINE;
+    FSREC *r;
+    struct stat sb;
+    struct ufile *f;
+    DCKEY key, lkey;
+
+    if(n > URING_BATCH || ring_open() != 0) return -1;
+    uring_stat(dir, e, n, fields | filter_fields);
+
+    for(i = 0; i < n; i++) {
+        r = &e[i].rec;
+        udigest[i] = 0;
+        ulink[i] = -1;
+        if(ures[i] != 0) {
+            e[i].rc = collect_file_stat_at(r, dir, e[i].name, e[i].dtype, e[i].filename, fields);
+            continue;
+        }
+        statx_to_stat(&ustx[i], &sb);
+        e[i].rc = collect_file_stat_stated(r, dir, e[i].name, e[i].dtype, e[i].filename, fields & ~FLDM_DIGESTS, &sb);
+        r->fields = fields;
+        if(e[i].rc < 0 || r->filtered || (fields & FLDM_DIGESTS) == 0 || !S_ISREG(r->sb.st_mode)) continue;
+
+        /* What collect_file_stat_at() would not read either */
+        if(since_digests(r, &r->dg) == 0 || inode_digests(r, &r->dg) == 0) {
+            r->dgstat = DG_OK;
+            continue;
+        }
+        udigest[i] = 1;
+        /* Another link of a file of the batch is read once */
+        dcache_key(&key, &r->sb, &r->ts);
+        for(j = 0; r->sb.st_nlink > 1 && j < i; j++) {
+            if(!udigest[j] || ulink[j] >= 0 || e[j].rec.sb.st_ino != r->sb.st_ino) continue;
+            dcache_key(&lkey, &e[j].rec.sb, &e[j].rec.ts);
+            if(memcmp(&lkey, &key, sizeof(DCKEY)) == 0) break;
+        }
+        if(r->sb.st_nlink > 1 && j < i) {
+            ulink[i] = j;
+            continue;
+        }
+        f = &ufile[nf];
+        memset(f, 0, sizeof(struct ufile));
+        f->e = &e[i];
+        f->fd = -1;
+        f->key = key;
+        if(want && dcache != (DCACHE *)NULL) f->have = dcache_lookup(dcache, &f->key, want, &r->dg);
+        f->want = want & ~f->have;
+        f->limit = f->key.size;
+        r->dgstat = DG_PENDING;
+        if(f->want == 0) {
+            r->dgstat = DG_OK;
+            continue;
+        }
+        if((f->ds = digest_begin(f->want)) == (DSTREAM *)NULL) {
+            r->dgstat = DG_ERR;
+            r->err = ENOMEM;
+            continue;
+        }
+        nf++;
+    }
+    if(nf > 0) uring_read(dir, nf);
+
+    /* The tree hash is a pass of its own */
+    for(i = 0; i < n; i++) {
+        r = &e[i].rec;
+        if(!udigest[i]) continue;
+        if(ulink[i] >= 0) {
+            r->dgstat = e[ulink[i]].rec.dgstat;
+            r->dg = e[ulink[i]].rec.dg;
+            r->err = e[ulink[i]].rec.err;
+            if(r->dgstat == DG_OK) inode_reused();
+            continue;
+        }
+        if(r->dgstat != DG_OK) continue;
+        if(fields & FLDM(FLD_TREE)) {
+            dcache_key(&key, &r->sb, &r->ts);
+            if(tree_hash_at(dir->fd, e[i].name, &key, &r->dg) != 0) {
+                r->dgstat = DG_ERR;
+                r->err = errno;
+                continue;
+            }
+        }
+        inode_keep(r);
+    }
+    return 0;
+}
+
+void uring_counts(unsigned long *enters, unsigned long *requests, int *fixed)
+{
+    *enters = nenters;
+    *requests = nrequests;
+    *fixed = ring.fixed;
+    return;
+}
+
+#else
+
+int uring_collect(const FSDIR *dir, UENTRY *e, int n, uint32_t fields)
+{
+    static int warned;
+
+    (void)dir;
+    (void)e;
+    (void)n;
+    (void)fields;
+    if(!warned) fprintf(stderr, "%s: io_uring not available on this system; files are read one at a time.\n", progname);
+    warned = 1;
+    return -1;
+}
+
+void uring_close(void)
+{
+    return;
+}
+
+void uring_counts(unsigned long *enters, unsigned long *requests, int *fixed)
+{
+    *enters = *requests = 0;
+    *fixed = 0;
+    return;
+}
+
+#endif
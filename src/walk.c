@@ -0,0 +1,590 @@
+/*
+# +-------------------------------------------------------------------+
+# | Program Name  :  walk.c                                           |
+# | Author        :  Bhaskar Bhaumik (web.bhaskar.bhaumik@gmail.com)  |
+# | Version       :  0.1                                              |
+# | Date Created  :  October 13, 2018                                 |
+# | Description   :  Parallel traversal of the input arguments over a |
+# |                  work-stealing pool of threads (option -j).       |
+# +-------------------------------------------------------------------+
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "filestat.h"
+
+/*
+    Every path is a task. Running a task formats the record of the path
+    into the reusable buffer of the worker and, for a directory being
+    recursed into, pushes one child task per entry onto the deque of the
+    running worker. Workers pop their own deque from the bottom and steal
+    from the top of the others, so a large directory is spread over the
+    pool as soon as it is expanded.
+
+    In deterministic order the tasks also form a tree (children in readdir
+    order) that the main thread emits in pre-order, which is exactly the
+    order of the serial traversal; each record is written as soon as all
+    those before it are, and its task freed. The children are pushed last
+    first, so that a worker pops them in that order too, and the others
+    steal from the bottom as well rather than far ahead. At most
+    WALK_HELD records wait formatted for those before them: past that the
+    workers stop, and the main thread takes the task it waits for out of
+    its deque and runs it itself. In completion order a record is written
+    as soon as it is formatted and the task is freed right away.
+
+    The entries of a directory are stat'ed and opened relative to one
+    shared descriptor of it, which is closed when the last of them has
+    run; see process_entry() for the serial equivalent. So only the
+    directories with entries still to run hold a descriptor, as many as
+    the serial traversal has down the tree per worker. A directory also
+    holds the identity of its parent, but not its descriptor, so that
+    visit_dir() can look for loops up the tree.
+
+    The arguments, then the names of a --files-from list, are fed to the
+    pool by the main thread while it runs, PLIST_QUEUE at most in flight:
+    in deterministic order the oldest is written out before another is
+    read, in completion order the main thread waits for one to finish.
+*/
+struct wdir {
+    FSDIR dir;
+    long refs;                  /* tasks and subdirectories; frees it */
+    long users;                 /* tasks; closes dir.fd */
+    struct wdir *up;
+};
+
+struct wtask {
+    char *path;
+    size_t base;                /* offset of the name relative to dir */
+    int dtype;                  /* DT_* from the directory */
+    struct wdir *dir;           /* NULL for the arguments */
+    char *out;
+    size_t outlen;
+    int done;
+    struct wtask *child;
+    struct wtask *ctail;
+    struct wtask *next;
+};
+
+struct deque {
+    pthread_mutex_t lock;
+    struct wtask **v;
+    size_t cap;
+    size_t top;
+    size_t bottom;
+};
+
+struct pool;
+
+struct worker {
+    int id;
+    pthread_t tid;
+    struct deque dq;
+    OBUF ob;                    /* record being formatted */
+    struct pool *pool;
+};
+
+struct pool {
+    OBUF *out;
+    int otyp;
+    int recurse;
+    int order;
+    int nworkers;
+    struct worker *w;           /* nworkers, then the main thread */
+    int threaded;               /* the tasks are not all run by the main thread */
+    long held;                  /* records formatted, not yet written */
+    long queued;                /* tasks sitting in deques */
+    long pending;               /* tasks not yet finished */
+    long idle;
+    int feeding;                /* the main thread may still push arguments */
+    long roots;                 /* arguments not yet finished */
+    pthread_mutex_t lock;       /* sleeping workers */
+    pthread_cond_t cond;
+    pthread_mutex_t out_lock;   /* out and task completion */
+    pthread_cond_t out_cond;
+};
+
+/* Room for n more tasks at the bottom of dq, locked */
+static void deque_reserve(struct deque *dq, size_t n)
+{
+    if(dq->bottom + n <= dq->cap) return;
+    if(dq->top > 0) {
+        memmove(dq->v, dq->v + dq->top, (dq->bottom - dq->top) * sizeof(struct wtask *));
+        dq->bottom -= dq->top;
+        dq->top = 0;
+    }
+    if(dq->bottom + n <= dq->cap) return;
+    if(dq->cap == 0) dq->cap = 64;
+    while(dq->cap < dq->bottom + n) dq->cap *= 2;
+    if((dq->v = (struct wtask **)realloc(dq->v, dq->cap * sizeof(struct wtask *))) == (struct wtask **)NULL) {
+        perror(progname);
+        exit(1);
+    }
+    return;
+}
+
+static void deque_push(struct deque *dq, struct wtask *t)
+{
+    pthread_mutex_lock(&dq->lock);
+    deque_reserve(dq, 1);
+    dq->v[dq->bottom++] = t;
+    pthread_mutex_unlock(&dq->lock);
+    return;
+}
+
+/* Push the n tasks linked from first, the last one first */
+static void deque_push_list(struct deque *dq, struct wtask *first, size_t n)
+{
+    size_t i;
+
+    pthread_mutex_lock(&dq->lock);
+    deque_reserve(dq, n);
+    for(i = n; i > 0; i--, first = first->next)
+        dq->v[dq->bottom + i - 1] = first;
+    dq->bottom += n;
+    pthread_mutex_unlock(&dq->lock);
+    return;
+}
+
+static struct wtask *deque_pop(struct deque *dq)
+{
+    struct wtask *t = (struct wtask *)NULL;
+    pthread_mutex_lock(&dq->lock);
+    while(t == (struct wtask *)NULL && dq->bottom > dq->top) t = dq->v[--dq->bottom];
+    if(dq->bottom == dq->top) dq->bottom = dq->top = 0;
+    pthread_mutex_unlock(&dq->lock);
+    return t;
+}
+
+static struct wtask *deque_steal(struct deque *dq)
+{
+    struct wtask *t = (struct wtask *)NULL;
+    pthread_mutex_lock(&dq->lock);
+    while(t == (struct wtask *)NULL && dq->bottom > dq->top) t = dq->v[dq->top++];
+    if(dq->bottom == dq->top) dq->bottom = dq->top = 0;
+    pthread_mutex_unlock(&dq->lock);
+    return t;
+}
+
+/* Take t out of dq if it is still there; its slot is left empty. Returns 1 if it was */
+static int deque_remove(struct deque *dq, struct wtask *t)
+{
+    size_t i;
+    int found = 0;
+
+    pthread_mutex_lock(&dq->lock);
+    for(i = dq->bottom; i > dq->top; i--) {
+        if(dq->v[i - 1] == t) {
+            dq->v[i - 1] = (struct wtask *)NULL;
+            found = 1;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&dq->lock);
+    return found;
+}
+
+static struct wtask *task_new(char *path, size_t base, int dtype, struct wdir *dir)
+{
+    struct wtask *t;
+    if((t = (struct wtask *)calloc(1, sizeof(struct wtask))) == (struct wtask *)NULL) {
+        perror(progname);
+        exit(1);
+    }
+    t->path = path;
+    t->base = base;
+    t->dtype = dtype;
+    t->dir = dir;
+    if(dir != (struct wdir *)NULL) {
+        __atomic_add_fetch(&dir->refs, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&dir->users, 1, __ATOMIC_RELAXED);
+    }
+    return t;
+}
+
+/* Drop a reference to d, freeing it and then its parents as they become unused */
+static void wdir_unref(struct wdir *d)
+{
+    struct wdir *up;
+
+    for(; d != (struct wdir *)NULL && __atomic_sub_fetch(&d->refs, 1, __ATOMIC_ACQ_REL) == 0; d = up) {
+        up = d->up;
+        free(d);
+    }
+    return;
+}
+
+/* A task of d is done with its descriptor; the last one closes it */
+static void wdir_release(struct wdir *d)
+{
+    if(d == (struct wdir *)NULL) return;
+    if(__atomic_sub_fetch(&d->users, 1, __ATOMIC_ACQ_REL) == 0) {
+        close(d->dir.fd);
+        d->dir.fd = -1;
+        free(d->dir.path);
+        d->dir.path = (char *)NULL;
+    }
+    wdir_unref(d);
+    return;
+}
+
+static void pool_wake(struct pool *p)
+{
+    if(__atomic_load_n(&p->idle, __ATOMIC_SEQ_CST) > 0) {
+        pthread_mutex_lock(&p->lock);
+        pthread_cond_broadcast(&p->cond);
+        pthread_mutex_unlock(&p->lock);
+    }
+    return;
+}
+
+static void pool_push(struct pool *p, struct worker *w, struct wtask *t)
+{
+    __atomic_add_fetch(&p->pending, 1, __ATOMIC_SEQ_CST);
+    deque_push(&w->dq, t);
+    __atomic_add_fetch(&p->queued, 1, __ATOMIC_SEQ_CST);
+    pool_wake(p);
+    return;
+}
+
+/* Push the children first, ... of a task so that w pops them in that order */
+static void pool_push_children(struct pool *p, struct worker *w, struct wtask *first)
+{
+    size_t n = 0;
+    struct wtask *c;
+
+    for(c = first; c != (struct wtask *)NULL; c = c->next)
+        n++;
+    __atomic_add_fetch(&p->pending, (long)n, __ATOMIC_SEQ_CST);
+    deque_push_list(&w->dq, first, n);
+    __atomic_add_fetch(&p->queued, (long)n, __ATOMIC_SEQ_CST);
+    pool_wake(p);
+    return;
+}
+
+static struct wtask *pool_take(struct pool *p, struct worker *w)
+{
+    int i;
+    struct wtask *t;
+    struct deque *dq;
+
+    if((t = deque_pop(&w->dq)) == (struct wtask *)NULL) {
+        for(i = 1; i <= p->nworkers && t == (struct wtask *)NULL; i++) {
+            dq = &p->w[(w->id + i) % (p->nworkers + 1)].dq;
+            t = (p->order == ORDER_DETERMINISTIC) ? deque_pop(dq) : deque_steal(dq);
+        }
+    }
+    if(t != (struct wtask *)NULL) __atomic_sub_fetch(&p->queued, 1, __ATOMIC_SEQ_CST);
+    return t;
+}
+
+static void task_finish(struct pool *p)
+{
+    if(__atomic_sub_fetch(&p->pending, 1, __ATOMIC_SEQ_CST) == 0) {
+        pthread_mutex_lock(&p->lock);
+        pthread_cond_broadcast(&p->cond);
+        pthread_mutex_unlock(&p->lock);
+    }
+    return;
+}
+
+static void task_expand(struct pool *p, struct worker *w, struct wtask *t, char *real)
+{
+    int rc, dtype;
+    DREADER dr;
+    struct wtask *c;
+    struct wdir *d;
+    size_t plen, nlen;
+    const char *name;
+    char *newent;
+
+    if(dreader_open(&dr, (t->dir != (struct wdir *)NULL) ? t->dir->dir.fd : AT_FDCWD, t->path + t->base) != 0) {
+        perror(t->path);
+        free(real);
+        return;
+    }
+    /* The reader keeps its own descriptor; the children share a duplicate */
+    if((d = (struct wdir *)calloc(1, sizeof(struct wdir))) == (struct wdir *)NULL) {
+        perror(progname);
+        exit(1);
+    }
+    if((d->dir.fd = fcntl(dr.fd, F_DUPFD_CLOEXEC, 0)) < 0) {
+        perror(t->path);
+        dreader_close(&dr);
+        free(d);
+        free(real);
+        return;
+    }
+    if(!visit_dir(&d->dir, (t->dir != (struct wdir *)NULL) ? &t->dir->dir : (const FSDIR *)NULL, t->path)) {
+        dreader_close(&dr);
+        close(d->dir.fd);
+        free(d);
+        free(real);
+        return;
+    }
+    if((d->up = t->dir) != (struct wdir *)NULL) __atomic_add_fetch(&d->up->refs, 1, __ATOMIC_RELAXED);
+    d->dir.path = real;
+    d->dir.netfs = fs_is_network(dr.fd);
+    d->refs = 1;
+    d->users = 1;
+    plen = strlen(t->path);
+    while((rc = dreader_next(&dr, &name, &dtype)) > 0) {
+        if(!filter_entry(name, dtype, p->recurse)) continue;
+        nlen = strlen(name);
+        if((newent = (char *)malloc(plen + nlen + 2)) == (char *)NULL) {
+            perror(progname);
+            exit(1);
+        }
+        memcpy(newent, t->path, plen);
+        newent[plen] = DIR_PATH_CHAR;
+        memcpy(newent + plen + 1, name, nlen + 1);
+        c = task_new(newent, plen + 1, dtype, d);
+        if(p->order == ORDER_DETERMINISTIC) {
+            if(t->ctail) t->ctail->next = c;
+            else t->child = c;
+            t->ctail = c;
+            continue;
+        }
+        pool_push(p, w, c);
+    }
+    if(rc < 0) perror(t->path);
+    dreader_close(&dr);
+    if(t->child != (struct wtask *)NULL) pool_push_children(p, w, t->child);
+    wdir_release(d);
+    return;
+}
+
+static void task_run(struct pool *p, struct worker *w, struct wtask *t)
+{
+    int rc;
+    FSREC rec;
+    char *real;
+    int root = (t->dir == (struct wdir *)NULL);
+
+    w->ob.len = 0;
+    rc = collect_file_stat_at(&rec, (t->dir != (struct wdir *)NULL) ? &t->dir->dir : (const FSDIR *)NULL,
+                              t->path + t->base, t->dtype, t->path, out_fields);
+    collect_perror(&rec, t->path);
+    if(rc >= 0) {
+        if(!rec.filtered && since_keep(&rec)) format_record(&w->ob, p->otyp, &rec);
+        real = rec.path;
+        rec.path = (char *)NULL;
+        free_file_stat(&rec);
+        if(rc == 1 && p->recurse == 1) task_expand(p, w, t, real);
+        else free(real);
+    }
+    wdir_release(t->dir);
+    t->dir = (struct wdir *)NULL;
+
+    if(p->order == ORDER_COMPLETION) {
+        pthread_mutex_lock(&p->out_lock);
+        obuf_write(p->out, w->ob.buf, w->ob.len);
+        if(p->out->interactive) obuf_flush(p->out);
+        if(root) {
+            p->roots--;
+            pthread_cond_broadcast(&p->out_cond);
+        }
+        pthread_mutex_unlock(&p->out_lock);
+        free(t->path);
+        free(t);
+    } else {
+        if(w->ob.len > 0) {
+            if((t->out = (char *)malloc(w->ob.len)) == (char *)NULL) {
+                perror(progname);
+                exit(1);
+            }
+            memcpy(t->out, w->ob.buf, w->ob.len);
+            t->outlen = w->ob.len;
+        }
+        pthread_mutex_lock(&p->out_lock);
+        t->done = 1;
+        p->held++;
+        pthread_cond_broadcast(&p->out_cond);
+        pthread_mutex_unlock(&p->out_lock);
+    }
+    task_finish(p);
+    return;
+}
+
+static void *worker_main(void *arg)
+{
+    struct worker *w = (struct worker *)arg;
+    struct pool *p = w->pool;
+    struct wtask *t;
+
+    for(;;) {
+        if(p->order == ORDER_DETERMINISTIC && p->threaded && __atomic_load_n(&p->held, __ATOMIC_SEQ_CST) >= WALK_HELD) {
+            pthread_mutex_lock(&p->out_lock);
+            while(p->held >= WALK_HELD)
+                pthread_cond_wait(&p->out_cond, &p->out_lock);
+            pthread_mutex_unlock(&p->out_lock);
+        }
+        if((t = pool_take(p, w)) != (struct wtask *)NULL) {
+            task_run(p, w, t);
+            continue;
+        }
+        pthread_mutex_lock(&p->lock);
+        __atomic_add_fetch(&p->idle, 1, __ATOMIC_SEQ_CST);
+        while(__atomic_load_n(&p->queued, __ATOMIC_SEQ_CST) == 0
+                && (__atomic_load_n(&p->pending, __ATOMIC_SEQ_CST) > 0
+                    || __atomic_load_n(&p->feeding, __ATOMIC_SEQ_CST)))
+            pthread_cond_wait(&p->cond, &p->lock);
+        __atomic_sub_fetch(&p->idle, 1, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock(&p->lock);
+        if(__atomic_load_n(&p->pending, __ATOMIC_SEQ_CST) == 0 && !__atomic_load_n(&p->feeding, __ATOMIC_SEQ_CST)) break;
+    }
+    return (void *)NULL;
+}
+
+/*
+    Take t, not yet run, out of the deques and run it on the main thread,
+    when the workers have stopped for the records held. Returns 1 if it
+    did, 0 if they have not stopped, -1 if a worker has t already.
+*/
+static int run_held(struct pool *p, struct wtask *t)
+{
+    int i;
+
+    if(__atomic_load_n(&p->held, __ATOMIC_SEQ_CST) < WALK_HELD) return 0;
+    for(i = 0; i <= p->nworkers; i++) {
+        if(deque_remove(&p->w[i].dq, t)) {
+            __atomic_sub_fetch(&p->queued, 1, __ATOMIC_SEQ_CST);
+            task_run(p, &p->w[p->nworkers], t);
+            return 1;
+        }
+    }
+    return -1;
+}
+
+/* Write a finished task and its subtree in pre-order, freeing as it goes */
+static void emit_tree(struct pool *p, struct wtask *t)
+{
+    struct wtask *c, *next;
+    int rc;
+
+    pthread_mutex_lock(&p->out_lock);
+    while(!t->done) {
+        pthread_mutex_unlock(&p->out_lock);
+        rc = run_held(p, t);
+        pthread_mutex_lock(&p->out_lock);
+        if(!t->done && (rc < 0 || (rc == 0 && p->held < WALK_HELD)))
+            pthread_cond_wait(&p->out_cond, &p->out_lock);
+    }
+    p->held--;
+    if(p->held == WALK_HELD - 1) pthread_cond_broadcast(&p->out_cond);
+    pthread_mutex_unlock(&p->out_lock);
+
+    obuf_write(p->out, t->out, t->outlen);
+    if(p->out->interactive) obuf_flush(p->out);
+    free(t->out);
+    t->out = (char *)NULL;
+    for(c = t->child; c != (struct wtask *)NULL; c = next) {
+        next = c->next;
+        emit_tree(p, c);
+    }
+    free(t->path);
+    free(t);
+    return;
+}
+
+/*
+    Process the nargs arguments args, then the names of the list pl (may
+    be NULL), with a pool of jobs threads. Returns 0, or -1 if the pool
+    could not be started.
+*/
+int walk_parallel(OBUF *out, int otyp, int recurse, char **args, int nargs, PLIST *pl, int jobs, int order)
+{
+    int i, started;
+    long n = 0, head = 0;
+    const char *name;
+    char *path;
+    struct pool p;
+    struct wtask **roots, *t;
+
+    memset(&p, 0, sizeof(p));
+    p.out = out;
+    p.otyp = otyp;
+    p.recurse = recurse;
+    p.order = order;
+    p.nworkers = jobs;
+    p.feeding = 1;
+    pthread_mutex_init(&p.lock, NULL);
+    pthread_cond_init(&p.cond, NULL);
+    pthread_mutex_init(&p.out_lock, NULL);
+    pthread_cond_init(&p.out_cond, NULL);
+
+    if((p.w = (struct worker *)calloc(jobs + 1, sizeof(struct worker))) == (struct worker *)NULL
+            || (roots = (struct wtask **)calloc(PLIST_QUEUE, sizeof(struct wtask *))) == (struct wtask **)NULL) {
+        perror(progname);
+        return -1;
+    }
+    for(i = 0; i <= jobs; i++) {
+        p.w[i].id = i;
+        p.w[i].pool = &p;
+        obuf_init(&p.w[i].ob, -1);
+        pthread_mutex_init(&p.w[i].dq.lock, NULL);
+    }
+
+    p.threaded = 1;
+    for(started = 0; started < jobs; started++) {
+        if(pthread_create(&p.w[started].tid, NULL, worker_main, &p.w[started]) != 0) {
+            fprintf(stderr, "%s: can't start worker thread: %s\n", progname, strerror(errno));
+            break;
+        }
+    }
+    /* Nothing runs the tasks; each argument is run on this thread as it comes */
+    if(started == 0) p.feeding = p.threaded = 0;
+
+    /* Round-robin over the workers; the rest is balanced by stealing */
+    for(i = 0; ; i++) {
+        if(i < nargs) name = args[i];
+        else if(pl == (PLIST *)NULL || (name = plist_next(pl)) == (const char *)NULL) break;
+        if(!filter_entry(name, DT_UNKNOWN, recurse)) continue;
+        if((path = strdup(name)) == (char *)NULL) {
+            perror(progname);
+            exit(1);
+        }
+        if(order == ORDER_DETERMINISTIC) {
+            if(n - head == PLIST_QUEUE) emit_tree(&p, roots[head++ % PLIST_QUEUE]);
+        } else {
+            pthread_mutex_lock(&p.out_lock);
+            while(p.roots >= PLIST_QUEUE)
+                pthread_cond_wait(&p.out_cond, &p.out_lock);
+            p.roots++;
+            pthread_mutex_unlock(&p.out_lock);
+        }
+        t = task_new(path, 0, DT_UNKNOWN, (struct wdir *)NULL);
+        if(order == ORDER_DETERMINISTIC) roots[n++ % PLIST_QUEUE] = t;
+        pool_push(&p, &p.w[i % jobs], t);
+        if(started == 0) worker_main(&p.w[0]);
+    }
+    pthread_mutex_lock(&p.lock);
+    __atomic_store_n(&p.feeding, 0, __ATOMIC_SEQ_CST);
+    pthread_cond_broadcast(&p.cond);
+    pthread_mutex_unlock(&p.lock);
+
+    if(order == ORDER_DETERMINISTIC) {
+        while(head < n) emit_tree(&p, roots[head++ % PLIST_QUEUE]);
+    }
+    for(i = 0; i < started; i++)
+        pthread_join(p.w[i].tid, NULL);
+
+    for(i = 0; i <= jobs; i++) {
+        free(p.w[i].dq.v);
+        obuf_free(&p.w[i].ob);
+        pthread_mutex_destroy(&p.w[i].dq.lock);
+    }
+    free(p.w);
+    free(roots);
+    pthread_mutex_destroy(&p.lock);
+    pthread_cond_destroy(&p.cond);
+    pthread_mutex_destroy(&p.out_lock);
+    pthread_cond_destroy(&p.out_cond);
+    return 0;
+}
@@ -0,0 +1,690 @@
+/*
+# +-------------------------------------------------------------------+
+# | Program Name  :  watch.c                                          |
+# | Author        :  Bhaskar Bhaumik (web.bhaskar.bhaumik@gmail.com)  |
+# | Version       :  0.1                                              |
+# | Date Created  :  October 13, 2018                                 |
+# | Description   :  Watch mode: a resident index of the records kept |
+# |                  current with inotify and queried over a Unix     |
+# |                  socket.                                          |
+# +-------------------------------------------------------------------+
+*/
+#define _GNU_SOURCE                     /* accept4() */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#if defined(__linux__)
+#include <sys/inotify.h>
+#endif
+
+#include "filestat.h"
+
+/*
+    Client: send the output type and the names, one per line, and copy
+    the answer to fd. No names asks for every record; a name that ends
+    in '/' asks for the records under that directory.
+*/
+static int watch_connect(const char *sockpath)
+{
+    int s;
+    struct sockaddr_un sa;
+
+    if(strlen(sockpath) >= sizeof(sa.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    memset(&sa, 0, sizeof(sa));
+    sa.sun_family = AF_UNIX;
+    strcpy(sa.sun_path, sockpath);
+    if((s = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0) return -1;
+    if(connect(s, (struct sockaddr *)&sa, sizeof(sa)) != 0) {
+        close(s);
+        return -1;
+    }
+    return s;
+}
+
+int watch_query(const char *sockpath, const char *out_type, char **names, int nnames, int fd)
+{
+    int i, s;
+    ssize_t n;
+    char buf[BUFLEN];
+    OBUF req;
+
+    if((s = watch_connect(sockpath)) < 0) {
+        perror(sockpath);
+        return -1;
+    }
+    obuf_init(&req, s);
+    obuf_write(&req, out_type, strlen(out_type));
+    obuf_write(&req, "\n", 1);
+    for(i = 0; i < nnames; i++) {
+        obuf_write(&req, names[i], strlen(names[i]));
+        obuf_write(&req, "\n", 1);
+    }
+    obuf_flush(&req);
+    obuf_free(&req);
+    shutdown(s, SHUT_WR);
+
+    while((n = read(s, buf, sizeof(buf))) != 0) {
+        if(n < 0) {
+            if(errno == EINTR) continue;
+            perror(sockpath);
+            close(s);
+            return -1;
+        }
+        if(write(fd, buf, (size_t)n) != n) {
+            fprintf(stderr, "%s: write error: %s\n", progname, strerror(errno));
+            close(s);
+            return -1;
+        }
+    }
+    close(s);
+    return 0;
+}
+
+#if defined(__linux__)
+
+/*
+    The index: every record by its name, in a chained hash table that
+    doubles when it is full. The same table, with empty records, is the
+    set of dirty names that are waiting to be looked at again.
+*/
+struct went {
+    char *name;
+    FSREC rec;                  /* rec.name is name, rec.path is owned */
+    struct went *next;
+};
+
+struct windex {
+    struct went **bucket;
+    size_t nbucket;             /* power of 2 */
+    size_t n;
+};
+
+struct watch {
+    int recurse;
+    char **args;
+    int nargs;
+    int ifd;                    /* inotify */
+    int lfd;                    /* listening socket */
+    char **wdname;              /* watched directory by watch descriptor */
+    int nwd;
+    struct windex index;
+    struct windex dirty;
+    long long dirty_since;      /* ms, when the oldest dirty name came in */
+    int overflow;
+    int nospace;
+};
+
+static volatile sig_atomic_t watch_stop;
+
+static void watch_signal(int sig)
+{
+    (void)sig;
+    watch_stop = 1;
+    return;
+}
+
+static long long now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static size_t name_hash(const char *s)
+{
+    size_t h = 5381;
+    while(*s) h = h * 33 + (unsigned char)*s++;
+    return h;
+}
+
+static struct went *index_find(const struct windex *x, const char *name)
+{
+    struct went *e;
+
+    if(x->nbucket == 0) return (struct went *)NULL;
+    for(e = x->bucket[name_hash(name) & (x->nbucket - 1)]; e != (struct went *)NULL; e = e->next)
+        if(strcmp(e->name, name) == 0) return e;
+    return (struct went *)NULL;
+}
+
+/* The entry of name, added (with an empty record) if it is not there */
+static struct went *index_add(struct windex *x, const char *name)
+{
+    size_t i, h, nb;
+    struct went *e, *next, **b;
+
+    if((e = index_find(x, name)) != (struct went *)NULL) return e;
+    if(x->n >= x->nbucket) {
+        nb = x->nbucket ? 2 * x->nbucket : 1024;
+        if((b = (struct went **)calloc(nb, sizeof(struct went *))) == (struct went **)NULL) {
+            perror(progname);
+            exit(1);
+        }
+        for(i = 0; i < x->nbucket; i++) {
+            for(e = x->bucket[i]; e != (struct went *)NULL; e = next) {
+                next = e->next;
+                h = name_hash(e->name) & (nb - 1);
+                e->next = b[h];
+                b[h] = e;
+            }
+        }
+        free(x->bucket);
+        x->bucket = b;
+        x->nbucket = nb;
+    }
+    if((e = (struct went *)calloc(1, sizeof(struct went))) == (struct went *)NULL || (e->name = strdup(name)) == (char *)NULL) {
+        perror(progname);
+        exit(1);
+    }
+    e->rec.name = e->name;
+    h = name_hash(name) & (x->nbucket - 1);
+    e->next = x->bucket[h];
+    x->bucket[h] = e;
+    x->n++;
+    return e;
+}
+
+static void went_free(struct went *e)
+{
+    free_file_stat(&e->rec);
+    free(e->name);
+    free(e);
+    return;
+}
+
+/* Remove name, and with tree everything under it too */
+static void index_del(struct windex *x, const char *name, int tree)
+{
+    size_t i, len = strlen(name);
+    struct went *e, **pe;
+
+    for(i = 0; i < x->nbucket; i++) {
+        if(!tree) i = name_hash(name) & (x->nbucket - 1);
+        for(pe = &x->bucket[i]; (e = *pe) != (struct went *)NULL; ) {
+            if(strcmp(e->name, name) == 0 || (tree && strncmp(e->name, name, len) == 0 && e->name[len] == DIR_PATH_CHAR)) {
+                *pe = e->next;
+                went_free(e);
+                x->n--;
+            } else pe = &e->next;
+        }
+        if(!tree) break;
+    }
+    return;
+}
+
+static void index_clear(struct windex *x)
+{
+    size_t i;
+    struct went *e, *next;
+
+    for(i = 0; i < x->nbucket; i++)
+        for(e = x->bucket[i]; e != (struct went *)NULL; e = next) {
+            next = e->next;
+            went_free(e);
+        }
+    free(x->bucket);
+    memset(x, 0, sizeof(struct windex));
+    return;
+}
+
+static void watch_add(struct watch *w, const char *name)
+{
+    int wd;
+    char **p;
+
+    wd = inotify_add_watch(w->ifd, name, IN_CREATE | IN_DELETE | IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB
+                           | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR | IN_DONT_FOLLOW);
+    if(wd < 0) {
+        /* Out of watches: the directory is still indexed, it is just not kept current */
+        if(errno == ENOSPC && !w->nospace++)
+            fprintf(stderr, "%s: out of inotify watches (fs.inotify.max_user_watches); some directories are not watched.\n", progname);
+        else if(errno != ENOSPC) perror(name);
+        return;
+    }
+    if(wd >= w->nwd) {
+        if((p = (char **)realloc(w->wdname, 2 * (wd + 1) * sizeof(char *))) == (char **)NULL) {
+            perror(progname);
+            exit(1);
+        }
+        memset(p + w->nwd, 0, (2 * (wd + 1) - w->nwd) * sizeof(char *));
+        w->wdname = p;
+        w->nwd = 2 * (wd + 1);
+    }
+    free(w->wdname[wd]);
+    w->wdname[wd] = strdup(name);
+    return;
+}
+
+/* Stop watching the directory name and the directories under it */
+static void watch_del(struct watch *w, const char *name)
+{
+    int wd;
+    size_t len = strlen(name);
+
+    for(wd = 0; wd < w->nwd; wd++) {
+        if(w->wdname[wd] == (char *)NULL) continue;
+        if(strcmp(w->wdname[wd], name) == 0 || (strncmp(w->wdname[wd], name, len) == 0 && w->wdname[wd][len] == DIR_PATH_CHAR)) {
+            inotify_rm_watch(w->ifd, wd);
+            free(w->wdname[wd]);
+            w->wdname[wd] = (char *)NULL;
+        }
+    }
+    return;
+}
+
+/*
+    (Re)collect the record of name into the index. The digests of a file
+    whose size, times and inode did not change are kept from the record
+    it replaces. Returns 1 for a directory, 0 otherwise, -1 on error.
+*/
+static int watch_collect(struct watch *w, const char *name)
+{
+    int rc;
+    DCKEY key;
+    FSREC rec;
+    struct went *e;
+
+    uint32_t fields = out_fields & ~FLDM_DIGESTS;
+
+    /* What tells whether the kept digests are still good */
+    if(out_fields & FLDM_DIGESTS) fields |= FLDM(FLD_SIZE) | FLDM(FLD_INODE) | FLDM(FLD_MTIME) | FLDM(FLD_CTIME);
+    rc = collect_file_stat(&rec, name, fields);
+    collect_perror(&rec, name);
+    if(rc < 0) return -1;
+    rec.fields = out_fields;
+    if((out_fields & FLDM_DIGESTS) && S_ISREG(rec.sb.st_mode)) {
+        e = index_find(&w->index, name);
+        if(e != (struct went *)NULL && e->rec.dgstat == DG_OK && S_ISREG(e->rec.sb.st_mode)
+                && e->rec.sb.st_size == rec.sb.st_size && e->rec.sb.st_ino == rec.sb.st_ino
+                && e->rec.ts.mts_sec == rec.ts.mts_sec && e->rec.ts.mts_nsec == rec.ts.mts_nsec
+                && e->rec.ts.cts_sec == rec.ts.cts_sec && e->rec.ts.cts_nsec == rec.ts.cts_nsec) {
+            rec.dg = e->rec.dg;
+            rec.dgstat = DG_OK;
+        } else {
+            dcache_key(&key, &rec.sb, &rec.ts);
+            if(get_digests(AT_FDCWD, name, &key, out_fields, &rec.dg) == 0) {
+                rec.dgstat = DG_OK;
+            } else {
+                rec.dgstat = DG_ERR;
+                perror(name);
+            }
+        }
+    }
+    e = index_add(&w->index, name);
+    free_file_stat(&e->rec);
+    e->rec = rec;
+    e->rec.name = e->name;
+    return rc;
+}
+
+/*
+    Index name and, for a directory, watch it and index what is under it.
+    Only an argument (top set) is followed when it is a symbolic link to
+    a directory; a link met below one is indexed as what it points to,
+    but not descended, so that a link up the tree cannot loop the scan.
+*/
+static void watch_scan(struct watch *w, const char *name, int top)
+{
+    int dtype;
+    char *child;
+    const char *cname;
+    struct stat sb;
+    DREADER dr;
+
+    if(watch_collect(w, name) != 1 || !w->recurse) return;
+    if(!top && (lstat(name, &sb) != 0 || !S_ISDIR(sb.st_mode))) return;
+    watch_add(w, name);
+    if(dreader_open(&dr, AT_FDCWD, name) != 0) {
+        perror(name);
+        return;
+    }
+    while(dreader_next(&dr, &cname, &dtype) > 0) {
+        child = path_join(name, cname);
+        watch_scan(w, child, 0);
+        free(child);
+    }
+    dreader_close(&dr);
+    return;
+}
+
+static void watch_rescan(struct watch *w)
+{
+    int i;
+
+    index_clear(&w->index);
+    index_clear(&w->dirty);
+    for(i = 0; i < w->nwd; i++) {
+        if(w->wdname[i] == (char *)NULL) continue;
+        inotify_rm_watch(w->ifd, i);
+        free(w->wdname[i]);
+        w->wdname[i] = (char *)NULL;
+    }
+    for(i = 0; i < w->nargs; i++) watch_scan(w, w->args[i], 1);
+    w->overflow = 0;
+    return;
+}
+
+/*
+    Look at the dirty names again. The names that are gone are dropped
+    first, with what was under them, so that a directory renamed within
+    the tree gets its watches back under the new name.
+*/
+static void watch_settle(struct watch *w)
+{
+    size_t i;
+    struct stat sb;
+    struct went *e, *old;
+
+    if(w->overflow) {
+        fprintf(stderr, "%s: change events were lost; rescanning.\n", progname);
+        watch_rescan(w);
+        return;
+    }
+    for(i = 0; i < w->dirty.nbucket; i++) {
+        for(e = w->dirty.bucket[i]; e != (struct went *)NULL; e = e->next) {
+            if(lstat(e->name, &sb) == 0) continue;
+            index_del(&w->index, e->name, 1);
+            watch_del(w, e->name);
+        }
+    }
+    for(i = 0; i < w->dirty.nbucket; i++) {
+        for(e = w->dirty.bucket[i]; e != (struct went *)NULL; e = e->next) {
+            if(lstat(e->name, &sb) != 0) continue;
+            old = index_find(&w->index, e->name);
+            if(old != (struct went *)NULL && S_ISDIR(old->rec.sb.st_mode) && !S_ISDIR(sb.st_mode)) {
+                index_del(&w->index, e->name, 1);
+                watch_del(w, e->name);
+                old = (struct went *)NULL;
+            }
+            /* A new directory is scanned whole: its entries may predate its watch */
+            if(old == (struct went *)NULL) watch_scan(w, e->name, 0);
+            else watch_collect(w, e->name);
+        }
+    }
+    index_clear(&w->dirty);
+    return;
+}
+
+static void watch_events(struct watch *w)
+{
+    ssize_t n;
+    char *p, *name;
+    const struct inotify_event *ev;
+    char buf[BUFLEN] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+    while((n = read(w->ifd, buf, sizeof(buf))) > 0) {
+        for(p = buf; p < buf + n; p += sizeof(struct inotify_event) + ev->len) {
+            ev = (const struct inotify_event *)p;
+            if(ev->mask & IN_Q_OVERFLOW) {
+                w->overflow = 1;
+                continue;
+            }
+            if(ev->wd < 0 || ev->wd >= w->nwd || w->wdname[ev->wd] == (char *)NULL) continue;
+            if(ev->mask & IN_IGNORED) {
+                free(w->wdname[ev->wd]);
+                w->wdname[ev->wd] = (char *)NULL;
+                continue;
+            }
+            if(w->dirty.n == 0) w->dirty_since = now_ms();
+            if(ev->len > 0 && ev->name[0] != '\0') {
+                name = path_join(w->wdname[ev->wd], ev->name);
+                index_add(&w->dirty, name);
+                free(name);
+            } else {
+                index_add(&w->dirty, w->wdname[ev->wd]);
+            }
+            /* Past this many pending names a rescan is cheaper and bounds the memory */
+            if(w->dirty.n > WATCH_DIRTY_MAX) {
+                index_clear(&w->dirty);
+                w->overflow = 1;
+            }
+        }
+    }
+    return;
+}
+
+static int cmp_went(const void *a, const void *b)
+{
+    return strcmp((*(struct went * const *)a)->name, (*(struct went * const *)b)->name);
+}
+
+/* Write the records for the request (see watch_query()) to ob */
+static void watch_answer(struct watch *w, OBUF *ob, char *req)
+{
+    int otyp;
+    size_t i, n = 0, len;
+    char *line, *next;
+    struct went *e, **all = (struct went **)NULL;
+
+    if((next = strchr(req, '\n')) != (char *)NULL) *next++ = '\0';
+    if((otyp = is_valid_out_type(req)) == OUT_TYPE_UNKNOWN) otyp = OUT_TYPE_TXT;
+    print_file_stat_header(ob, otyp);
+    len = (next != (char *)NULL) ? strlen(next) : 0;
+    if(len == 0 || strstr(next, "/\n") != (char *)NULL || next[len - 1] == DIR_PATH_CHAR) {
+        /* In name order, like a walk in deterministic order would not be */
+        if((all = (struct went **)malloc((w->index.n + 1) * sizeof(struct went *))) == (struct went **)NULL) {
+            perror(progname);
+            exit(1);
+        }
+        for(i = 0; i < w->index.nbucket; i++)
+            for(e = w->index.bucket[i]; e != (struct went *)NULL; e = e->next) all[n++] = e;
+        qsort(all, n, sizeof(struct went *), cmp_went);
+    }
+
+    if(next == (char *)NULL || *next == '\0') {
+        for(i = 0; i < n; i++) format_record(ob, otyp, &all[i]->rec);
+    }
+    for(line = next; line != (char *)NULL && *line != '\0'; line = next) {
+        if((next = strchr(line, '\n')) != (char *)NULL) *next++ = '\0';
+        len = strlen(line);
+        if(len > 0 && line[len - 1] == DIR_PATH_CHAR) {
+            for(i = 0; i < n; i++)
+                if(strncmp(all[i]->name, line, len) == 0) format_record(ob, otyp, &all[i]->rec);
+        } else if((e = index_find(&w->index, line)) != (struct went *)NULL) {
+            format_record(ob, otyp, &e->rec);
+        }
+    }
+    print_file_stat_footer(ob, otyp);
+    free(all);
+    return;
+}
+
+static void watch_serve(struct watch *w)
+{
+    int s;
+    ssize_t n;
+    size_t len = 0;
+    char *req;
+    OBUF ob;
+    struct timeval tv = { WATCH_CLIENT_TIMEOUT, 0 };
+
+    if((s = accept4(w->lfd, (struct sockaddr *)NULL, (socklen_t *)NULL, SOCK_CLOEXEC)) < 0) return;
+    setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(s, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    if((req = (char *)malloc(WATCH_REQ_MAX + 1)) == (char *)NULL) {
+        close(s);
+        return;
+    }
+    while(len < WATCH_REQ_MAX && (n = read(s, req + len, WATCH_REQ_MAX - len)) != 0) {
+        if(n < 0) {
+            if(errno == EINTR) continue;
+            break;
+        }
+        len += (size_t)n;
+    }
+    req[len] = '\0';
+    if(len == 0) {
+        /* Not a query: someone only looking whether the socket is live */
+        free(req);
+        close(s);
+        return;
+    }
+
+    /* Answer from an index that has every change seen so far */
+    if(w->dirty.n > 0 || w->overflow) watch_settle(w);
+    obuf_init(&ob, s);
+    watch_answer(w, &ob, req);
+    obuf_flush(&ob);
+    obuf_free(&ob);
+    free(req);
+    close(s);
+    return;
+}
+
+/*
+    Remove sockpath if it is a socket nobody listens on any more, as a
+    watcher that did not exit cleanly leaves behind. Anything else at
+    sockpath, a live watcher's socket included, is left alone. Returns 0,
+    or -1 with errno set.
+*/
+static int watch_stale(const char *sockpath)
+{
+    int s;
+    struct stat sb;
+
+    if(lstat(sockpath, &sb) != 0) return -1;
+    if(!S_ISSOCK(sb.st_mode)) {
+        errno = EADDRINUSE;
+        return -1;
+    }
+    if((s = watch_connect(sockpath)) >= 0) {
+        close(s);
+        errno = EADDRINUSE;
+        return -1;
+    }
+    if(errno != ECONNREFUSED) return -1;
+    return unlink(sockpath);
+}
+
+static int watch_listen(const char *sockpath)
+{
+    int s, rc;
+    struct sockaddr_un sa;
+
+    if(strlen(sockpath) >= sizeof(sa.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    memset(&sa, 0, sizeof(sa));
+    sa.sun_family = AF_UNIX;
+    strcpy(sa.sun_path, sockpath);
+    if((s = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0)) < 0) return -1;
+    if(bind(s, (struct sockaddr *)&sa, sizeof(sa)) != 0 && (errno != EADDRINUSE || watch_stale(sockpath) != 0
+            || bind(s, (struct sockaddr *)&sa, sizeof(sa)) != 0)) {
+        rc = errno;
+        close(s);
+        errno = rc;
+        return -1;
+    }
+    if(listen(s, 64) != 0) {
+        close(s);
+        unlink(sockpath);
+        return -1;
+    }
+    return s;
+}
+
+/*
+    Watch mode. The arguments are scanned once into the index and every
+    directory gets an inotify watch. Events only mark names dirty; the
+    dirty names are looked at again once no event came for WATCH_SETTLE_MS
+    (or WATCH_DELAY_MAX_MS after the first one), so a file written in many
+    small pieces is collected, and hashed, once. When the kernel queue
+    overflows, or too many names are pending, everything is rescanned.
+    Runs until SIGINT or SIGTERM. Returns 0, or -1 after printing the error.
+*/
+int watch_run(const char *sockpath, int recurse, char **args, int nargs)
+{
+    int rc, timeout;
+    long long age;
+    struct watch w;
+    struct pollfd pfd[2];
+    struct sigaction sa;
+
+    memset(&w, 0, sizeof(w));
+    w.recurse = recurse;
+    w.args = args;
+    w.nargs = nargs;
+    if((w.ifd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) < 0) {
+        perror(progname);
+        return -1;
+    }
+    if((w.lfd = watch_listen(sockpath)) < 0) {
+        perror(sockpath);
+        close(w.ifd);
+        return -1;
+    }
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = watch_signal;
+    sigaction(SIGINT, &sa, (struct sigaction *)NULL);
+    sigaction(SIGTERM, &sa, (struct sigaction *)NULL);
+    sa.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &sa, (struct sigaction *)NULL);
+
+    watch_rescan(&w);
+    fprintf(stderr, "%s: watching %lu records; listening on %s\n", progname, (unsigned long)w.index.n, sockpath);
+
+    pfd[0].fd = w.ifd;
+    pfd[0].events = POLLIN;
+    pfd[1].fd = w.lfd;
+    pfd[1].events = POLLIN;
+    while(!watch_stop) {
+        timeout = -1;
+        if(w.dirty.n > 0 || w.overflow) {
+            age = now_ms() - w.dirty_since;
+            timeout = (age >= WATCH_DELAY_MAX_MS) ? 0 : WATCH_SETTLE_MS;
+        }
+        if((rc = poll(pfd, 2, timeout)) < 0) {
+            if(errno == EINTR) continue;
+            perror(progname);
+            break;
+        }
+        if(rc == 0) {
+            watch_settle(&w);
+            continue;
+        }
+        if(pfd[0].revents & POLLIN) watch_events(&w);
+        if(pfd[1].revents & POLLIN) watch_serve(&w);
+    }
+
+    close(w.lfd);
+    unlink(sockpath);
+    close(w.ifd);
+    index_clear(&w.index);
+    index_clear(&w.dirty);
+    for(rc = 0; rc < w.nwd; rc++) free(w.wdname[rc]);
+    free(w.wdname);
+    return 0;
+}
+
+#else
+
+int watch_run(const char *sockpath, int recurse, char **args, int nargs)
+{
+    (void)sockpath;
+    (void)recurse;
+    (void)args;
+    (void)nargs;
+    fprintf(stderr, "%s: --watch needs inotify, which this system does not have.\n", progname);
+    return -1;
+}
+
+#endif
@@ -0,0 +1,490 @@
+/*
+# +-------------------------------------------------------------------+
+# | Program Name  :  xxh3.c                                           |
+# | Author        :  Bhaskar Bhaumik (web.bhaskar.bhaumik@gmail.com)  |
+# | Version       :  0.1                                              |
+# | Date Created  :  October 13, 2018                                 |
+# | Description   :  Streaming XXH3 64 bit hash (seed 0, default      |
+# |                  secret) with scalar, SSE2, AVX2 and AVX-512      |
+# |                  stripe kernels, picked at run time.              |
+# +-------------------------------------------------------------------+
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define XXH_X86             1
+#include <immintrin.h>
+#endif
+
+#include "filestat.h"
+
+/*
+    The output is the XXH3_64bits() of xxHash 0.8, printed big endian like
+    xxhsum -H3 does. Inputs up to 240 bytes have their own short paths.
+    Longer ones are cut in 64 byte stripes: every stripe is mixed into
+    eight 64 bit accumulators with the secret at a different offset, and
+    every 16 stripes (a block) the accumulators are scrambled. The last
+    stripe is always the last 64 bytes of the input, so a stripe is only
+    consumed once at least one more byte is known to follow it; the
+    stream keeps the tail, and a copy of the stripe before it.
+*/
+#define XXH_PRIME32_1       0x9E3779B1U
+#define XXH_PRIME32_2       0x85EBCA77U
+#define XXH_PRIME32_3       0xC2B2AE3DU
+#define XXH_PRIME64_1       0x9E3779B185EBCA87ULL
+#define XXH_PRIME64_2       0xC2B2AE3D27D4EB4FULL
+#define XXH_PRIME64_3       0x165667B19E3779F9ULL
+#define XXH_PRIME64_4       0x85EBCA77C2B2AE63ULL
+#define XXH_PRIME64_5       0x27D4EB2F165667C5ULL
+#define XXH_PRIME_MX1       0x165667919E3779F9ULL
+#define XXH_PRIME_MX2       0x9FB21C651E98DF25ULL
+
+#define XXH_SECRET_LEN      192
+#define XXH_SECRET_MIN      136
+#define XXH_MIDSIZE_MAX     240
+#define XXH_MID_START       3
+#define XXH_MID_LAST        17
+#define XXH_LASTACC_START   7
+#define XXH_MERGEACCS_START 11
+
+typedef void (*xxh_accum_fn)(uint64_t *acc, const unsigned char *in, const unsigned char *secret, size_t nstripes);
+typedef void (*xxh_scramble_fn)(uint64_t *acc, const unsigned char *secret);
+
+static const unsigned char xxh_secret[XXH_SECRET_LEN] = {
+    0xb8, 0xfe, 0x6c, 0x39, 0x23, 0xa4, 0x4b, 0xbe, 0x7c, 0x01, 0x81, 0x2c, 0xf7, 0x21, 0xad, 0x1c,
+    0xde, 0xd4, 0x6d, 0xe9, 0x83, 0x90, 0x97, 0xdb, 0x72, 0x40, 0xa4, 0xa4, 0xb7, 0xb3, 0x67, 0x1f,
+    0xcb, 0x79, 0xe6, 0x4e, 0xcc, 0xc0, 0xe5, 0x78, 0x82, 0x5a, 0xd0, 0x7d, 0xcc, 0xff, 0x72, 0x21,
+    0xb8, 0x08, 0x46, 0x74, 0xf7, 0x43, 0x24, 0x8e, 0xe0, 0x35, 0x90, 0xe6, 0x81, 0x3a, 0x26, 0x4c,
+    0x3c, 0x28, 0x52, 0xbb, 0x91, 0xc3, 0x00, 0xcb, 0x88, 0xd0, 0x65, 0x8b, 0x1b, 0x53, 0x2e, 0xa3,
+    0x71, 0x64, 0x48, 0x97, 0xa2, 0x0d, 0xf9, 0x4e, 0x38, 0x19, 0xef, 0x46, 0xa9, 0xde, 0xac, 0xd8,
+    0xa8, 0xfa, 0x76, 0x3f, 0xe3, 0x9c, 0x34, 0x3f, 0xf9, 0xdc, 0xbb, 0xc7, 0xc7, 0x0b, 0x4f, 0x1d,
+    0x8a, 0x51, 0xe0, 0x4b, 0xcd, 0xb4, 0x59, 0x31, 0xc8, 0x9f, 0x7e, 0xc9, 0xd9, 0x78, 0x73, 0x64,
+    0xea, 0xc5, 0xac, 0x83, 0x34, 0xd3, 0xeb, 0xc3, 0xc5, 0x81, 0xa0, 0xff, 0xfa, 0x13, 0x63, 0xeb,
+    0x17, 0x0d, 0xdd, 0x51, 0xb7, 0xf0, 0xda, 0x49, 0xd3, 0x16, 0x55, 0x26, 0x29, 0xd4, 0x68, 0x9e,
+    0x2b, 0x16, 0xbe, 0x58, 0x7d, 0x47, 0xa1, 0xfc, 0x8f, 0xf8, 0xb8, 0xd1, 0x7a, 0xd0, 0x31, 0xce,
+    0x45, 0xcb, 0x3a, 0x8f, 0x95, 0x16, 0x04, 0x28, 0xaf, 0xd7, 0xfb, 0xca, 0xbb, 0x4b, 0x40, 0x7e,
+};
+
+static pthread_once_t xxh_once = PTHREAD_ONCE_INIT;
+static xxh_accum_fn xxh_accum;
+static xxh_scramble_fn xxh_scramble;
+static const char *xxh_engine_name;
+
+static inline uint32_t read32(const unsigned char *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline uint64_t read64(const unsigned char *p)
+{
+    return (uint64_t)read32(p) | ((uint64_t)read32(p + 4) << 32);
+}
+
+static inline uint64_t rotl64(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t swap64(uint64_t x)
+{
+    return __builtin_bswap64(x);
+}
+
+/* Low and high halves of the 128 bit product, folded together */
+static inline uint64_t mul128_fold64(uint64_t a, uint64_t b)
+{
+    unsigned __int128 p = (unsigned __int128)a * b;
+    return (uint64_t)p ^ (uint64_t)(p >> 64);
+}
+
+static inline uint64_t xxh64_avalanche(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= XXH_PRIME64_2;
+    h ^= h >> 29;
+    h *= XXH_PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+static inline uint64_t xxh3_avalanche(uint64_t h)
+{
+    h ^= h >> 37;
+    h *= XXH_PRIME_MX1;
+    h ^= h >> 32;
+    return h;
+}
+
+static inline uint64_t xxh3_rrmxmx(uint64_t h, uint64_t len)
+{
+    h ^= rotl64(h, 49) ^ rotl64(h, 24);
+    h *= XXH_PRIME_MX2;
+    h ^= (h >> 35) + len;
+    h *= XXH_PRIME_MX2;
+    h ^= h >> 28;
+    return h;
+}
+
+static inline uint64_t mix16(const unsigned char *in, const unsigned char *secret)
+{
+    return mul128_fold64(read64(in) ^ read64(secret), read64(in + 8) ^ read64(secret + 8));
+}
+
+/* One shot hash of up to XXH_MIDSIZE_MAX bytes */
+static uint64_t xxh3_short(const unsigned char *in, size_t len)
+{
+    const unsigned char *s = xxh_secret;
+    uint64_t acc, lo, hi;
+    uint32_t c;
+    size_t i;
+
+    if(len == 0) return xxh64_avalanche(read64(s + 56) ^ read64(s + 64));
+    if(len <= 3) {
+        c = ((uint32_t)in[0] << 16) | ((uint32_t)in[len >> 1] << 24) | (uint32_t)in[len - 1] | ((uint32_t)len << 8);
+        return xxh64_avalanche((uint64_t)c ^ (uint64_t)(read32(s) ^ read32(s + 4)));
+    }
+    if(len <= 8) {
+        lo = (uint64_t)read32(in + len - 4) + ((uint64_t)read32(in) << 32);
+        return xxh3_rrmxmx(lo ^ (read64(s + 8) ^ read64(s + 16)), len);
+    }
+    if(len <= 16) {
+        lo = read64(in) ^ (read64(s + 24) ^ read64(s + 32));
+        hi = read64(in + len - 8) ^ (read64(s + 40) ^ read64(s + 48));
+        return xxh3_avalanche(len + swap64(lo) + hi + mul128_fold64(lo, hi));
+    }
+    acc = len * XXH_PRIME64_1;
+    if(len <= 128) {
+        if(len > 32) {
+            if(len > 64) {
+                if(len > 96) {
+                    acc += mix16(in + 48, s + 96);
+                    acc += mix16(in + len - 64, s + 112);
+                }
+                acc += mix16(in + 32, s + 64);
+                acc += mix16(in + len - 48, s + 80);
+            }
+            acc += mix16(in + 16, s + 32);
+            acc += mix16(in + len - 32, s + 48);
+        }
+        acc += mix16(in, s);
+        acc += mix16(in + len - 16, s + 16);
+        return xxh3_avalanche(acc);
+    }
+    for(i = 0; i < 8; i++) acc += mix16(in + 16 * i, s + 16 * i);
+    acc = xxh3_avalanche(acc);
+    for(i = 8; i < len / 16; i++) acc += mix16(in + 16 * i, s + 16 * (i - 8) + XXH_MID_START);
+    acc += mix16(in + len - 16, s + XXH_SECRET_MIN - XXH_MID_LAST);
+    return xxh3_avalanche(acc);
+}
+
+static void accum_scalar(uint64_t *acc, const unsigned char *in, const unsigned char *secret, size_t nstripes)
+{
+    int i;
+    uint64_t v, k;
+
+    for(; nstripes > 0; nstripes--, in += XXH3_STRIPE, secret += 8) {
+        for(i = 0; i < 8; i++) {
+            v = read64(in + 8 * i);
+            k = v ^ read64(secret + 8 * i);
+            acc[i ^ 1] += v;
+            acc[i] += (k & 0xFFFFFFFF) * (k >> 32);
+        }
+    }
+    return;
+}
+
+static void scramble_scalar(uint64_t *acc, const unsigned char *secret)
+{
+    int i;
+    uint64_t a;
+
+    for(i = 0; i < 8; i++) {
+        a = acc[i];
+        a ^= a >> 47;
+        a ^= read64(secret + 8 * i);
+        acc[i] = a * XXH_PRIME32_1;
+    }
+    return;
+}
+
+#ifdef XXH_X86
+/*
+    The vector kernels do the same per 64 bit lane: the product of the
+    low and high 32 bits of data ^ key is one pmuludq, and the data is
+    added to the neighbouring lane with a 64 bit swap within 128 bits.
+*/
+__attribute__((target("sse2")))
+static void accum_sse2(uint64_t *acc, const unsigned char *in, const unsigned char *secret, size_t nstripes)
+{
+    int i;
+    __m128i a[4], d, k, dk;
+
+    for(i = 0; i < 4; i++) a[i] = _mm_loadu_si128((const __m128i *)acc + i);
+    for(; nstripes > 0; nstripes--, in += XXH3_STRIPE, secret += 8) {
+        for(i = 0; i < 4; i++) {
+            d = _mm_loadu_si128((const __m128i *)in + i);
+            k = _mm_loadu_si128((const __m128i *)secret + i);
+            dk = _mm_xor_si128(d, k);
+            a[i] = _mm_add_epi64(a[i], _mm_shuffle_epi32(d, _MM_SHUFFLE(1, 0, 3, 2)));
+            a[i] = _mm_add_epi64(a[i], _mm_mul_epu32(dk, _mm_shuffle_epi32(dk, _MM_SHUFFLE(0, 3, 0, 1))));
+        }
+    }
+    for(i = 0; i < 4; i++) _mm_storeu_si128((__m128i *)acc + i, a[i]);
+    return;
+}
+
+__attribute__((target("sse2")))
+static void scramble_sse2(uint64_t *acc, const unsigned char *secret)
+{
+    int i;
+    __m128i a, dk;
+    const __m128i prime = _mm_set1_epi32((int)XXH_PRIME32_1);
+
+    for(i = 0; i < 4; i++) {
+        a = _mm_loadu_si128((const __m128i *)acc + i);
+        a = _mm_xor_si128(a, _mm_srli_epi64(a, 47));
+        dk = _mm_xor_si128(a, _mm_loadu_si128((const __m128i *)secret + i));
+        a = _mm_add_epi64(_mm_mul_epu32(dk, prime),
+                          _mm_slli_epi64(_mm_mul_epu32(_mm_shuffle_epi32(dk, _MM_SHUFFLE(0, 3, 0, 1)), prime), 32));
+        _mm_storeu_si128((__m128i *)acc + i, a);
+    }
+    return;
+}
+
+__attribute__((target("avx2")))
+static void accum_avx2(uint64_t *acc, const unsigned char *in, const unsigned char *secret, size_t nstripes)
+{
+    int i;
+    __m256i a[2], d, k, dk;
+
+    for(i = 0; i < 2; i++) a[i] = _mm256_loadu_si256((const __m256i *)acc + i);
+    for(; nstripes > 0; nstripes--, in += XXH3_STRIPE, secret += 8) {
+        for(i = 0; i < 2; i++) {
+            d = _mm256_loadu_si256((const __m256i *)in + i);
+            k = _mm256_loadu_si256((const __m256i *)secret + i);
+            dk = _mm256_xor_si256(d, k);
+            a[i] = _mm256_add_epi64(a[i], _mm256_shuffle_epi32(d, _MM_SHUFFLE(1, 0, 3, 2)));
+            a[i] = _mm256_add_epi64(a[i], _mm256_mul_epu32(dk, _mm256_shuffle_epi32(dk, _MM_SHUFFLE(0, 3, 0, 1))));
+        }
+    }
+    for(i = 0; i < 2; i++) _mm256_storeu_si256((__m256i *)acc + i, a[i]);
+    return;
+}
+
+__attribute__((target("avx2")))
+static void scramble_avx2(uint64_t *acc, const unsigned char *secret)
+{
+    int i;
+    __m256i a, dk;
+    const __m256i prime = _mm256_set1_epi32((int)XXH_PRIME32_1);
+
+    for(i = 0; i < 2; i++) {
+        a = _mm256_loadu_si256((const __m256i *)acc + i);
+        a = _mm256_xor_si256(a, _mm256_srli_epi64(a, 47));
+        dk = _mm256_xor_si256(a, _mm256_loadu_si256((const __m256i *)secret + i));
+        a = _mm256_add_epi64(_mm256_mul_epu32(dk, prime),
+                             _mm256_slli_epi64(_mm256_mul_epu32(_mm256_shuffle_epi32(dk, _MM_SHUFFLE(0, 3, 0, 1)), prime), 32));
+        _mm256_storeu_si256((__m256i *)acc + i, a);
+    }
+    return;
+}
+
+__attribute__((target("avx512f")))
+static void accum_avx512(uint64_t *acc, const unsigned char *in, const unsigned char *secret, size_t nstripes)
+{
+    __m512i a, d, dk;
+
+    a = _mm512_loadu_si512((const void *)acc);
+    for(; nstripes > 0; nstripes--, in += XXH3_STRIPE, secret += 8) {
+        d = _mm512_loadu_si512((const void *)in);
+        dk = _mm512_xor_si512(d, _mm512_loadu_si512((const void *)secret));
+        a = _mm512_add_epi64(a, _mm512_shuffle_epi32(d, (_MM_PERM_ENUM)_MM_SHUFFLE(1, 0, 3, 2)));
+        a = _mm512_add_epi64(a, _mm512_mul_epu32(dk, _mm512_shuffle_epi32(dk, (_MM_PERM_ENUM)_MM_SHUFFLE(0, 3, 0, 1))));
+    }
+    _mm512_storeu_si512((void *)acc, a);
+    return;
+}
+
+__attribute__((target("avx512f")))
+static void scramble_avx512(uint64_t *acc, const unsigned char *secret)
+{
+    __m512i a, dk;
+    const __m512i prime = _mm512_set1_epi32((int)XXH_PRIME32_1);
+
+    a = _mm512_loadu_si512((const void *)acc);
+    a = _mm512_xor_si512(a, _mm512_srli_epi64(a, 47));
+    dk = _mm512_xor_si512(a, _mm512_loadu_si512((const void *)secret));
+    a = _mm512_add_epi64(_mm512_mul_epu32(dk, prime),
+                         _mm512_slli_epi64(_mm512_mul_epu32(_mm512_shuffle_epi32(dk, (_MM_PERM_ENUM)_MM_SHUFFLE(0, 3, 0, 1)), prime), 32));
+    _mm512_storeu_si512((void *)acc, a);
+    return;
+}
+#endif /* XXH_X86 */
+
+static int xxh_supported(const char *name)
+{
+    if(strcmp(name, "scalar") == 0) return 1;
+#ifdef XXH_X86
+    __builtin_cpu_init();
+    if(strcmp(name, "sse2") == 0) return __builtin_cpu_supports("sse2");
+    if(strcmp(name, "avx2") == 0) return __builtin_cpu_supports("avx2");
+    if(strcmp(name, "avx512") == 0) return __builtin_cpu_supports("avx512f");
+#endif
+    return 0;
+}
+
+static void xxh_use(const char *name)
+{
+    xxh_engine_name = name;
+    if(strcmp(name, "scalar") == 0) {
+        xxh_accum = accum_scalar;
+        xxh_scramble = scramble_scalar;
+    }
+#ifdef XXH_X86
+    else if(strcmp(name, "sse2") == 0) {
+        xxh_accum = accum_sse2;
+        xxh_scramble = scramble_sse2;
+    } else if(strcmp(name, "avx2") == 0) {
+        xxh_accum = accum_avx2;
+        xxh_scramble = scramble_avx2;
+    } else if(strcmp(name, "avx512") == 0) {
+        xxh_accum = accum_avx512;
+        xxh_scramble = scramble_avx512;
+    }
+#endif
+    return;
+}
+
+static const char *xxh_best(void)
+{
+    return xxh_supported("avx512") ? "avx512" : xxh_supported("avx2") ? "avx2"
+           : xxh_supported("sse2") ? "sse2" : "scalar";
+}
+
+static void xxh_init(void)
+{
+    xxh_use(xxh_best());
+    return;
+}
+
+/*
+    Select an XXH3 kernel by name: scalar, sse2, avx2, avx512 or auto.
+    Returns 0, or -1 if the kernel is unknown or the CPU lacks it.
+*/
+int xxh3_set_engine(const char *name)
+{
+    pthread_once(&xxh_once, xxh_init);
+    if(strcmp(name, "auto") == 0) name = xxh_best();
+    if(!xxh_supported(name)) return -1;
+    xxh_use(name);
+    return 0;
+}
+
+const char *xxh3_engine(void)
+{
+    pthread_once(&xxh_once, xxh_init);
+    return xxh_engine_name;
+}
+
+void xxh3_init(XXH3_CTX *c)
+{
+    static const uint64_t acc0[8] = {
+        XXH_PRIME32_3, XXH_PRIME64_1, XXH_PRIME64_2, XXH_PRIME64_3,
+        XXH_PRIME64_4, XXH_PRIME32_2, XXH_PRIME64_5, XXH_PRIME32_1
+    };
+
+    pthread_once(&xxh_once, xxh_init);
+    memcpy(c->acc, acc0, sizeof(acc0));
+    c->total = 0;
+    c->stripes = 0;
+    c->buflen = 0;
+    return;
+}
+
+/* Consume n whole stripes, scrambling at the end of every block */
+static void xxh3_consume(uint64_t *acc, size_t *stripes, const unsigned char *in, size_t n)
+{
+    size_t k;
+
+    while(n > 0) {
+        k = XXH3_BLOCK_STRIPES - *stripes;
+        if(k > n) k = n;
+        xxh_accum(acc, in, xxh_secret + 8 * *stripes, k);
+        in += k * XXH3_STRIPE;
+        n -= k;
+        if((*stripes += k) == XXH3_BLOCK_STRIPES) {
+            xxh_scramble(acc, xxh_secret + XXH_SECRET_LEN - XXH3_STRIPE);
+            *stripes = 0;
+        }
+    }
+    return;
+}
+
+void xxh3_update(XXH3_CTX *c, const unsigned char *buf, size_t len)
+{
+    size_t n;
+
+    c->total += len;
+    if(c->buflen + len <= XXH3_BUFLEN) {
+        memcpy(c->buf + c->buflen, buf, len);
+        c->buflen += len;
+        return;
+    }
+
+    /* More follows the buffer, so all of it can go */
+    if(c->buflen > 0) {
+        n = XXH3_BUFLEN - c->buflen;
+        memcpy(c->buf + c->buflen, buf, n);
+        buf += n;
+        len -= n;
+        xxh3_consume(c->acc, &c->stripes, c->buf, XXH3_BUFLEN / XXH3_STRIPE);
+        memcpy(c->last, c->buf + XXH3_BUFLEN - XXH3_STRIPE, XXH3_STRIPE);
+        c->buflen = 0;
+    }
+
+    /* Straight from the input, keeping between 1 and XXH3_BUFLEN bytes */
+    if(len > XXH3_BUFLEN) {
+        n = (len - 1) / XXH3_STRIPE;
+        xxh3_consume(c->acc, &c->stripes, buf, n);
+        buf += n * XXH3_STRIPE;
+        len -= n * XXH3_STRIPE;
+        memcpy(c->last, buf - XXH3_STRIPE, XXH3_STRIPE);
+    }
+    memcpy(c->buf, buf, len);
+    c->buflen = len;
+    return;
+}
+
+uint64_t xxh3_final(const XXH3_CTX *c)
+{
+    int i;
+    size_t stripes, n;
+    uint64_t acc[8], h;
+    unsigned char tail[XXH3_STRIPE];
+    const unsigned char *last;
+
+    if(c->total <= XXH_MIDSIZE_MAX) return xxh3_short(c->buf, (size_t)c->total);
+
+    memcpy(acc, c->acc, sizeof(acc));
+    stripes = c->stripes;
+    n = (c->buflen - 1) / XXH3_STRIPE;
+    xxh3_consume(acc, &stripes, c->buf, n);
+    if(c->buflen >= XXH3_STRIPE) {
+        last = c->buf + c->buflen - XXH3_STRIPE;
+    } else {
+        memcpy(tail, c->last + c->buflen, XXH3_STRIPE - c->buflen);
+        memcpy(tail + XXH3_STRIPE - c->buflen, c->buf, c->buflen);
+        last = tail;
+    }
+    xxh_accum(acc, last, xxh_secret + XXH_SECRET_LEN - XXH3_STRIPE - XXH_LASTACC_START, 1);
+
+    h = c->total * XXH_PRIME64_1;
+    for(i = 0; i < 4; i++)
+        h += mul128_fold64(acc[2 * i] ^ read64(xxh_secret + XXH_MERGEACCS_START + 16 * i),
+                           acc[2 * i + 1] ^ read64(xxh_secret + XXH_MERGEACCS_START + 16 * i + 8));
+    return xxh3_avalanche(h);
+}
@@ -0,0 +1,67 @@
+/*
+# +-------------------------------------------------------------------+
+# | Program Name  :  batch.c                                          |
+# | Author        :  Bhaskar Bhaumik (web.bhaskar.bhaumik@gmail.com)  |
+# | Version       :  0.1                                              |
+# | Date Created  :  October 13, 2018                                 |
+# | Description   :  filestat_batch() as a program that links         |
+# |                  libfilestat.a sees it.                           |
+# +-------------------------------------------------------------------+
+*/
+/*
+    batch [-j jobs] file...
+
+    Collects the files twice with filestat_batch(), through libfilestat.h
+    only, and prints name,size,md5 for each, as filestat -t csv --fields
+    name,size,md5 does but for the quotes, or name,error. The two calls
+    must agree. The exit status is the number of failed records, 255 if
+    the calls disagree.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "libfilestat.h"
+
+int main(int argc, char **argv)
+{
+    int c, i, jobs = 1, failed;
+    size_t n;
+    FSREC *recs, *again;
+    char sum[2 * MD5_LEN + 1];
+
+    while((c = getopt(argc, argv, "j:")) != -1) {
+        if(c != 'j') return 2;
+        jobs = atoi(optarg);
+    }
+    n = (size_t)(argc - optind);
+    recs = (FSREC *)calloc(n + 1, sizeof(FSREC));
+    again = (FSREC *)calloc(n + 1, sizeof(FSREC));
+    if(recs == (FSREC *)NULL || again == (FSREC *)NULL) {
+        perror(argv[0]);
+        return 2;
+    }
+
+    failed = filestat_batch((const char * const *)argv + optind, n, FLDM(FLD_NAME) | FLDM(FLD_SIZE) | FLDM(FLD_MD5),
+                            jobs, (const FSOPTS *)NULL, recs);
+    if(filestat_batch((const char * const *)argv + optind, n, FLDM(FLD_NAME) | FLDM(FLD_SIZE) | FLDM(FLD_MD5),
+                      jobs, (const FSOPTS *)NULL, again) != failed)
+        return 255;
+    for(i = 0; i < (int)n; i++) {
+        if(recs[i].err != again[i].err || recs[i].dgstat != again[i].dgstat
+                || memcmp(&recs[i].dg, &again[i].dg, sizeof(FDIGEST)) != 0)
+            return 255;
+        if(recs[i].err != 0) {
+            printf("%s,%s\n", recs[i].name, strerror(recs[i].err));
+            continue;
+        }
+        printf("%s,%lld,%s\n", recs[i].name, (long long)recs[i].sb.st_size,
+               (recs[i].dgstat == DG_OK) ? digest2hex_r(recs[i].dg.md5, MD5_LEN, sum) : "N/A");
+    }
+    filestat_batch_free(recs, n);
+    filestat_batch_free(again, n);
+    free(recs);
+    free(again);
+    return failed;
+}